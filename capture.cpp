@@ -0,0 +1,858 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/stat.h>
+#ifdef WIN32
+#include <direct.h>
+#endif
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//	Saving frames as a numbered image sequence, or as a video stream into an encoder
+//
+//	CaptureFrame( ) reads each frame's pixels into the next of CAPTUREPBOS pixel buffer objects -- glReadPixels( )
+//	into a buffer only queues a copy, it does not wait for the drawing to finish -- and then maps the buffer that was
+//	read into CAPTUREPBOS-1 frames ago, whose copy is long done.  So the readback never stalls the gpu or the frame
+//	after it.  A fence after each read says when its copy is finished; a map that finds its fence not yet signaled
+//	waits for it, and that is counted (CaptureTotal.fenceWaits), like the frame ring's (framering.cpp).
+//	Without pixel buffer objects (opengl 2.1 or ARB_pixel_buffer_object) the pixels are read straight back instead.
+//	Frames that were not drawn by opengl at all (the ray tracer's, raytrace.cpp) are handed over with CaptureFramePixels( ).
+//
+//	The mapped pixels are copied into an image from a small pool and handed to worker threads, which turn them right
+//	way up, encode them, and write them out:
+//		CAPTUREPNG	a png file a frame (deflated right here, with the fixed huffman codes -- no zlib needed)
+//		CAPTUREYUV	a raw planar yuv 4:2:0 file a frame (bt.601 studio range, what encoders expect from "yuv420p")
+//		CAPTUREPIPE	one yuv4mpeg2 stream into the standard input of a command, such as
+//				"ffmpeg -y -i - -c:v libx264 -pix_fmt yuv420p orbit.mp4"
+//	Files are written by whichever worker encoded them, in any order.  The pipe gets its frames in order: a finished
+//	frame waits in CapturePipeWaiting until the ones before it have gone, and the worker that finishes the next one
+//	writes it and any that were waiting after it.
+//
+//	When every image in the pool is waiting for a worker, CaptureFrame( ) waits for one to come back rather than
+//	let memory grow, and that is counted too (CaptureTotal.poolWaits): it means the workers cannot keep up.
+
+
+const int	CAPTUREPNG	= 0;
+const int	CAPTUREYUV	= 1;
+const int	CAPTUREPIPE	= 2;
+const int	CAPTURENUMFORMATS = 3;
+
+const char *	CAPTUREFORMATNAMES[CAPTURENUMFORMATS] = { "png", "yuv", "pipe" };
+
+const int	CAPTUREPBOS = 3;		// frames in flight between glReadPixels( ) and the map
+const int	CAPTUREMAXWORKERS = 8;
+const int	CAPTUREMAXPATH = 1024;
+const GLuint64	CAPTUREFENCETIMEOUT = 1000000000;	// longest wait on a fence, in nanoseconds
+
+// deflate (rfc 1951) with the fixed huffman codes, and matches found through hash chains:
+
+const int	CAPTUREWINDOW = 32768;		// farthest back a match can start
+const int	CAPTUREHASHBITS = 15;
+const int	CAPTUREMAXCHAIN = 16;		// earlier places with the same hash tried for each match
+const int	CAPTUREMINMATCH = 3;
+const int	CAPTUREMAXMATCH = 258;
+
+const int	CAPTURELENGTHBASE[29]  = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+					   67, 83, 99, 115, 131, 163, 195, 227, 258 };
+const int	CAPTURELENGTHEXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+					   4, 4, 4, 4, 5, 5, 5, 5, 0 };
+const int	CAPTUREDISTBASE[30]    = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769,
+					   1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+const int	CAPTUREDISTEXTRA[30]   = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8,
+					   9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+// one frame's pixels, on their way to a worker:
+
+struct CaptureImage
+{
+	long				index;		// which frame of the capture
+	std::vector<unsigned char>	rgba;		// as read back: bottom row first
+	std::vector<unsigned char>	encoded;	// the file (or the pipe's piece of the stream)
+};
+
+struct CaptureCounters
+{
+	long	frames;
+	double	readMs;			// the drawing thread reading back, mapping, and copying out (not counting pool waits)
+	long	fenceWaits;		// maps that had to wait for their copy to finish
+	double	fenceWaitMs;
+	long	poolWaits;		// frames that had to wait for the workers to give an image back
+	double	poolWaitMs;
+	double	encodeMs;		// the workers encoding and writing, all of them added up
+	double	bytes;			// written
+	long	failures;		// frames that could not be written
+};
+
+// the bits going into a deflate stream:
+
+struct CaptureBits
+{
+	std::vector<unsigned char> *	out;
+	unsigned long long		bits;		// not yet written, the first one lowest
+	int				count;
+};
+
+int		CaptureFormat;
+int		CaptureWidth, CaptureHeight;		// of what is read back
+double		CaptureFps;
+char		CapturePrefix[CAPTUREMAXPATH];		// the files are this with the frame number and ".png" or ".yuv"
+FILE *		CapturePipe;				// the encoder's standard input, for CAPTUREPIPE
+bool		CaptureOn;				// true between CaptureStart( ) and CaptureFinish( )
+bool		CapturePbosOK;				// true if the pixels go through pixel buffer objects
+bool		CaptureFencesOK;			// true if there are fences to tell when they are ready
+GLuint		CapturePbos[CAPTUREPBOS];
+GLsync		CaptureFences[CAPTUREPBOS];
+long		CapturePboFrame[CAPTUREPBOS];		// which frame each was read into for, -1 if none
+long		CaptureNextFrame;			// the next frame's index
+unsigned int	CaptureCrcTable[256];
+
+std::vector<std::thread>		CaptureWorkers;
+std::mutex				CaptureMutex;		// guards everything below here
+std::condition_variable			CaptureWake;		// for the workers, and for the drawing thread wanting an image
+std::deque<struct CaptureImage*>	CaptureQueue;		// read back, waiting to be encoded
+std::vector<struct CaptureImage*>	CaptureFree;		// the pool's images not in use
+std::vector<struct CaptureImage*>	CaptureAll;		// the whole pool, to delete at the end
+bool					CaptureQuit;
+std::mutex				CapturePipeMutex;	// guards the pipe and the two below
+std::map<long, struct CaptureImage*>	CapturePipeWaiting;	// encoded, waiting for the frames before them
+long					CapturePipeNext;	// the next frame the pipe wants
+struct CaptureCounters			CaptureTotal;
+
+
+void
+CapturePutBits(struct CaptureBits* b, unsigned int value, int n)
+{
+	b->bits |= (unsigned long long)value << b->count;
+	b->count += n;
+	while (b->count >= 8)
+	{
+		b->out->push_back((unsigned char)(b->bits & 0xff));
+		b->bits >>= 8;
+		b->count -= 8;
+	}
+}
+
+// a huffman code, which goes in highest bit first:
+
+void
+CapturePutCode(struct CaptureBits* b, unsigned int code, int n)
+{
+	unsigned int reversed = 0;
+	for (int i = 0; i < n; i++)
+		reversed |= ((code >> i) & 1) << (n - 1 - i);
+	CapturePutBits(b, reversed, n);
+}
+
+// a literal byte (0-255), the end of the block (256), or a length (257-285), in the fixed code:
+
+void
+CapturePutSymbol(struct CaptureBits* b, int symbol)
+{
+	if (symbol < 144)
+		CapturePutCode(b, 0x30 + symbol, 8);
+	else if (symbol < 256)
+		CapturePutCode(b, 0x190 + symbol - 144, 9);
+	else if (symbol < 280)
+		CapturePutCode(b, symbol - 256, 7);
+	else
+		CapturePutCode(b, 0xc0 + symbol - 280, 8);
+}
+
+void
+CapturePutMatch(struct CaptureBits* b, int length, int distance)
+{
+	int l = 28;
+	while (CAPTURELENGTHBASE[l] > length)
+		l--;
+	CapturePutSymbol(b, 257 + l);
+	CapturePutBits(b, length - CAPTURELENGTHBASE[l], CAPTURELENGTHEXTRA[l]);
+
+	int d = 29;
+	while (CAPTUREDISTBASE[d] > distance)
+		d--;
+	CapturePutCode(b, d, 5);
+	CapturePutBits(b, distance - CAPTUREDISTBASE[d], CAPTUREDISTEXTRA[d]);
+}
+
+
+unsigned int
+CaptureHash(const unsigned char* p)
+{
+	unsigned int h = ((unsigned int)p[0] << 16) | ((unsigned int)p[1] << 8) | (unsigned int)p[2];
+	return (h * 2654435761u) >> (32 - CAPTUREHASHBITS);
+}
+
+
+// append a zlib (rfc 1950) stream of the data to out:
+// (one deflate block with the fixed codes -- not as small as zlib's best, but the sky is mostly black,
+//  and long runs are what this does well)
+
+void
+CaptureDeflate(const unsigned char* data, size_t n, std::vector<unsigned char>* out)
+{
+	out->push_back(0x78);		// deflate, 32K window
+	out->push_back(0x01);		// no dictionary, fastest (and the check bits)
+
+	struct CaptureBits b = { out, 0, 0 };
+	CapturePutBits(&b, 1, 1);	// the last block
+	CapturePutBits(&b, 1, 2);	// with the fixed codes
+
+	std::vector<long> head(1 << CAPTUREHASHBITS, -1);	// the latest place each hash was seen
+	std::vector<long> prev(CAPTUREWINDOW, -1);		// the place before that, by place % CAPTUREWINDOW
+	size_t i = 0;
+	while (i < n)
+	{
+		int bestLength = 0;
+		long bestDistance = 0;
+		if (i + CAPTUREMINMATCH <= n)
+		{
+			int maxLength = n - i < (size_t)CAPTUREMAXMATCH ? (int)(n - i) : CAPTUREMAXMATCH;
+			long candidate = head[CaptureHash(data + i)];
+			for (int chain = 0; chain < CAPTUREMAXCHAIN && candidate >= 0 && (long)i - candidate < CAPTUREWINDOW; chain++)
+			{
+				const unsigned char* p = data + candidate;
+				const unsigned char* q = data + i;
+				int length = 0;
+				while (length < maxLength && p[length] == q[length])
+					length++;
+				if (length > bestLength)
+				{
+					bestLength = length;
+					bestDistance = (long)i - candidate;
+					if (length == maxLength)
+						break;
+				}
+				long before = prev[candidate % CAPTUREWINDOW];
+				if (before >= candidate)
+					break;		// (that slot has been reused by a later place)
+				candidate = before;
+			}
+		}
+
+		int advance = 1;
+		if (bestLength >= CAPTUREMINMATCH)
+		{
+			CapturePutMatch(&b, bestLength, (int)bestDistance);
+			advance = bestLength;
+		}
+		else
+			CapturePutSymbol(&b, data[i]);
+
+		for (int k = 0; k < advance; k++, i++)
+		{
+			if (i + CAPTUREMINMATCH <= n)
+			{
+				unsigned int h = CaptureHash(data + i);
+				prev[i % CAPTUREWINDOW] = head[h];
+				head[h] = (long)i;
+			}
+		}
+	}
+	CapturePutSymbol(&b, 256);
+	if (b.count > 0)
+		CapturePutBits(&b, 0, 8 - b.count);
+
+	unsigned int s1 = 1, s2 = 0;		// adler-32
+	for (size_t k = 0; k < n; k++)
+	{
+		s1 = (s1 + data[k]) % 65521;
+		s2 = (s2 + s1) % 65521;
+	}
+	unsigned int adler = (s2 << 16) | s1;
+	for (int shift = 24; shift >= 0; shift -= 8)
+		out->push_back((unsigned char)(adler >> shift));
+}
+
+
+// the table for the png chunks' crc-32s (call before encoding a png):
+
+void
+CaptureMakeCrcTable()
+{
+	for (unsigned int n = 0; n < 256; n++)
+	{
+		unsigned int c = n;
+		for (int k = 0; k < 8; k++)
+			c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+		CaptureCrcTable[n] = c;
+	}
+}
+
+
+void
+CapturePut32(std::vector<unsigned char>* out, unsigned int value)
+{
+	for (int shift = 24; shift >= 0; shift -= 8)
+		out->push_back((unsigned char)(value >> shift));
+}
+
+void
+CapturePutChunk(std::vector<unsigned char>* out, const char* type, const unsigned char* data, size_t n)
+{
+	CapturePut32(out, (unsigned int)n);
+	size_t start = out->size();
+	out->insert(out->end(), type, type + 4);
+	if (n > 0)
+		out->insert(out->end(), data, data + n);
+
+	unsigned int crc = 0xffffffff;
+	for (size_t k = start; k < out->size(); k++)
+		crc = CaptureCrcTable[(crc ^ (*out)[k]) & 0xff] ^ (crc >> 8);
+	CapturePut32(out, crc ^ 0xffffffff);
+}
+
+
+// what a png filter predicts a byte from the ones to the left (a), above (b), and above and to the left (c):
+
+int
+CapturePredict(int filter, int a, int b, int c)
+{
+	switch (filter)
+	{
+		case 1:		return a;
+		case 2:		return b;
+		case 3:		return (a + b) / 2;
+		case 4:
+		{
+			int p = a + b - c;
+			int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+			if (pa <= pb && pa <= pc)
+				return a;
+			return pb <= pc ? b : c;
+		}
+		default:	return 0;
+	}
+}
+
+
+// encode an image as an 8-bit rgb png, each row with the filter that leaves the smallest sum of
+// (signed) differences -- the usual guess at which one will deflate best:
+
+void
+CaptureEncodePng(const struct CaptureImage* image, int w, int h, std::vector<unsigned char>* out)
+{
+	size_t stride = 3 * (size_t)w;
+	std::vector<unsigned char> filtered((stride + 1) * h);
+	std::vector<unsigned char> row(stride), above(stride, 0), trial(stride);
+	for (int y = 0; y < h; y++)
+	{
+		const unsigned char* src = &image->rgba[(size_t)(h - 1 - y) * 4 * w];	// (png's rows go top down)
+		for (int x = 0; x < w; x++)
+		{
+			row[3*x + 0] = src[4*x + 0];
+			row[3*x + 1] = src[4*x + 1];
+			row[3*x + 2] = src[4*x + 2];
+		}
+
+		unsigned char* dst = &filtered[y * (stride + 1)];
+		long bestSum = -1;
+		for (int filter = 0; filter < 5; filter++)
+		{
+			long sum = 0;
+			for (size_t k = 0; k < stride; k++)
+			{
+				int a = k >= 3 ? row[k - 3] : 0;
+				int c = k >= 3 ? above[k - 3] : 0;
+				trial[k] = (unsigned char)(row[k] - CapturePredict(filter, a, above[k], c));
+				sum += abs((int)(signed char)trial[k]);
+			}
+			if (bestSum < 0 || sum < bestSum)
+			{
+				bestSum = sum;
+				dst[0] = (unsigned char)filter;
+				memcpy(dst + 1, &trial[0], stride);
+			}
+		}
+		above.swap(row);
+	}
+
+	static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	out->insert(out->end(), signature, signature + 8);
+
+	std::vector<unsigned char> header;
+	CapturePut32(&header, (unsigned int)w);
+	CapturePut32(&header, (unsigned int)h);
+	header.push_back(8);		// bits per channel
+	header.push_back(2);		// rgb
+	header.push_back(0);		// deflate
+	header.push_back(0);		// the adaptive filters
+	header.push_back(0);		// not interlaced
+	CapturePutChunk(out, "IHDR", &header[0], header.size());
+
+	std::vector<unsigned char> compressed;
+	compressed.reserve(filtered.size() / 4);
+	CaptureDeflate(&filtered[0], filtered.size(), &compressed);
+	CapturePutChunk(out, "IDAT", &compressed[0], compressed.size());
+	CapturePutChunk(out, "IEND", NULL, 0);
+}
+
+
+// encode an image as planar yuv 4:2:0 (all of y, then u and v at half the size each way),
+// with the bt.601 studio-range coefficients in 8-bit fixed point:
+
+void
+CaptureEncodeYuv(const struct CaptureImage* image, int w, int h, std::vector<unsigned char>* out)
+{
+	int cw = (w + 1) / 2, ch = (h + 1) / 2;
+	size_t start = out->size();
+	out->resize(start + (size_t)w * h + 2 * (size_t)cw * ch);
+	unsigned char* y = &(*out)[start];
+	unsigned char* u = y + (size_t)w * h;
+	unsigned char* v = u + (size_t)cw * ch;
+
+	for (int j = 0; j < h; j++)
+	{
+		const unsigned char* src = &image->rgba[(size_t)(h - 1 - j) * 4 * w];	// (top row first)
+		for (int i = 0; i < w; i++)
+		{
+			int r = src[4*i], g = src[4*i + 1], b = src[4*i + 2];
+			y[(size_t)j * w + i] = (unsigned char)(((66*r + 129*g + 25*b + 128) >> 8) + 16);
+		}
+	}
+
+	// each chroma sample is of the average of the (up to) four pixels it covers:
+	for (int j = 0; j < ch; j++)
+	{
+		for (int i = 0; i < cw; i++)
+		{
+			int r = 0, g = 0, b = 0, count = 0;
+			for (int dj = 0; dj < 2 && 2*j + dj < h; dj++)
+			{
+				const unsigned char* src = &image->rgba[(size_t)(h - 1 - (2*j + dj)) * 4 * w];
+				for (int di = 0; di < 2 && 2*i + di < w; di++)
+				{
+					r += src[4*(2*i + di)];
+					g += src[4*(2*i + di) + 1];
+					b += src[4*(2*i + di) + 2];
+					count++;
+				}
+			}
+			r /= count;	g /= count;	b /= count;
+			u[(size_t)j * cw + i] = (unsigned char)(((-38*r - 74*g + 112*b + 128) >> 8) + 128);
+			v[(size_t)j * cw + i] = (unsigned char)(((112*r - 94*g - 18*b + 128) >> 8) + 128);
+		}
+	}
+}
+
+
+// make the directory the files named prefix go in, and any above it that are not there yet:
+// returns false if it is not a directory when done
+
+bool
+CaptureMakeDirs(const char* prefix)
+{
+	char dir[CAPTUREMAXPATH];
+	strncpy(dir, prefix, CAPTUREMAXPATH - 1);
+	dir[CAPTUREMAXPATH - 1] = '\0';
+	char* end = strrchr(dir, '/');
+#ifdef WIN32
+	char* back = strrchr(dir, '\\');
+	if (back != NULL && (end == NULL || back > end))
+		end = back;
+#endif
+	if (end == NULL || end == dir)
+		return true;			// (the current directory, or the root)
+	*end = '\0';
+
+	for (char* p = dir + 1; ; p++)
+	{
+		if (*p != '/' && *p != '\\' && *p != '\0')
+			continue;
+		char c = *p;
+		*p = '\0';
+#ifdef WIN32
+		int made = _mkdir(dir);
+#else
+		int made = mkdir(dir, 0755);
+#endif
+		if (made != 0 && errno != EEXIST)
+			return false;
+		*p = c;
+		if (c == '\0')
+			break;
+	}
+
+	struct stat st;
+	return stat(dir, &st) == 0 && (st.st_mode & S_IFMT) == S_IFDIR;
+}
+
+
+// write an encoded frame to its own file:
+// returns false if it cannot
+
+bool
+CaptureWriteFile(const struct CaptureImage* image)
+{
+	char path[CAPTUREMAXPATH + 32];
+	snprintf(path, sizeof(path), "%s%05ld.%s", CapturePrefix, image->index, CaptureFormat == CAPTUREPNG ? "png" : "yuv");
+	FILE* fp = fopen(path, "wb");
+	if (fp == NULL)
+	{
+		fprintf(stderr, "Cannot write capture file '%s'\n", path);
+		return false;
+	}
+	size_t written = fwrite(&image->encoded[0], 1, image->encoded.size(), fp);
+	bool ok = fclose(fp) == 0 && written == image->encoded.size();
+	if (!ok)
+		fprintf(stderr, "Cannot write all of capture file '%s'\n", path);
+	return ok;
+}
+
+
+// hand an encoded frame to the pipe, and write it and every frame waiting after it once it is the next one:
+// returns the images written (to go back in the pool)
+
+std::vector<struct CaptureImage*>
+CaptureWritePipe(struct CaptureImage* image, long* failures)
+{
+	std::vector<struct CaptureImage*> done;
+	std::lock_guard<std::mutex> lock(CapturePipeMutex);
+	CapturePipeWaiting[image->index] = image;
+	for (;;)
+	{
+		std::map<long, struct CaptureImage*>::iterator next = CapturePipeWaiting.find(CapturePipeNext);
+		if (next == CapturePipeWaiting.end())
+			break;
+		struct CaptureImage* ready = next->second;
+		CapturePipeWaiting.erase(next);
+		CapturePipeNext++;
+		if (CapturePipe == NULL || fwrite(&ready->encoded[0], 1, ready->encoded.size(), CapturePipe) != ready->encoded.size())
+		{
+			if (CapturePipe != NULL)
+				fprintf(stderr, "Cannot write frame %ld to the capture pipe\n", ready->index);
+			(*failures)++;
+		}
+		done.push_back(ready);
+	}
+	return done;
+}
+
+
+// a worker thread: encode and write whatever frames come along, until told to quit and there are none left
+// (no opengl calls in here!)
+
+void
+CaptureWorker()
+{
+	std::unique_lock<std::mutex> lock(CaptureMutex);
+	for (;;)
+	{
+		CaptureWake.wait(lock, [] { return CaptureQuit || !CaptureQueue.empty(); });
+		if (CaptureQueue.empty())
+			return;
+		struct CaptureImage* image = CaptureQueue.front();
+		CaptureQueue.pop_front();
+		lock.unlock();
+
+		double t0 = WallSeconds();
+		image->encoded.clear();
+		if (CaptureFormat == CAPTUREPIPE)
+		{
+			const char* header = "FRAME\n";		// (each frame of the stream starts with this)
+			image->encoded.insert(image->encoded.end(), header, header + strlen(header));
+		}
+		if (CaptureFormat == CAPTUREPNG)
+			CaptureEncodePng(image, CaptureWidth, CaptureHeight, &image->encoded);
+		else
+			CaptureEncodeYuv(image, CaptureWidth, CaptureHeight, &image->encoded);
+		double bytes = (double)image->encoded.size();
+
+		long failures = 0;
+		std::vector<struct CaptureImage*> done;
+		if (CaptureFormat == CAPTUREPIPE)
+			done = CaptureWritePipe(image, &failures);
+		else
+		{
+			if (!CaptureWriteFile(image))
+				failures++;
+			done.push_back(image);
+		}
+		double ms = 1000. * (WallSeconds() - t0);
+
+		lock.lock();
+		CaptureTotal.encodeMs += ms;
+		CaptureTotal.bytes += bytes;
+		CaptureTotal.failures += failures;
+		CaptureFree.insert(CaptureFree.end(), done.begin(), done.end());
+		CaptureWake.notify_all();
+	}
+}
+
+
+// start capturing frames of width x height pixels, at fps frames a second of the animation:
+//	format is CAPTUREPNG or CAPTUREYUV (files named prefix followed by the frame number), or CAPTUREPIPE
+//	(a stream into the standard input of command), and readBack false means the frames will come from
+//	CaptureFramePixels( ), not opengl (there does not even have to be an opengl context)
+// returns false if it cannot be started
+
+bool
+CaptureStart(int format, const char* prefix, const char* command, int width, int height, double fps, bool readBack)
+{
+	CaptureFormat = format;
+	CaptureWidth = width;
+	CaptureHeight = height;
+	CaptureFps = fps;
+	strncpy(CapturePrefix, prefix != NULL ? prefix : "", CAPTUREMAXPATH - 1);
+	CapturePrefix[CAPTUREMAXPATH - 1] = '\0';
+	memset(&CaptureTotal, 0, sizeof(CaptureTotal));
+
+	CaptureMakeCrcTable();
+
+	if (format != CAPTUREPIPE && !CaptureMakeDirs(CapturePrefix))
+	{
+		fprintf(stderr, "Cannot make the directory for the capture files '%s...'\n", CapturePrefix);
+		return false;
+	}
+
+	if (format == CAPTUREPIPE)
+	{
+#ifdef WIN32
+		CapturePipe = _popen(command, "wb");
+#else
+		signal(SIGPIPE, SIG_IGN);		// (so an encoder that quits early is a write error, not the end of us)
+		CapturePipe = popen(command, "w");
+#endif
+		if (CapturePipe == NULL)
+		{
+			fprintf(stderr, "Cannot run capture command '%s'\n", command);
+			return false;
+		}
+
+		// the stream header (the frame rate as a fraction, in thousandths, unless it is whole):
+		int num = (int)(fps * 1000. + 0.5), den = 1000;
+		if (num % 1000 == 0)
+		{
+			num /= 1000;
+			den = 1;
+		}
+		fprintf(CapturePipe, "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C420jpeg\n", width, height, num, den);
+		CapturePipeWaiting.clear();
+		CapturePipeNext = 0;
+	}
+
+	CapturePbosOK = readBack && (GLEW_VERSION_2_1 || GLEW_ARB_pixel_buffer_object);
+	CaptureFencesOK = readBack && (GLEW_VERSION_3_2 || GLEW_ARB_sync);
+	if (CapturePbosOK)
+	{
+		glGenBuffers(CAPTUREPBOS, CapturePbos);
+		for (int s = 0; s < CAPTUREPBOS; s++)
+		{
+			RsBindBuffer(GL_PIXEL_PACK_BUFFER, CapturePbos[s]);
+			glBufferData(GL_PIXEL_PACK_BUFFER, 4 * (GLsizeiptr)width * height, NULL, GL_STREAM_READ);
+			CaptureFences[s] = 0;
+			CapturePboFrame[s] = -1;
+		}
+		RsBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+	else if (readBack)
+		fprintf(stderr, "No pixel buffer objects -- capture reads each frame back straight away\n");
+	CaptureNextFrame = 0;
+
+	// the workers (leaving a core for the drawing), and two images each to work on:
+	int numWorkers = (int)std::thread::hardware_concurrency() - 1;
+	if (numWorkers < 1)
+		numWorkers = 1;
+	if (numWorkers > CAPTUREMAXWORKERS)
+		numWorkers = CAPTUREMAXWORKERS;
+	CaptureQuit = false;
+	CaptureQueue.clear();
+	CaptureFree.clear();
+	CaptureAll.clear();
+	for (int i = 0; i < 2 * numWorkers; i++)
+	{
+		struct CaptureImage* image = new struct CaptureImage;
+		image->rgba.resize(4 * (size_t)width * height);
+		CaptureAll.push_back(image);
+		CaptureFree.push_back(image);
+	}
+	for (int i = 0; i < numWorkers; i++)
+		CaptureWorkers.push_back(std::thread(CaptureWorker));
+
+	CaptureOn = true;
+	fprintf(stderr, "Capturing %dx%d at %g fps as %s, with %d worker(s)\n", width, height, fps,
+		CAPTUREFORMATNAMES[format], numWorkers);
+	return true;
+}
+
+
+// an image from the pool to copy a frame into (waiting for a worker to give one back, if none are free):
+
+struct CaptureImage*
+CaptureGetImage()
+{
+	std::unique_lock<std::mutex> lock(CaptureMutex);
+	if (CaptureFree.empty())
+	{
+		double t0 = WallSeconds();
+		CaptureWake.wait(lock, [] { return !CaptureFree.empty(); });
+		CaptureTotal.poolWaits++;
+		CaptureTotal.poolWaitMs += 1000. * (WallSeconds() - t0);
+	}
+	struct CaptureImage* image = CaptureFree.back();
+	CaptureFree.pop_back();
+	return image;
+}
+
+
+void
+CaptureQueueImage(struct CaptureImage* image)
+{
+	{
+		std::lock_guard<std::mutex> lock(CaptureMutex);
+		CaptureQueue.push_back(image);
+		CaptureTotal.frames++;
+	}
+	CaptureWake.notify_all();
+}
+
+
+// map a pixel buffer object that has been read into, and send its frame to the workers:
+
+void
+CaptureCollect(int slot)
+{
+	if (CaptureFencesOK && CaptureFences[slot] != 0)
+	{
+		if (glClientWaitSync(CaptureFences[slot], 0, 0) == GL_TIMEOUT_EXPIRED)
+		{
+			double t0 = WallSeconds();
+			glClientWaitSync(CaptureFences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, CAPTUREFENCETIMEOUT);
+			CaptureTotal.fenceWaits++;
+			CaptureTotal.fenceWaitMs += 1000. * (WallSeconds() - t0);
+		}
+		glDeleteSync(CaptureFences[slot]);
+		CaptureFences[slot] = 0;
+	}
+
+	struct CaptureImage* image = CaptureGetImage();
+	image->index = CapturePboFrame[slot];
+	CapturePboFrame[slot] = -1;
+
+	RsBindBuffer(GL_PIXEL_PACK_BUFFER, CapturePbos[slot]);
+	void* pixels = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+	if (pixels != NULL)
+	{
+		memcpy(&image->rgba[0], pixels, image->rgba.size());
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	else
+	{
+		fprintf(stderr, "Cannot map capture frame %ld (0x%04x)\n", image->index, glGetError());
+		memset(&image->rgba[0], 0, image->rgba.size());
+	}
+	RsBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	CaptureQueueImage(image);
+}
+
+
+// capture what has just been drawn into the framebuffer being read from:
+// (the lower-left CaptureWidth x CaptureHeight pixels)
+
+void
+CaptureFrame()
+{
+	if (!CaptureOn)
+		return;
+	double t0 = WallSeconds();
+	double poolWaitMs = CaptureTotal.poolWaitMs;
+	if (!CapturePbosOK)
+	{
+		struct CaptureImage* image = CaptureGetImage();
+		image->index = CaptureNextFrame++;
+		glReadPixels(0, 0, CaptureWidth, CaptureHeight, GL_RGBA, GL_UNSIGNED_BYTE, &image->rgba[0]);
+		CaptureQueueImage(image);
+	}
+	else
+	{
+		// queue the copy into this frame's buffer, then collect the oldest one still in flight:
+		int slot = (int)(CaptureNextFrame % CAPTUREPBOS);
+		if (CapturePboFrame[slot] >= 0)
+			CaptureCollect(slot);		// (only if a frame went by without collecting it)
+		RsBindBuffer(GL_PIXEL_PACK_BUFFER, CapturePbos[slot]);
+		glReadPixels(0, 0, CaptureWidth, CaptureHeight, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+		RsBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		if (CaptureFencesOK)
+			CaptureFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		CapturePboFrame[slot] = CaptureNextFrame++;
+
+		int oldest = (int)(CaptureNextFrame % CAPTUREPBOS);
+		if (CapturePboFrame[oldest] >= 0)
+			CaptureCollect(oldest);
+	}
+	CaptureTotal.readMs += 1000. * (WallSeconds() - t0) - (CaptureTotal.poolWaitMs - poolWaitMs);	// (counted apart)
+}
+
+
+// capture a frame that is already in memory: rgba is CaptureWidth x CaptureHeight, bottom row first
+
+void
+CaptureFramePixels(const unsigned char* rgba)
+{
+	if (!CaptureOn)
+		return;
+	double t0 = WallSeconds();
+	double poolWaitMs = CaptureTotal.poolWaitMs;
+	struct CaptureImage* image = CaptureGetImage();
+	image->index = CaptureNextFrame++;
+	memcpy(&image->rgba[0], rgba, image->rgba.size());
+	CaptureQueueImage(image);
+	CaptureTotal.readMs += 1000. * (WallSeconds() - t0) - (CaptureTotal.poolWaitMs - poolWaitMs);
+}
+
+
+// collect the frames still in flight, wait for the workers to write everything, and stop:
+// returns false if any frame could not be written
+
+bool
+CaptureFinish()
+{
+	if (!CaptureOn)
+		return true;
+	if (CapturePbosOK)
+	{
+		for (long f = CaptureNextFrame - CAPTUREPBOS; f < CaptureNextFrame; f++)
+		{
+			int slot = (int)(f % CAPTUREPBOS);
+			if (f >= 0 && CapturePboFrame[slot] == f)
+				CaptureCollect(slot);
+		}
+		glDeleteBuffers(CAPTUREPBOS, CapturePbos);
+		RsInvalidate();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(CaptureMutex);
+		CaptureQuit = true;
+	}
+	CaptureWake.notify_all();
+	for (size_t i = 0; i < CaptureWorkers.size(); i++)
+		CaptureWorkers[i].join();
+	CaptureWorkers.clear();
+	for (size_t i = 0; i < CaptureAll.size(); i++)
+		delete CaptureAll[i];
+	CaptureAll.clear();
+	CaptureFree.clear();
+
+	if (CapturePipe != NULL)
+	{
+#ifdef WIN32
+		int status = _pclose(CapturePipe);
+#else
+		int status = pclose(CapturePipe);
+#endif
+		CapturePipe = NULL;
+		if (status != 0)
+		{
+			fprintf(stderr, "The capture command exited with status %d\n", status);
+			CaptureTotal.failures++;
+		}
+	}
+	CaptureOn = false;
+	return CaptureTotal.failures == 0;
+}
@@ -0,0 +1,311 @@
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+//	Skipping the bodies and orbit lines that cannot be seen
+//
+//	Frustum culling: every frame, the six planes of the view volume are pulled out of projection * view
+//	(in world coordinates), and each body's bounding sphere (and each orbit circle's, centered on what it
+//	orbits) is checked against them.  From the earth and moon views most of the scene is behind the eye.
+//
+//	Occlusion culling (optional): each lit body drawn one at a time is drawn inside an occlusion query.
+//	A body whose query from an earlier frame says no samples passed -- it was behind the sun or the earth --
+//	is not drawn; a slightly bigger, coarse proxy sphere is drawn inside its query instead, with color and depth
+//	writes off, to find out when it comes back into sight.  Results are only read once the card says they are
+//	available, so there is never a wait (the cost is that a body can show up a frame or so late).
+//	Bodies drawn instanced are frustum culled only, since the queries need a draw call per body.
+//
+//	Needs CullFrameBegin( ) once per frame, then CullBodies( ) for each view, with its view matrix current, before
+//	anything is drawn in it.  The frustum test itself (CullPlanesFrom( ) and FrustumCullViews( )) makes no opengl
+//	calls, so the frame pipeline's worker can do it ahead of time and hand CullBodies( ) the answer.  When several
+//	views are drawn in one frame (the quad view), all of them are tested in one pass down the bodies.
+
+
+const float	CULLPROXYSCALE = 1.1f;		// the 8-slice proxy sphere has to cover the real one
+
+// one view's volume, and which bodies are inside it:
+
+struct CullView
+{
+	double	origin[3];		// the world point its planes are relative to (see RebaseBodyFrame( ))
+	float	planes[6][4];
+	std::vector<unsigned char>	inView;		// 1 if the body is inside (see FrustumCullViews( ))
+};
+
+struct CullCounters
+{
+	long	bodiesDrawn;
+	long	bodiesOutside;		// outside the view volume
+	long	bodiesOccluded;		// hidden behind something, as of an earlier frame
+	long	orbitsDrawn;
+	long	orbitsOutside;
+};
+
+float	CullPlanes[6][4];		// left, right, bottom, top, near, far: a*x + b*y + c*z + d >= 0 inside
+std::vector<unsigned char>	BodyVisible;	// 1 if the body should be drawn this frame
+std::vector<unsigned char>	BodyOccluded;	// 1 if the body's last query result said it was hidden
+std::vector<unsigned char>	BodyQueryPending;	// 1 if the body has a query whose result has not been read
+std::vector<GLuint>	BodyQueries;		// one occlusion query object per body
+GLenum	CullQueryTarget;		// GL_ANY_SAMPLES_PASSED, or GL_SAMPLES_PASSED on older opengl
+bool	CullFrustum;			// true if CullBodies( ) was asked to do frustum culling this frame
+bool	CullOcclusion;			// true if CullBodies( ) was asked to use the occlusion queries this frame
+struct CullCounters	CullFrame;	// counts for this frame (all of its views)
+struct CullCounters	CullTotal;	// counts since the caller last zeroed them
+
+
+// pull the view volume's planes out of a projection and a modelview matrix:
+// (the planes are in the coordinates the modelview matrix starts from -- relative to the scene's origin)
+
+void
+CullPlanesFrom(const float proj[16], const float mv[16], float planes[6][4])
+{
+	float m[16];
+
+	// m = proj * mv, column-major:
+	for (int c = 0; c < 4; c++)
+	{
+		for (int r = 0; r < 4; r++)
+		{
+			m[4*c + r] = proj[r]*mv[4*c] + proj[4 + r]*mv[4*c + 1] + proj[8 + r]*mv[4*c + 2] + proj[12 + r]*mv[4*c + 3];
+		}
+	}
+
+	// each plane is the last row of m plus or minus one of the others:
+	for (int p = 0; p < 6; p++)
+	{
+		int row = p / 2;
+		float sign = (p % 2 == 0) ? 1.f : -1.f;
+		float len = 0.f;
+		for (int k = 0; k < 4; k++)
+		{
+			planes[p][k] = m[4*k + 3] + sign * m[4*k + row];
+			if (k < 3)
+				len += planes[p][k] * planes[p][k];
+		}
+		len = sqrtf(len);
+		if (len > 0.f)
+		{
+			for (int k = 0; k < 4; k++)
+				planes[p][k] /= len;
+		}
+	}
+}
+
+
+// the same, from the current projection and modelview matrices, into CullPlanes:
+
+void
+ExtractCullPlanes()
+{
+	GLfloat mv[16], proj[16];
+	glGetFloatv(GL_MODELVIEW_MATRIX, mv);
+	glGetFloatv(GL_PROJECTION_MATRIX, proj);
+	CullPlanesFrom(proj, mv, CullPlanes);
+}
+
+
+// true if any of a sphere is inside the view volume these planes bound:
+
+bool
+SphereInPlanes(const float planes[6][4], float x, float y, float z, float r)
+{
+	for (int p = 0; p < 6; p++)
+	{
+		if (planes[p][0]*x + planes[p][1]*y + planes[p][2]*z + planes[p][3] < -r)
+			return false;
+	}
+	return true;
+}
+
+inline bool	SphereInView(float x, float y, float z, float r)	{ return SphereInPlanes(CullPlanes, x, y, z, r); }
+
+
+// which bodies of a frame are inside each of some views' volumes, into their inView[ ]s (1 if so):
+// (one pass down the bodies for all of the views, each body's place relative to each view's origin
+//  worked out the same way RebaseBodyFrame( ) would)
+
+void
+FrustumCullViews(const struct BodyFrame* f, int numViews, struct CullView* const views[])
+{
+	int n = Bodies.count;
+	for (int v = 0; v < numViews; v++)
+		views[v]->inView.resize(n);
+	for (int i = 0; i < n; i++)
+	{
+		for (int v = 0; v < numViews; v++)
+		{
+			const double* o = views[v]->origin;
+			views[v]->inView[i] = SphereInPlanes(views[v]->planes, (float)(f->frameX[i] - o[0]), (float)-o[1],
+				(float)(f->frameZ[i] - o[2]), Bodies.radius[i]);
+		}
+	}
+}
+
+
+// true if the orbit circle of a body is worth drawing (always, if frustum culling is off):
+
+bool
+OrbitInView(int body)
+{
+	float c[3];
+	BodyCenter(&Bodies, Bodies.parent[body], c);
+	bool in = !CullFrustum || SphereInView(c[0], c[1], c[2], Bodies.orbitRadius[body]);
+	if (in)
+		CullFrame.orbitsDrawn++;
+	else
+		CullFrame.orbitsOutside++;
+	return in;
+}
+
+
+// decide which bodies get drawn in this view (in BodyVisible[ ]), with the current modelview as the view:
+//	frustum false means draw everything,
+//	occlusion true means use the occlusion queries from earlier frames for the lit bodies,
+//	planes and inView, if not NULL, are the view volume and FrustumCullViews( )'s answer for it, worked out ahead of time
+//	(otherwise they come from the current matrices)
+
+void
+CullBodies(bool frustum, bool occlusion, const float planes[6][4], const unsigned char* inView)
+{
+	int n = Bodies.count;
+	if ((int)BodyVisible.size() != n)
+	{
+		// a new scene -- start over:
+		if (!BodyQueries.empty())
+			glDeleteQueries((GLsizei)BodyQueries.size(), &BodyQueries[0]);
+		BodyQueries.assign(n, 0);
+		BodyVisible.assign(n, 1);
+		BodyOccluded.assign(n, 0);
+		BodyQueryPending.assign(n, 0);
+	}
+
+	CullFrustum = frustum;
+	CullOcclusion = occlusion && GLEW_VERSION_1_5 && n > 0;
+	if (CullOcclusion && BodyQueries[0] == 0)
+	{
+		glGenQueries(n, &BodyQueries[0]);
+		CullQueryTarget = GLEW_VERSION_3_3 ? GL_ANY_SAMPLES_PASSED : GL_SAMPLES_PASSED;
+	}
+
+	if (frustum && planes != NULL)
+		memcpy(CullPlanes, planes, sizeof(CullPlanes));
+	else if (frustum)
+		ExtractCullPlanes();
+
+	for (int i = 0; i < n; i++)
+	{
+		if (frustum && !(inView != NULL ? inView[i] != 0 : SphereInView(Bodies.relX[i], Bodies.relY, Bodies.relZ[i], Bodies.radius[i])))
+		{
+			BodyVisible[i] = 0;
+			BodyOccluded[i] = 0;		// (assume it is visible when it comes back in)
+			CullFrame.bodiesOutside++;
+			continue;
+		}
+
+		// pick up last frame's answer, if it is in yet:
+		if (CullOcclusion && BodyQueryPending[i])
+		{
+			GLuint available = 0;
+			glGetQueryObjectuiv(BodyQueries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (available)
+			{
+				GLuint samples = 0;
+				glGetQueryObjectuiv(BodyQueries[i], GL_QUERY_RESULT, &samples);
+				BodyOccluded[i] = samples == 0;
+				BodyQueryPending[i] = 0;
+			}
+		}
+		if (!CullOcclusion || (Bodies.flags[i] & BODYUNLIT) != 0)
+			BodyOccluded[i] = 0;
+
+		BodyVisible[i] = !BodyOccluded[i];
+		if (BodyVisible[i])
+			CullFrame.bodiesDrawn++;
+		else
+			CullFrame.bodiesOccluded++;
+	}
+}
+
+
+// wrap a lit body's draw in its occlusion query:
+// (a body whose last query has not come back yet does not get a new one)
+
+void
+CullBeginQuery(int body)
+{
+	if (CullOcclusion && !BodyQueryPending[body])
+		glBeginQuery(CullQueryTarget, BodyQueries[body]);
+}
+
+void
+CullEndQuery(int body)
+{
+	if (CullOcclusion && !BodyQueryPending[body])
+	{
+		glEndQuery(CullQueryTarget);
+		BodyQueryPending[body] = 1;
+	}
+}
+
+
+// draw a proxy sphere, inside its query, for each body that is in view but was hidden,
+// after everything else is drawn:
+
+void
+DrawOcclusionProxies()
+{
+	if (!CullOcclusion)
+		return;
+
+	struct SphereMesh* m = GetSphereMesh(SPHLODSLICES[0], SPHLODSLICES[0]);
+	bool any = false;
+	for (int i = 0; i < Bodies.count; i++)
+	{
+		if (!BodyOccluded[i] || BodyQueryPending[i])
+			continue;
+		if (!any)
+		{
+			RsUseProgram(0);
+			glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+			glDepthMask(GL_FALSE);
+			BindSphereMesh(m);
+			any = true;
+		}
+
+		float r = CULLPROXYSCALE * Bodies.radius[i];
+		glPushMatrix();
+		glTranslatef(Bodies.relX[i], Bodies.relY, Bodies.relZ[i]);
+		glScalef(r, r, r);
+		CullBeginQuery(i);
+		DrawBoundSphereMesh(m);
+		CullEndQuery(i);
+		glPopMatrix();
+	}
+	if (any)
+	{
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		glDepthMask(GL_TRUE);
+	}
+}
+
+
+// start this frame's counts over:
+
+void
+CullFrameBegin()
+{
+	memset(&CullFrame, 0, sizeof(CullFrame));
+}
+
+
+// add this frame's counts to the totals:
+
+void
+CullFrameEnd()
+{
+	CullTotal.bodiesDrawn += CullFrame.bodiesDrawn;
+	CullTotal.bodiesOutside += CullFrame.bodiesOutside;
+	CullTotal.bodiesOccluded += CullFrame.bodiesOccluded;
+	CullTotal.orbitsDrawn += CullFrame.orbitsDrawn;
+	CullTotal.orbitsOutside += CullFrame.orbitsOutside;
+}
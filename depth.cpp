@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <math.h>
+
+//	Depth buffer setups that hold up at real solar-system distances
+//
+//	DEPTHSTANDARD	what opengl does by default: depth goes as 1/distance from the near plane, so almost all of
+//			a 24-bit buffer's precision is used up within a few thousand near-plane distances of the eye.
+//			Fine for the exaggerated scene, but at real scale the sun's depth rounds to the far plane's.
+//	DEPTHREVERSED	reversed-Z: a float depth buffer, glClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE), and a projection
+//			that puts the near plane at depth 1 and an infinitely far plane at depth 0 (tested with GL_GREATER).
+//			The 1/distance curve then lines up with where a float has its precision, so the depth is good to
+//			about 7 digits of the distance at any distance, and there is no far plane to fit the scene inside.
+//			The glut window's depth buffer is not a float one, so in a window the scene is drawn into an
+//			offscreen framebuffer with one and copied to the window (DepthTargetBind( ) and DepthTargetPresent( )).
+//	DEPTHLOG	logarithmic depth, for when there is no glClipControl( ) (before opengl 4.5): the fragment shaders
+//			write log2(1 + w) / log2(1 + DEPTHLOGFAR) as the depth, which is good to about 6 digits of the distance
+//			with the ordinary 24-bit buffer.  Everything that writes depth has to go through a shader that does this
+//			(see LOGDEPTHGLSL in shading.cpp), so the lit bodies are drawn per pixel, the sun and the orbit lines
+//			with the unlit shader, and there are no occlusion queries.  Writing gl_FragDepth turns off early-Z,
+//			so this costs fill rate -- it is the fallback, not the default.
+//
+//	The sky (skybox.cpp) is drawn at whatever depth the far plane is in the current mode: DepthFarValue( ).
+
+
+const int	DEPTHSTANDARD	= 0;
+const int	DEPTHREVERSED	= 1;
+const int	DEPTHLOG	= 2;
+const int	DEPTHNUMMODES	= 3;
+
+const char *	DEPTHMODENAMES[DEPTHNUMMODES] = { "standard", "reversed-Z", "logarithmic" };
+
+const double	DEPTHLOGFAR = 1.e12;		// distance logarithmic depth reaches 1 at (far past Pluto, in miles)
+
+int		DepthMode;				// DEPTHSTANDARD, DEPTHREVERSED, or DEPTHLOG
+bool	DepthModeOK[DEPTHNUMMODES];	// which of them this opengl can do (see InitDepth( ))
+int		DepthAppliedMode = -1;	// the mode the clip control was last set for
+GLuint	DepthTargetFramebuffer;	// the window's offscreen framebuffer for reversed-Z, and its buffers
+GLuint	DepthTargetColorBuffer;
+GLuint	DepthTargetDepthBuffer;
+int		DepthTargetWidth, DepthTargetHeight;
+bool	DepthTargetBound;		// true if the scene is being drawn into DepthTargetFramebuffer this frame
+
+
+// find out which depth modes can be used:
+//	logOK is whether the shaders logarithmic depth needs are there (shading.cpp's)
+
+void
+InitDepth(bool logOK)
+{
+	DepthModeOK[DEPTHSTANDARD] = true;
+	DepthModeOK[DEPTHREVERSED] = (GLEW_VERSION_4_5 || GLEW_ARB_clip_control) &&
+		(GLEW_VERSION_3_0 || (GLEW_ARB_depth_buffer_float && GLEW_ARB_framebuffer_object));
+	DepthModeOK[DEPTHLOG] = logOK;
+	DepthAppliedMode = -1;
+
+	if (!DepthModeOK[DEPTHREVERSED])
+		fprintf(stderr, "Reversed-Z depth needs glClipControl( ) and float depth buffers -- %s\n",
+			logOK ? "logarithmic depth will be used instead" : "using the standard depth buffer");
+}
+
+
+// the best mode there is -- reversed-Z, then logarithmic depth, then standard:
+
+int
+DepthBestMode()
+{
+	if (DepthModeOK[DEPTHREVERSED])
+		return DEPTHREVERSED;
+	if (DepthModeOK[DEPTHLOG])
+		return DEPTHLOG;
+	return DEPTHSTANDARD;
+}
+
+
+// the next mode this opengl can do after the current one (for the keyboard):
+
+int
+DepthNextMode()
+{
+	int m = DepthMode;
+	do
+	{
+		m = (m + 1) % DEPTHNUMMODES;
+	} while (!DepthModeOK[m]);
+	return m;
+}
+
+
+// the depth comparison, and the depth of the far plane, in the current mode:
+
+GLenum
+DepthTestFunc()
+{
+	return DepthMode == DEPTHREVERSED ? GL_GREATER : GL_LESS;
+}
+
+GLenum
+DepthFarFunc()		// for drawing right on the far plane, behind everything that is already there
+{
+	return DepthMode == DEPTHREVERSED ? GL_GEQUAL : GL_LEQUAL;
+}
+
+double
+DepthFarValue()
+{
+	return DepthMode == DEPTHREVERSED ? 0. : 1.;
+}
+
+
+// set up the depth test for a frame in the current mode, ahead of the glClear( ):
+
+void
+DepthFrameBegin()
+{
+	if (DepthMode < 0 || DepthMode >= DEPTHNUMMODES || !DepthModeOK[DepthMode])
+		DepthMode = DepthBestMode();
+
+	if (DepthMode != DepthAppliedMode)
+	{
+		if (DepthModeOK[DEPTHREVERSED])
+			glClipControl(GL_LOWER_LEFT, DepthMode == DEPTHREVERSED ? GL_ZERO_TO_ONE : GL_NEGATIVE_ONE_TO_ONE);
+		DepthAppliedMode = DepthMode;
+	}
+	glClearDepth(DepthFarValue());
+	glDepthFunc(DepthTestFunc());
+}
+
+
+// a perspective projection for a depth mode, like gluPerspective( ) makes, into m[ ] (column-major):
+// (reversed-Z has no far plane, so far is only used by the other modes; no opengl calls, so the frame
+//  pipeline's worker can use it)
+
+void
+DepthProjectionMatrix(int mode, double fovy, double aspect, double zNear, double zFar, float m[16])
+{
+	double f = 1. / tan(fovy * M_PI / 360.);
+	for (int k = 0; k < 16; k++)
+		m[k] = 0.f;
+	m[0] = (float)(f / aspect);
+	m[5] = (float)f;
+	m[11] = -1.f;
+	if (mode == DEPTHREVERSED)
+	{
+		// clip z = near and clip w = -eye z, so the depth is near / distance: 1 at the near plane, 0 at infinity
+		m[14] = (float)zNear;
+	}
+	else
+	{
+		m[10] = (float)((zFar + zNear) / (zNear - zFar));
+		m[14] = (float)(2. * zFar * zNear / (zNear - zFar));
+	}
+}
+
+
+// load one for the current mode into the projection matrix:
+// (leaves the matrix mode at GL_PROJECTION)
+
+void
+DepthProjection(double fovy, double aspect, double zNear, double zFar)
+{
+	GLfloat m[16];
+	DepthProjectionMatrix(DepthMode, fovy, aspect, zNear, zFar, m);
+	glMatrixMode(GL_PROJECTION);
+	glLoadMatrixf(m);
+}
+
+
+// in a glut window, draw into an offscreen framebuffer with a float depth buffer when reversed-Z is on:
+// (the size is the window's; does nothing in the other modes, which use the window's own depth buffer)
+
+void
+DepthTargetBind(int width, int height)
+{
+	DepthTargetBound = DepthMode == DEPTHREVERSED;
+	if (!DepthTargetBound)
+		return;
+
+	if (DepthTargetFramebuffer == 0 || width != DepthTargetWidth || height != DepthTargetHeight)
+	{
+		if (DepthTargetFramebuffer == 0)
+		{
+			glGenFramebuffers(1, &DepthTargetFramebuffer);
+			glGenRenderbuffers(1, &DepthTargetColorBuffer);
+			glGenRenderbuffers(1, &DepthTargetDepthBuffer);
+		}
+		glBindRenderbuffer(GL_RENDERBUFFER, DepthTargetColorBuffer);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, DepthTargetDepthBuffer);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT32F, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, DepthTargetFramebuffer);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, DepthTargetColorBuffer);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, DepthTargetDepthBuffer);
+		GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+		if (status != GL_FRAMEBUFFER_COMPLETE)
+		{
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+			DepthModeOK[DEPTHREVERSED] = false;
+			DepthMode = DepthBestMode();
+			fprintf(stderr, "Reversed-Z framebuffer is incomplete (0x%04x) -- using %s depth\n", status, DEPTHMODENAMES[DepthMode]);
+			DepthTargetBound = false;
+			return;
+		}
+		DepthTargetWidth = width;
+		DepthTargetHeight = height;
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, DepthTargetFramebuffer);
+	glDrawBuffer(GL_COLOR_ATTACHMENT0);
+}
+
+
+// copy what was drawn offscreen into the window's back buffer:
+
+void
+DepthTargetPresent()
+{
+	if (!DepthTargetBound)
+		return;
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, DepthTargetFramebuffer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glDrawBuffer(GL_BACK);
+	glBlitFramebuffer(0, 0, DepthTargetWidth, DepthTargetHeight, 0, 0, DepthTargetWidth, DepthTargetHeight,
+		GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	DepthTargetBound = false;
+}
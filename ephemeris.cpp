@@ -0,0 +1,288 @@
+#include <stddef.h>
+#include <math.h>
+#include <thread>
+#include <vector>
+
+#if defined(__AVX2__) && defined(__FMA__)
+#define EPH_AVX2
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define EPH_NEON
+#include <arm_neon.h>
+#endif
+
+//	The Sun-Earth-Moon orbital model, and a batch ephemeris that evaluates it
+//	for many timestamps at once -- with no opengl or glut, so offline tools can include it by itself
+//
+//	The model is the same one MakeEarthMatrix( ) and MakeMoonMatrix( ) build matrices for:
+//		earth = RotateY(earthOrbit) * Translate(EARTH_ORBITAL_RADIUS_MILES) * RotateY(earthSpin)
+//		moon  = RotateY(earthOrbit) * Translate(EARTH_ORBITAL_RADIUS_MILES) *
+//		        RotateY(moonOrbit) * Translate(MOON_ORBITAL_RADIUS_MILES) * RotateY(moonSpin)
+//	Every rotation is about Y and every translation is along X, so everything stays in the
+//	XZ plane: positions have y = 0, and orientations are quaternions (x,y,z,w) = (0, sin(a/2), 0, cos(a/2)).
+//	The batch only writes the components that are not always 0, and its quaternions always have qy >= 0.
+//
+//	Times are in years (earth orbits), as from the sim clock.
+
+
+// the orbital model:
+const float ONE_FULL_TURN = 2 * M_PI;					// base turn for one full turn
+const float DAYS_PER_MONTH = 27.3;						// Earth rotates ~27.3 times for each time the moon revolves around earth
+const float DAYS_PER_YEAR = 365.3;						// Earth rotates ~365 times for each time it revolves around sun
+const float MONTHS_PER_YEAR = DAYS_PER_YEAR / DAYS_PER_MONTH;	// Moon revolves around earth ~13 times for each time earth revolves around the sun
+const float SUN_RADIUS_MILES = 15.0;					// sun's radius (exaggerated to be smaller relative to earth and moon)
+const float EARTH_RADIUS_MILES = 2;						// earth's radius (accurate ratio with moon's radius)
+const float EARTH_ORBITAL_RADIUS_MILES = 45;			// earth's orbital radius (exaggerated to be smaller relative to moon's orbital radius)
+const float MOON_RADIUS_MILES = EARTH_RADIUS_MILES * 1079.6 / 3964.19;	// moon's radius (accurate ratio with moon's radius, moon radius is ~1/4 of earth radius)
+const float MOON_ORBITAL_RADIUS_MILES = 4;				// moon's orbital radius (exaggerated to be bigger relative to earth's orbital radius)
+
+
+// where the batch puts its results, one array per component (structure-of-arrays):
+struct EphemerisSoA
+{
+	float *earthX, *earthZ;		// earth position
+	float *earthQy, *earthQw;	// earth orientation quaternion
+	float *moonX, *moonZ;		// moon position
+	float *moonQy, *moonQw;		// moon orientation quaternion
+};
+
+
+// how many turns each angle makes per year -- the angles add up along the chain of rotations,
+// so combine them before taking the fractional part:
+const double EPH_EARTH_ORBIT_TURNS = 1.;
+const double EPH_EARTH_ORIENT_TURNS = 1. + (double)DAYS_PER_YEAR;
+const double EPH_MOON_ORBIT_TURNS = 1. + (double)MONTHS_PER_YEAR;
+const double EPH_MOON_ORIENT_TURNS = 1. + 2. * (double)MONTHS_PER_YEAR;
+
+
+//	A tiny portable SIMD layer: EphFloats is EPHLANES floats that get the same operation.
+//	AVX2+FMA and NEON get real vector registers, anything else gets a plain loop
+//	(which the compiler is free to vectorize on its own)
+
+const int EPHLANES = 8;
+
+#if defined(EPH_AVX2)
+
+struct EphFloats { __m256 v; };
+inline EphFloats EphSet(float a)							{ return { _mm256_set1_ps(a) }; }
+inline EphFloats EphAdd(EphFloats a, EphFloats b)			{ return { _mm256_add_ps(a.v, b.v) }; }
+inline EphFloats EphSub(EphFloats a, EphFloats b)			{ return { _mm256_sub_ps(a.v, b.v) }; }
+inline EphFloats EphMul(EphFloats a, EphFloats b)			{ return { _mm256_mul_ps(a.v, b.v) }; }
+inline EphFloats EphMulAdd(EphFloats a, EphFloats b, EphFloats c)	{ return { _mm256_fmadd_ps(a.v, b.v, c.v) }; }
+inline void EphStore(float* p, EphFloats a)				{ _mm256_storeu_ps(p, a.v); }
+
+// frac(t * turnsPerYear) - .5, computed in double precision, returned as floats in [-.5, .5):
+inline EphFloats
+EphHalfTurns(const double* t, double turnsPerYear)
+{
+	__m256d k = _mm256_set1_pd(turnsPerYear);
+	__m256d half = _mm256_set1_pd(0.5);
+	__m256d a = _mm256_mul_pd(_mm256_loadu_pd(t), k);
+	__m256d b = _mm256_mul_pd(_mm256_loadu_pd(t + 4), k);
+	a = _mm256_sub_pd(_mm256_sub_pd(a, _mm256_floor_pd(a)), half);
+	b = _mm256_sub_pd(_mm256_sub_pd(b, _mm256_floor_pd(b)), half);
+	return { _mm256_set_m128(_mm256_cvtpd_ps(b), _mm256_cvtpd_ps(a)) };
+}
+
+#elif defined(EPH_NEON)
+
+struct EphFloats { float32x4_t lo, hi; };
+inline EphFloats EphSet(float a)							{ return { vdupq_n_f32(a), vdupq_n_f32(a) }; }
+inline EphFloats EphAdd(EphFloats a, EphFloats b)			{ return { vaddq_f32(a.lo, b.lo), vaddq_f32(a.hi, b.hi) }; }
+inline EphFloats EphSub(EphFloats a, EphFloats b)			{ return { vsubq_f32(a.lo, b.lo), vsubq_f32(a.hi, b.hi) }; }
+inline EphFloats EphMul(EphFloats a, EphFloats b)			{ return { vmulq_f32(a.lo, b.lo), vmulq_f32(a.hi, b.hi) }; }
+inline EphFloats EphMulAdd(EphFloats a, EphFloats b, EphFloats c)	{ return { vfmaq_f32(c.lo, a.lo, b.lo), vfmaq_f32(c.hi, a.hi, b.hi) }; }
+inline void EphStore(float* p, EphFloats a)				{ vst1q_f32(p, a.lo); vst1q_f32(p + 4, a.hi); }
+
+inline float32x2_t
+EphHalfTurns2(const double* t, float64x2_t k)
+{
+	float64x2_t a = vmulq_f64(vld1q_f64(t), k);
+	a = vsubq_f64(vsubq_f64(a, vrndmq_f64(a)), vdupq_n_f64(0.5));
+	return vcvt_f32_f64(a);
+}
+
+inline EphFloats
+EphHalfTurns(const double* t, double turnsPerYear)
+{
+	float64x2_t k = vdupq_n_f64(turnsPerYear);
+	return { vcombine_f32(EphHalfTurns2(t, k), EphHalfTurns2(t + 2, k)),
+			 vcombine_f32(EphHalfTurns2(t + 4, k), EphHalfTurns2(t + 6, k)) };
+}
+
+#else
+
+struct EphFloats { float v[EPHLANES]; };
+#define EPH_EACH(expr)	EphFloats r; for (int i = 0; i < EPHLANES; i++) r.v[i] = (expr); return r
+inline EphFloats EphSet(float a)							{ EPH_EACH(a); }
+inline EphFloats EphAdd(EphFloats a, EphFloats b)			{ EPH_EACH(a.v[i] + b.v[i]); }
+inline EphFloats EphSub(EphFloats a, EphFloats b)			{ EPH_EACH(a.v[i] - b.v[i]); }
+inline EphFloats EphMul(EphFloats a, EphFloats b)			{ EPH_EACH(a.v[i] * b.v[i]); }
+inline EphFloats EphMulAdd(EphFloats a, EphFloats b, EphFloats c)	{ EPH_EACH(a.v[i] * b.v[i] + c.v[i]); }
+inline void EphStore(float* p, EphFloats a)				{ for (int i = 0; i < EPHLANES; i++) p[i] = a.v[i]; }
+
+inline EphFloats
+EphHalfTurns(const double* t, double turnsPerYear)
+{
+	EPH_EACH((float)(t[i] * turnsPerYear - floor(t[i] * turnsPerYear) - 0.5));
+}
+#undef EPH_EACH
+
+#endif
+
+
+// sin and cos of half of a full-turn angle, given frac(turns) - .5 from EphHalfTurns( ):
+//	half the angle is PI*(g + .5), so its sin is cos(PI*g) and its cos is -sin(PI*g),
+//	with PI*g in [-PI/2, PI/2), where short Taylor series are good to about 1e-7
+
+inline void
+EphHalfSinCos(EphFloats g, EphFloats* sinHalf, EphFloats* cosHalf)
+{
+	EphFloats y = EphMul(g, EphSet((float)M_PI));
+	EphFloats y2 = EphMul(y, y);
+
+	// sin(y) = y * (1 - y^2/3! + y^4/5! - ... - y^10/11!):
+	EphFloats s = EphSet(-1.f / 39916800.f);
+	s = EphMulAdd(s, y2, EphSet(1.f / 362880.f));
+	s = EphMulAdd(s, y2, EphSet(-1.f / 5040.f));
+	s = EphMulAdd(s, y2, EphSet(1.f / 120.f));
+	s = EphMulAdd(s, y2, EphSet(-1.f / 6.f));
+	s = EphMulAdd(s, y2, EphSet(1.f));
+	s = EphMul(s, y);
+
+	// cos(y) = 1 - y^2/2! + y^4/4! - ... + y^12/12!:
+	EphFloats c = EphSet(1.f / 479001600.f);
+	c = EphMulAdd(c, y2, EphSet(-1.f / 3628800.f));
+	c = EphMulAdd(c, y2, EphSet(1.f / 40320.f));
+	c = EphMulAdd(c, y2, EphSet(-1.f / 720.f));
+	c = EphMulAdd(c, y2, EphSet(1.f / 24.f));
+	c = EphMulAdd(c, y2, EphSet(-1.f / 2.f));
+	c = EphMulAdd(c, y2, EphSet(1.f));
+
+	*sinHalf = c;
+	*cosHalf = EphSub(EphSet(0.f), s);
+}
+
+
+// EPHLANES samples: t[0..EPHLANES-1] in, out[0..EPHLANES-1] of each array out:
+
+inline void
+EphemerisLanes(const double* t, const struct EphemerisSoA* out, size_t i)
+{
+	EphFloats sh, ch;
+	EphFloats two = EphSet(2.f);
+
+	// earth position: (R cos a, 0, -R sin a), with cos a = ch^2 - sh^2 and sin a = 2 sh ch
+	EphHalfSinCos(EphHalfTurns(t, EPH_EARTH_ORBIT_TURNS), &sh, &ch);
+	EphFloats earthR = EphSet(EARTH_ORBITAL_RADIUS_MILES);
+	EphFloats ex = EphMul(earthR, EphSub(EphMul(ch, ch), EphMul(sh, sh)));
+	EphFloats ez = EphMul(EphSet(-EARTH_ORBITAL_RADIUS_MILES), EphMul(two, EphMul(sh, ch)));
+	EphStore(&out->earthX[i], ex);
+	EphStore(&out->earthZ[i], ez);
+
+	// earth orientation:
+	EphHalfSinCos(EphHalfTurns(t, EPH_EARTH_ORIENT_TURNS), &sh, &ch);
+	EphStore(&out->earthQy[i], sh);
+	EphStore(&out->earthQw[i], ch);
+
+	// moon position, around the earth:
+	EphHalfSinCos(EphHalfTurns(t, EPH_MOON_ORBIT_TURNS), &sh, &ch);
+	EphFloats moonR = EphSet(MOON_ORBITAL_RADIUS_MILES);
+	EphStore(&out->moonX[i], EphMulAdd(moonR, EphSub(EphMul(ch, ch), EphMul(sh, sh)), ex));
+	EphStore(&out->moonZ[i], EphMulAdd(EphSet(-MOON_ORBITAL_RADIUS_MILES), EphMul(two, EphMul(sh, ch)), ez));
+
+	// moon orientation:
+	EphHalfSinCos(EphHalfTurns(t, EPH_MOON_ORIENT_TURNS), &sh, &ch);
+	EphStore(&out->moonQy[i], sh);
+	EphStore(&out->moonQw[i], ch);
+}
+
+
+// fill out[first..first+count-1] from times[first..first+count-1] on this thread:
+
+void
+EphemerisRange(const double* times, size_t first, size_t count, const struct EphemerisSoA* out)
+{
+	size_t end = first + count;
+	size_t i = first;
+	for (; i + EPHLANES <= end; i += EPHLANES)
+		EphemerisLanes(&times[i], out, i);
+
+	// the last few: pad them out to a full set of lanes, then copy back what was asked for
+	if (i < end)
+	{
+		size_t n = end - i;
+		double t[EPHLANES];
+		float buf[8][EPHLANES];
+		struct EphemerisSoA tail = { buf[0], buf[1], buf[2], buf[3], buf[4], buf[5], buf[6], buf[7] };
+		for (int k = 0; k < EPHLANES; k++)
+			t[k] = times[i + ((size_t)k < n ? k : 0)];
+		EphemerisLanes(t, &tail, 0);
+
+		float* dst[8] = { out->earthX, out->earthZ, out->earthQy, out->earthQw, out->moonX, out->moonZ, out->moonQy, out->moonQw };
+		for (int a = 0; a < 8; a++)
+			for (size_t k = 0; k < n; k++)
+				dst[a][i + k] = buf[a][k];
+	}
+}
+
+
+// the batch ephemeris:
+//	for each of the n times (in years), write the earth and moon positions and orientations into 'out'
+//	numThreads <= 0 means use every core
+
+void
+EphemerisBatch(const double* times, size_t n, const struct EphemerisSoA* out, int numThreads)
+{
+	if (numThreads <= 0)
+		numThreads = (int)std::thread::hardware_concurrency();
+	if (numThreads < 1)
+		numThreads = 1;
+
+	// don't bother with threads for small batches:
+	const size_t MINPERTHREAD = 64 * 1024;
+	if ((size_t)numThreads > n / MINPERTHREAD)
+		numThreads = (int)(n / MINPERTHREAD);
+	if (numThreads <= 1)
+	{
+		EphemerisRange(times, 0, n, out);
+		return;
+	}
+
+	// split into chunks that start on whole sets of lanes:
+	size_t chunk = (n / numThreads + EPHLANES - 1) / EPHLANES * EPHLANES;
+	std::vector<std::thread> threads;
+	for (size_t first = 0; first < n; first += chunk)
+	{
+		size_t count = (n - first < chunk) ? n - first : chunk;
+		threads.push_back(std::thread(EphemerisRange, times, first, count, out));
+	}
+	for (size_t i = 0; i < threads.size(); i++)
+		threads[i].join();
+}
+
+
+// the same model for one time, in double precision, the straightforward way
+// (what the batch is checked against):
+
+void
+EphemerisOne(double years, double* earthX, double* earthZ, double* earthQy, double* earthQw,
+	double* moonX, double* moonZ, double* moonQy, double* moonQw)
+{
+	// the batch takes the fractional part of each number of turns, so its quaternions always have qy >= 0.
+	// (q and -q are the same orientation) -- do the same here so they can be compared directly:
+
+	double earthOrbit = 2. * M_PI * (years * EPH_EARTH_ORBIT_TURNS - floor(years * EPH_EARTH_ORBIT_TURNS));
+	double earthOrient = 2. * M_PI * (years * EPH_EARTH_ORIENT_TURNS - floor(years * EPH_EARTH_ORIENT_TURNS));
+	double moonOrbit = 2. * M_PI * (years * EPH_MOON_ORBIT_TURNS - floor(years * EPH_MOON_ORBIT_TURNS));
+	double moonOrient = 2. * M_PI * (years * EPH_MOON_ORIENT_TURNS - floor(years * EPH_MOON_ORIENT_TURNS));
+
+	*earthX = EARTH_ORBITAL_RADIUS_MILES * cos(earthOrbit);
+	*earthZ = -EARTH_ORBITAL_RADIUS_MILES * sin(earthOrbit);
+	*earthQy = sin(earthOrient / 2.);
+	*earthQw = cos(earthOrient / 2.);
+	*moonX = *earthX + MOON_ORBITAL_RADIUS_MILES * cos(moonOrbit);
+	*moonZ = *earthZ - MOON_ORBITAL_RADIUS_MILES * sin(moonOrbit);
+	*moonQy = sin(moonOrient / 2.);
+	*moonQw = cos(moonOrient / 2.);
+}
@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <thread>
+#include <chrono>
+
+#include "ephemeris.cpp"
+
+//	Benchmark and check for the batch ephemeris (no opengl needed)
+//
+//	Build with the vector instructions turned on, e.g.:
+//		g++ -O3 -march=native ephemerisbench.cpp -o ephemerisbench -lpthread
+//	then run:
+//		./ephemerisbench [--samples N] [--reps N] [--threads N]
+//
+//	Prints samples/sec on one thread and on all threads, and the largest difference
+//	from the double-precision model over the same times
+
+
+double
+BenchSeconds()
+{
+	using namespace std::chrono;
+	return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+
+// best-of-reps samples/sec for a batch:
+
+double
+BenchBatch(const double* times, size_t n, const struct EphemerisSoA* out, int numThreads, int reps)
+{
+	double best = 1.e30;
+	for (int r = 0; r < reps; r++)
+	{
+		double t0 = BenchSeconds();
+		EphemerisBatch(times, n, out, numThreads);
+		double dt = BenchSeconds() - t0;
+		if (dt < best)
+			best = dt;
+	}
+	return (double)n / best;
+}
+
+
+int
+main(int argc, char* argv[])
+{
+	size_t n = 16 * 1024 * 1024;
+	int reps = 5;
+	int numThreads = (int)std::thread::hardware_concurrency();
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc)
+			n = (size_t)atof(argv[++i]);
+		else if (strcmp(argv[i], "--reps") == 0 && i + 1 < argc)
+			reps = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+			numThreads = atoi(argv[++i]);
+		else
+		{
+			fprintf(stderr, "Usage: %s [--samples N] [--reps N] [--threads N]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (numThreads < 1)
+		numThreads = 1;
+
+#if defined(EPH_AVX2)
+	const char* kernel = "avx2+fma";
+#elif defined(EPH_NEON)
+	const char* kernel = "neon";
+#else
+	const char* kernel = "scalar";
+#endif
+
+	// samples an hour apart -- plus a bit, so the tail gets used:
+	n += 3;
+	std::vector<double> times(n);
+	for (size_t i = 0; i < n; i++)
+		times[i] = (double)i / (365.25 * 24.);
+
+	std::vector<float> buffers(8 * n);
+	struct EphemerisSoA out = { &buffers[0*n], &buffers[1*n], &buffers[2*n], &buffers[3*n],
+		&buffers[4*n], &buffers[5*n], &buffers[6*n], &buffers[7*n] };
+
+	// touch the output once so page faults are not timed:
+	EphemerisBatch(&times[0], n, &out, numThreads);
+
+	double one = BenchBatch(&times[0], n, &out, 1, reps);
+	double all = BenchBatch(&times[0], n, &out, numThreads, reps);
+
+	// check against the double-precision model:
+	double maxPos = 0., maxQuat = 0.;
+	for (size_t i = 0; i < n; i += 97)
+	{
+		double e[8];
+		EphemerisOne(times[i], &e[0], &e[1], &e[2], &e[3], &e[4], &e[5], &e[6], &e[7]);
+		for (int a = 0; a < 8; a++)
+		{
+			double d = fabs(e[a] - (double)buffers[a*n + i]);
+			bool isQuat = (a % 4) >= 2;
+			if (isQuat && d > maxQuat)
+				maxQuat = d;
+			if (!isQuat && d > maxPos)
+				maxPos = d;
+		}
+	}
+
+	fprintf(stdout, "kernel:        %s, %d lanes\n", kernel, EPHLANES);
+	fprintf(stdout, "samples:       %zu (times 0 to %.1f years)\n", n, times[n-1]);
+	fprintf(stdout, "1 thread:      %.1f M samples/sec\n", one / 1.e6);
+	fprintf(stdout, "%d threads:%*s%.1f M samples/sec\n", numThreads, numThreads < 10 ? 5 : 4, "", all / 1.e6);
+	fprintf(stdout, "max error:     position %.2e miles, quaternion %.2e\n", maxPos, maxQuat);
+	return 0;
+}
@@ -1,7 +1,10 @@
 #include <stdio.h>
+#include <string.h>
 #include <string>
 #include <stdlib.h>
 #include <ctype.h>
+#include <atomic>
+#include <thread>
 #define GLM_FORCE_RADIANS
 #include "glm/vec2.hpp"
 #include "glm/vec3.hpp"
@@ -17,13 +20,37 @@
 #ifdef WIN32
 #include <windows.h>
 #pragma warning(disable:4996)
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #endif
 
 #include "glew.h"
 #include <GL/gl.h>
 #include <GL/glu.h>
 #include "glut.h"
+#include "renderstate.cpp"
 #include "osusphere.cpp"
+#include "headless.cpp"
+#include "texturecache.cpp"
+#include "simclock.cpp"
+#include "ephemeris.cpp"
+#include "scenegraph.cpp"
+#include "transforms.cpp"
+#include "culling.cpp"
+#include "depth.cpp"
+#include "skybox.cpp"
+#include "framering.cpp"
+#include "shading.cpp"
+#include "instancing.cpp"
+#include "framepipeline.cpp"
+#include "profiler.cpp"
+#include "framepacing.cpp"
+#include "capture.cpp"
+#include "golden.cpp"
+#include "raytrace.cpp"
 
 //	This is a sample OpenGL / GLUT program
 //
@@ -43,16 +70,10 @@
 //
 //	Author:			Jeff Huang
 
-const float ONE_FULL_TURN = 2 * M_PI;					// base turn for one full turn
-const float DAYS_PER_MONTH = 27.3;						// Earth rotates ~27.3 times for each time the moon revolves around earth
-const float DAYS_PER_YEAR = 365.3;						// Earth rotates ~365 times for each time it revolves around sun
-const float MONTHS_PER_YEAR = DAYS_PER_YEAR / DAYS_PER_MONTH;	// Moon revolves around earth ~13 times for each time earth revolves around the sun
+// the orbital model (ONE_FULL_TURN, DAYS_PER_YEAR, MONTHS_PER_YEAR, the radii, ...) is in ephemeris.cpp
+
 int		WhichPOV;										// outside(top), sideways, earth, moon view
-const float SUN_RADIUS_MILES = 15.0;					// sun's radius (exaggerated to be smaller relative to earth and moon)
-const float EARTH_RADIUS_MILES = 2;						// earth's radius (accurate ratio with moon's radius)
-const float EARTH_ORBITAL_RADIUS_MILES = 45;			// earth's orbital radius (exaggerated to be smaller relative to moon's orbital radius)
-const float MOON_RADIUS_MILES = EARTH_RADIUS_MILES * 1079.6 / 3964.19;	// moon's radius (accurate ratio with moon's radius, moon radius is ~1/4 of earth radius)
-const float MOON_ORBITAL_RADIUS_MILES = 4;				// moon's orbital radius (exaggerated to be bigger relative to earth's orbital radius)
+int		QuadViewOn;										// != 0 means to draw all four views at once instead
 
 // number of times object moves per cycle
 const int NUM_BACK_AND_FORTH_PER_CYCLE = 1;
@@ -100,7 +121,8 @@ enum ViewVals
 	OUTSIDE,
 	SIDEWAYS,
 	EARTHVIEW,
-	MOONVIEW
+	MOONVIEW,
+	QUADVIEW		// (all four at once, in a 2x2 grid -- QuadViewOn, not a WhichPOV)
 };
 
 // initialize orbit lines as on
@@ -120,6 +142,21 @@ enum ButtonVals
 	QUIT
 };
 
+// the debug menu's entries past off (0) and on (1):
+enum DebugVals
+{
+	PROFILER = 2,
+	SAVETRACE
+};
+
+// what draws the frames:
+enum RendererVals
+{
+	RENDEROPENGL,
+	RENDERRAYTRACE,
+	RENDERSHADOWS		// (the ray tracer, with ShadowsOn)
+};
+
 // window background color (rgba):
 const GLfloat BACKCOLOR[] = { 0., 0., 0., 1. };
 
@@ -174,6 +211,38 @@ const GLfloat FOGDENSITY = 0.30f;
 const GLfloat FOGSTART = 1.5f;
 const GLfloat FOGEND = 4.f;
 
+// a bmp file memory-mapped by MapBmp( ):
+struct BmpMapping
+{
+	const unsigned char* base;		// start of the mapped file
+	size_t	length;					// # bytes mapped
+	const unsigned char* pixels;	// bgr, bottom-to-top, rows padded to 4 bytes
+	int		width, height;
+#ifdef WIN32
+	HANDLE	file, mapping;
+#endif
+};
+
+// a texture being read in the background at startup:
+//	a worker thread fills in the pixels and then sets 'decoded',
+//	the glut thread uploads them the next time it draws
+struct TextureLoad
+{
+	GLuint	tex;					// texture to put the image into
+	const char* filename;
+	GLubyte	placeholder[3];			// color shown until the image arrives
+	std::atomic<bool> decoded;		// set (last) by the worker when the fields below are ready
+	bool	uploaded;
+	struct BmpMapping bm;			// if the file could be memory-mapped
+	unsigned char* rgb;				// if it had to be read with BmpToTexture( ) instead
+	int		width, height;
+	bool	hashed;					// true if 'hash' and 'cachePath' are valid
+	unsigned long long hash;		// HashBytes( ) of the bmp file
+	char	cachePath[512];			// where its compressed version is cached
+	unsigned char* cached;			// the cache file, if there was one (then there are no pixels)
+	double	decodeMs;				// time spent on the worker
+};
+
 
 // what options should we compile-in?
 // in general, you don't need to worry about these
@@ -182,40 +251,94 @@ const GLfloat FOGEND = 4.f;
 //#define DEMO_Z_FIGHTING
 //#define DEMO_DEPTH_BUFFER
 
+// how close to an edge a pixel can be and still count in the depth check (--depth-check):
+const int DEPTHCHECKEDGE = 4;
+
+// when the depth check looks, in years, if not told (--start):
+// (not at 0, when the sun, earth, and moon are in a line, and the earth hides the sun from behind the moon)
+const double DEPTHCHECKYEARS = .3;
+
+// the points the jitter check (--jitter-check) watches: on the ground straight ahead of the eye, in body radii,
+// and how far (in pixels) they may wander from where they belong:
+const double JITTERDISTANCES[] = { .001, .01, .1 };
+const double JITTERMAXPIXELS = .25;
+
+// the golden-image check (--golden): the times each point of view is drawn at, in years, and the size of the pictures:
+const double GOLDENYEARS[] = { .137, .61, 2.25 };
+const int GOLDENSIZE = 256;
+
 
 // non-constant global variables:
 int		ActiveButton;			// current button that is down
-GLuint  moontex;
-GLuint  earthtex;
-GLuint  suntex;
-GLuint  starstex;
+const int MAXTEXTURES = 64;
+struct TextureLoad TextureLoads[MAXTEXTURES];	// one for each of the scene's textures (SceneTextures[ ])
+int		NumTextureLoads;
+std::atomic<int> NextTextureLoad;		// next entry in TextureLoads[ ] for a worker to take
+bool	TextureLoadsStarted;			// true once the workers have been launched
+bool	TexturesReady;					// true once every texture has been uploaded
+double	StartupSeconds;					// WallSeconds( ) when main( ) began
+bool	FirstFrameDrawn;
 GLuint	AxesList;				// list to hold the axes
 int		AxesOn;					// != 0 means to draw the axes
 int		DebugOn;				// != 0 means to print debugging info
 int		DepthCueOn;				// != 0 means to use intensity depth cueing
 int		DepthBufferOn;			// != 0 means to use the z-buffer
 int		DepthFightingOn;		// != 0 means to force the creation of z-fighting
+int		LodOn;					// != 0 means to pick sphere tessellation from the size on the screen
+int		InstancingOn;			// != 0 means to draw the bodies with instanced draw calls (if InstancingOK)
+bool	InstancingOK;			// true if InitInstancing( ) worked
+bool	InstTexturesStale = true;	// true if the instancing texture array needs to be rebuilt
+int		ShaderLightingOn;		// != 0 means to light the bodies per pixel with GLSL (if ShadingOK) instead of fixed-function
+bool	ShadingOK;				// true if InitShading( ) worked
+int		CullingOn;				// != 0 means to skip the bodies and orbits outside the view volume
+int		OcclusionOn;			// != 0 means to skip bodies hidden behind others (found with occlusion queries)
+int		SkyboxOn;				// != 0 means to draw the sky body as a cube map after everything else (if SkyboxOK)
+bool	SkyboxOK;				// true if InitSkybox( ) worked
+bool	SkyTexturesStale = true;	// true if the sky's cube map needs to be made again from its texture
 GLuint	BoxList;				// object display list
-GLuint	SunList;				// display list for sun
-GLuint	StarsList;				// display list for stars
-GLuint  MoonOrbitList;			// display list for moon orbit circle
-GLuint  EarthOrbitList;			// display list for earth's orbit circle
-GLuint  EarthList;				// display list for earth
-GLuint  MoonList;				// display list for moon
+GLuint	OrbitList;				// display list for an orbit circle of radius 1.
+int		EarthBody, MoonBody;	// the bodies the earth and moon views look from, -1 if the scene has none
 int		MainWindow;				// window id for main graphics window
 float	Scale;					// scaling factor
-int		ShadowsOn;				// != 0 means to turn shadows on
+int		CameraRelativeOn;		// != 0 means to draw relative to the eye (see RebaseScene( )) instead of the world's origin
+int		FramePipelineOn;		// != 0 means to work out the next frame on another thread while this one is drawn
+int		ShadowsOn;				// != 0 means to turn shadows on (only the ray tracer casts them)
+int		RayTraceOn;				// != 0 means to draw the frames by ray tracing on the cpu (raytrace.cpp) instead of with opengl
+std::vector<unsigned char>	RayTraceImage;	// the window's ray-traced picture
 int		WhichColor;				// index into Colors[ ]
 int		WhichProjection;		// ORTHO or PERSP
 int		Xmouse, Ymouse;			// mouse values
 float	Xrot, Yrot;				// rotation angles in degrees
-float	Time;					// timer in the range [0.,1.)
+float	Time;					// timer in the range [0.,1.) -- the fraction of the current year
+double	SimYears;				// simulation time to render, in years (earth orbits), from the sim clock
 bool	Light0On, Frozen; // checking if the lights should be turned on or if all objects should stop moving
+bool	Headless;				// true means render offscreen with no window (benchmark mode)
+bool	MappedBmpOn = true;		// true means upload 24-bit bmp files straight from a memory mapping
+bool	CompressedTexturesOn = true;	// true means mipmapped, block-compressed textures, cached on disk
+bool	RingPersistentOn = true;	// true means map the frame ring persistently, if this opengl can
+size_t	TextureBytesRaw;		// texture memory the bmp files would take uncompressed, without mipmaps
+size_t	TextureBytesUsed;		// texture memory they actually take
 
 
 // function prototypes:
 void	Animate();
+void	UpdateIdle();
+void	UpdateSimTime();
 void	Display();
+void	SetView();
+glm::mat4	ViewMatrix(struct BodyFrame*, int, float, float, float, bool);
+void	ComputeFrame(const struct FrameInputs*, struct FramePacket*);
+glm::dmat4	LookFromBody(struct BodyFrame*, int, glm::vec4, glm::vec4, glm::vec4, bool);
+glm::dmat4	LookAtWorld(struct BodyFrame*, const double[3], const double[3], const double[3], bool);
+int		PlaceBodyLights();
+void	DrawBody(int);
+void	DrawBodySphere(float);
+void	SetBodyState();
+void	DrawDebugOverlay();
+void	DrawFrameView(const struct FrameView*, bool, bool, int, GLuint[]);
+void	DrawProfileHud();
+void	RayTraceFrame(const struct FramePacket*, int, int, std::vector<unsigned char>*);
+void	RayTraceLoadTextures();
 void	DoAxesMenu(int);
 void	DoLightsMenu(int);
 void	DoColorMenu(int);
@@ -225,6 +348,7 @@ void	DoDepthBufferMenu(int);
 void	DoDepthFightingMenu(int);
 void	DoDepthMenu(int);
 void	DoDebugMenu(int);
+void	DoRendererMenu(int);
 void	DoMainMenu(int);
 void	DoProjectMenu(int);
 void	DoRasterString(float, float, float, char*);
@@ -233,11 +357,22 @@ float	ElapsedSeconds();
 void	InitGraphics();
 void	InitLists();
 void	InitMenus();
+void	InitScene(int, char*[]);
+void	InitTextures();
+void	StartTextureLoads();
+void	DecodeTextures();
+bool	UploadLoadedTextures();
+void	FinishTextureLoads();
+void	CreateTexture(GLuint*);
+double	StartupMs();
 void	Keyboard(unsigned char, int, int);
 void	MouseButton(int, int, int, int);
 void	MouseMotion(int, int);
 void	Reset();
 void	Resize(int, int);
+int		RunHeadless(int, char* []);
+bool	RunRayTrace(int, double, double, int, int);
+void	BenchTextureLoaders(int);
 void	Visibility(int);
 
 void			Axes(float);
@@ -247,6 +382,10 @@ void			SetPointLight(int, float, float, float, float, float, float);
 void			SetSpotLight(int, float, float, float, float, float, float, float, float, float);
 void			SetMaterial(float, float, float, float);
 unsigned char* BmpToTexture(char*, int*, int*);
+bool			MappedBmpToTexture(char*);
+bool			MapBmp(char*, struct BmpMapping*);
+void			UnmapBmp(struct BmpMapping*);
+void			InitTexture(GLuint*, char*);
 int				ReadInt(FILE*);
 short			ReadShort(FILE*);
 
@@ -259,6 +398,36 @@ float			Unit(float[3], float[3]);
 int
 main(int argc, char* argv[])
 {
+	StartupSeconds = WallSeconds();
+
+	// read the scene file first, since it says which textures to load:
+	InitScene(argc, argv);
+
+	// the headless benchmark never opens a window, so it must not start glut:
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--headless") == 0)
+			return RunHeadless(argc, argv);
+	}
+
+	// how the frames are paced:
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--pacing") == 0 && i + 1 < argc)
+		{
+			int m = PaceModeNamed(argv[++i]);
+			if (m >= 0)
+				PaceMode = m;
+			else
+				fprintf(stderr, "Don't know what pacing '%s' is\n", argv[i]);
+		}
+		else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc)
+			PaceTargetFps = atof(argv[++i]);
+	}
+
+	// start reading the texture files in the background while glut and opengl start up:
+	StartTextureLoads();
+
 	// turn on the glut package:
 	// (do this before checking argc and argv since it might
 	// pull some command line arguments out)
@@ -271,6 +440,9 @@ main(int argc, char* argv[])
 	// create the display structures that will not change:
 	InitLists();
 
+	// start the thread that works out the next frame while this one is drawn:
+	FramePipelineStart(ComputeFrame);
+
 	// init all the global variables used by Display( ):
 	// this will also post a redisplay
 	Reset();
@@ -278,9 +450,11 @@ main(int argc, char* argv[])
 	// setup all the user interface stuff:
 	InitMenus();
 
+	fprintf(stderr, "Startup: %6.1f ms  window, display lists, and menus ready\n", StartupMs());
+
 	// draw the scene once and wait for some interaction:
 	// (this will never return)
-	glutSetWindow(MainWindow);
+	RsSetWindow(MainWindow);
 	glutMainLoop();
 
 	// glutMainLoop( ) never actually returns
@@ -301,16 +475,35 @@ Animate()
 {
 	// put animation stuff in here -- change some global variables
 	// for Display( ) to find:
-	const int MS_IN_THE_ANIMATION_CYCLE = 700000;
-	int ms = glutGet(GLUT_ELAPSED_TIME);
-	ms %= MS_IN_THE_ANIMATION_CYCLE;
-	Time = ((float)ms / (float)MS_IN_THE_ANIMATION_CYCLE);
+	// (the sim clock runs in fixed steps, however often this gets called;
+	//  the frame pacing mode may have it wait for the next frame to be due first)
+	PaceWait();
+	ProfileBegin("animate", false);
+	SimClockTick(WallSeconds());
+	UpdateSimTime();
+	ProfileEnd();
 
 	// force a call to Display( ) next time it is convenient:
-	glutSetWindow(MainWindow);
+	RsSetWindow(MainWindow);
 	glutPostRedisplay();
 }
 
+// keep animating (and drawing) one frame after another, or only draw when something asks for it,
+// as the frame pacing mode says for whether the animation is frozen and the window is visible:
+void
+UpdateIdle()
+{
+	glutIdleFunc(PaceAnimating(Frozen) ? Animate : NULL);
+}
+
+// pick up the time to render from the sim clock:
+void
+UpdateSimTime()
+{
+	SimYears = SimClockYears();
+	Time = (float)(SimYears - floor(SimYears));
+}
+
 void
 LatLngToXYZ(float lat, float lng, float rad, glm::vec3* xyzp)
 {
@@ -335,138 +528,98 @@ SetViewingFromLatLng(float eyeLat, float eyeLng, float lookLat, float lookLng, f
 	*lookp = glm::vec4(eye + eyeToLook, 1.);
 }
 
-glm::mat4
-MakeEarthMatrix()
-{
-	float earthSpinAngle = Time * ONE_FULL_TURN * DAYS_PER_YEAR;
-	float earthOrbitAngle = Time * ONE_FULL_TURN;
-	glm::mat4 identity = glm::mat4(1.);
-	glm::vec3 yaxis = glm::vec3(0., 1., 0.);
-	glm::mat4 erorbity = glm::rotate(identity, earthOrbitAngle, yaxis);
-	glm::mat4 etransx = glm::translate(identity, glm::vec3(EARTH_ORBITAL_RADIUS_MILES, 0., 0.));/* 1. */ glm::mat4 erspiny = glm::rotate(identity, earthSpinAngle, yaxis);
-	return erorbity * etransx * erspiny;
-}
-
-glm::mat4 MakeMoonMatrix()
+// the view from near a body, with eye, look, and up relative to its center (and turned with it):
+glm::dmat4
+LookFromBody(struct BodyFrame* f, int body, glm::vec4 eyePos, glm::vec4 lookPos, glm::vec4 upVec, bool cameraRelative)
 {
-	float moonSpinAngle = Time * ONE_FULL_TURN * MONTHS_PER_YEAR;
-	float moonOrbitAngle = Time * ONE_FULL_TURN * MONTHS_PER_YEAR;
-	float earthOrbitAngle = Time * ONE_FULL_TURN;
-	glm::mat4 identity = glm::mat4(1.);
-	glm::vec3 yaxis = glm::vec3(0., 1., 0.);
-
-	glm::mat4 erorbity = glm::rotate(identity, earthOrbitAngle, yaxis);
-	glm::mat4 etransx = glm::translate(identity, glm::vec3(EARTH_ORBITAL_RADIUS_MILES, 0., 0.));
-	glm::mat4 mrorbity = glm::rotate(identity, moonOrbitAngle, yaxis);
-	glm::mat4 mtransx = glm::translate(identity, glm::vec3(MOON_ORBITAL_RADIUS_MILES, 0., 0.
-	));
-	glm::mat4 mrspiny = glm::rotate(identity, moonSpinAngle, yaxis);
-	return erorbity * etransx * mrorbity * mtransx * mrspiny;
+	double bx = body >= 0 ? f->frameX[body] : 0.;
+	double bz = body >= 0 ? f->frameZ[body] : 0.;
+	double eye[3] = { bx + eyePos.x, eyePos.y, bz + eyePos.z };
+	double look[3] = { bx + lookPos.x, lookPos.y, bz + lookPos.z };
+	double up[3] = { upVec.x, upVec.y, upVec.z };
+	return LookAtWorld(f, eye, look, up, cameraRelative);
 }
 
-// draw the complete scene:
-
-void
-Display()
+// the view from eye to look, both in world coordinates, like gluLookAt( ) makes:
+// (cameraRelative true moves the frame's origin to the eye first, so the view is only a turn,
+//  and what is near the eye is drawn with small numbers instead of ones the size of the earth's orbit)
+glm::dmat4
+LookAtWorld(struct BodyFrame* f, const double eye[3], const double look[3], const double up[3], bool cameraRelative)
 {
-	glm::mat4 moon = MakeMoonMatrix();
-	glm::mat4 earth = MakeEarthMatrix();
-
-	// set which window we want to do the graphics into:
-
-	glutSetWindow(MainWindow);
-
-
-	// erase the background:
-
-	glDrawBuffer(GL_BACK);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	glEnable(GL_DEPTH_TEST);
-
-	// specify shading to be flat:
-	glShadeModel(GL_FLAT);
-
-	// set the viewport to a square centered in the window:
-	GLsizei vx = glutGet(GLUT_WINDOW_WIDTH);
-	GLsizei vy = glutGet(GLUT_WINDOW_HEIGHT);
-	GLsizei v = vx < vy ? vx : vy;			// minimum dimension
-	GLint xl = (vx - v) / 2;
-	GLint yb = (vy - v) / 2;
-	glViewport(xl, yb, v, v);
-
-	if (AxesOn != 0)
+	glm::dvec3 u(up[0], up[1], up[2]);
+	if (cameraRelative)
 	{
-		glColor3fv(&Colors[WhichColor][0]);
-		glCallList(AxesList);
+		RebaseBodyFrame(f, eye[0], eye[1], eye[2]);
+		return glm::lookAt(glm::dvec3(0., 0., 0.), glm::dvec3(look[0] - eye[0], look[1] - eye[1], look[2] - eye[2]), u);
 	}
 
-	// set the viewing volume:
-	// remember that the Z clipping  values are actually
-	// given as DISTANCES IN FRONT OF THE EYE
-	// USE gluOrtho2D( ) IF YOU ARE DOING 2D !
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
-	gluPerspective(90., 1., 0.1, 1000.);
-
-
-	// place the objects into the scene:
-	glMatrixMode(GL_MODELVIEW);
-	glLoadIdentity();
+	// the way it used to be: everything in float world coordinates
+	RebaseBodyFrame(f, 0., 0., 0.);
+	return glm::lookAt(glm::dvec3((float)eye[0], (float)eye[1], (float)eye[2]),
+		glm::dvec3((float)look[0], (float)look[1], (float)look[2]), u);
+}
 
+// the view for a point of view, moving the frame's origin to where it needs to be:
+// (no opengl calls, so the frame pipeline's worker can use it)
+glm::mat4
+ViewMatrix(struct BodyFrame* f, int pov, float xrot, float yrot, float scale, bool cameraRelative)
+{
 	glm::mat4 e;
+	glm::dmat4 view = glm::dmat4(1.);
 	glm::vec4 eyePos = glm::vec4(0., 0., 0., 1.);
 	glm::vec4 lookPos = glm::vec4(0., 0., 0., 1.);
 	glm::vec4 upVec = glm::vec4(0., 0., 0., 0.); // vectors dont get translations
-	glMatrixMode(GL_MODELVIEW);
-	glLoadIdentity();
-	
-	if (WhichPOV == OUTSIDE)
+
+	if (pov == OUTSIDE)
 	{
+		// (the outside views are the whole scene, looked at from its own origin)
+		RebaseBodyFrame(f, 0., 0., 0.);
+
 		// set the eye position, look-at position, and up-vector:
-		gluLookAt(0., 60.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f);
+		view = glm::lookAt(glm::dvec3(0., 60., 0.), glm::dvec3(0., 0., 0.), glm::dvec3(1., 0., 0.));
 		//gluLookAt(3.3f, 0.f, 80.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f);
 		//gluLookAt((3.3f), (sin(Time) * (ONE_FULL_TURN)), 80.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f);
 
 		// rotate the scene:
-		glRotatef((GLfloat)Yrot, 0.f, 1.f, 0.f);
-		glRotatef((GLfloat)Xrot, 1.f, 0.f, 0.f);
+		view = glm::rotate(view, glm::radians((double)yrot), glm::dvec3(0., 1., 0.));
+		view = glm::rotate(view, glm::radians((double)xrot), glm::dvec3(1., 0., 0.));
 
 		// uniformly scale the scene:
-		if (Scale < MINSCALE)
-			Scale = MINSCALE;
-		glScalef((GLfloat)Scale, (GLfloat)Scale, (GLfloat)Scale);
+		view = glm::scale(view, glm::dvec3(scale, scale, scale));
 
 	}
 
-	else if (WhichPOV == SIDEWAYS)
+	else if (pov == SIDEWAYS)
 	{
+		RebaseBodyFrame(f, 0., 0., 0.);
 
 		// set the eye position, look-at position, and up-vector:
 		//gluLookAt(0., 60.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f);
-		 gluLookAt(3.3f, 0.f, 70.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f);
+		view = glm::lookAt(glm::dvec3(3.3, 0., 70.), glm::dvec3(0., 0., 0.), glm::dvec3(0., 1., 0.));
 		//gluLookAt((3.3f), (sin(Time) * (ONE_FULL_TURN)), 80.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f);
 
 		// rotate the scene:
-		glRotatef((GLfloat)Yrot, 0.f, 1.f, 0.f);
-		glRotatef((GLfloat)Xrot, 1.f, 0.f, 0.f);
+		view = glm::rotate(view, glm::radians((double)yrot), glm::dvec3(0., 1., 0.));
+		view = glm::rotate(view, glm::radians((double)xrot), glm::dvec3(1., 0., 0.));
 
 		// uniformly scale the scene:
-		if (Scale < MINSCALE)
-			Scale = MINSCALE;
-		glScalef((GLfloat)Scale, (GLfloat)Scale, (GLfloat)Scale);
+		view = glm::scale(view, glm::dvec3(scale, scale, scale));
 
 	}
 
-	else if (WhichPOV == EARTHVIEW) {
-		e = MakeEarthMatrix();
+	else if (pov == EARTHVIEW) {
+		// (the earth's turn -- its place is added in double by LookFromBody( ))
+		e = EarthBody >= 0 ? f->world[EarthBody] : glm::mat4(1.);
+		e[3] = glm::vec4(0., 0., 0., 1.);
+		float radius = EarthBody >= 0 ? Bodies.radius[EarthBody] : EARTH_RADIUS_MILES;
 		//SetViewingFromLatLng(0., 0., 0., -10., EARTH_RADIUS_MILES, &eye, &look);
 
 		// set eye position somewhere on the earth's equator
-		eyePos.x = EARTH_RADIUS_MILES;
+		eyePos.x = radius;
 		eyePos = e * eyePos;
 
 		// set look direction to be tangent across earth's surface
-		lookPos.x = EARTH_RADIUS_MILES;
+		lookPos.x = radius;
 		lookPos.z = -1000.;
 		lookPos = e * lookPos;
 
@@ -477,19 +630,20 @@ Display()
 		//upVec.z = 1000.;
 		upVec = e * upVec;
 
-		gluLookAt(eyePos.x, eyePos.y, eyePos.z, lookPos.x, lookPos.y, lookPos.z,
-			upVec.x, upVec.y, upVec.z);
+		view = LookFromBody(f, EarthBody, eyePos, lookPos, upVec, cameraRelative);
 	}
 
-	else if (WhichPOV == MOONVIEW) {
-		e = MakeMoonMatrix();
+	else if (pov == MOONVIEW) {
+		e = MoonBody >= 0 ? f->world[MoonBody] : glm::mat4(1.);
+		e[3] = glm::vec4(0., 0., 0., 1.);
+		float radius = MoonBody >= 0 ? Bodies.radius[MoonBody] : MOON_RADIUS_MILES;
 
 		// set eye position somewhere on the moon's equator
-		eyePos.x = MOON_RADIUS_MILES;
+		eyePos.x = radius;
 		eyePos = e * eyePos;
 
 		// set look direction to be tangent across moon's surface
-		lookPos.x = MOON_RADIUS_MILES;
+		lookPos.x = radius;
 		lookPos.z = -1000.;
 		lookPos = e * lookPos;
 
@@ -499,832 +653,2857 @@ Display()
 		//upVec.z = 1000.;
 		upVec = e * upVec;
 
-		gluLookAt(eyePos.x, eyePos.y, eyePos.z, lookPos.x, lookPos.y, lookPos.z,
-			upVec.x, upVec.y, upVec.z);
-	}
-
-	// turn orbital path lines on or off
-	if (ORBIT_LINES_ON == 1){
-		glPushMatrix();
-		glCallList(EarthOrbitList);
-		glPopMatrix();
-
-		glPushMatrix();
-		glMultMatrixf(glm::value_ptr(earth));
-		glCallList(MoonOrbitList);
-		glPopMatrix();
+		view = LookFromBody(f, MoonBody, eyePos, lookPos, upVec, cameraRelative);
 	}
 
-	glEnable(GL_NORMALIZE);
-
-	// create sun light
-	glPushMatrix();
-	glCallList(SunList);
-	glPopMatrix();
-
-	// checking if the sun light is on
-	if (Light0On)
-		glEnable(GL_LIGHT0);
-	else
-		glDisable(GL_LIGHT0);
-
-	// create sphere around the whole scene textured with stars (milky way) pattern
-	glPushMatrix();
-	glCallList(StarsList);
-	glPopMatrix();
-	
-	glEnable(GL_LIGHTING);	// enable lighting
-
-	// creating the objects/spheres
-	// draw earth
-	glPushMatrix();
-	glMultMatrixf(glm::value_ptr(earth));
-	glCallList(EarthList);
-	glPopMatrix();
-
-	// draw moon
-	glPushMatrix();
-	glMultMatrixf(glm::value_ptr(moon));
-	glCallList(MoonList);
-	glPopMatrix();
-
-	glDisable(GL_LIGHTING);
-
-	// swap the double-buffered framebuffers:
-	glutSwapBuffers();
-
-	// be sure the graphics buffer has been sent:
-	// note: be sure to use glFlush( ) here, not glFinish( ) !
-	glFlush();
-}
-
-void DoAxesMenu(int id)
-{
-	AxesOn = id;
-
-	glutSetWindow(MainWindow);
-	glutPostRedisplay();
+	return glm::mat4(view);
 }
 
-// menu for setting the views (earthview, moonview, outside(top), sideview)
+// multiply in the view for WhichPOV, for the bodies being drawn (the modelview matrix should be the identity):
 void
-DoViewMenu(int id)
+SetView()
 {
-	WhichPOV = id;
-	Reset();
-	glutSetWindow(MainWindow);
-	glutPostRedisplay();
+	if (Scale < MINSCALE)
+		Scale = MINSCALE;
+	glm::mat4 view = ViewMatrix(&Bodies, WhichPOV, Xrot, Yrot, Scale, CameraRelativeOn != 0);
+	glMultMatrixf(glm::value_ptr(view));
 }
 
-// menu for turning orbit lines on and off
+// work out everything about a frame that does not need opengl -- where the bodies are, the view, the projection,
+// and what is worth drawing -- into a frame packet:
+// (the frame pipeline's worker thread calls this, so it only reads its inputs and the scene's own arrays)
 void
-DoOrbitLinesMenu(int id)
+ComputeFrame(const struct FrameInputs* in, struct FramePacket* p)
 {
-	ORBIT_LINES_ON = id;
+	double t0 = WallSeconds();
+	UpdateBodyFrame(&p->bodies, in->years);		// (once, for every view)
+	p->numViews = in->quad ? FRAMEMAXVIEWS : 1;
+	for (int k = 0; k < p->numViews; k++)
+	{
+		struct FrameView* v = &p->views[k];
+		v->pov = in->quad ? OUTSIDE + k : in->pov;
+		glm::mat4 view = ViewMatrix(&p->bodies, v->pov, in->xrot, in->yrot, in->scale, in->cameraRelative);
+		memcpy(v->view, glm::value_ptr(view), sizeof(v->view));
+		v->cull.origin[0] = p->bodies.originX;
+		v->cull.origin[1] = p->bodies.originY;
+		v->cull.origin[2] = p->bodies.originZ;
+
+		// bring the far plane in to just past the farthest body or orbit
+		// (without the sky sphere, that is a lot closer, and the depth buffer gets all of its precision back):
+		// (reversed-Z has no far plane at all)
+		float farDistance = SceneFarDistance(&p->bodies, v->view, in->skipSky);
+		DepthProjectionMatrix(in->depthMode, 90., 1., 0.1, farDistance > 1.f ? farDistance : 1000., v->projection);
+		CullPlanesFrom(v->projection, v->view, v->cull.planes);
+	}
+	double t1 = WallSeconds();
+
+	// all of the views culled in one pass, then each one's levels of detail, from its own eye:
+	struct CullView* culls[FRAMEMAXVIEWS];
+	for (int k = 0; k < p->numViews; k++)
+		culls[k] = &p->views[k].cull;
+	if (in->frustum)
+		FrustumCullViews(&p->bodies, p->numViews, culls);
+	for (int k = 0; k < p->numViews; k++)
+	{
+		struct FrameView* v = &p->views[k];
+		if (!in->frustum)
+			v->cull.inView.assign(p->bodies.world.size(), 1);
+		RebaseBodyFrame(&p->bodies, v->cull.origin[0], v->cull.origin[1], v->cull.origin[2]);
+		PickBodyLods(&p->bodies, v->view, v->projection, in->viewportSize, in->lod,
+			v->cull.inView.empty() ? NULL : &v->cull.inView[0], &v->lods);
+	}
+	double t2 = WallSeconds();
 
-	glutSetWindow(MainWindow);
-	glutPostRedisplay();
+	p->moveMs = 1000. * (t1 - t0);
+	p->cullMs = 1000. * (t2 - t1);
 }
 
-// menu for freezing animation
+// what this frame is to be worked out from, out of the globals:
 void
-DoFreezeMenu(int id)
+GetFrameInputs(bool skipSky, int viewportSize, struct FrameInputs* in)
 {
-	Frozen = id;
-	if (Frozen)
-		glutIdleFunc(NULL);
-	else
-		glutIdleFunc(Animate);
-	glutSetWindow(MainWindow);
-	glutPostRedisplay();
+	if (Scale < MINSCALE)
+		Scale = MINSCALE;
+	in->scene = SceneSerial;
+	in->years = SimYears;
+	in->pov = WhichPOV;
+	in->quad = QuadViewOn != 0;
+	in->xrot = Xrot;
+	in->yrot = Yrot;
+	in->scale = Scale;
+	in->cameraRelative = CameraRelativeOn != 0;
+	in->depthMode = DepthMode;
+	in->frustum = CullingOn != 0;
+	in->lod = LodOn != 0;
+	in->skipSky = skipSky;
+	in->viewportSize = viewportSize;
 }
 
-// menu for turning lights on and off
-void
-DoLightsMenu(int id)
+// the side of each view's square with the quad view, in a window this size:
+GLsizei
+QuadViewportSize(GLsizei vx, GLsizei vy)
 {
-	Light0On = id;
-
-	glutSetWindow(MainWindow);
-	glutPostRedisplay();
+	return vx / 2 < vy / 2 ? vx / 2 : vy / 2;
 }
 
+// view k's square (x, y, width, height), centered in its quarter of the window
+// (outside and sideways along the top, earth and moon along the bottom):
 void
-DoColorMenu(int id)
+QuadViewportRect(GLsizei vx, GLsizei vy, int k, GLint rect[4])
 {
-	WhichColor = id - RED;
-
-	glutSetWindow(MainWindow);
-	glutPostRedisplay();
+	GLsizei q = QuadViewportSize(vx, vy);
+	GLint cx = (k % 2) * (vx / 2);
+	GLint cy = (1 - k / 2) * (vy / 2);
+	rect[0] = cx + (vx / 2 - q) / 2;
+	rect[1] = cy + (vy / 2 - q) / 2;
+	rect[2] = rect[3] = q;
 }
 
+// set the viewport to view k's square:
 void
-DoDebugMenu(int id)
+QuadViewport(GLsizei vx, GLsizei vy, int k)
 {
-	DebugOn = id;
-
-	glutSetWindow(MainWindow);
-	glutPostRedisplay();
+	GLint rect[4];
+	QuadViewportRect(vx, vy, k, rect);
+	glViewport(rect[0], rect[1], rect[2], rect[3]);
 }
 
 
-void
-DoDepthBufferMenu(int id)
-{
-	DepthBufferOn = id;
-
-	glutSetWindow(MainWindow);
-	glutPostRedisplay();
-}
-
+// draw the complete scene:
 
 void
-DoDepthFightingMenu(int id)
+Display()
 {
-	DepthFightingOn = id;
-
-	glutSetWindow(MainWindow);
-	glutPostRedisplay();
-}
+	ProfileFrameBegin();
+	RsFrameBegin();
+	CullFrameBegin();
 
+	// room in the frame ring for each view's lighting block and every body's instance data:
+	int numViews = QuadViewOn ? FRAMEMAXVIEWS : 1;
+	RingFrameBegin(numViews * (RingAligned(sizeof(struct ShadingFrame)) + RingAligned(Bodies.count * sizeof(struct BodyInstance))));
 
-void
-DoDepthMenu(int id)
-{
-	DepthCueOn = id;
+	SphVerticesDrawn = 0;
 
-	glutSetWindow(MainWindow);
-	glutPostRedisplay();
-}
-
-// main menu callback:
-void
-DoMainMenu(int id)
-{
-	switch (id)
+	// bring in any textures that have finished loading since the last frame:
+	if (!TexturesReady)
 	{
-	case RESET:
-		Reset();
-		break;
-
-	case QUIT:
-		// gracefully close out the graphics:
-		// gracefully close the graphics window:
-		// gracefully exit the program:
-		glutSetWindow(MainWindow);
-		glFinish();
-		glutDestroyWindow(MainWindow);
-		exit(0);
-		break;
+		TexturesReady = UploadLoadedTextures();
+		InstTexturesStale = true;
+		SkyTexturesStale = true;
+		if (!TexturesReady && !Headless)
+			glutPostRedisplay();		// come back even if the animation is frozen
+	}
 
-	default:
-		fprintf(stderr, "Don't know what to do with Main Menu ID %d\n", id);
+	// the sky body is drawn as a cube map, made from its texture once that is in:
+	int skyBody = SkyboxOn && SkyboxOK ? FindSkyBody() : -1;
+	if (skyBody >= 0 && SkyTexturesStale)
+	{
+		int t = Bodies.texture[skyBody];
+		BuildSkyCubeMap(t >= 0 && t < NumTextureLoads ? TextureLoads[t].tex : 0);
+		RsInvalidate();		// (it bound textures behind the state cache's back)
+		SkyTexturesStale = false;
 	}
 
-	glutSetWindow(MainWindow);
-	glutPostRedisplay();
-}
+	// set which window we want to do the graphics into:
+	// (in headless mode, the offscreen framebuffer is always bound)
 
+	ProfileBegin("clear", true);
+	if (!Headless)
+	{
+		RsSetWindow(MainWindow);
+		glDrawBuffer(GL_BACK);
+		DepthTargetBind(glutGet(GLUT_WINDOW_WIDTH), glutGet(GLUT_WINDOW_HEIGHT));	// (offscreen, for reversed-Z)
+	}
 
-void
-DoProjectMenu(int id)
-{
-	WhichProjection = id;
 
-	glutSetWindow(MainWindow);
-	glutPostRedisplay();
-}
+	// erase the background:
 
+	DepthFrameBegin();
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	ProfileEnd();
+	RsEnable(GL_DEPTH_TEST);
 
-// use glut to display a string of characters using a raster font:
+	// specify shading to be flat:
+	RsShadeModel(GL_FLAT);
 
-void
-DoRasterString(float x, float y, float z, char* s)
-{
-	glRasterPos3f((GLfloat)x, (GLfloat)y, (GLfloat)z);
+	// set the viewport to a square centered in the window:
+	GLsizei vx = Headless ? HeadlessWidth : glutGet(GLUT_WINDOW_WIDTH);
+	GLsizei vy = Headless ? HeadlessHeight : glutGet(GLUT_WINDOW_HEIGHT);
+	GLsizei v = vx < vy ? vx : vy;			// minimum dimension
+	GLint xl = (vx - v) / 2;
+	GLint yb = (vy - v) / 2;
+	glViewport(xl, yb, v, v);
 
-	char c;			// one character to print
-	for (; (c = *s) != '\0'; s++)
+	if (AxesOn != 0)
 	{
-		glutBitmapCharacter(GLUT_BITMAP_TIMES_ROMAN_24, c);
+		UseUnlitShading(false);
+		glColor3fv(&Colors[WhichColor][0]);
+		glCallList(AxesList);
 	}
-}
-
 
-// use glut to display a string of characters using a stroke font:
+	// where everything is this frame, and what is worth drawing from here: worked out by the frame pipeline's
+	// worker while the last frame was being drawn, or right here with the pipeline off (see ComputeFrame( )):
+	ProfileBegin("matrices", false);
+	struct FrameInputs in;
+	GetFrameInputs(skyBody >= 0, QuadViewOn ? QuadViewportSize(vx, vy) : v, &in);
+	struct FramePacket* frame = FrameGet(&in, FramePipelineOn != 0);
+	InstallFramePacket(frame);
+	ProfileEnd();
+	double drawStart = WallSeconds();
+
+	// the textures every view draws with:
+	GLuint textures[MAXTEXTURES];
+	for (int i = 0; i < NumTextureLoads; i++)
+		textures[i] = TextureLoads[i].tex;
+	if (InstancingOn && InstancingOK && InstTexturesStale)
+	{
+		BuildInstanceTextureArray(textures, NumTextureLoads);
+		InstTexturesStale = false;
+	}
 
-void
-DoStrokeString(float x, float y, float z, float ht, char* s)
-{
-	glPushMatrix();
-	glTranslatef((GLfloat)x, (GLfloat)y, (GLfloat)z);
-	float sf = ht / (119.05f + 33.33f);
-	glScalef((GLfloat)sf, (GLfloat)sf, (GLfloat)sf);
-	char c;			// one character to print
-	for (; (c = *s) != '\0'; s++)
+	// each view in its own viewport, from its own eye
+	// (occlusion queries need a draw call per body and one view, so not when the bodies are instanced
+	//  or there are four views, and their proxies do not write logarithmic depth):
+	bool occlusion = OcclusionOn != 0 && !(InstancingOn && InstancingOK) && DepthMode != DEPTHLOG && frame->numViews == 1;
+	if (RayTraceOn)
 	{
-		glutStrokeCharacter(GLUT_STROKE_ROMAN, c);
+		// or the whole window traced on the cpu, and only put up by opengl:
+		ProfileBegin("ray trace", false);
+		RayTraceFrame(frame, vx, vy, &RayTraceImage);
+		ProfileEnd();
+		ProfileBegin("draw pixels", true);
+		RsUseProgram(0);
+		RsDisable(GL_DEPTH_TEST);
+		RsDisable(GL_LIGHTING);
+		RsDisable(GL_TEXTURE_2D);
+		glWindowPos2i(0, 0);
+		glDrawPixels(vx, vy, GL_RGBA, GL_UNSIGNED_BYTE, &RayTraceImage[0]);
+		ProfileEnd();
 	}
-	glPopMatrix();
-}
+	else
+	{
+		for (int k = 0; k < frame->numViews; k++)
+		{
+			if (frame->numViews > 1)
+				QuadViewport(vx, vy, k);
+			InstallFrameView(frame, k);
+			DrawFrameView(&frame->views[k], frame->in.frustum, occlusion, skyBody, textures);
+		}
+	}
+	if (frame->numViews > 1)
+		glViewport(xl, yb, v, v);
 
+	if ((DebugOn != 0 || ProfileOn != 0) && !Headless)
+	{
+		ProfileBegin("hud", true);
+		DrawDebugOverlay();
+		ProfileEnd();
+	}
+	CullFrameEnd();
+	RingFrameEnd();
 
-// return the number of seconds since the start of the program:
+	// swap the double-buffered framebuffers:
+	if (!Headless)
+	{
+		ProfileBegin("swap", true);
+		DepthTargetPresent();
+		glutSwapBuffers();
+		ProfileEnd();
+	}
 
-float
-ElapsedSeconds()
-{
-	// get # of milliseconds since the start of the program:
-	int ms = glutGet(GLUT_ELAPSED_TIME);
+	if (!FirstFrameDrawn)
+	{
+		FirstFrameDrawn = true;
+		fprintf(stderr, "Startup: %6.1f ms  first frame drawn\n", StartupMs());
+	}
 
-	// convert it to seconds:
-	return (float)ms / 1000.f;
-}
+	// be sure the graphics buffer has been sent:
+	// note: be sure to use glFlush( ) here, not glFinish( ) !
+	glFlush();
 
+	FrameTotal.drawMs += 1000. * (WallSeconds() - drawStart);
+	FrameTotal.frames++;
+	ProfileFrameEnd();
+	PaceFrameDone();
 
-// initialize the glui window:
+	// with the pipeline on, what was drawn can be a frame behind -- come back for the one that is up to date:
+	if (!Headless && !FrameInputsSame(&frame->in, &in))
+		glutPostRedisplay();
+}
 
+// draw one view of a frame, into the current viewport, with the bodies already where the view wants them
+// (see InstallFrameView( )):
+//	frustum and occlusion say which culling to do, skyBody is the sky body drawn as a cube map (or -1),
+//	and textures[ ] are the scene's textures
 void
-InitMenus()
+DrawFrameView(const struct FrameView* view, bool frustum, bool occlusion, int skyBody, GLuint textures[])
 {
-	glutSetWindow(MainWindow);
+	// set the viewing volume:
+	// remember that the Z clipping  values are actually
+	// given as DISTANCES IN FRONT OF THE EYE
+	// USE gluOrtho2D( ) IF YOU ARE DOING 2D !
+	glMatrixMode(GL_PROJECTION);
+	glLoadMatrixf(view->projection);
 
-	// viewing options
-	int viewmenu = glutCreateMenu(DoViewMenu);
-	glutAddMenuEntry("Outside (Top)", OUTSIDE);
-	glutAddMenuEntry("Sideways", SIDEWAYS);
-	glutAddMenuEntry("Earthview", EARTHVIEW);
-	glutAddMenuEntry("Moonview", MOONVIEW);
+	// place the objects into the scene:
+	glMatrixMode(GL_MODELVIEW);
+	glLoadMatrixf(view->view);
 
-	int numColors = sizeof(Colors) / (3 * sizeof(int));
-	int colormenu = glutCreateMenu(DoColorMenu);
-	for (int i = 0; i < numColors; i++)
+	// decide what is worth drawing from here:
+	ProfileBegin("culling", true);
+	CullBodies(frustum, occlusion, view->cull.planes, view->cull.inView.empty() ? NULL : &view->cull.inView[0]);
+	ProfileEnd();
+
+	// turn orbital path lines on or off
+	if (ORBIT_LINES_ON == 1)
 	{
-		glutAddMenuEntry(ColorNames[i], i);
+		ProfileBegin("orbits", true);
+		UseUnlitShading(false);
+		for (int i = 0; i < Bodies.count; i++)
+		{
+			if (Bodies.orbitRadius[i] <= 0.f || (Bodies.flags[i] & BODYNOORBIT) != 0)
+				continue;
+			if (!OrbitInView(i))
+				continue;
+			float r = Bodies.orbitRadius[i];
+			glPushMatrix();
+			glMultMatrixf(glm::value_ptr(BodyFrameMatrix(Bodies.parent[i])));
+			glScalef(r, r, r);
+			glCallList(OrbitList);
+			glPopMatrix();
+		}
+		ProfileEnd();
 	}
 
-	int axesmenu = glutCreateMenu(DoAxesMenu);
-	glutAddMenuEntry("On", 1);
-	glutAddMenuEntry("Off", 0);
-
-	int orbit_lines_menu = glutCreateMenu(DoOrbitLinesMenu);
-	glutAddMenuEntry("On", 1);
-	glutAddMenuEntry("Off", 0);
-
-	int freezemenu = glutCreateMenu(DoFreezeMenu);
-	glutAddMenuEntry("Freeze Animation", 1);
-	glutAddMenuEntry("Turn Animation On", 0);
-	
-	int lightsmenu = glutCreateMenu(DoLightsMenu);
-	glutAddMenuEntry("On", 1);
-	glutAddMenuEntry("Off", 0);
-	
-	//int depthcuemenu = glutCreateMenu(DoDepthMenu);
-	//glutAddMenuEntry("Off", 0);
-	//glutAddMenuEntry("On", 1);
-
-	//int depthbuffermenu = glutCreateMenu(DoDepthBufferMenu);
-	//glutAddMenuEntry("Off", 0);
-	//glutAddMenuEntry("On", 1);
+	ProfileBegin("lights", false);
+	SetBodyState();
 
-	//int depthfightingmenu = glutCreateMenu(DoDepthFightingMenu);
-	//glutAddMenuEntry("Off", 0);
-	//glutAddMenuEntry("On", 1);
+	// put the lights where their bodies are -- as opengl lights, or in the per-pixel lighting's uniform block:
+	// (logarithmic depth needs the shaders)
+	bool perPixel = (ShaderLightingOn || DepthMode == DEPTHLOG) && ShadingOK;
+	int numLights;
+	if (perPixel)
+		numLights = UpdateShadingFrame(Light0On);
+	else
+	{
+		numLights = PlaceBodyLights();
 
-	int debugmenu = glutCreateMenu(DoDebugMenu);
-	glutAddMenuEntry("Off", 0);
-	glutAddMenuEntry("On", 1);
+		// checking if the sun light is on
+		for (int k = 0; k < numLights; k++)
+		{
+			if (Light0On)
+				RsEnable(GL_LIGHT0 + k);
+			else
+				RsDisable(GL_LIGHT0 + k);
+		}
+		if (!Light0On)
+			numLights = 0;
+	}
+	ProfileEnd();
 
-	//int projmenu = glutCreateMenu(DoProjectMenu);
-	//glutAddMenuEntry("Orthographic", ORTHO);
-	//glutAddMenuEntry("Perspective", PERSP);
+	// the unlit bodies first (the sun, and the sky if it is not a cube map):
+	ProfileBegin("unlit bodies", true);
+	UseUnlitShading(true);
+	for (int i = 0; i < Bodies.count; i++)
+	{
+		if ((Bodies.flags[i] & BODYUNLIT) == 0 || !BodyVisible[i] || i == skyBody)
+			continue;
+		bool sky = (Bodies.flags[i] & BODYSKY) != 0;
+		if (sky)
+			SkyBeginCount();
+		DrawBody(i);
+		if (sky)
+			SkyEndCount();
+	}
+	ProfileEnd();
 
-	int mainmenu = glutCreateMenu(DoMainMenu);
-	glutAddSubMenu("Views", viewmenu);
-	glutAddSubMenu("Light", lightsmenu);
-	glutAddSubMenu("Freeze Animation", freezemenu);
-	glutAddSubMenu("Orbit Lines", orbit_lines_menu);
-	//glutAddSubMenu("Axes", axesmenu);
-	//glutAddSubMenu("Axis Colors", colormenu);
+	// then the ones the lights shine on:
+	ProfileBegin("lit bodies", true);
+	if (!perPixel)
+	{
+		RsEnable(GL_LIGHTING);	// enable lighting
+		RsEnable(GL_NORMALIZE);	// (the spheres are unit meshes scaled by the modelview)
+	}
 
-#ifdef DEMO_DEPTH_BUFFER
-	glutAddSubMenu("Depth Buffer", depthbuffermenu);
-#endif
+	if (InstancingOn && InstancingOK)
+	{
+		// all of them in a few draw calls:
+		DrawBodiesInstanced(numLights, LodOn != 0, perPixel);
+	}
+	else if (perPixel)
+	{
+		DrawBodiesShaded(textures, NumTextureLoads, LodOn != 0);
+	}
+	else
+	{
+		for (int i = 0; i < Bodies.count; i++)
+		{
+			if ((Bodies.flags[i] & BODYUNLIT) == 0 && BodyVisible[i])
+			{
+				CullBeginQuery(i);
+				DrawBody(i);
+				CullEndQuery(i);
+			}
+		}
+	}
 
-#ifdef DEMO_Z_FIGHTING
-	glutAddSubMenu("Depth Fighting", depthfightingmenu);
-#endif
+	ProfileEnd();
 
-	//glutAddSubMenu("Depth Cue", depthcuemenu);
-	//glutAddSubMenu("Projection", projmenu);
-	glutAddMenuEntry("Reset", RESET);
-	glutAddSubMenu("Debug", debugmenu);
-	glutAddMenuEntry("Quit", QUIT);
+	// ask again about the bodies that were hidden:
+	ProfileBegin("occlusion", true);
+	DrawOcclusionProxies();
+	ProfileEnd();
 
-	// attach the pop-up menu to the right mouse button:
+	UnbindSphereMesh();
+	if (!perPixel)
+	{
+		RsDisable(GL_NORMALIZE);
+		RsDisable(GL_LIGHTING);
+	}
 
-	glutAttachMenu(GLUT_RIGHT_BUTTON);
+	// the sky last, only where nothing else was drawn:
+	if (skyBody >= 0)
+	{
+		ProfileBegin("sky", true);
+		DrawSkybox(skyBody);
+		ProfileEnd();
+	}
 }
 
 
-
-// initialize the glut and OpenGL libraries:
-//	also setup callback functions
+// trace each of a frame's views on the cpu into its viewport's place in a picture of the whole vx x vy window,
+// bottom row first (see raytrace.cpp):
+// (no opengl calls, so this works with no opengl context at all)
 void
-InitGraphics()
+RayTraceFrame(const struct FramePacket* frame, int vx, int vy, std::vector<unsigned char>* rgba)
 {
-	// request the display modes:
-	// ask for red-green-blue-alpha color, double-buffering, and z-buffering:
-
-	glutInitDisplayMode(GLUT_RGBA | GLUT_DOUBLE | GLUT_DEPTH);
+	if (RayTraceTextures.size() != SceneTextures.size())
+		RayTraceLoadTextures();
+	RayTraceStart(0);
+
+	// the background around the viewports:
+	rgba->resize(4 * (size_t)vx * vy);
+	unsigned char back[4];
+	for (int k = 0; k < 4; k++)
+		back[k] = (unsigned char)(BACKCOLOR[k] * 255.f + .5f);
+	for (size_t i = 0; i < rgba->size(); i += 4)
+		memcpy(&(*rgba)[i], back, 4);
+
+	for (int k = 0; k < frame->numViews; k++)
+	{
+		GLint rect[4];
+		if (frame->numViews > 1)
+			QuadViewportRect(vx, vy, k, rect);
+		else
+		{
+			rect[2] = rect[3] = vx < vy ? vx : vy;
+			rect[0] = (vx - rect[2]) / 2;
+			rect[1] = (vy - rect[3]) / 2;
+		}
+		RayTraceView(&frame->bodies, &frame->views[k], rect[2], rect[3], vx, Light0On, ShadowsOn != 0, BACKCOLOR,
+			&(*rgba)[4 * ((size_t)rect[1] * vx + rect[0])]);
+	}
+}
 
-	// set the initial window configuration:
 
-	glutInitWindowPosition(0, 0);
-	glutInitWindowSize(INIT_WINDOW_SIZE, INIT_WINDOW_SIZE);
+// put an opengl light at the center of each body that is a light, in order, starting at GL_LIGHT0:
+// returns how many lights were used
+int
+PlaceBodyLights()
+{
+	int numLights = 0;
+	for (int i = 0; i < Bodies.count && numLights < MAXSCENELIGHTS; i++)
+	{
+		if ((Bodies.flags[i] & BODYLIGHT) == 0)
+			continue;
+		glPushMatrix();
+		glMultMatrixf(glm::value_ptr(Bodies.world[i]));
+		SetPointLight(GL_LIGHT0 + numLights, 0., 0., 0., 1., 1., 1.);
+		glPopMatrix();
+		numLights++;
+	}
+	return numLights;
+}
 
-	// open the window and set its title:
 
-	MainWindow = glutCreateWindow(WINDOWTITLE);
-	glutSetWindowTitle(WINDOWTITLE);
+// draw one body of the scene, with its texture, at its place in the world:
+void
+DrawBody(int body)
+{
+	glPushMatrix();
+	glMultMatrixf(glm::value_ptr(Bodies.world[body]));
 
-	// set the framebuffer clear values:
+	int t = Bodies.texture[body];
+	RsBindTexture(GL_TEXTURE_2D, t >= 0 && t < NumTextureLoads ? TextureLoads[t].tex : 0);
+	DrawBodySphere(Bodies.radius[body]);
+	glPopMatrix();
+}
 
-	glClearColor(BACKCOLOR[0], BACKCOLOR[1], BACKCOLOR[2], BACKCOLOR[3]);
 
-	// setup the callback functions:
-	// DisplayFunc -- redraw the window
-	// ReshapeFunc -- handle the user resizing the window
-	// KeyboardFunc -- handle a keyboard input
-	// MouseFunc -- handle the mouse button going down or up
-	// MotionFunc -- handle the mouse moving with a button down
-	// PassiveMotionFunc -- handle the mouse moving with a button up
-	// VisibilityFunc -- handle a change in window visibility
-	// EntryFunc	-- handle the cursor entering or leaving the window
-	// SpecialFunc -- handle special keys on the keyboard
-	// SpaceballMotionFunc -- handle spaceball translation
-	// SpaceballRotateFunc -- handle spaceball rotation
-	// SpaceballButtonFunc -- handle spaceball button hits
-	// ButtonBoxFunc -- handle button box hits
-	// DialsFunc -- handle dial rotations
-	// TabletMotionFunc -- handle digitizing tablet motion
-	// TabletButtonFunc -- handle digitizing tablet button hits
-	// MenuStateFunc -- declare when a pop-up menu is in use
-	// TimerFunc -- trigger something to happen a certain time from now
-	// IdleFunc -- what to do when nothing else is going on
+// the state every body is drawn with -- each body binds its own texture after this:
+// (through the state cache, so after the first frame this costs no opengl calls at all)
+void
+SetBodyState()
+{
+	RsShadeModel(GL_SMOOTH);
+	SetMaterial(1., 1., 1., 50.);
+	RsEnable(GL_TEXTURE_2D);
+	RsTexEnvMode(GL_MODULATE);
+	glColor3f(1., 1., 1.);
+}
 
-	glutSetWindow(MainWindow);
-	glutDisplayFunc(Display);
-	glutReshapeFunc(Resize);
-	glutKeyboardFunc(Keyboard);
-	glutMouseFunc(MouseButton);
-	glutMotionFunc(MouseMotion);
-	glutPassiveMotionFunc(MouseMotion);
-	glutVisibilityFunc(Visibility);
-	glutEntryFunc(NULL);
-	glutSpecialFunc(NULL);
-	glutSpaceballMotionFunc(NULL);
-	glutSpaceballRotateFunc(NULL);
-	glutSpaceballButtonFunc(NULL);
-	glutButtonBoxFunc(NULL);
-	glutDialsFunc(NULL);
-	glutTabletMotionFunc(NULL);
-	glutTabletButtonFunc(NULL);
-	glutMenuStateFunc(NULL);
-	glutTimerFunc(-1, NULL, 0);
-	glutIdleFunc(Animate);
 
-	// moon texture settings
-	glGenTextures(1, &moontex);
-	int width = 2, height = 2;
-	unsigned char* t32 = BmpToTexture("moon.bmp", &width, &height);
-	glBindTexture(GL_TEXTURE_2D, moontex);
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
-	glTexImage2D(GL_TEXTURE_2D, 0, 3, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, t32);
+// print the state cache's counts for the last frame in the corner of the window,
+// and the profiler's hud under them:
+// (when they are turned on from the debug menu)
+void
+DrawDebugOverlay()
+{
+	RsDisable(GL_DEPTH_TEST);
+	RsDisable(GL_TEXTURE_2D);
+	RsUseProgram(0);
+	glMatrixMode(GL_PROJECTION);
+	glLoadIdentity();
+	gluOrtho2D(0., 100., 0., 100.);
+	glMatrixMode(GL_MODELVIEW);
+	glLoadIdentity();
+	glColor3f(1., 1., 1.);
 
-	// earth texture settings
-	glGenTextures(1, &earthtex);
-	width = 2, height = 2;
-	t32 = BmpToTexture("earth.bmp", &width, &height);
-	glBindTexture(GL_TEXTURE_2D, earthtex);
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
-	glTexImage2D(GL_TEXTURE_2D, 0, 3, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, t32);
+	if (ProfileOn != 0)
+		DrawProfileHud();
+	if (DebugOn == 0)
+		return;
 
-	// sun texture settings
-	glGenTextures(1, &starstex);
-	width = 2, height = 2;
-	t32 = BmpToTexture("stars.bmp", &width, &height);
-	glBindTexture(GL_TEXTURE_2D, starstex);
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
-	glTexImage2D(GL_TEXTURE_2D, 0, 3, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, t32);
+	char line[128];
+	snprintf(line, sizeof(line), "GL state calls: %ld issued, %ld skipped", RsLastFrame.issued, RsLastFrame.skipped);
+	DoRasterString(2., 95., 0., line);
+	snprintf(line, sizeof(line), "Sphere vertices: %d", SphVerticesDrawn);
+	DoRasterString(2., 90., 0., line);
+	snprintf(line, sizeof(line), "Bodies: %ld drawn, %ld outside the view, %ld hidden", CullFrame.bodiesDrawn,
+		CullFrame.bodiesOutside, CullFrame.bodiesOccluded);
+	DoRasterString(2., 85., 0., line);
+	snprintf(line, sizeof(line), "Orbits: %ld drawn, %ld outside the view", CullFrame.orbitsDrawn, CullFrame.orbitsOutside);
+	DoRasterString(2., 80., 0., line);
+	snprintf(line, sizeof(line), "Pacing: %s%s, %.1f fps, cpu %.0f%%, jitter %.2f ms, %ld late", PACEMODENAMES[PaceMode],
+		PaceMode == PACEUNCAPPED ? "" : PaceVsynced() ? " (vsync)" : " (sleeping)", PaceLast.fps, PaceLast.cpuPercent,
+		PaceLast.jitterMs, PaceLast.late);
+	DoRasterString(2., 75., 0., line);
+}
 
-	// sun texture settings
-	glGenTextures(1, &suntex);
-	width = 2, height = 2;
-	t32 = BmpToTexture("sun.bmp", &width, &height);
-	glBindTexture(GL_TEXTURE_2D, suntex);
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
-	glTexImage2D(GL_TEXTURE_2D, 0, 3, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, t32);
 
-	// init glew (a window must be open to do this):
+// the profiler's hud: each stage's cpu and gpu milliseconds, and a graph of the last frames' times
+// (the time from frame to frame in white, the cpu time in the frame in green, the gpu time in orange,
+//  against lines at 60 and 30 fps):
+void
+DrawProfileHud()
+{
+	char line[128];
+	double interval = 0.;
+	int n = 0;
+	for (int k = 0; k < 30; k++)
+	{
+		float ms = ProfileHistoryMs(k, 0);
+		if (ms > 0.f)
+		{
+			interval += ms;
+			n++;
+		}
+	}
+	interval = n > 0 ? interval / (double)n : 0.;
+	snprintf(line, sizeof(line), "Frame: %.2f ms (%.1f fps)%s", interval, interval > 0. ? 1000. / interval : 0.,
+		ProfileGpuOK ? "" : "   (no gpu timers)");
+	DoRasterString(2., 70., 0., line);
 
-#ifdef WIN32
-	GLenum err = glewInit();
-	if (err != GLEW_OK)
+	float y = 65.;
+	for (int z = 0; z < ProfileNumZones && y > 1.; z++, y -= 4.)
 	{
-		fprintf(stderr, "glewInit Error\n");
+		const struct ProfileZone* zone = &ProfileZones[z];
+		if (ProfileGpuOK && !zone->between)
+			snprintf(line, sizeof(line), "%-14s cpu %6.3f  gpu %6.3f ms", zone->name, zone->cpuAvg, zone->gpuAvg);
+		else
+			snprintf(line, sizeof(line), "%-14s cpu %6.3f ms", zone->name, zone->cpuAvg);
+		DoRasterString(2., y, 0., line);
 	}
-	else
-		fprintf(stderr, "GLEW initialized OK\n");
-	fprintf(stderr, "Status: Using GLEW %s\n", glewGetString(GLEW_VERSION));
-#endif
 
+	// the graph, in the lower right, newest frame on the right:
+	const float left = 58., bottom = 2., width = 40., height = 20.;
+	float top = 1000.f / 30.f;
+	for (int k = 0; k < PROFHISTORY; k++)
+		for (int which = 0; which < 3; which++)
+			if (ProfileHistoryMs(k, which) > top)
+				top = ProfileHistoryMs(k, which);
+
+	glColor3f(0.4f, 0.4f, 0.4f);
+	glBegin(GL_LINES);
+		glVertex2f(left, bottom);
+		glVertex2f(left + width, bottom);
+		glVertex2f(left, bottom + height * (1000.f / 60.f) / top);
+		glVertex2f(left + width, bottom + height * (1000.f / 60.f) / top);
+		glVertex2f(left, bottom + height * (1000.f / 30.f) / top);
+		glVertex2f(left + width, bottom + height * (1000.f / 30.f) / top);
+	glEnd();
+
+	const float colors[3][3] = { { 1.f, 1.f, 1.f }, { 0.3f, 1.f, 0.3f }, { 1.f, 0.6f, 0.2f } };
+	for (int which = 0; which < 3; which++)
+	{
+		glColor3fv(colors[which]);
+		glBegin(GL_LINE_STRIP);
+		for (int k = PROFHISTORY - 1; k >= 0; k--)
+		{
+			float x = left + width * (float)(PROFHISTORY - 1 - k) / (float)(PROFHISTORY - 1);
+			glVertex2f(x, bottom + height * ProfileHistoryMs(k, which) / top);
+		}
+		glEnd();
+	}
+	glColor3f(1., 1., 1.);
 }
 
 
-// initialize the display lists that will not change:
-// (a display list is a way to store opengl commands in
-//  memory so that they can be played back efficiently at a later time
-//  with a call to glCallList( )
+// draw a body's sphere, picking its tessellation from how big it is on the screen:
+void
+DrawBodySphere(float radius)
+{
+	int slices = LodOn != 0 ? OsuSphereLodSlices(radius) : 64;
+	OsuSphere(radius, slices, slices);
+}
+
+void DoAxesMenu(int id)
+{
+	AxesOn = id;
+
+	RsSetWindow(MainWindow);
+	glutPostRedisplay();
+}
+
+// menu for setting the views (earthview, moonview, outside(top), sideview)
+void
+DoViewMenu(int id)
+{
+	QuadViewOn = id == QUADVIEW;
+	if (!QuadViewOn)
+		WhichPOV = id;
+	Reset();
+	RsSetWindow(MainWindow);
+	glutPostRedisplay();
+}
+
+// menu for turning orbit lines on and off
+void
+DoOrbitLinesMenu(int id)
+{
+	ORBIT_LINES_ON = id;
+
+	RsSetWindow(MainWindow);
+	glutPostRedisplay();
+}
+
+// menu for freezing animation
+void
+DoFreezeMenu(int id)
+{
+	Frozen = id;
+	SimClockPause(Frozen);
+	UpdateSimTime();
+	UpdateIdle();
+	RsSetWindow(MainWindow);
+	glutPostRedisplay();
+}
+
+// menu for turning lights on and off
+void
+DoLightsMenu(int id)
+{
+	Light0On = id;
+
+	RsSetWindow(MainWindow);
+	glutPostRedisplay();
+}
+
+void
+DoColorMenu(int id)
+{
+	WhichColor = id - RED;
+
+	RsSetWindow(MainWindow);
+	glutPostRedisplay();
+}
+
+void
+DoDebugMenu(int id)
+{
+	if (id == PROFILER)
+		ProfileOn = !ProfileOn;
+	else if (id == SAVETRACE)
+		ProfileWriteTrace(PROFILETRACEFILE);
+	else
+		DebugOn = id;
+
+	RsSetWindow(MainWindow);
+	glutPostRedisplay();
+}
+
+
+// menu for drawing with opengl or the ray tracer
+void
+DoRendererMenu(int id)
+{
+	RayTraceOn = id != RENDEROPENGL;
+	ShadowsOn = id == RENDERSHADOWS;
+
+	RsSetWindow(MainWindow);
+	glutPostRedisplay();
+}
+
+
+void
+DoDepthBufferMenu(int id)
+{
+	DepthBufferOn = id;
+
+	RsSetWindow(MainWindow);
+	glutPostRedisplay();
+}
+
+
+void
+DoDepthFightingMenu(int id)
+{
+	DepthFightingOn = id;
+
+	RsSetWindow(MainWindow);
+	glutPostRedisplay();
+}
+
+
+void
+DoDepthMenu(int id)
+{
+	DepthCueOn = id;
+
+	RsSetWindow(MainWindow);
+	glutPostRedisplay();
+}
+
+// main menu callback:
+void
+DoMainMenu(int id)
+{
+	switch (id)
+	{
+	case RESET:
+		Reset();
+		break;
+
+	case QUIT:
+		// gracefully close out the graphics:
+		// gracefully close the graphics window:
+		// gracefully exit the program:
+		RsSetWindow(MainWindow);
+		glFinish();
+		FramePipelineStop();
+		RayTraceStop();
+		FinishTexCacheWrites();
+		glutDestroyWindow(MainWindow);
+		exit(0);
+		break;
+
+	default:
+		fprintf(stderr, "Don't know what to do with Main Menu ID %d\n", id);
+	}
+
+	RsSetWindow(MainWindow);
+	glutPostRedisplay();
+}
+
+
+void
+DoProjectMenu(int id)
+{
+	WhichProjection = id;
+
+	RsSetWindow(MainWindow);
+	glutPostRedisplay();
+}
+
+
+// use glut to display a string of characters using a raster font:
+
+void
+DoRasterString(float x, float y, float z, char* s)
+{
+	glRasterPos3f((GLfloat)x, (GLfloat)y, (GLfloat)z);
+
+	char c;			// one character to print
+	for (; (c = *s) != '\0'; s++)
+	{
+		glutBitmapCharacter(GLUT_BITMAP_TIMES_ROMAN_24, c);
+	}
+}
+
+
+// use glut to display a string of characters using a stroke font:
+
+void
+DoStrokeString(float x, float y, float z, float ht, char* s)
+{
+	glPushMatrix();
+	glTranslatef((GLfloat)x, (GLfloat)y, (GLfloat)z);
+	float sf = ht / (119.05f + 33.33f);
+	glScalef((GLfloat)sf, (GLfloat)sf, (GLfloat)sf);
+	char c;			// one character to print
+	for (; (c = *s) != '\0'; s++)
+	{
+		glutStrokeCharacter(GLUT_STROKE_ROMAN, c);
+	}
+	glPopMatrix();
+}
+
+
+// return the number of seconds since the start of the program:
+
+float
+ElapsedSeconds()
+{
+	// get # of milliseconds since the start of the program:
+	int ms = glutGet(GLUT_ELAPSED_TIME);
+
+	// convert it to seconds:
+	return (float)ms / 1000.f;
+}
+
+
+// initialize the glui window:
+
+void
+InitMenus()
+{
+	RsSetWindow(MainWindow);
+
+	// viewing options
+	int viewmenu = glutCreateMenu(DoViewMenu);
+	glutAddMenuEntry("Outside (Top)", OUTSIDE);
+	glutAddMenuEntry("Sideways", SIDEWAYS);
+	glutAddMenuEntry("Earthview", EARTHVIEW);
+	glutAddMenuEntry("Moonview", MOONVIEW);
+	glutAddMenuEntry("All Four", QUADVIEW);
+
+	int numColors = sizeof(Colors) / (3 * sizeof(int));
+	int colormenu = glutCreateMenu(DoColorMenu);
+	for (int i = 0; i < numColors; i++)
+	{
+		glutAddMenuEntry(ColorNames[i], i);
+	}
+
+	int axesmenu = glutCreateMenu(DoAxesMenu);
+	glutAddMenuEntry("On", 1);
+	glutAddMenuEntry("Off", 0);
+
+	int orbit_lines_menu = glutCreateMenu(DoOrbitLinesMenu);
+	glutAddMenuEntry("On", 1);
+	glutAddMenuEntry("Off", 0);
+
+	int freezemenu = glutCreateMenu(DoFreezeMenu);
+	glutAddMenuEntry("Freeze Animation", 1);
+	glutAddMenuEntry("Turn Animation On", 0);
+	
+	int lightsmenu = glutCreateMenu(DoLightsMenu);
+	glutAddMenuEntry("On", 1);
+	glutAddMenuEntry("Off", 0);
+	
+	//int depthcuemenu = glutCreateMenu(DoDepthMenu);
+	//glutAddMenuEntry("Off", 0);
+	//glutAddMenuEntry("On", 1);
+
+	//int depthbuffermenu = glutCreateMenu(DoDepthBufferMenu);
+	//glutAddMenuEntry("Off", 0);
+	//glutAddMenuEntry("On", 1);
+
+	//int depthfightingmenu = glutCreateMenu(DoDepthFightingMenu);
+	//glutAddMenuEntry("Off", 0);
+	//glutAddMenuEntry("On", 1);
+
+	int debugmenu = glutCreateMenu(DoDebugMenu);
+	glutAddMenuEntry("Off", 0);
+	glutAddMenuEntry("On", 1);
+	glutAddMenuEntry("Profiler On/Off", PROFILER);
+	glutAddMenuEntry("Save Profiler Trace", SAVETRACE);
+
+	//int projmenu = glutCreateMenu(DoProjectMenu);
+	//glutAddMenuEntry("Orthographic", ORTHO);
+	//glutAddMenuEntry("Perspective", PERSP);
+
+	int renderermenu = glutCreateMenu(DoRendererMenu);
+	glutAddMenuEntry("OpenGL", RENDEROPENGL);
+	glutAddMenuEntry("Ray Tracer", RENDERRAYTRACE);
+	glutAddMenuEntry("Ray Tracer with Shadows", RENDERSHADOWS);
+
+	int mainmenu = glutCreateMenu(DoMainMenu);
+	glutAddSubMenu("Views", viewmenu);
+	glutAddSubMenu("Light", lightsmenu);
+	glutAddSubMenu("Renderer", renderermenu);
+	glutAddSubMenu("Freeze Animation", freezemenu);
+	glutAddSubMenu("Orbit Lines", orbit_lines_menu);
+	//glutAddSubMenu("Axes", axesmenu);
+	//glutAddSubMenu("Axis Colors", colormenu);
+
+#ifdef DEMO_DEPTH_BUFFER
+	glutAddSubMenu("Depth Buffer", depthbuffermenu);
+#endif
+
+#ifdef DEMO_Z_FIGHTING
+	glutAddSubMenu("Depth Fighting", depthfightingmenu);
+#endif
+
+	//glutAddSubMenu("Depth Cue", depthcuemenu);
+	//glutAddSubMenu("Projection", projmenu);
+	glutAddMenuEntry("Reset", RESET);
+	glutAddSubMenu("Debug", debugmenu);
+	glutAddMenuEntry("Quit", QUIT);
+
+	// attach the pop-up menu to the right mouse button:
+
+	glutAttachMenu(GLUT_RIGHT_BUTTON);
+}
+
+
+
+// initialize the glut and OpenGL libraries:
+//	also setup callback functions
+void
+InitGraphics()
+{
+	// request the display modes:
+	// ask for red-green-blue-alpha color, double-buffering, and z-buffering:
+
+	glutInitDisplayMode(GLUT_RGBA | GLUT_DOUBLE | GLUT_DEPTH);
+
+	// set the initial window configuration:
+
+	glutInitWindowPosition(0, 0);
+	glutInitWindowSize(INIT_WINDOW_SIZE, INIT_WINDOW_SIZE);
+
+	// open the window and set its title:
+
+	MainWindow = glutCreateWindow(WINDOWTITLE);
+	glutSetWindowTitle(WINDOWTITLE);
+
+	// set the framebuffer clear values:
+
+	glClearColor(BACKCOLOR[0], BACKCOLOR[1], BACKCOLOR[2], BACKCOLOR[3]);
+
+	// setup the callback functions:
+	// DisplayFunc -- redraw the window
+	// ReshapeFunc -- handle the user resizing the window
+	// KeyboardFunc -- handle a keyboard input
+	// MouseFunc -- handle the mouse button going down or up
+	// MotionFunc -- handle the mouse moving with a button down
+	// PassiveMotionFunc -- handle the mouse moving with a button up
+	// VisibilityFunc -- handle a change in window visibility
+	// EntryFunc	-- handle the cursor entering or leaving the window
+	// SpecialFunc -- handle special keys on the keyboard
+	// SpaceballMotionFunc -- handle spaceball translation
+	// SpaceballRotateFunc -- handle spaceball rotation
+	// SpaceballButtonFunc -- handle spaceball button hits
+	// ButtonBoxFunc -- handle button box hits
+	// DialsFunc -- handle dial rotations
+	// TabletMotionFunc -- handle digitizing tablet motion
+	// TabletButtonFunc -- handle digitizing tablet button hits
+	// MenuStateFunc -- declare when a pop-up menu is in use
+	// TimerFunc -- trigger something to happen a certain time from now
+	// IdleFunc -- what to do when nothing else is going on
+
+	RsSetWindow(MainWindow);
+	glutDisplayFunc(Display);
+	glutReshapeFunc(Resize);
+	glutKeyboardFunc(Keyboard);
+	glutMouseFunc(MouseButton);
+	glutMotionFunc(MouseMotion);
+	glutPassiveMotionFunc(MouseMotion);
+	glutVisibilityFunc(Visibility);
+	glutEntryFunc(NULL);
+	glutSpecialFunc(NULL);
+	glutSpaceballMotionFunc(NULL);
+	glutSpaceballRotateFunc(NULL);
+	glutSpaceballButtonFunc(NULL);
+	glutButtonBoxFunc(NULL);
+	glutDialsFunc(NULL);
+	glutTabletMotionFunc(NULL);
+	glutTabletButtonFunc(NULL);
+	glutMenuStateFunc(NULL);
+	glutTimerFunc(-1, NULL, 0);
+	glutIdleFunc(Animate);
+
+	// init glew (a window must be open to do this):
+
+	GLenum err = glewInit();
+	if (err != GLEW_OK)
+	{
+		fprintf(stderr, "glewInit Error\n");
+	}
+	else
+		fprintf(stderr, "GLEW initialized OK\n");
+	fprintf(stderr, "Status: Using GLEW %s\n", glewGetString(GLEW_VERSION));
+	fprintf(stderr, "Startup: %6.1f ms  window and opengl context ready\n", StartupMs());
+
+	// the swap interval (vsync) for the frame pacing mode:
+	InitPacing();
+
+	InitTextures();
+}
+
+
+// read the scene file (--scene FILE, or SCENEFILE) and set up a texture load for each of its textures:
+void
+InitScene(int argc, char* argv[])
+{
+	const char* filename = SCENEFILE;
+	for (int i = 1; i < argc - 1; i++)
+	{
+		if (strcmp(argv[i], "--scene") == 0)
+			filename = argv[i + 1];
+	}
+	LoadScene(filename);
+
+	NumTextureLoads = (int)SceneTextures.size();
+	if (NumTextureLoads > MAXTEXTURES)
+	{
+		fprintf(stderr, "The scene uses %d textures, but only %d can be loaded\n", NumTextureLoads, MAXTEXTURES);
+		NumTextureLoads = MAXTEXTURES;
+	}
+	for (int i = 0; i < NumTextureLoads; i++)
+	{
+		TextureLoads[i].filename = SceneTextures[i].filename.c_str();
+		memcpy(TextureLoads[i].placeholder, SceneTextures[i].placeholder, 3);
+	}
+
+	EarthBody = FindBody("earth");
+	MoonBody = FindBody("moon");
+}
+
+
+// create the textures, showing a solid placeholder color in each until its bmp file arrives:
+//	(needs a current opengl context, but not a window.
+//	 the files are read by StartTextureLoads( )'s workers and uploaded by UploadLoadedTextures( ))
+void
+InitTextures()
+{
+	StartTextureLoads();
+
+	for (int i = 0; i < NumTextureLoads; i++)
+	{
+		CreateTexture(&TextureLoads[i].tex);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexImage2D(GL_TEXTURE_2D, 0, 3, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, TextureLoads[i].placeholder);
+	}
+}
+
+
+// create a texture object with the settings all of our textures use, and leave it bound:
+void
+CreateTexture(GLuint* tex)
+{
+	glGenTextures(1, tex);
+	RsBindTexture(GL_TEXTURE_2D, *tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	RsTexEnvMode(GL_REPLACE);
+}
+
+
+// create one texture from a bmp file, right now, on this thread:
+void
+InitTexture(GLuint* tex, char* filename)
+{
+	CreateTexture(tex);
+
+	if (MappedBmpOn && MappedBmpToTexture(filename))
+		return;
+
+	// the file is not something we can upload directly, so read and convert it the slow way:
+	int width = 2, height = 2;
+	unsigned char* t32 = BmpToTexture(filename, &width, &height);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, 3, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, t32);
+	delete[] t32;
+}
+
+
+// read the scene's textures again for the ray tracer, which looks them up on the cpu:
+// (one that cannot be read is its placeholder color, as it would be in opengl)
+void
+RayTraceLoadTextures()
+{
+	RayTraceTextures.assign(SceneTextures.size(), RtImage());
+	for (size_t i = 0; i < SceneTextures.size(); i++)
+	{
+		struct RtImage* image = &RayTraceTextures[i];
+		int width, height;
+		unsigned char* rgb = BmpToTexture((char*)SceneTextures[i].filename.c_str(), &width, &height);
+		if (rgb != NULL)
+		{
+			image->width = width;
+			image->height = height;
+			image->rgb.assign(rgb, rgb + 3 * (size_t)width * height);
+			delete[] rgb;
+		}
+		else
+		{
+			image->width = image->height = 1;
+			image->rgb.assign(SceneTextures[i].placeholder, SceneTextures[i].placeholder + 3);
+		}
+	}
+}
+
+
+// milliseconds since main( ) began, for the startup log:
+double
+StartupMs()
+{
+	return 1000. * (WallSeconds() - StartupSeconds);
+}
+
+
+// launch worker threads to read all of the bmp files:
+// (safe to call more than once -- only the first call does anything.
+//  call it as early as possible, since it does not need opengl)
+void
+StartTextureLoads()
+{
+	if (TextureLoadsStarted)
+		return;
+	TextureLoadsStarted = true;
+
+	int numWorkers = (int)std::thread::hardware_concurrency();
+	if (numWorkers < 1)
+		numWorkers = 1;
+	if (numWorkers > NumTextureLoads)
+		numWorkers = NumTextureLoads;
+
+	NextTextureLoad = 0;
+	for (int i = 0; i < numWorkers; i++)
+		std::thread(DecodeTextures).detach();
+
+	fprintf(stderr, "Startup: %6.1f ms  started %d texture worker(s)\n", StartupMs(), numWorkers);
+}
+
+
+// a worker thread: keep taking files from TextureLoads[ ] until there are none left
+// (no opengl calls in here!)
+void
+DecodeTextures()
+{
+	for (int i; (i = NextTextureLoad++) < NumTextureLoads; )
+	{
+		struct TextureLoad* tl = &TextureLoads[i];
+		double t0 = WallSeconds();
+
+		// hashing a mapped file also touches every page now, so the upload does not wait on the disk:
+		if (MappedBmpOn && MapBmp((char*)tl->filename, &tl->bm))
+		{
+			tl->hash = HashBytes(tl->bm.base, tl->bm.length, TEXCACHEHASHSTART);
+			tl->hashed = true;
+			tl->width = tl->bm.width;
+			tl->height = tl->bm.height;
+		}
+		else
+			tl->hashed = HashFile(tl->filename, &tl->hash);
+
+		// if the compressed version is already on disk, that is all we need:
+		if (CompressedTexturesOn && tl->hashed)
+		{
+			size_t length;
+			TexCachePath(tl->cachePath, sizeof(tl->cachePath), tl->filename, tl->hash);
+			tl->cached = ReadTexCache(tl->cachePath, tl->hash, &length);
+			if (tl->cached != NULL)
+				UnmapBmp(&tl->bm);
+		}
+
+		if (tl->cached == NULL && tl->bm.pixels == NULL)
+		{
+			tl->width = tl->height = 0;
+			tl->rgb = BmpToTexture((char*)tl->filename, &tl->width, &tl->height);
+		}
+
+		tl->decodeMs = 1000. * (WallSeconds() - t0);
+		tl->decoded.store(true, std::memory_order_release);
+	}
+}
+
+
+// upload every texture whose file has finished reading, through a pixel buffer object:
+// (call this on the glut thread -- returns true once all of the textures have arrived)
+bool
+UploadLoadedTextures()
+{
+	bool allDone = true;
+	for (int i = 0; i < NumTextureLoads; i++)
+	{
+		struct TextureLoad* tl = &TextureLoads[i];
+		if (tl->uploaded)
+			continue;
+		if (!tl->decoded.load(std::memory_order_acquire))
+		{
+			allDone = false;
+			continue;
+		}
+
+		double t0 = WallSeconds();
+		const unsigned char* pixels = tl->bm.pixels != NULL ? tl->bm.pixels : tl->rgb;
+		bool found = pixels != NULL || tl->cached != NULL;
+		const char* how = "uncompressed";
+		RsBindTexture(GL_TEXTURE_2D, tl->tex);
+		if (tl->cached != NULL)
+		{
+			UploadTexCache(tl->cached);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+			delete[] tl->cached;
+			tl->cached = NULL;
+			how = "from the compressed cache";
+		}
+		else if (pixels != NULL)
+		{
+			// let the driver compress it and build the mipmaps the first time:
+			bool compress = CompressedTexturesOn && GLEW_EXT_texture_compression_s3tc;
+			bool mipmap = CompressedTexturesOn && (GLEW_VERSION_3_0 || GLEW_ARB_framebuffer_object);
+			GLint internalFormat = compress ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : 3;
+
+			GLenum format = tl->bm.pixels != NULL ? GL_BGR : GL_RGB;
+			GLint alignment = tl->bm.pixels != NULL ? 4 : 1;
+			size_t rowBytes = (size_t)(3 * tl->width + alignment - 1) / alignment * alignment;
+			size_t size = rowBytes * (size_t)tl->height;
+
+			// copy into a pixel buffer object so the driver can do the transfer on its own time:
+
+			GLuint pbo;
+			glGenBuffers(1, &pbo);
+			RsBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+			void* dst = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+			if (dst != NULL)
+			{
+				memcpy(dst, pixels, size);
+				glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+				pixels = NULL;		// now an offset into the pbo
+			}
+			else
+				RsBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+			glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+			glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, tl->width, tl->height, 0, format, GL_UNSIGNED_BYTE, pixels);
+			RsBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			glDeleteBuffers(1, &pbo);
+
+			if (mipmap)
+			{
+				glGenerateMipmap(GL_TEXTURE_2D);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+			}
+			if (compress && mipmap && tl->hashed)
+			{
+				WriteTexCache(tl->cachePath, tl->hash);
+				how = "compressed, and saved to the cache";
+			}
+		}
+
+		UnmapBmp(&tl->bm);
+		delete[] tl->rgb;
+		tl->rgb = NULL;
+		tl->uploaded = true;
+
+		if (found)
+		{
+			GLint w, h;
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &w);
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &h);
+			size_t raw = 4 * (size_t)w * (size_t)h;
+			size_t used = TextureMemory();
+			TextureBytesRaw += raw;
+			TextureBytesUsed += used;
+			fprintf(stderr, "Startup: %6.1f ms  '%s' %dx%d: read %.1f ms on a worker, upload %.1f ms %s, %zu KB (%zu KB uncompressed)\n",
+				StartupMs(), tl->filename, w, h, tl->decodeMs, 1000. * (WallSeconds() - t0), how, used / 1024, raw / 1024);
+		}
+		else
+			fprintf(stderr, "Startup: %6.1f ms  '%s' could not be read -- keeping the placeholder\n",
+				StartupMs(), tl->filename);
+	}
+
+	if (allDone)
+		fprintf(stderr, "Startup: %6.1f ms  all textures ready, %zu KB of texture memory (%zu KB uncompressed without mipmaps)\n",
+			StartupMs(), TextureBytesUsed / 1024, TextureBytesRaw / 1024);
+	return allDone;
+}
+
+
+// wait for all of the textures to arrive:
+void
+FinishTextureLoads()
+{
+	while (!UploadLoadedTextures())
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	TexturesReady = true;
+}
+
+
+// initialize the display lists that will not change:
+// (a display list is a way to store opengl commands in
+//  memory so that they can be played back efficiently at a later time
+//  with a call to glCallList( )
 void
 InitLists()
 {
-	float dx = BOXSIZE / 2.f;
-	float dy = BOXSIZE / 2.f;
-	float dz = BOXSIZE / 2.f;
-	glutSetWindow(MainWindow);
+	float dx = BOXSIZE / 2.f;
+	float dy = BOXSIZE / 2.f;
+	float dz = BOXSIZE / 2.f;
+	if (!Headless)
+		RsSetWindow(MainWindow);
+
+	// create the object:
+
+	BoxList = glGenLists(1);
+	glNewList(BoxList, GL_COMPILE);
+
+	glBegin(GL_QUADS);
+
+	glColor3f(1., 0., 0.);
+
+	glNormal3f(1., 0., 0.);
+	glVertex3f(dx, -dy, dz);
+	glVertex3f(dx, -dy, -dz);
+	glVertex3f(dx, dy, -dz);
+	glVertex3f(dx, dy, dz);
+
+	glNormal3f(-1., 0., 0.);
+	glVertex3f(-dx, -dy, dz);
+	glVertex3f(-dx, dy, dz);
+	glVertex3f(-dx, dy, -dz);
+	glVertex3f(-dx, -dy, -dz);
+
+	glColor3f(0., 1., 0.);
+
+	glNormal3f(0., 1., 0.);
+	glVertex3f(-dx, dy, dz);
+	glVertex3f(dx, dy, dz);
+	glVertex3f(dx, dy, -dz);
+	glVertex3f(-dx, dy, -dz);
+
+	glNormal3f(0., -1., 0.);
+	glVertex3f(-dx, -dy, dz);
+	glVertex3f(-dx, -dy, -dz);
+	glVertex3f(dx, -dy, -dz);
+	glVertex3f(dx, -dy, dz);
+
+	glColor3f(0., 0., 1.);
+
+	glNormal3f(0., 0., 1.);
+	glVertex3f(-dx, -dy, dz);
+	glVertex3f(dx, -dy, dz);
+	glVertex3f(dx, dy, dz);
+	glVertex3f(-dx, dy, dz);
+
+	glNormal3f(0., 0., -1.);
+	glVertex3f(-dx, -dy, -dz);
+	glVertex3f(-dx, dy, -dz);
+	glVertex3f(dx, dy, -dz);
+	glVertex3f(dx, -dy, -dz);
+
+	glEnd();
+
+	glEndList();
+
+	// build all of the sphere levels of detail up front:
+	InitSphereLods();
+
+	// the buffer the per-frame uniform and instance data goes into:
+	InitFrameRing(RingPersistentOn);
+
+	// the per-pixel lighting shaders:
+	ShadingOK = InitShading();
+
+	// and the shader for drawing them instanced:
+	InstancingOK = InitInstancing();
+
+	// which depth buffer setups there are (logarithmic depth needs the shaders):
+	InitDepth(ShadingOK && UnlitProgram != 0);
+
+	// the sky's cube map and the cube it is drawn on:
+	SkyboxOK = InitSkybox();
+	SkyTexturesStale = true;
+
+	// (all of that bound buffers and textures without going through the state cache)
+	RsInvalidate();
+
+	// an orbit circle, drawn in the frame of whatever is being orbited and scaled to the orbit's radius:
+	OrbitList = glGenLists(1);
+		glNewList(OrbitList, GL_COMPILE);
+		glColor3f(1, 0, 0);
+		glRotatef(90, 1, 0., 0.);
+		float dang = 2. * M_PI / (float)(99);
+		float ang = 0.;
+		glBegin(GL_LINE_LOOP);
+		for (int i = 0; i < 100; i++)
+		{
+			glVertex3f(cos(ang), sin(ang), 0.);
+			ang += dang;
+		}
+		glEnd();
+	glEndList();
+
+	// create the axes:
+	AxesList = glGenLists(1);
+	glNewList(AxesList, GL_COMPILE);
+	glLineWidth(AXES_WIDTH);
+	Axes(1.5);
+	glLineWidth(1.);
+	glEndList();
+}
+
+// the keyboard callback:
+void
+Keyboard(unsigned char c, int x, int y)
+{
+	fprintf(stderr, "Keyboard: '%c' (0x%0x)\n", c, c);
+
+	switch (c)
+	{
+
+	// set view: Outside (top), sideways, earthview, moonview
+	case 'o':
+	case 'O':
+		Reset();
+		WhichPOV = OUTSIDE;
+		QuadViewOn = 0;
+		break;
+	case 's':
+	case 'S':
+		Reset();
+		WhichPOV = SIDEWAYS;
+		QuadViewOn = 0;
+		break;
+	case 'r':
+	case 'R':
+		Reset();
+		break;
+	case 'e':
+	case 'E':
+		WhichPOV = EARTHVIEW;
+		QuadViewOn = 0;
+		break;
+	case 'm':
+	case 'M':
+		WhichPOV = MOONVIEW;
+		QuadViewOn = 0;
+		break;
+
+	// all four views at once, or back to the one
+	case 'a':
+	case 'A':
+		QuadViewOn = !QuadViewOn;
+		break;
+
+	// turn orbit lines on or off
+	case 'c':
+	case 'C':
+		ORBIT_LINES_ON = !ORBIT_LINES_ON;
+		break;
+
+	// turn sphere level-of-detail on or off
+	case 'l':
+	case 'L':
+		LodOn = !LodOn;
+		break;
+
+	// draw the bodies instanced or one at a time
+	case 'i':
+	case 'I':
+		InstancingOn = !InstancingOn;
+		fprintf(stderr, "Instancing: %s\n", InstancingOn && InstancingOK ? "on" : "off");
+		break;
+
+	// light the bodies per pixel with shaders, or with the fixed-function lights
+	case 'p':
+	case 'P':
+		ShaderLightingOn = !ShaderLightingOn;
+		fprintf(stderr, "Lighting: %s\n", (ShaderLightingOn || DepthMode == DEPTHLOG) && ShadingOK ? "per-pixel shader" : "fixed-function");
+		break;
+
+	// skip what is outside the view, or hidden behind other bodies
+	case 'u':
+	case 'U':
+		CullingOn = !CullingOn;
+		fprintf(stderr, "Frustum culling: %s\n", CullingOn ? "on" : "off");
+		break;
+	case 'q':
+	case 'Q':
+		OcclusionOn = !OcclusionOn;
+		fprintf(stderr, "Occlusion culling: %s\n", OcclusionOn ? "on" : "off");
+		break;
+
+	// draw the sky as a cube map last, or as a sphere first
+	case 'k':
+	case 'K':
+		SkyboxOn = !SkyboxOn;
+		fprintf(stderr, "Sky: %s\n", SkyboxOn && SkyboxOK ? "cube map" : "sphere");
+		break;
+
+	// go to the next depth buffer setup: standard, reversed-Z, logarithmic
+	case 'z':
+	case 'Z':
+		DepthMode = DepthNextMode();
+		fprintf(stderr, "Depth: %s\n", DEPTHMODENAMES[DepthMode]);
+		break;
+
+	// draw relative to the eye, or in world coordinates (to see the difference at real scale)
+	case 'w':
+	case 'W':
+		CameraRelativeOn = !CameraRelativeOn;
+		fprintf(stderr, "Coordinates: %s\n", CameraRelativeOn ? "camera-relative" : "world");
+		break;
+
+	// work out the next frame on another thread while this one is drawn, or each frame in turn
+	case 't':
+	case 'T':
+		FramePipelineOn = !FramePipelineOn;
+		fprintf(stderr, "Frame pipeline: %s\n", FramePipelineOn ? "on" : "off");
+		break;
+
+	// turn sun's light on or off
+	case '0':	// entering '0' or '6' will turn on/off the first/white light 
+	case '6':
+		Light0On = !Light0On;
+		break;
+
+	// freeze or resume animation
+	case 'f':	// entering 'f' or 'F' will turn on/off all animation
+	case 'F':
+		Frozen = !Frozen;
+		SimClockPause(Frozen);
+		UpdateSimTime();
+		UpdateIdle();
+		break;
+
+	// draw with the cpu ray tracer, or with opengl
+	case 'y':
+	case 'Y':
+		RayTraceOn = !RayTraceOn;
+		fprintf(stderr, "Renderer: %s\n", RayTraceOn ? "ray tracer" : "opengl");
+		break;
+
+	// turn the ray tracer's shadows on or off
+	case 'g':
+	case 'G':
+		ShadowsOn = !ShadowsOn;
+		fprintf(stderr, "Shadows: %s%s\n", ShadowsOn ? "on" : "off", ShadowsOn && !RayTraceOn ? " (only the ray tracer casts them)" : "");
+		break;
+
+	// the next frame pacing mode: vsync, capped, on-demand, uncapped
+	case 'h':
+	case 'H':
+		PaceSetMode((PaceMode + 1) % PACENUMMODES);
+		UpdateIdle();
+		fprintf(stderr, "Frame pacing: %s%s\n", PACEMODENAMES[PaceMode],
+			PaceMode == PACEUNCAPPED || PaceVsynced() ? "" : " (sleeping to the target frame rate)");
+		break;
+
+	// step the simulation one step forward or back (best while frozen)
+	case '.':
+	case '>':
+		SimClockStep(1);
+		UpdateSimTime();
+		break;
+	case ',':
+	case '<':
+		SimClockStep(-1);
+		UpdateSimTime();
+		break;
+
+	// speed up, slow down, or reverse the simulation
+	case '+':
+	case '=':
+		SimClockSetWarp(Sim.warp * 2.);
+		fprintf(stderr, "Time warp: %g\n", Sim.warp);
+		break;
+	case '-':
+	case '_':
+		SimClockSetWarp(Sim.warp / 2.);
+		fprintf(stderr, "Time warp: %g\n", Sim.warp);
+		break;
+	case 'v':
+	case 'V':
+		SimClockSetWarp(-Sim.warp);
+		fprintf(stderr, "Time warp: %g\n", Sim.warp);
+		break;
+	case ESCAPE:
+		DoMainMenu(QUIT);	// will not return here
+		break;				// happy compiler
+
+	default:
+		fprintf(stderr, "Don't know what to do with keyboard hit: '%c' (0x%0x)\n", c, c);
+	}
+
+	// force a call to Display( ):
+
+	RsSetWindow(MainWindow);
+	glutPostRedisplay();
+}
+
+
+// called when the mouse button transitions down or up:
+void
+MouseButton(int button, int state, int x, int y)
+{
+	int b = 0;			// LEFT, MIDDLE, or RIGHT
+
+	if (DebugOn != 0)
+		fprintf(stderr, "MouseButton: %d, %d, %d, %d\n", button, state, x, y);
+
+
+	// get the proper button bit mask:
+	switch (button)
+	{
+	case GLUT_LEFT_BUTTON:
+		b = LEFT;		break;
+
+	case GLUT_MIDDLE_BUTTON:
+		b = MIDDLE;		break;
+
+	case GLUT_RIGHT_BUTTON:
+		b = RIGHT;		break;
+
+	case SCROLL_WHEEL_UP:
+		Scale += SCLFACT * SCROLL_WHEEL_CLICK_FACTOR;
+		// keep object from turning inside-out or disappearing:
+		if (Scale < MINSCALE)
+			Scale = MINSCALE;
+		break;
+
+	case SCROLL_WHEEL_DOWN:
+		Scale -= SCLFACT * SCROLL_WHEEL_CLICK_FACTOR;
+		// keep object from turning inside-out or disappearing:
+		if (Scale < MINSCALE)
+			Scale = MINSCALE;
+		break;
+
+	default:
+		b = 0;
+		fprintf(stderr, "Unknown mouse button: %d\n", button);
+	}
+
+	// button down sets the bit, up clears the bit:
+
+	if (state == GLUT_DOWN)
+	{
+		Xmouse = x;
+		Ymouse = y;
+		ActiveButton |= b;		// set the proper bit
+	}
+	else
+	{
+		ActiveButton &= ~b;		// clear the proper bit
+	}
+
+	RsSetWindow(MainWindow);
+	glutPostRedisplay();
+
+}
+
+
+// called when the mouse moves while a button is down:
+void
+MouseMotion(int x, int y)
+{
+	int dx = x - Xmouse;		// change in mouse coords
+	int dy = y - Ymouse;
 
-	// create the object:
+	if ((ActiveButton & LEFT) != 0)
+	{
+		Xrot += (ANGFACT * dy);
+		Yrot += (ANGFACT * dx);
+	}
 
-	BoxList = glGenLists(1);
-	glNewList(BoxList, GL_COMPILE);
+	if ((ActiveButton & MIDDLE) != 0)
+	{
+		Scale += SCLFACT * (float)(dx - dy);
 
-	glBegin(GL_QUADS);
+		// keep object from turning inside-out or disappearing:
 
-	glColor3f(1., 0., 0.);
+		if (Scale < MINSCALE)
+			Scale = MINSCALE;
+	}
 
-	glNormal3f(1., 0., 0.);
-	glVertex3f(dx, -dy, dz);
-	glVertex3f(dx, -dy, -dz);
-	glVertex3f(dx, dy, -dz);
-	glVertex3f(dx, dy, dz);
+	Xmouse = x;			// new current position
+	Ymouse = y;
 
-	glNormal3f(-1., 0., 0.);
-	glVertex3f(-dx, -dy, dz);
-	glVertex3f(-dx, dy, dz);
-	glVertex3f(-dx, dy, -dz);
-	glVertex3f(-dx, -dy, -dz);
+	RsSetWindow(MainWindow);
+	glutPostRedisplay();
+}
 
-	glColor3f(0., 1., 0.);
 
-	glNormal3f(0., 1., 0.);
-	glVertex3f(-dx, dy, dz);
-	glVertex3f(dx, dy, dz);
-	glVertex3f(dx, dy, -dz);
-	glVertex3f(-dx, dy, -dz);
+// reset the transformations and the colors:
+// this only sets the global variables --
+// the glut main loop is responsible for redrawing the scene
+void
+Reset()
+{
+	ActiveButton = 0;
+	AxesOn = 1;
+	DebugOn = 0;
+	ProfileOn = 0;
+	DepthBufferOn = 1;
+	DepthFightingOn = 0;
+	DepthCueOn = 0;
+	LodOn = 1;
+	InstancingOn = 1;
+	ShaderLightingOn = 0;
+	CullingOn = 1;
+	OcclusionOn = 0;
+	SkyboxOn = 1;
+	DepthMode = DepthBestMode();
+	CameraRelativeOn = 1;
+	FramePipelineOn = 1;
+	Scale = 1.0;
+	ShadowsOn = 0;
+	RayTraceOn = 0;
+	WhichColor = WHITE;
+	WhichProjection = PERSP;
+	Xrot = Yrot = 0.;
+}
 
-	glNormal3f(0., -1., 0.);
-	glVertex3f(-dx, -dy, dz);
-	glVertex3f(-dx, -dy, -dz);
-	glVertex3f(dx, -dy, -dz);
-	glVertex3f(dx, -dy, dz);
 
-	glColor3f(0., 0., 1.);
+// called when user resizes the window:
+void
+Resize(int width, int height)
+{
+	// don't really need to do anything since window size is
+	// checked each time in Display( ):
 
-	glNormal3f(0., 0., 1.);
-	glVertex3f(-dx, -dy, dz);
-	glVertex3f(dx, -dy, dz);
-	glVertex3f(dx, dy, dz);
-	glVertex3f(-dx, dy, dz);
+	RsSetWindow(MainWindow);
+	glutPostRedisplay();
+}
 
-	glNormal3f(0., 0., -1.);
-	glVertex3f(-dx, -dy, -dz);
-	glVertex3f(-dx, dy, -dz);
-	glVertex3f(dx, dy, -dz);
-	glVertex3f(dx, -dy, -dz);
 
-	glEnd();
+// handle a change to the window's visibility:
 
-	glEndList();
+void
+Visibility(int state)
+{
+	if (DebugOn != 0)
+		fprintf(stderr, "Visibility: %d\n", state);
 
-	// earth display list
-	EarthOrbitList = glGenLists(1);
-		glNewList(EarthOrbitList, GL_COMPILE);
-		glColor3f(1, 0, 0);
-		glRotatef(90, 1, 0., 0.);
-		float dang = 2. * M_PI / (float)(99);
-		float ang = 0.;
-		glBegin(GL_LINE_LOOP);
-		for (int i = 0; i < 100; i++)
+	// stop animating and redrawing while the window cannot be seen (unless the pacing mode is uncapped):
+	PaceHidden = state != GLUT_VISIBLE;
+	UpdateIdle();
+
+	if (state == GLUT_VISIBLE)
+	{
+		RsSetWindow(MainWindow);
+		glutPostRedisplay();
+	}
+}
+
+
+// time the memory-mapped and the stdio bmp loaders against each other:
+void
+BenchTextureLoaders(int reps)
+{
+	const char* names[] = { "stdio", "mmap" };
+
+	for (int loader = 0; loader < 2; loader++)
+	{
+		MappedBmpOn = loader == 1;
+		std::vector<double> ms;
+		for (int r = 0; r < reps; r++)
 		{
-			glVertex3f((EARTH_ORBITAL_RADIUS_MILES)*cos(ang), (EARTH_ORBITAL_RADIUS_MILES)*sin(ang), 0.);
-			ang += dang;
+			GLuint tex[MAXTEXTURES];
+			double t0 = WallSeconds();
+			for (int f = 0; f < NumTextureLoads; f++)
+				InitTexture(&tex[f], (char*)TextureLoads[f].filename);
+			glFinish();
+			ms.push_back(1000. * (WallSeconds() - t0));
+			glDeleteTextures(NumTextureLoads, tex);
+			RsInvalidate();		// (deleting a bound texture unbinds it)
 		}
-		glEnd();
-	glEndList();
+		std::sort(ms.begin(), ms.end());
+		fprintf(stdout, "%-6s loader: %d runs, ms to load all textures: min %.3f  p50 %.3f  max %.3f\n",
+			names[loader], reps, Percentile(ms, 0.), Percentile(ms, 50.), Percentile(ms, 100.));
+	}
+	MappedBmpOn = true;
+}
 
-	// moon display list
-	MoonOrbitList = glGenLists(1);
-		glNewList(MoonOrbitList, GL_COMPILE);
-		glColor3f(1, 0, 0);
-		glRotatef(90, 1, 0., 0.);
-		dang = 2. * M_PI / (float)(99);
-		ang = 0.;
-		glBegin(GL_LINE_LOOP);
-		for (int i = 0; i < 100; i++)
+
+// draw a number of frames as fast as possible, after one untimed frame,
+// running the sim clock for exactly dt years each frame (so every run sees the same steps):
+// returns the total seconds, and fills in each frame's milliseconds and the total sphere vertices
+// (the state call, culling, and sky fragment totals start over too)
+double
+TimeFrames(int frames, double startTime, double dt, std::vector<double>* frameMs, double* vertices)
+{
+	// one untimed frame so that first-use costs (shader compiles, texture uploads) are not counted:
+	SimClockSet(startTime);
+	UpdateSimTime();
+	Display();
+	glFinish();
+	SkyReadFragments();
+	RsTotal.issued = RsTotal.skipped = 0;
+	memset(&CullTotal, 0, sizeof(CullTotal));
+	memset(&FrameTotal, 0, sizeof(FrameTotal));
+	memset(&RingTotal, 0, sizeof(RingTotal));
+	ProfileResetTotals();
+	SkyFragments = 0.;
+
+	frameMs->clear();
+	frameMs->reserve((size_t)std::max(frames, 1));
+	*vertices = 0.;
+	double start = WallSeconds();
+	for (int i = 0; i < frames; i++)
+	{
+		ProfileBegin("animate", false);
+		if (i > 0)
+			SimClockAdvance(dt * SIMREALSECONDSPERYEAR);
+		UpdateSimTime();
+		ProfileEnd();
+
+		double t0 = WallSeconds();
+		Display();
+		glFinish();		// wait for the renderer so the frame time includes the actual drawing
+		frameMs->push_back(1000. * (WallSeconds() - t0));
+		*vertices += (double)SphVerticesDrawn;
+		SkyReadFragments();
+	}
+	return WallSeconds() - start;
+}
+
+// the flat color a body (or, for 0, the sky) is drawn in by the depth check, and back:
+
+void
+DepthCheckColor(int id, unsigned char rgb[3])
+{
+	rgb[0] = (unsigned char)(32 * (id & 7) + 16);
+	rgb[1] = (unsigned char)(32 * ((id >> 3) & 7) + 16);
+	rgb[2] = 0;
+}
+
+int
+DepthCheckId(const unsigned char rgb[3])
+{
+	return (rgb[0] / 32) + 8 * (rgb[1] / 32);
+}
+
+
+// draw the bodies in their depth check colors from one place, in the current depth mode,
+// and count the pixels that are not the body a ray through them hits first:
+// (pixels within DEPTHCHECKEDGE pixels of an edge are left out)
+//	*behindPixels is set to how many of the pixels counted should be body behind
+
+long
+DepthCheckView(const double eye[3], const double look[3], double fovy, int behind, long* behindPixels)
+{
+	int w = HeadlessWidth, h = HeadlessHeight;
+	int skyBody = SkyboxOK ? FindSkyBody() : -1;
+
+	// which body each pixel should be, in double precision:
+	double f[3], side[3], up[3];
+	double len = 0.;
+	for (int k = 0; k < 3; k++)
+	{
+		f[k] = look[k] - eye[k];
+		len += f[k] * f[k];
+	}
+	for (int k = 0; k < 3; k++)
+		f[k] /= sqrt(len);
+	side[0] = -f[2];	side[1] = 0.;	side[2] = f[0];		// f x (0,1,0)
+	len = sqrt(side[0]*side[0] + side[2]*side[2]);
+	side[0] /= len;		side[2] /= len;
+	up[0] = side[1]*f[2] - side[2]*f[1];
+	up[1] = side[2]*f[0] - side[0]*f[2];
+	up[2] = side[0]*f[1] - side[1]*f[0];
+
+	double farthest = 0.;
+	for (int i = 0; i < Bodies.count; i++)
+	{
+		if ((Bodies.flags[i] & BODYSKY) == 0)
 		{
-			glVertex3f((MOON_ORBITAL_RADIUS_MILES)*cos(ang), (MOON_ORBITAL_RADIUS_MILES)*sin(ang), 0.);
-			ang += dang;
+			double dx = Bodies.frameX[i] - eye[0], dy = -eye[1], dz = Bodies.frameZ[i] - eye[2];
+			farthest = std::max(farthest, sqrt(dx*dx + dy*dy + dz*dz) + Bodies.radius[i]);
 		}
-		glEnd();
-	glEndList();
+	}
 
-	//sun display list
-	SunList = glGenLists(1);
-		glNewList(SunList, GL_COMPILE);
-		glShadeModel(GL_SMOOTH);
-		SetMaterial(1., 1., 1., 50.);
-		glEnable(GL_TEXTURE_2D);
-		glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
-		glBindTexture(GL_TEXTURE_2D, suntex);
-		glColor3f(1., 1., 1.);
-		OsuSphere(SUN_RADIUS_MILES, 64, 64);
-		SetPointLight(GL_LIGHT0, 0., 0., 0., 1., 1., 1.);
-	glEndList();
+	double tanHalf = tan(fovy * M_PI / 360.);
+	std::vector<int> expected(w * h);
+	for (int j = 0; j < h; j++)
+	{
+		for (int i = 0; i < w; i++)
+		{
+			double x = (2. * ((double)i + .5) / (double)w - 1.) * tanHalf;
+			double y = (2. * ((double)j + .5) / (double)h - 1.) * tanHalf;
+			double d[3];
+			for (int k = 0; k < 3; k++)
+				d[k] = f[k] + x * side[k] + y * up[k];
+			double dd = d[0]*d[0] + d[1]*d[1] + d[2]*d[2];
+
+			int id = 0;
+			double nearest = 1.e300;
+			for (int b = 0; b < Bodies.count; b++)
+			{
+				if ((Bodies.flags[b] & BODYSKY) != 0)
+					continue;
+				double oc[3] = { eye[0] - Bodies.frameX[b], eye[1], eye[2] - Bodies.frameZ[b] };
+				double r = Bodies.radius[b];
+				double hb = oc[0]*d[0] + oc[1]*d[1] + oc[2]*d[2];
+				double c = oc[0]*oc[0] + oc[1]*oc[1] + oc[2]*oc[2] - r*r;
+				double disc = hb*hb - dd*c;
+				if (disc < 0.)
+					continue;
+				double t = (-hb - sqrt(disc)) / dd;
+				if (t > 0. && t < nearest)
+				{
+					nearest = t;
+					id = b + 1;
+				}
+			}
+			expected[j*w + i] = id;
+		}
+	}
 
-	// stars display list
-	StarsList = glGenLists(1);
-		glNewList(StarsList, GL_COMPILE);
-		glShadeModel(GL_SMOOTH);
-		SetMaterial(1., 1., 1., 50.);
-		glEnable(GL_TEXTURE_2D);
-		glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
-		glBindTexture(GL_TEXTURE_2D, starstex);
-		OsuSphere(1000, 64., 64.);
-	glEndList();
+	// draw them:
+	unsigned char rgb[3];
+	DepthCheckColor(0, rgb);
+	glViewport(0, 0, w, h);
+	glClearColor((float)rgb[0] / 255.f, (float)rgb[1] / 255.f, (float)rgb[2] / 255.f, 1.f);
+	DepthFrameBegin();
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	RsEnable(GL_DEPTH_TEST);
+	RsDisable(GL_LIGHTING);
+	RsDisable(GL_TEXTURE_2D);
+	glDisable(GL_DITHER);
 
-	// earth display list
-	EarthList = glGenLists(1);
-		glNewList(EarthList, GL_COMPILE);
-		glShadeModel(GL_SMOOTH);
-		SetMaterial(1., 1., 1., 50.);
-		glEnable(GL_TEXTURE_2D);
-		glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
-		glBindTexture(GL_TEXTURE_2D, earthtex);
-		OsuSphere(EARTH_RADIUS_MILES, 64., 64.);
-	glEndList();
+	DepthProjection(fovy, 1., 0.1, 1.01 * farthest);
+	glMatrixMode(GL_MODELVIEW);
+	glLoadIdentity();
+	double yAxis[3] = { 0., 1., 0. };
+	glm::mat4 view = glm::mat4(LookAtWorld(&Bodies, eye, look, yAxis, CameraRelativeOn != 0));
+	glMultMatrixf(glm::value_ptr(view));
 
-	// moon display list
-	MoonList = glGenLists(1);
-		glNewList(MoonList, GL_COMPILE);
-		glShadeModel(GL_SMOOTH);
-		SetMaterial(1., 1., 1., 50.);
-		glEnable(GL_TEXTURE_2D);
-		glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
-		glBindTexture(GL_TEXTURE_2D, moontex);
-		OsuSphere(MOON_RADIUS_MILES, 64., 64.);
-	glEndList();
+	UseUnlitShading(false);
+	for (int b = 0; b < Bodies.count; b++)
+	{
+		if ((Bodies.flags[b] & BODYSKY) != 0)
+			continue;
+		DepthCheckColor(b + 1, rgb);
+		glColor3ubv(rgb);
+		glPushMatrix();
+		glMultMatrixf(glm::value_ptr(Bodies.world[b]));
+		DrawBodySphere(Bodies.radius[b]);
+		glPopMatrix();
+	}
+	UnbindSphereMesh();
+	if (skyBody >= 0)
+	{
+		RsUseProgram(0);
+		DepthCheckColor(0, rgb);
+		glColor3ubv(rgb);
+		DrawSkyboxShape(skyBody);
+	}
+	glEnable(GL_DITHER);
 
-	// create the axes:
-	AxesList = glGenLists(1);
-	glNewList(AxesList, GL_COMPILE);
-	glLineWidth(AXES_WIDTH);
-	Axes(1.5);
-	glLineWidth(1.);
-	glEndList();
+	std::vector<unsigned char> pixels(3 * w * h);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, w, h, GL_RGB, GL_UNSIGNED_BYTE, &pixels[0]);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glClearColor(BACKCOLOR[0], BACKCOLOR[1], BACKCOLOR[2], BACKCOLOR[3]);
+
+	// compare, away from the edges:
+	long wrong = 0;
+	*behindPixels = 0;
+	for (int j = DEPTHCHECKEDGE; j < h - DEPTHCHECKEDGE; j++)
+	{
+		for (int i = DEPTHCHECKEDGE; i < w - DEPTHCHECKEDGE; i++)
+		{
+			int id = expected[j*w + i];
+			bool edge = false;
+			for (int dj = -DEPTHCHECKEDGE; dj <= DEPTHCHECKEDGE && !edge; dj++)
+			{
+				for (int di = -DEPTHCHECKEDGE; di <= DEPTHCHECKEDGE && !edge; di++)
+					edge = expected[(j + dj)*w + i + di] != id;
+			}
+			if (edge)
+				continue;
+			if (id == behind + 1)
+				(*behindPixels)++;
+			if (DepthCheckId(&pixels[3 * (j*w + i)]) != id)
+				wrong++;
+		}
+	}
+	return wrong;
 }
 
-// the keyboard callback:
-void
-Keyboard(unsigned char c, int x, int y)
+
+// check that the depth buffer gets the bodies in the right order, at the scene's distances, in each depth mode:
+//	from two places where one body passes in front of another -- the moon across the sun, and the moon across
+//	the earth, seen from half the moon's orbit radius behind the moon -- each body is drawn in its own flat color
+//	with a narrow field of view, and every pixel is compared with the body a ray from the eye hits first
+//	(worked out in double precision).  Meant for realscale.txt, where the standard depth buffer loses the sun.
+// returns the number of wrong pixels in the best depth mode there is, or -1 if a body behind the moon does not
+// show at all (then there is nothing to check it against)
+
+long
+DepthCheck(double years)
 {
-	fprintf(stderr, "Keyboard: '%c' (0x%0x)\n", c, c);
+	int sun = FindBody("sun");
+	int earth = FindBody("earth");
+	int moon = FindBody("moon");
+	if (sun < 0 || earth < 0 || moon < 0)
+	{
+		fprintf(stderr, "The depth check needs a scene with a sun, an earth, and a moon\n");
+		return 1;
+	}
+	UpdateSceneState(years);
+
+	const char* viewNames[2] = { "moon across the sun", "moon across the earth" };
+	int behind[2] = { sun, earth };
+	double moonPos[3] = { Bodies.frameX[moon], 0., Bodies.frameZ[moon] };
+	double earthPos[3] = { Bodies.frameX[earth], 0., Bodies.frameZ[earth] };
+	double moonDistance = sqrt((moonPos[0] - earthPos[0])*(moonPos[0] - earthPos[0]) + (moonPos[2] - earthPos[2])*(moonPos[2] - earthPos[2]));
+
+	int bestMode = DepthBestMode();
+	int savedMode = DepthMode;
+	long bestWrong = 0;
+	bool hidden = false;
+	fprintf(stdout, "depth check at %.4f years (wrong pixels, more than %d pixels from an edge, %dx%d):\n",
+		years, DEPTHCHECKEDGE, HeadlessWidth, HeadlessHeight);
+	for (int v = 0; v < 2; v++)
+	{
+		// back from the moon, away from the body behind it, and off to the side by a bit more than the moon's
+		// radius, so the moon's edge crosses the other body:
+		double look[3] = { Bodies.frameX[behind[v]], 0., Bodies.frameZ[behind[v]] };
+		double u[3] = { look[0] - moonPos[0], 0., look[2] - moonPos[2] };
+		double len = sqrt(u[0]*u[0] + u[2]*u[2]);
+		u[0] /= len;	u[2] /= len;
+		double eye[3];
+		eye[0] = moonPos[0] - .5 * moonDistance * u[0] - 1.2 * Bodies.radius[moon] * u[2];
+		eye[1] = 0.;
+		eye[2] = moonPos[2] - .5 * moonDistance * u[2] + 1.2 * Bodies.radius[moon] * u[0];
+
+		// wide enough for both bodies:
+		double lookDistance = sqrt((look[0] - eye[0])*(look[0] - eye[0]) + (look[2] - eye[2])*(look[2] - eye[2]));
+		double fovy = 2. * (180. / M_PI) * std::max(Bodies.radius[behind[v]] / lookDistance, 2.4 * Bodies.radius[moon] / (.5 * moonDistance));
+
+		fprintf(stdout, "  %-22s", viewNames[v]);
+		long behindPixels = 0;
+		for (int m = 0; m < DEPTHNUMMODES; m++)
+		{
+			if (!DepthModeOK[m])
+				continue;
+			DepthMode = m;
+			long wrong = DepthCheckView(eye, look, fovy, behind[v], &behindPixels);
+			fprintf(stdout, "  %s %ld", DEPTHMODENAMES[m], wrong);
+			if (m == bestMode)
+				bestWrong += wrong;
+		}
+		fprintf(stdout, " (of %ld %s pixels)\n", behindPixels, Bodies.name[behind[v]].c_str());
+		if (behindPixels == 0)
+		{
+			fprintf(stderr, "The %s cannot be seen from behind the moon at %.4f years -- nothing to check\n",
+				Bodies.name[behind[v]].c_str(), years);
+			hidden = true;
+		}
+	}
+	DepthMode = savedMode;
+	DepthFrameBegin();
 
-	switch (c)
+	fprintf(stdout, "%s (%s depth)\n", bestWrong == 0 && !hidden ? "passed" : "FAILED", DEPTHMODENAMES[bestMode]);
+	return hidden ? -1 : bestWrong;
+}
+
+
+// the largest error, in pixels, of the ground points ahead of the eye in the current view over a run of frames:
+// (the eye turns with the body it stands on, so a point fixed to the body belongs at the same place in eye
+//  coordinates in every frame -- straight ahead, at its distance -- and anything else is jitter)
+
+double
+JitterView(int body, int frames, double startTime, double dt, double* worstMiles)
+{
+	double r = Bodies.radius[body];
+	double pixelsPerTan = .5 * (double)HeadlessHeight;	// (the 90-degree field of view)
+	double worst = 0.;
+	*worstMiles = 0.;
+	for (int f = 0; f < frames; f++)
 	{
+		UpdateSceneState(startTime + (double)f * dt);
 
-	// set view: Outside (top), sideways, earthview, moonview
-	case 'o':
-	case 'O':
-		Reset();
-		WhichPOV = OUTSIDE;
-		break;
-	case 's':
-	case 'S':
-		Reset();
-		WhichPOV = SIDEWAYS;
-		break;
-	case 'r':
-	case 'R':
-		Reset();
-		break;
-	case 'e':
-	case 'E':
-		WhichPOV = EARTHVIEW;
-		break;
-	case 'm':
-	case 'M':
-		WhichPOV = MOONVIEW;
-		break;
+		// the matrices opengl would be given for the body's vertices, multiplied out by opengl:
+		glMatrixMode(GL_MODELVIEW);
+		glLoadIdentity();
+		SetView();
+		glMultMatrixf(glm::value_ptr(Bodies.world[body]));
+		GLfloat mv[16];
+		glGetFloatv(GL_MODELVIEW_MATRIX, mv);
+
+		for (size_t k = 0; k < sizeof(JITTERDISTANCES) / sizeof(JITTERDISTANCES[0]); k++)
+		{
+			// (in float, like the vertex shader)
+			float d = (float)(JITTERDISTANCES[k] * r);
+			float q[3] = { (float)r, 0.f, -d };
+			float ex = mv[0]*q[0] + mv[4]*q[1] + mv[8]*q[2] + mv[12];
+			float ey = mv[1]*q[0] + mv[5]*q[1] + mv[9]*q[2] + mv[13];
+			double miles = sqrt((double)ex*(double)ex + (double)ey*(double)ey);
+			*worstMiles = std::max(*worstMiles, miles);
+			worst = std::max(worst, pixelsPerTan * miles / (double)d);
+		}
+	}
+	glLoadIdentity();
+	return worst;
+}
+
+
+// check that the earth and moon views hold still at the scene's distances, drawn relative to the eye
+// and (for comparison) in world coordinates -- meant for realscale.txt, where the earth is 93 million
+// miles from the origin and a float only gets its place to about 8 miles:
+// returns the largest error in pixels drawn relative to the eye
+
+double
+JitterCheck(int frames, double startTime, double dt)
+{
+	const char* viewNames[2] = { "earth view", "moon view" };
+	int povs[2] = { EARTHVIEW, MOONVIEW };
+	int bodies[2] = { EarthBody, MoonBody };
+	int savedPov = WhichPOV;
+	int savedRelative = CameraRelativeOn;
+	double worst = 0.;
+
+	fprintf(stdout, "jitter check, %d frames from %.4f years (largest error of the ground ahead of the eye, %dx%d):\n",
+		frames, startTime, HeadlessWidth, HeadlessHeight);
+	for (int v = 0; v < 2; v++)
+	{
+		if (bodies[v] < 0)
+			continue;
+		WhichPOV = povs[v];
+		fprintf(stdout, "  %-11s", viewNames[v]);
+		for (int relative = 1; relative >= 0; relative--)
+		{
+			CameraRelativeOn = relative;
+			double miles;
+			double pixels = JitterView(bodies[v], frames, startTime, dt, &miles);
+			fprintf(stdout, "  %s %.4f pixels (%.6f)", relative ? "camera-relative" : "world", pixels, miles);
+			if (relative)
+				worst = std::max(worst, pixels);
+		}
+		fprintf(stdout, "\n");
+	}
+	WhichPOV = savedPov;
+	CameraRelativeOn = savedRelative;
 
-	// turn orbit lines on or off
-	case 'c':
-	case 'C':
-		ORBIT_LINES_ON = !ORBIT_LINES_ON;
-		break;
+	fprintf(stdout, "%s (camera-relative, at most %.2f pixels)\n", worst <= JITTERMAXPIXELS ? "passed" : "FAILED", JITTERMAXPIXELS);
+	return worst;
+}
 
-	// turn sun's light on or off
-	case '0':	// entering '0' or '6' will turn on/off the first/white light 
-	case '6':
-		Light0On = !Light0On;
-		break;
 
-	// freeze or resume animation
-	case 'f':	// entering 'f' or 'F' will turn on/off all animation
-	case 'F':
-		Frozen = !Frozen;
-		if (Frozen)
-			glutIdleFunc(NULL);
-		else
-			glutIdleFunc(Animate);
-		break;
-	case ESCAPE:
-		DoMainMenu(QUIT);	// will not return here
-		break;				// happy compiler
+// frame rates with more and more bodies, drawn one at a time and instanced:
+// (the belts use a texture the default scene already has, so the texture loads still line up)
+void
+BenchInstancing(int frames, double startTime, double dt)
+{
+	const int counts[] = { 0, 1000, 2000, 5000, 10000, 20000 };
+	const int numCounts = sizeof(counts) / sizeof(counts[0]);
 
-	default:
-		fprintf(stderr, "Don't know what to do with keyboard hit: '%c' (0x%0x)\n", c, c);
+	fprintf(stdout, "%8s  %16s  %16s\n", "bodies", "one at a time", "instanced");
+	for (int c = 0; c < numCounts; c++)
+	{
+		char belt[256];
+		snprintf(belt, sizeof(belt), "belt asteroid sun %d  60 90  0.05 0.4  1100  moon.bmp 128 128 128\n", counts[c]);
+		std::string text = std::string(DEFAULTSCENE) + belt;
+		FramePipelineSync();		// (the worker reads the scene)
+		ParseScene(text.c_str(), "instance benchmark");
+
+		double fps[2];
+		for (int mode = 0; mode < 2; mode++)
+		{
+			InstancingOn = mode;
+			std::vector<double> frameMs;
+			double vertices;
+			double total = TimeFrames(frames, startTime, dt, &frameMs, &vertices);
+			fps[mode] = (double)frames / total;
+		}
+		fprintf(stdout, "%8d  %12.1f fps  %12.1f fps\n", Bodies.count, fps[0], InstancingOK ? fps[1] : 0.);
 	}
+}
 
-	// force a call to Display( ):
 
-	glutSetWindow(MainWindow);
-	glutPostRedisplay();
+// time each point of view on its own, drawn the size of a quarter of the window (so the same pixels as one view
+// of the quad view), then the quad view -- which should cost well under the four of them, since the bodies are
+// moved once and culled for all four views in one pass:
+void
+BenchViews(int frames, double startTime, double dt)
+{
+	const char* povNames[] = { "outside", "sideways", "earth", "moon" };
+	int savedWidth = HeadlessWidth, savedHeight = HeadlessHeight;
+	std::vector<double> frameMs;
+	double vertices;
+	double sumMs = 0.;
+
+	fprintf(stdout, "view bench, %d frames, %d bodies:\n", frames, Bodies.count);
+	HeadlessWidth = savedWidth / 2;		// (draws into the lower-left quarter of the framebuffer)
+	HeadlessHeight = savedHeight / 2;
+	for (int pov = OUTSIDE; pov <= MOONVIEW; pov++)
+	{
+		QuadViewOn = 0;
+		WhichPOV = pov;
+		double total = TimeFrames(frames, startTime, dt, &frameMs, &vertices);
+		double ms = 1000. * total / (double)frames;
+		sumMs += ms;
+		fprintf(stdout, "  %-10s %dx%d  %8.3f ms/frame (stages: move %.3f, cull %.3f, draw %.3f)\n", povNames[pov],
+			HeadlessWidth, HeadlessHeight, ms, FrameTotal.moveMs / (double)frames, FrameTotal.cullMs / (double)frames,
+			FrameTotal.drawMs / (double)frames);
+	}
+	HeadlessWidth = savedWidth;
+	HeadlessHeight = savedHeight;
+
+	QuadViewOn = 1;
+	double total = TimeFrames(frames, startTime, dt, &frameMs, &vertices);
+	double quadMs = 1000. * total / (double)frames;
+	fprintf(stdout, "  %-10s %dx%d  %8.3f ms/frame (stages: move %.3f, cull %.3f, draw %.3f)\n", "quad",
+		HeadlessWidth, HeadlessHeight, quadMs, FrameTotal.moveMs / (double)frames, FrameTotal.cullMs / (double)frames,
+		FrameTotal.drawMs / (double)frames);
+	fprintf(stdout, "quad view: %.2f x the average single view, %.0f%% of the four drawn one at a time\n",
+		quadMs / (sumMs / 4.), 100. * quadMs / sumMs);
+	QuadViewOn = 0;
 }
 
 
-// called when the mouse button transitions down or up:
+// run the frame pacing modes one after another for some seconds each, the way the glut main loop would,
+// and print what each costs:
+// (offscreen there is no vsync, so that mode is left out; on-demand is run frozen, when it should draw nothing)
 void
-MouseButton(int button, int state, int x, int y)
+BenchPacing(double seconds, double startTime)
 {
-	int b = 0;			// LEFT, MIDDLE, or RIGHT
+	const int modes[] = { PACECAPPED, PACEONDEMAND, PACEUNCAPPED };
+	fprintf(stdout, "%-20s %8s %7s %10s %8s %6s\n", "pacing", "fps", "cpu %", "jitter ms", "p99 ms", "late");
+	fprintf(stdout, "%-20s (no vsync offscreen)\n", PACEMODENAMES[PACEVSYNC]);
+	for (int k = 0; k < 3; k++)
+	{
+		PaceSetMode(modes[k]);
+		bool frozen = modes[k] == PACEONDEMAND;
+		SimClockSet(startTime);
+		SimClockPause(frozen);
+		UpdateSimTime();
+		Display();		// (one frame to get going)
+		glFinish();
 
-	if (DebugOn != 0)
-		fprintf(stderr, "MouseButton: %d, %d, %d, %d\n", button, state, x, y);
+		PaceStatsStart(&PaceTotal);
+		double end = WallSeconds() + seconds;
+		while (WallSeconds() < end)
+		{
+			if (!PaceAnimating(frozen))
+			{
+				// nothing asks for a frame, so glut would wait in its event loop the whole time:
+				std::this_thread::sleep_for(std::chrono::duration<double>(end - WallSeconds()));
+				break;
+			}
+			PaceWait();
+			SimClockTick(WallSeconds());
+			UpdateSimTime();
+			Display();
+			glFinish();		// (the buffer swap would wait for the drawing)
+		}
+		struct PaceReport r = PaceSummarize(&PaceTotal);
+
+		char name[64];
+		if (modes[k] == PACECAPPED)
+			snprintf(name, sizeof(name), "%s (%.0f fps)", PACEMODENAMES[modes[k]], PaceTargetFps);
+		else if (frozen)
+			snprintf(name, sizeof(name), "%s (frozen)", PACEMODENAMES[modes[k]]);
+		else
+			snprintf(name, sizeof(name), "%s", PACEMODENAMES[modes[k]]);
+		fprintf(stdout, "%-20s %8.1f %7.1f %10.3f %8.3f %6ld\n", name, r.fps, r.cpuPercent, r.jitterMs, r.p99Ms, r.late);
+	}
+	SimClockPause(false);
+}
 
 
-	// get the proper button bit mask:
-	switch (button)
+// draw every point of view at each of GOLDENYEARS, lit by the fixed-function pipeline and by the shaders, and
+// compare them with the golden images in dir (or, with update true, make them the golden images):
+// (the shader cases are drawn again with logarithmic depth, if there is such a thing here, and compared with the
+//  same golden images -- the depth mode should not change the picture)
+// returns the number of cases that failed
+
+int
+GoldenCheck(const char* dir, bool update)
+{
+	const char* povNames[] = { "outside", "sideways", "earth", "moon" };
+	int numYears = sizeof(GOLDENYEARS) / sizeof(GOLDENYEARS[0]);
+	int numLightings = update || !DepthModeOK[DEPTHLOG] ? 2 : 3;
+	std::vector<struct GoldenCase> cases(numLightings * 4 * numYears);
+	int savedMode = DepthMode;
+	FramePipelineOn = 0;		// (so each picture is drawn at its own time)
+	QuadViewOn = 0;
+	SkyCountFragments = false;
+
+	double start = WallSeconds();
+	GoldenStart(dir, update);
+	int n = 0;
+	for (int lighting = 0; lighting < numLightings; lighting++)
 	{
-	case GLUT_LEFT_BUTTON:
-		b = LEFT;		break;
+		DepthMode = lighting == 2 ? DEPTHLOG : savedMode;
+		for (int pov = OUTSIDE; pov <= MOONVIEW; pov++)
+		{
+			for (int y = 0; y < numYears; y++)
+			{
+				struct GoldenCase* c = &cases[n++];
+				snprintf(c->golden, sizeof(c->golden), "%s-%.3f-%s", povNames[pov], GOLDENYEARS[y], lighting ? "shader" : "fixed");
+				snprintf(c->name, sizeof(c->name), "%s%s", c->golden, lighting == 2 ? "-log" : "");
+				WhichPOV = pov;
+				ShaderLightingOn = lighting != 0;
+				if (lighting == 2)
+					InstTexturesStale = true;	// (put together again after a log-depth frame, as in a --depth log run)
+				SimClockSet(GOLDENYEARS[y]);
+				UpdateSimTime();
+				Display();
+
+				c->width = HeadlessWidth;
+				c->height = HeadlessHeight;
+				c->rgba.resize(4 * (size_t)c->width * c->height);
+				glReadPixels(0, 0, c->width, c->height, GL_RGBA, GL_UNSIGNED_BYTE, &c->rgba[0]);
+				GoldenSubmit(c);
+			}
+		}
+	}
+	GoldenFinish();
+	DepthMode = savedMode;
+	DepthFrameBegin();
+	double seconds = WallSeconds() - start;
+
+	int failed = 0;
+	if (!ShadingOK)
+		fprintf(stderr, "No shaders here -- the shader cases are lit by the fixed-function pipeline\n");
+	if (update)
+	{
+		for (int i = 0; i < n; i++)
+			if (!cases[i].passed)
+			{
+				fprintf(stdout, "  FAILED  %s: %s\n", cases[i].name, cases[i].message);
+				failed++;
+			}
+		fprintf(stdout, "wrote %d golden images, %dx%d, to %s/ (%.2f s)\n", n - failed, HeadlessWidth, HeadlessHeight, dir, seconds);
+		return failed;
+	}
 
-	case GLUT_MIDDLE_BUTTON:
-		b = MIDDLE;		break;
+	fprintf(stdout, "golden check: %d cases, %dx%d, against %s/ (delta E tolerance %.1f, %.1f%% of the pixels):\n", n,
+		HeadlessWidth, HeadlessHeight, dir, GoldenTolerance, 100. * GOLDENMAXWRONG);
+	for (int i = 0; i < n; i++)
+	{
+		struct GoldenCase* c = &cases[i];
+		if (c->message[0] != '\0')
+			fprintf(stdout, "  FAILED  %-28s %s\n", c->name, c->message);
+		else
+			fprintf(stdout, "  %-6s  %-28s max delta E %6.2f, %ld pixels over%s%s%s\n", c->passed ? "ok" : "FAILED", c->name,
+				c->maxDeltaE, c->wrong, c->passed ? "" : " (see ", c->passed ? "" : dir, c->passed ? "" : "/failed/)");
+		if (!c->passed)
+			failed++;
+	}
+	fprintf(stdout, "%s (%d of %d cases failed, %.2f s)\n", failed == 0 ? "passed" : "FAILED", failed, n, seconds);
+	return failed;
+}
 
-	case GLUT_RIGHT_BUTTON:
-		b = RIGHT;		break;
 
-	case SCROLL_WHEEL_UP:
-		Scale += SCLFACT * SCROLL_WHEEL_CLICK_FACTOR;
-		// keep object from turning inside-out or disappearing:
-		if (Scale < MINSCALE)
-			Scale = MINSCALE;
-		break;
+// draw and capture frames one after another, the clock set to exactly frame / fps seconds of animation after
+// startTime each time (so a capture is the same every time, however long the frames take to draw and save):
+// returns false if any frame could not be written
 
-	case SCROLL_WHEEL_DOWN:
-		Scale -= SCLFACT * SCROLL_WHEEL_CLICK_FACTOR;
-		// keep object from turning inside-out or disappearing:
-		if (Scale < MINSCALE)
-			Scale = MINSCALE;
-		break;
+bool
+RunCapture(int frames, double startTime, double fps)
+{
+	FramePipelineOn = 0;		// (so each frame is drawn at its own time, not the one before's)
+	SkyCountFragments = false;
 
-	default:
-		b = 0;
-		fprintf(stderr, "Unknown mouse button: %d\n", button);
+	double start = WallSeconds();
+	for (int i = 0; i < frames; i++)
+	{
+		SimClockSet(startTime + (double)i * Sim.warp / (fps * SIMREALSECONDSPERYEAR));
+		UpdateSimTime();
+		Display();
+		CaptureFrame();
 	}
+	double drawn = WallSeconds() - start;
+	bool ok = CaptureFinish();
+	double total = WallSeconds() - start;
+
+	long n = CaptureTotal.frames > 0 ? CaptureTotal.frames : 1;
+	fprintf(stdout, "captured:      %ld frames, %dx%d, as %s, years %.6f to %.6f\n", CaptureTotal.frames, CaptureWidth,
+		CaptureHeight, CAPTUREFORMATNAMES[CaptureFormat], startTime,
+		startTime + (double)(frames - 1) * Sim.warp / (fps * SIMREALSECONDSPERYEAR));
+	fprintf(stdout, "total time:    %.3f s (%.3f s drawing, then %.3f s for the workers to finish), %.2f frames/sec\n",
+		total, drawn, total - drawn, total > 0. ? (double)CaptureTotal.frames / total : 0.);
+	fprintf(stdout, "readback:      %.3f ms/frame on the drawing thread, %ld fence waits (%.3f ms)\n",
+		CaptureTotal.readMs / (double)n, CaptureTotal.fenceWaits, CaptureTotal.fenceWaitMs);
+	fprintf(stdout, "encoding:      %.3f ms/frame on the workers, %ld waits for them (%.3f ms), %.2f MB written\n",
+		CaptureTotal.encodeMs / (double)n, CaptureTotal.poolWaits, CaptureTotal.poolWaitMs, CaptureTotal.bytes / 1.e6);
+	if (CaptureTotal.failures > 0)
+		fprintf(stdout, "failures:      %ld\n", CaptureTotal.failures);
+	return ok;
+}
 
-	// button down sets the bit, up clears the bit:
 
-	if (state == GLUT_DOWN)
+// ray trace frames one after another with no opengl at all, the clock set to exactly startTime + frame * dt years
+// each time, timing each frame and capturing it if CaptureStart( ) was called:
+// returns false if any frame could not be captured (or there are no frames to trace)
+
+bool
+RunRayTrace(int frames, double startTime, double dt, int size, int threads)
+{
+	if (frames < 1)
 	{
-		Xmouse = x;
-		Ymouse = y;
-		ActiveButton |= b;		// set the proper bit
+		fprintf(stderr, "Cannot ray trace %d frames\n", frames);
+		return false;
 	}
-	else
+	RayTraceStart(threads);
+	double t0 = WallSeconds();
+	RayTraceLoadTextures();
+	double textureMs = 1000. * (WallSeconds() - t0);
+
+	static struct FramePacket packet;
+	std::vector<unsigned char> image;
+	std::vector<double> frameMs;
+	frameMs.reserve(frames);
+	memset(&RayTraceTotal, 0, sizeof(RayTraceTotal));
+	double moveMs = 0.;
+	double start = WallSeconds();
+	for (int i = 0; i < frames; i++)
 	{
-		ActiveButton &= ~b;		// clear the proper bit
+		SimClockSet(startTime + (double)i * dt);
+		UpdateSimTime();
+
+		double f0 = WallSeconds();
+		struct FrameInputs in;
+		GetFrameInputs(FindSkyBody() >= 0, QuadViewOn ? QuadViewportSize(size, size) : size, &in);
+		ComputeFrame(&in, &packet);
+		moveMs += packet.moveMs + packet.cullMs;
+		RayTraceFrame(&packet, size, size, &image);
+		frameMs.push_back(1000. * (WallSeconds() - f0));
+		CaptureFramePixels(&image[0]);
 	}
-
-	glutSetWindow(MainWindow);
-	glutPostRedisplay();
-
+	double total = WallSeconds() - start;
+	bool ok = CaptureFinish();
+	double views = RayTraceTotal.frames > 0 ? (double)RayTraceTotal.frames : 1.;
+
+	const char* povNames[] = { "outside", "sideways", "earth", "moon" };
+	fprintf(stdout, "renderer:      ray traced on the cpu, %d thread(s), %s packets of %d rays, shadows %s\n", RtNumThreads,
+		RTSIMDNAME, RTLANES, ShadowsOn ? "on" : "off");
+	fprintf(stdout, "view:          %s, %dx%d\n", QuadViewOn ? "all four (quad)" : povNames[WhichPOV], size, size);
+	fprintf(stdout, "bodies:        %d\n", Bodies.count);
+	PrintFrameStats(stdout, frameMs, total);
+	fprintf(stdout, "texture load:  %.3f ms\n", textureMs);
+	fprintf(stdout, "stages ms/frame: move and cull %.3f, bin %.3f, trace %.3f\n", moveMs / (double)frames,
+		RayTraceTotal.setupMs / (double)frames, RayTraceTotal.traceMs / (double)frames);
+	fprintf(stdout, "rays:          %.2f M/sec traced, %.2f sphere tests/ray, %.1f spheres/tile\n",
+		RayTraceTotal.traceMs > 0. ? RayTraceTotal.rays / (1000. * RayTraceTotal.traceMs) : 0.,
+		RayTraceTotal.rays > 0. ? RayTraceTotal.tests / RayTraceTotal.rays : 0.,
+		RayTraceTotal.tiles > 0. ? RayTraceTotal.binned / RayTraceTotal.tiles : 0.);
+	fprintf(stdout, "tiles stolen:  %.1f/view\n", (double)RayTraceTotal.steals / views);
+	if (CaptureTotal.frames > 0)
+		fprintf(stdout, "captured:      %ld frames as %s, %.3f ms/frame on the workers, %ld waits for them (%.3f ms), %.2f MB\n",
+			CaptureTotal.frames, CAPTUREFORMATNAMES[CaptureFormat], CaptureTotal.encodeMs / (double)CaptureTotal.frames,
+			CaptureTotal.poolWaits, CaptureTotal.poolWaitMs, CaptureTotal.bytes / 1.e6);
+	if (CaptureTotal.failures > 0)
+		fprintf(stdout, "failures:      %ld\n", CaptureTotal.failures);
+	RayTraceStop();
+	return ok;
 }
 
 
-// called when the mouse moves while a button is down:
-void
-MouseMotion(int x, int y)
-{
-	int dx = x - Xmouse;		// change in mouse coords
-	int dy = y - Ymouse;
+// headless benchmark mode:
+//	renders a fixed number of frames into an offscreen framebuffer,
+//	running the sim clock for a fixed amount of time (--dt years) each frame, and prints the frame timings
+//
+//	final --headless [--scene FILE] [--frames N] [--start T] [--dt T] [--size PIXELS] [--view outside|sideways|earth|moon|quad]
+//		[--lod on|off] [--instancing on|off] [--lighting fixed|shader] [--culling on|off] [--occlusion on|off]
+//		[--sky cube|sphere] [--depth standard|reversed|log] [--camera relative|world] [--pipeline on|off]
+//		[--loader mmap|stdio] [--textures compressed|raw] [--ring persistent|orphan] [--profile TRACE.json]
+//
+//	final --headless --texture-bench N
+//		loads the textures N times with each bmp loader and prints the average startup cost
+//
+//	final --headless --depth-check [--scene realscale.txt] [--start T] [--size PIXELS]
+//		checks that each depth mode draws the bodies in the right order at the scene's distances (see DepthCheck( )),
+//		at DEPTHCHECKYEARS if there is no --start
+//
+//	final --headless --jitter-check [--scene realscale.txt] [--frames N] [--start T] [--dt T]
+//		checks that the earth and moon views hold still at the scene's distances (see JitterCheck( ))
+//
+//	final --headless --instance-bench [--frames N] ...
+//		draws the scene plus belts of more and more asteroids, one body at a time and instanced
+//
+//	final --headless --view-bench [--frames N] ...
+//		times each view on its own at the size of a quarter of the window, then all four at once (see BenchViews( ))
+//
+//	final --headless --pacing-bench SECONDS [--fps N] ...
+//		runs each frame pacing mode for SECONDS and prints its frame rate, cpu use, and jitter (see BenchPacing( ))
+//
+//	final --headless --golden [DIR] [--golden-update] [--golden-tolerance DELTAE]
+//		draws each view at a few fixed times, lit both ways, and compares them with the golden images in DIR
+//		(golden/ by default), writing the failures and diff images to DIR/failed/ (see GoldenCheck( ))
+//
+//	final --headless --capture PREFIX [--capture-format png|yuv] [--capture-fps F] [--start T] [--end T | --frames N] [--warp W] ...
+//	final --headless --capture-pipe "COMMAND" [--capture-fps F] ...
+//		draws the frames from --start to --end years, --capture-fps a second of the animation at warp W, and saves
+//		them as PREFIX00000.png, ... or .yuv, or as a yuv4mpeg2 stream into COMMAND (see RunCapture( ))
+//
+//	final --headless --raytrace [--threads N] [--shadows on|off] [--view ...] [--frames N] [--start T] [--dt T] [--size PIXELS]
+//		[--capture PREFIX ... | --capture-pipe "COMMAND" ...]
+//		ray traces the frames on the cpu, with no opengl context (or gpu) at all, and prints the frame timings,
+//		or captures them as above (see RunRayTrace( ))
 
-	if ((ActiveButton & LEFT) != 0)
+int
+RunHeadless(int argc, char* argv[])
+{
+	int frames = 600;
+	double startTime = 0.;								// in years
+	bool startGiven = false;
+	double dt = 1. / (SIMREALSECONDSPERYEAR * 60.);		// one 60 fps frame at warp 1
+	int size = INIT_WINDOW_SIZE;
+	int pov = OUTSIDE;
+	int lod = 1;
+	int instancing = 1;
+	int shaderLighting = 0;
+	int culling = 1;
+	int occlusion = 0;
+	int skybox = 1;
+	int depthMode = -1;		// (the best there is)
+	bool depthCheck = false;
+	bool jitterCheck = false;
+	int cameraRelative = 1;
+	int pipeline = 1;
+	bool instanceBench = false;
+	int textureBench = 0;
+	char* traceFile = NULL;
+	double pacingBench = 0.;
+	bool viewBench = false;
+	char* capturePrefix = NULL;
+	char* captureCommand = NULL;
+	int captureFormat = CAPTUREPNG;
+	double captureFps = 30.;
+	double endTime = -1.;
+	char* goldenDir = NULL;
+	bool goldenUpdate = false;
+	bool rayTrace = false;
+	int rayThreads = 0;		// (one a core)
+	int shadows = 0;
+
+	for (int i = 1; i < argc; i++)
 	{
-		Xrot += (ANGFACT * dy);
-		Yrot += (ANGFACT * dx);
+		if (strcmp(argv[i], "--headless") == 0)
+			continue;
+		else if (strcmp(argv[i], "--scene") == 0 && i + 1 < argc)
+			i++;		// (already read by InitScene( ))
+		else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+			frames = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--start") == 0 && i + 1 < argc)
+		{
+			startTime = atof(argv[++i]);
+			startGiven = true;
+		}
+		else if (strcmp(argv[i], "--dt") == 0 && i + 1 < argc)
+			dt = atof(argv[++i]);
+		else if (strcmp(argv[i], "--lod") == 0 && i + 1 < argc)
+			lod = strcmp(argv[++i], "off") != 0;
+		else if (strcmp(argv[i], "--instancing") == 0 && i + 1 < argc)
+			instancing = strcmp(argv[++i], "off") != 0;
+		else if (strcmp(argv[i], "--lighting") == 0 && i + 1 < argc)
+			shaderLighting = strcmp(argv[++i], "shader") == 0;
+		else if (strcmp(argv[i], "--culling") == 0 && i + 1 < argc)
+			culling = strcmp(argv[++i], "off") != 0;
+		else if (strcmp(argv[i], "--occlusion") == 0 && i + 1 < argc)
+			occlusion = strcmp(argv[++i], "off") != 0;
+		else if (strcmp(argv[i], "--sky") == 0 && i + 1 < argc)
+			skybox = strcmp(argv[++i], "sphere") != 0;
+		else if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc)
+		{
+			char* d = argv[++i];
+			if (strcmp(d, "standard") == 0)			depthMode = DEPTHSTANDARD;
+			else if (strcmp(d, "reversed") == 0)	depthMode = DEPTHREVERSED;
+			else if (strcmp(d, "log") == 0)			depthMode = DEPTHLOG;
+			else
+				fprintf(stderr, "Don't know what depth '%s' is\n", d);
+		}
+		else if (strcmp(argv[i], "--depth-check") == 0)
+			depthCheck = true;
+		else if (strcmp(argv[i], "--jitter-check") == 0)
+			jitterCheck = true;
+		else if (strcmp(argv[i], "--camera") == 0 && i + 1 < argc)
+			cameraRelative = strcmp(argv[++i], "world") != 0;
+		else if (strcmp(argv[i], "--pipeline") == 0 && i + 1 < argc)
+			pipeline = strcmp(argv[++i], "off") != 0;
+		else if (strcmp(argv[i], "--instance-bench") == 0)
+			instanceBench = true;
+		else if (strcmp(argv[i], "--loader") == 0 && i + 1 < argc)
+			MappedBmpOn = strcmp(argv[++i], "stdio") != 0;
+		else if (strcmp(argv[i], "--textures") == 0 && i + 1 < argc)
+			CompressedTexturesOn = strcmp(argv[++i], "raw") != 0;
+		else if (strcmp(argv[i], "--ring") == 0 && i + 1 < argc)
+			RingPersistentOn = strcmp(argv[++i], "orphan") != 0;
+		else if (strcmp(argv[i], "--view-bench") == 0)
+			viewBench = true;
+		else if (strcmp(argv[i], "--golden") == 0)
+			goldenDir = (i + 1 < argc && argv[i + 1][0] != '-') ? argv[++i] : (char*)"golden";
+		else if (strcmp(argv[i], "--golden-update") == 0)
+			goldenUpdate = true;
+		else if (strcmp(argv[i], "--golden-tolerance") == 0 && i + 1 < argc)
+			GoldenTolerance = atof(argv[++i]);
+		else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc)
+			capturePrefix = argv[++i];
+		else if (strcmp(argv[i], "--capture-pipe") == 0 && i + 1 < argc)
+			captureCommand = argv[++i];
+		else if (strcmp(argv[i], "--capture-format") == 0 && i + 1 < argc)
+			captureFormat = strcmp(argv[++i], "yuv") == 0 ? CAPTUREYUV : CAPTUREPNG;
+		else if (strcmp(argv[i], "--capture-fps") == 0 && i + 1 < argc)
+			captureFps = atof(argv[++i]);
+		else if (strcmp(argv[i], "--end") == 0 && i + 1 < argc)
+			endTime = atof(argv[++i]);
+		else if (strcmp(argv[i], "--warp") == 0 && i + 1 < argc)
+			SimClockSetWarp(atof(argv[++i]));
+		else if (strcmp(argv[i], "--raytrace") == 0)
+			rayTrace = true;
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+			rayThreads = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--shadows") == 0 && i + 1 < argc)
+			shadows = strcmp(argv[++i], "off") != 0;
+		else if (strcmp(argv[i], "--pacing-bench") == 0 && i + 1 < argc)
+			pacingBench = atof(argv[++i]);
+		else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc)
+			PaceTargetFps = atof(argv[++i]);
+		else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+			traceFile = argv[++i];
+		else if (strcmp(argv[i], "--texture-bench") == 0 && i + 1 < argc)
+			textureBench = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+			size = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--view") == 0 && i + 1 < argc)
+		{
+			char* v = argv[++i];
+			if (strcmp(v, "outside") == 0)			pov = OUTSIDE;
+			else if (strcmp(v, "sideways") == 0)	pov = SIDEWAYS;
+			else if (strcmp(v, "earth") == 0)		pov = EARTHVIEW;
+			else if (strcmp(v, "moon") == 0)		pov = MOONVIEW;
+			else if (strcmp(v, "quad") == 0)		pov = QUADVIEW;
+			else
+				fprintf(stderr, "Don't know what view '%s' is\n", v);
+		}
+		else
+			fprintf(stderr, "Don't know what to do with argument '%s'\n", argv[i]);
 	}
 
-	if ((ActiveButton & MIDDLE) != 0)
+	if (frames < 1)
+		frames = 1;
+	if (size < 1)
+		size = INIT_WINDOW_SIZE;
+	if (goldenUpdate && goldenDir == NULL)
+		goldenDir = (char*)"golden";
+	if (goldenDir != NULL)
+		size = GOLDENSIZE;
+	bool capture = capturePrefix != NULL || captureCommand != NULL;
+	if (capture)
 	{
-		Scale += SCLFACT * (float)(dx - dy);
+		if (captureFps <= 0.)
+			captureFps = 30.;
+		if (endTime >= 0.)
+		{
+			// (the clock runs backward with a negative warp, so the end must be on that side of the start)
+			if ((endTime - startTime) * Sim.warp < 0.)
+			{
+				fprintf(stderr, "--end %g is %s --start %g, and the clock runs %s (warp %g)\n", endTime,
+					endTime < startTime ? "before" : "after", startTime, Sim.warp < 0. ? "backward" : "forward", Sim.warp);
+				return 1;
+			}
+			frames = 1 + (int)floor(fabs(endTime - startTime) * SIMREALSECONDSPERYEAR * captureFps / fabs(Sim.warp) + 1.e-9);
+			if (frames < 1)
+				frames = 1;
+		}
+		if (captureCommand != NULL)
+			captureFormat = CAPTUREPIPE;
+	}
 
-		// keep object from turning inside-out or disappearing:
+	Headless = true;
 
-		if (Scale < MINSCALE)
-			Scale = MINSCALE;
+	// the ray tracer needs no opengl, so it runs without ever making a context:
+	if (rayTrace)
+	{
+		Reset();
+		QuadViewOn = pov == QUADVIEW;
+		WhichPOV = QuadViewOn ? OUTSIDE : pov;
+		ShadowsOn = shadows;
+		Light0On = true;
+		if (capture)
+		{
+			dt = Sim.warp / (captureFps * SIMREALSECONDSPERYEAR);
+			if (!CaptureStart(captureFormat, capturePrefix, captureCommand, size, size, captureFps, false))
+				return 1;
+		}
+		return RunRayTrace(frames, startTime, dt, size, rayThreads) ? 0 : 1;
 	}
 
-	Xmouse = x;			// new current position
-	Ymouse = y;
-
-	glutSetWindow(MainWindow);
-	glutPostRedisplay();
-}
+	if (textureBench <= 0)
+		StartTextureLoads();		// (after --loader has been looked at)
+	if (!HeadlessInit(size, size))
+		return 1;
 
+	if (textureBench > 0)
+	{
+		BenchTextureLoaders(textureBench);
+		HeadlessFinish();
+		return 0;
+	}
 
-// reset the transformations and the colors:
-// this only sets the global variables --
-// the glut main loop is responsible for redrawing the scene
-void
-Reset()
-{
-	ActiveButton = 0;
-	AxesOn = 1;
-	DebugOn = 0;
-	DepthBufferOn = 1;
-	DepthFightingOn = 0;
-	DepthCueOn = 0;
-	Scale = 1.0;
-	ShadowsOn = 0;
-	WhichColor = WHITE;
-	WhichProjection = PERSP;
-	Xrot = Yrot = 0.;
-}
+	glClearColor(BACKCOLOR[0], BACKCOLOR[1], BACKCOLOR[2], BACKCOLOR[3]);
+	double t0 = WallSeconds();
+	InitTextures();
+	FinishTextureLoads();		// the benchmark should not time the placeholders
+	glFinish();
+	double textureMs = 1000. * (WallSeconds() - t0);
+	InitLists();
+	Reset();
+	QuadViewOn = pov == QUADVIEW;
+	WhichPOV = QuadViewOn ? OUTSIDE : pov;
+	LodOn = lod;
+	InstancingOn = instancing;
+	ShaderLightingOn = shaderLighting;
+	CullingOn = culling;
+	OcclusionOn = occlusion;
+	SkyboxOn = skybox;
+	CameraRelativeOn = cameraRelative;
+	FramePipelineOn = pipeline;
+	ProfileOn = traceFile != NULL;
+	if (depthMode >= 0)
+	{
+		if (!DepthModeOK[depthMode])
+			fprintf(stderr, "This OpenGL cannot do %s depth -- using %s\n", DEPTHMODENAMES[depthMode], DEPTHMODENAMES[DepthMode]);
+		else
+			DepthMode = depthMode;
+	}
+	SkyCountFragments = true;	// (to compare how much of the window the sky fills each way)
+	Light0On = true;		// benchmark the lit scene
+	FramePipelineStart(ComputeFrame);
 
+	if (depthCheck)
+	{
+		long wrong = DepthCheck(startGiven ? startTime : DEPTHCHECKYEARS);
+		FramePipelineStop();
+		FinishTexCacheWrites();
+		HeadlessFinish();
+		return wrong == 0 ? 0 : 1;
+	}
 
-// called when user resizes the window:
-void
-Resize(int width, int height)
-{
-	// don't really need to do anything since window size is
-	// checked each time in Display( ):
+	if (jitterCheck)
+	{
+		double worst = JitterCheck(frames, startTime, dt);
+		FramePipelineStop();
+		FinishTexCacheWrites();
+		HeadlessFinish();
+		return worst <= JITTERMAXPIXELS ? 0 : 1;
+	}
 
-	glutSetWindow(MainWindow);
-	glutPostRedisplay();
-}
+	if (instanceBench)
+	{
+		BenchInstancing(frames, startTime, dt);
+		FramePipelineStop();
+		FinishTexCacheWrites();
+		HeadlessFinish();
+		return 0;
+	}
 
+	if (viewBench)
+	{
+		BenchViews(frames, startTime, dt);
+		FramePipelineStop();
+		FinishTexCacheWrites();
+		HeadlessFinish();
+		return 0;
+	}
 
-// handle a change to the window's visibility:
+	if (goldenDir != NULL)
+	{
+		int failed = GoldenCheck(goldenDir, goldenUpdate);
+		FramePipelineStop();
+		FinishTexCacheWrites();
+		HeadlessFinish();
+		return failed == 0 ? 0 : 1;
+	}
 
-void
-Visibility(int state)
-{
-	if (DebugOn != 0)
-		fprintf(stderr, "Visibility: %d\n", state);
+	if (capture)
+	{
+		bool ok = CaptureStart(captureFormat, capturePrefix, captureCommand, size, size, captureFps, true) &&
+			RunCapture(frames, startTime, captureFps);
+		FramePipelineStop();
+		FinishTexCacheWrites();
+		HeadlessFinish();
+		return ok ? 0 : 1;
+	}
 
-	if (state == GLUT_VISIBLE)
+	if (pacingBench > 0.)
 	{
-		glutSetWindow(MainWindow);
-		glutPostRedisplay();
+		BenchPacing(pacingBench, startTime);
+		FramePipelineStop();
+		FinishTexCacheWrites();
+		HeadlessFinish();
+		return 0;
 	}
+
+	std::vector<double> frameMs;
+	double vertices = 0.;
+	double total = TimeFrames(frames, startTime, dt, &frameMs, &vertices);
+
+	const char* povNames[] = { "outside", "sideways", "earth", "moon" };
+	fprintf(stdout, "view:          %s, %dx%d\n", QuadViewOn ? "all four (quad)" : povNames[WhichPOV], size, size);
+	fprintf(stdout, "bodies:        %d\n", Bodies.count);
+	PrintFrameStats(stdout, frameMs, total);
+	fprintf(stdout, "texture load:  %.3f ms (%s, %s)\n", textureMs, MappedBmpOn ? "mmap" : "stdio",
+		CompressedTexturesOn ? "compressed" : "raw");
+	fprintf(stdout, "texture memory: %zu KB (%zu KB uncompressed without mipmaps)\n",
+		TextureBytesUsed / 1024, TextureBytesRaw / 1024);
+	fprintf(stdout, "sphere lod:    %s\n", LodOn != 0 ? "on" : "off");
+	fprintf(stdout, "instancing:    %s\n", InstancingOn && InstancingOK ? "on" : "off");
+	fprintf(stdout, "lighting:      %s\n", (ShaderLightingOn || DepthMode == DEPTHLOG) && ShadingOK ? "per-pixel shader" : "fixed-function");
+	fprintf(stdout, "depth:         %s\n", DEPTHMODENAMES[DepthMode]);
+	fprintf(stdout, "coordinates:   %s\n", CameraRelativeOn ? "camera-relative" : "world");
+	fprintf(stdout, "pipeline:      %s\n", FramePipelineOn ? "on (next frame worked out on another thread)" : "off");
+	fprintf(stdout, "frame ring:    %s, %d x %ld KB, %.1f KB/frame, %ld fence waits (%.3f ms), %ld new buffers\n",
+		RingPersistent ? "persistent-mapped" : "orphaned each frame", RingPersistent ? RINGSECTIONS : 1,
+		(long)(RingSectionSize / 1024),
+		RingTotal.bytes / (1024. * (double)frames), RingTotal.fenceWaits, RingTotal.waitMs, RingTotal.grows);
+	fprintf(stdout, "stages ms/frame: move %.3f, cull %.3f, wait %.3f, install %.3f, draw %.3f (%ld new packets)\n",
+		FrameTotal.moveMs / (double)frames, FrameTotal.cullMs / (double)frames, FrameTotal.waitMs / (double)frames,
+		FrameTotal.installMs / (double)frames, FrameTotal.drawMs / (double)frames, FrameTotal.packets);
+	fprintf(stdout, "vertices/frame: %.0f\n", vertices / (double)frames);
+	fprintf(stdout, "GL state calls/frame: %.1f issued, %.1f skipped\n",
+		(double)RsTotal.issued / (double)frames, (double)RsTotal.skipped / (double)frames);
+	fprintf(stdout, "culling:       frustum %s, occlusion %s\n", CullingOn ? "on" : "off",
+		OcclusionOn && !(InstancingOn && InstancingOK) && DepthMode != DEPTHLOG ? "on" : "off");
+	fprintf(stdout, "bodies/frame:  %.1f drawn, %.1f outside the view, %.1f hidden\n",
+		(double)CullTotal.bodiesDrawn / (double)frames, (double)CullTotal.bodiesOutside / (double)frames,
+		(double)CullTotal.bodiesOccluded / (double)frames);
+	fprintf(stdout, "orbits/frame:  %.1f drawn, %.1f outside the view\n",
+		(double)CullTotal.orbitsDrawn / (double)frames, (double)CullTotal.orbitsOutside / (double)frames);
+	if (SkyboxOn && SkyboxOK && FindSkyBody() >= 0)
+		fprintf(stdout, "sky:           cube map, %dx%d faces\n", SkyFaceSize, SkyFaceSize);
 	else
+		fprintf(stdout, "sky:           sphere\n");
+	fprintf(stdout, "sky fragments/frame: %.0f (%.1f%% of the %dx%d window)\n", SkyFragments / (double)frames,
+		100. * SkyFragments / ((double)frames * (double)size * (double)size), size, size);
+	if (ProfileOn)
 	{
-		// could optimize by keeping track of the fact
-		// that the window is not visible and avoid
-		// animating or redrawing it ...
+		ProfileFlush();
+		fprintf(stdout, "profile ms/frame:%s\n", ProfileGpuOK ? "" : " (no gpu timers)");
+		for (int z = 0; z < ProfileNumZones; z++)
+			fprintf(stdout, "  %-14s cpu %8.3f  gpu %8.3f\n", ProfileZones[z].name,
+				ProfileZones[z].cpuTotal / (double)frames, ProfileZones[z].gpuTotal / (double)frames);
+		if (ProfileGpuLate > 0)
+			fprintf(stdout, "  (%ld gpu times were not in after %d frames, and were dropped)\n", ProfileGpuLate, PROFLATENCY);
+		ProfileWriteTrace(traceFile);
 	}
+
+	FramePipelineStop();
+	FinishTexCacheWrites();
+	HeadlessFinish();
+	return 0;
 }
 
 
@@ -1379,15 +3558,15 @@ MulArray3(float factor, float a, float b, float c)
 void
 SetPointLight(int ilight, float x, float y, float z, float r, float g, float b)
 {
-	glLightfv(ilight, GL_POSITION, Array3(x, y, z));
-	glLightfv(ilight, GL_AMBIENT, Array3(0.1, 0.1, 0.2));
+	RsLightfv(ilight, GL_POSITION, Array3(x, y, z));
+	RsLightfv(ilight, GL_AMBIENT, Array3(0.1, 0.1, 0.2));
 	//glLightfv(ilight, GL_AMBIENT, Array3(1, 1, 1));
-	glLightfv(ilight, GL_DIFFUSE, Array3(r, g, b));
-	glLightfv(ilight, GL_SPECULAR, Array3(r, g, b));
-	glLightf(ilight, GL_CONSTANT_ATTENUATION, 1.);
-	glLightf(ilight, GL_LINEAR_ATTENUATION, 0.);
-	glLightf(ilight, GL_QUADRATIC_ATTENUATION, 0.);
-	glEnable(ilight);
+	RsLightfv(ilight, GL_DIFFUSE, Array3(r, g, b));
+	RsLightfv(ilight, GL_SPECULAR, Array3(r, g, b));
+	RsLightf(ilight, GL_CONSTANT_ATTENUATION, 1.);
+	RsLightf(ilight, GL_LINEAR_ATTENUATION, 0.);
+	RsLightf(ilight, GL_QUADRATIC_ATTENUATION, 0.);
+	RsEnable(ilight);
 }
 
 // setting the spot light
@@ -1395,17 +3574,17 @@ SetPointLight(int ilight, float x, float y, float z, float r, float g, float b)
 void
 SetSpotLight(int ilight, float x, float y, float z, float xdir, float ydir, float zdir, float r, float g, float b)
 {
-	glLightfv(ilight, GL_POSITION, Array3(x, y, z));
-	glLightfv(ilight, GL_SPOT_DIRECTION, Array3(xdir, ydir, zdir));
-	glLightf(ilight, GL_SPOT_EXPONENT, 1.);
-	glLightf(ilight, GL_SPOT_CUTOFF, 45.);
-	glLightfv(ilight, GL_AMBIENT, Array3(0., 0., 0.));
-	glLightfv(ilight, GL_DIFFUSE, Array3(r, g, b));
-	glLightfv(ilight, GL_SPECULAR, Array3(r, g, b));
-	glLightf(ilight, GL_CONSTANT_ATTENUATION, 1.);
-	glLightf(ilight, GL_LINEAR_ATTENUATION, 0.);
-	glLightf(ilight, GL_QUADRATIC_ATTENUATION, 0.);
-	glEnable(ilight);
+	RsLightfv(ilight, GL_POSITION, Array3(x, y, z));
+	RsLightfv(ilight, GL_SPOT_DIRECTION, Array3(xdir, ydir, zdir));
+	RsLightf(ilight, GL_SPOT_EXPONENT, 1.);
+	RsLightf(ilight, GL_SPOT_CUTOFF, 45.);
+	RsLightfv(ilight, GL_AMBIENT, Array3(0., 0., 0.));
+	RsLightfv(ilight, GL_DIFFUSE, Array3(r, g, b));
+	RsLightfv(ilight, GL_SPECULAR, Array3(r, g, b));
+	RsLightf(ilight, GL_CONSTANT_ATTENUATION, 1.);
+	RsLightf(ilight, GL_LINEAR_ATTENUATION, 0.);
+	RsLightf(ilight, GL_QUADRATIC_ATTENUATION, 0.);
+	RsEnable(ilight);
 }
 
 // setting the material
@@ -1413,16 +3592,16 @@ SetSpotLight(int ilight, float x, float y, float z, float xdir, float ydir, floa
 void
 SetMaterial(float r, float g, float b, float shininess)
 {
-	glMaterialfv(GL_BACK, GL_EMISSION, Array3(0., 0., 0.));
-	glMaterialfv(GL_BACK, GL_AMBIENT, MulArray3(.4f, 1., 1., 1.));
-	glMaterialfv(GL_BACK, GL_DIFFUSE, MulArray3(1., 1., 1., 1.));
-	glMaterialfv(GL_BACK, GL_SPECULAR, Array3(0., 0., 0.));
-	glMaterialf(GL_BACK, GL_SHININESS, 2.f);
-	glMaterialfv(GL_FRONT, GL_EMISSION, Array3(0., 0., 0.));
-	glMaterialfv(GL_FRONT, GL_AMBIENT, Array3(r, g, b));
-	glMaterialfv(GL_FRONT, GL_DIFFUSE, Array3(r, g, b));
-	glMaterialfv(GL_FRONT, GL_SPECULAR, MulArray3(.8f, 1., 1., 1.));
-	glMaterialf(GL_FRONT, GL_SHININESS, shininess);
+	RsMaterialfv(GL_BACK, GL_EMISSION, Array3(0., 0., 0.));
+	RsMaterialfv(GL_BACK, GL_AMBIENT, MulArray3(.4f, 1., 1., 1.));
+	RsMaterialfv(GL_BACK, GL_DIFFUSE, MulArray3(1., 1., 1., 1.));
+	RsMaterialfv(GL_BACK, GL_SPECULAR, Array3(0., 0., 0.));
+	RsMaterialf(GL_BACK, GL_SHININESS, 2.f);
+	RsMaterialfv(GL_FRONT, GL_EMISSION, Array3(0., 0., 0.));
+	RsMaterialfv(GL_FRONT, GL_AMBIENT, Array3(r, g, b));
+	RsMaterialfv(GL_FRONT, GL_DIFFUSE, Array3(r, g, b));
+	RsMaterialfv(GL_FRONT, GL_SPECULAR, MulArray3(.8f, 1., 1., 1.));
+	RsMaterialf(GL_FRONT, GL_SHININESS, shininess);
 }
 
 
@@ -1520,7 +3699,7 @@ struct bmfh
 	short bfReserved1;
 	short bfReserved2;
 	int bfOffBytes;		// # bytes to get to the start of the per-pixel data
-} FileHeader;
+};
 
 // bmp info header:
 struct bmih
@@ -1536,7 +3715,7 @@ struct bmih
 	int biYPixelsPerMeter;
 	int biClrUsed;		// # colors in the palette
 	int biClrImportant;
-} InfoHeader;
+};
 
 
 
@@ -1545,6 +3724,10 @@ struct bmih
 unsigned char*
 BmpToTexture(char* filename, int* width, int* height)
 {
+	// the headers are local so that several files can be read at once on different threads:
+	struct bmfh FileHeader;
+	struct bmih InfoHeader;
+
 	FILE* fp;
 #ifdef _WIN32
 	errno_t err = fopen_s(&fp, filename, "rb");
@@ -1717,6 +3900,148 @@ BmpToTexture(char* filename, int* width, int* height)
 	return texture;
 }
 
+// little-endian values out of a block of memory:
+
+int
+GetInt(const unsigned char* p)
+{
+	return (p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+}
+
+short
+GetShort(const unsigned char* p)
+{
+	return (p[1] << 8) | p[0];
+}
+
+
+// memory-map a 24-bit uncompressed bmp file and find its pixels:
+//	the rows are already bottom-to-top and padded to 4 bytes, which is what
+//	GL_UNPACK_ALIGNMENT = 4 expects, and the pixels are in bgr order,
+//	so they can go to glTexImage2D( ) as GL_BGR straight from the mapping
+// returns false (with nothing mapped) if the file cannot be opened or is some other kind of bmp
+// (this does not touch opengl, so it can run on any thread)
+
+bool
+MapBmp(char* filename, struct BmpMapping* bm)
+{
+	const unsigned char* base;
+	size_t length;
+
+#ifdef WIN32
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER size;
+	GetFileSizeEx(file, &size);
+	length = (size_t)size.QuadPart;
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	base = mapping != NULL ? (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+	if (base == NULL)
+	{
+		if (mapping != NULL)
+			CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+	bm->file = file;
+	bm->mapping = mapping;
+#else
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		close(fd);
+		return false;
+	}
+	length = (size_t)st.st_size;
+	void* map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);		// the mapping keeps the file open
+	if (map == MAP_FAILED)
+		return false;
+	madvise(map, length, MADV_SEQUENTIAL);
+	base = (const unsigned char*)map;
+#endif
+	bm->base = base;
+	bm->length = length;
+
+	// the headers are packed in the file, so pick the fields out by their offsets:
+
+	bool ok = length >= 14 + 40;
+	int offBytes = 0, width = 0, height = 0, rowBytes = 0;
+	if (ok)
+	{
+		offBytes = GetInt(&base[10]);
+		width = GetInt(&base[18]);
+		height = GetInt(&base[22]);
+		rowBytes = 4 * ((24 * width + 31) / 32);
+
+		ok = GetShort(&base[0]) == BMP_MAGIC_NUMBER &&
+			GetInt(&base[14]) >= 40 &&				// biSize
+			GetShort(&base[26]) == 1 &&				// biPlanes
+			GetShort(&base[28]) == 24 &&			// biBitCount
+			GetInt(&base[30]) == BI_RGB &&			// biCompression
+			width > 0 && height > 0 &&				// (height < 0 would be stored top-to-bottom)
+			offBytes >= 14 + 40 &&
+			(size_t)offBytes + (size_t)rowBytes * (size_t)height <= length;
+		if (VERBOSE)	fprintf(stderr, "'%s': %d x %d, mapped upload %s\n", filename, width, height, ok ? "ok" : "not possible");
+	}
+
+	if (!ok)
+	{
+		UnmapBmp(bm);
+		return false;
+	}
+
+	bm->pixels = &base[offBytes];
+	bm->width = width;
+	bm->height = height;
+	return true;
+}
+
+
+void
+UnmapBmp(struct BmpMapping* bm)
+{
+	if (bm->base == NULL)
+		return;
+#ifdef WIN32
+	UnmapViewOfFile(bm->base);
+	CloseHandle(bm->mapping);
+	CloseHandle(bm->file);
+#else
+	munmap((void*)bm->base, bm->length);
+#endif
+	bm->base = bm->pixels = NULL;
+	bm->length = 0;
+}
+
+
+// glTexImage2D( ) a bmp file into the bound texture directly from its memory mapping:
+// returns false (having uploaded nothing) if the file cannot be mapped
+
+bool
+MappedBmpToTexture(char* filename)
+{
+	struct BmpMapping bm = { };
+	if (!MapBmp(filename, &bm))
+		return false;
+
+	glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+	glTexImage2D(GL_TEXTURE_2D, 0, 3, bm.width, bm.height, 0, GL_BGR, GL_UNSIGNED_BYTE, bm.pixels);
+	glPopClientAttrib();
+
+	UnmapBmp(&bm);
+	return true;
+}
+
+
 int
 ReadInt(FILE* fp)
 {
@@ -0,0 +1,319 @@
+#include <stdio.h>
+#include <math.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
+//	When to draw the next frame
+//
+//	PACEVSYNC	draw every frame, and let the buffer swap wait for the monitor's refresh (swap interval 1)
+//	PACECAPPED	draw every frame, PaceTargetFps a second: the idle function sleeps until the next frame is due
+//			(sleeping to PACESLEEPSLACK before it, since a sleep can run over, and yielding the rest of the way)
+//	PACEONDEMAND	like PACEVSYNC while the animation runs, but draw nothing at all while it is frozen or the window
+//			is hidden -- only when something (the mouse, a key, a menu, a texture coming in) asks for a redisplay
+//	PACEUNCAPPED	draw as fast as possible, always, even when hidden: for benchmarking
+//
+//	Where there is no way to set the swap interval (WGL_EXT_swap_control, GLX_EXT_swap_control,
+//	GLX_MESA_swap_control, or GLX_SGI_swap_control), PACEVSYNC and PACEONDEMAND pace by sleeping, like PACECAPPED.
+//	PACEVSYNC and PACECAPPED stop drawing when the window is hidden too; only PACEUNCAPPED keeps going.
+//
+//	Each frame's end (after the buffer swap) is timed, and over each PACEWINDOW seconds the frame rate, the
+//	process's cpu time as a percentage of one core, and the jitter -- the standard deviation of the time from one
+//	frame to the next -- are worked out for the debug overlay.  PaceTotal adds them up for the headless report.
+
+
+const int	PACEVSYNC	= 0;
+const int	PACECAPPED	= 1;
+const int	PACEONDEMAND	= 2;
+const int	PACEUNCAPPED	= 3;
+const int	PACENUMMODES	= 4;
+
+const char *	PACEMODENAMES[PACENUMMODES] = { "vsync", "capped", "on-demand", "uncapped" };
+
+const double	PACESLEEPSLACK = 0.002;		// seconds before a frame is due to stop sleeping
+const double	PACEWINDOW = 1.;		// seconds the overlay's numbers are over
+
+// frame times since some start:
+
+struct PaceStats
+{
+	long			frames;
+	double			wallStart, cpuStart;	// WallSeconds( ) and ProcessCpuSeconds( ) at the start
+	double			lastFrame;		// WallSeconds( ) at the end of the last frame, 0 if none yet
+	std::vector<double>	intervalsMs;		// from each frame's end to the next's
+};
+
+// what they come to:
+
+struct PaceReport
+{
+	double	seconds;
+	long	frames;
+	double	fps;
+	double	cpuPercent;		// of one core, for the whole process (all its threads)
+	double	meanMs, jitterMs;	// the mean and standard deviation of the frame intervals
+	double	p99Ms;
+	long	late;			// intervals more than half again as long as the median one
+};
+
+int		PaceMode = PACEONDEMAND;
+double		PaceTargetFps = 60.;		// for PACECAPPED, and the other modes without vsync
+bool		PaceVsyncOK;			// true if the swap interval can be set (see InitPacing( ))
+bool		PaceHidden;			// true while the window is not visible
+double		PaceDeadline;			// WallSeconds( ) the next frame is due, when pacing by sleeping
+struct PaceStats	PaceWindow;		// the current PACEWINDOW seconds
+struct PaceReport	PaceLast;		// the last full PACEWINDOW seconds
+struct PaceStats	PaceTotal;		// since the caller last started it over (PaceStatsStart( ))
+
+#ifdef WIN32
+typedef BOOL	(WINAPI *PaceWglSwapIntervalFunc)(int);
+PaceWglSwapIntervalFunc	PaceWglSwapInterval;
+#else
+// the few glx calls needed, declared here rather than taken from GL/glx.h, whose X11 headers
+// define a 'Display' type that would clash with Display( ) (the X display is only passed along, so void* will do):
+extern "C"
+{
+	void *		glXGetCurrentDisplay();
+	unsigned long	glXGetCurrentDrawable();
+	const char *	glXQueryExtensionsString(void* dpy, int screen);
+	void		(*glXGetProcAddressARB(const GLubyte* name))();
+}
+
+typedef void	(*PaceGlxSwapIntervalExtFunc)(void*, unsigned long, int);
+typedef int	(*PaceGlxSwapIntervalFunc)(int);
+PaceGlxSwapIntervalExtFunc	PaceGlxSwapIntervalExt;
+PaceGlxSwapIntervalFunc		PaceGlxSwapInterval;		// the MESA or SGI one
+#endif
+
+
+// the cpu time this process has used, all threads, in seconds:
+
+double
+ProcessCpuSeconds()
+{
+#ifdef WIN32
+	FILETIME created, exited, kernel, user;
+	if (!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user))
+		return 0.;
+	ULARGE_INTEGER k, u;
+	k.LowPart = kernel.dwLowDateTime;	k.HighPart = kernel.dwHighDateTime;
+	u.LowPart = user.dwLowDateTime;		u.HighPart = user.dwHighDateTime;
+	return (double)(k.QuadPart + u.QuadPart) * 1.e-7;		// (100 ns units)
+#else
+	struct rusage ru;
+	if (getrusage(RUSAGE_SELF, &ru) != 0)
+		return 0.;
+	return (double)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) + 1.e-6 * (double)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec);
+#endif
+}
+
+
+// start adding up frame times over:
+
+void
+PaceStatsStart(struct PaceStats* s)
+{
+	s->frames = 0;
+	s->wallStart = WallSeconds();
+	s->cpuStart = ProcessCpuSeconds();
+	s->lastFrame = 0.;
+	s->intervalsMs.clear();
+}
+
+
+void
+PaceStatsAdd(struct PaceStats* s, double now)
+{
+	if (s->lastFrame > 0.)
+		s->intervalsMs.push_back(1000. * (now - s->lastFrame));
+	s->lastFrame = now;
+	s->frames++;
+}
+
+
+// what the frames added up since a start come to, now:
+
+struct PaceReport
+PaceSummarize(const struct PaceStats* s)
+{
+	struct PaceReport r;
+	memset(&r, 0, sizeof(r));
+	r.seconds = WallSeconds() - s->wallStart;
+	r.frames = s->frames;
+	if (r.seconds > 0.)
+	{
+		r.fps = (double)s->frames / r.seconds;
+		r.cpuPercent = 100. * (ProcessCpuSeconds() - s->cpuStart) / r.seconds;
+	}
+
+	size_t n = s->intervalsMs.size();
+	if (n > 0)
+	{
+		double sum = 0., sum2 = 0.;
+		for (size_t i = 0; i < n; i++)
+		{
+			sum += s->intervalsMs[i];
+			sum2 += s->intervalsMs[i] * s->intervalsMs[i];
+		}
+		r.meanMs = sum / (double)n;
+		double var = sum2 / (double)n - r.meanMs * r.meanMs;
+		r.jitterMs = var > 0. ? sqrt(var) : 0.;
+
+		std::vector<double> sorted = s->intervalsMs;
+		std::sort(sorted.begin(), sorted.end());
+		r.p99Ms = Percentile(sorted, 99.);
+
+		double p50 = Percentile(sorted, 50.);
+		for (size_t i = 0; i < n; i++)
+			if (s->intervalsMs[i] > 1.5 * p50)
+				r.late++;
+	}
+	return r;
+}
+
+
+// set how many refreshes a buffer swap waits for (0 = none):
+// returns false if it cannot be set
+
+bool
+PaceSetSwapInterval(int interval)
+{
+#ifdef WIN32
+	return PaceWglSwapInterval != NULL && PaceWglSwapInterval(interval);
+#else
+	if (PaceGlxSwapIntervalExt != NULL)
+	{
+		PaceGlxSwapIntervalExt(glXGetCurrentDisplay(), glXGetCurrentDrawable(), interval);
+		return true;
+	}
+	if (PaceGlxSwapInterval != NULL)
+		return PaceGlxSwapInterval(interval) == 0;
+	return false;
+#endif
+}
+
+
+// the mode with a name (one of PACEMODENAMES[ ]), or -1 if there is none:
+
+int
+PaceModeNamed(const char* name)
+{
+	for (int m = 0; m < PACENUMMODES; m++)
+		if (strcmp(name, PACEMODENAMES[m]) == 0)
+			return m;
+	return -1;
+}
+
+
+// true if the current mode is paced by the monitor's refresh:
+
+bool
+PaceVsynced()
+{
+	return PaceVsyncOK && (PaceMode == PACEVSYNC || PaceMode == PACEONDEMAND);
+}
+
+
+// switch to a mode (or, the first time, set the swap interval for the current one):
+
+void
+PaceSetMode(int mode)
+{
+	PaceMode = mode;
+	if (PaceVsyncOK && !PaceSetSwapInterval(PaceVsynced() ? 1 : 0))
+		PaceVsyncOK = false;
+	PaceDeadline = 0.;
+	PaceStatsStart(&PaceWindow);
+}
+
+
+// find out if the swap interval can be set for the window's context, and set it for the current mode:
+// (the window's context must be current; with no window, as headless, there is no vsync)
+
+void
+InitPacing()
+{
+	PaceVsyncOK = false;
+#ifdef WIN32
+	PaceWglSwapInterval = (PaceWglSwapIntervalFunc)wglGetProcAddress("wglSwapIntervalEXT");
+	PaceVsyncOK = PaceWglSwapInterval != NULL;
+#else
+	void* dpy = glXGetCurrentDisplay();
+	if (dpy != NULL)
+	{
+		const char* ext = glXQueryExtensionsString(dpy, 0);		// (the default screen)
+		if (ext != NULL && strstr(ext, "GLX_EXT_swap_control") != NULL)
+			PaceGlxSwapIntervalExt = (PaceGlxSwapIntervalExtFunc)glXGetProcAddressARB((const GLubyte*)"glXSwapIntervalEXT");
+		else if (ext != NULL && strstr(ext, "GLX_MESA_swap_control") != NULL)
+			PaceGlxSwapInterval = (PaceGlxSwapIntervalFunc)glXGetProcAddressARB((const GLubyte*)"glXSwapIntervalMESA");
+		else if (ext != NULL && strstr(ext, "GLX_SGI_swap_control") != NULL)
+			PaceGlxSwapInterval = (PaceGlxSwapIntervalFunc)glXGetProcAddressARB((const GLubyte*)"glXSwapIntervalSGI");
+		PaceVsyncOK = PaceGlxSwapIntervalExt != NULL || PaceGlxSwapInterval != NULL;
+	}
+#endif
+	if (!PaceVsyncOK)
+		fprintf(stderr, "Cannot set the swap interval -- vsync pacing will sleep to %.0f fps instead\n", PaceTargetFps);
+	PaceSetMode(PaceMode);
+	PaceStatsStart(&PaceTotal);
+}
+
+
+// true if frames should keep being drawn one after another (the idle function should be on):
+//	frozen is whether the animation is frozen
+
+bool
+PaceAnimating(bool frozen)
+{
+	if (PaceMode == PACEUNCAPPED)
+		return true;
+	if (PaceHidden)
+		return false;
+	return PaceMode != PACEONDEMAND || !frozen;
+}
+
+
+// in the idle function, before the next frame: wait until it is due, if this mode paces by sleeping
+
+void
+PaceWait()
+{
+	if (PaceMode == PACEUNCAPPED || PaceVsynced() || PaceTargetFps <= 0.)
+		return;
+
+	double period = 1. / PaceTargetFps;
+	double now = WallSeconds();
+	if (PaceDeadline == 0. || now > PaceDeadline + period)
+		PaceDeadline = now;		// (fell more than a frame behind -- start over from now, do not catch up)
+	else
+	{
+		if (PaceDeadline - now > PACESLEEPSLACK)
+			std::this_thread::sleep_for(std::chrono::duration<double>(PaceDeadline - now - PACESLEEPSLACK));
+		while (WallSeconds() < PaceDeadline)
+			std::this_thread::yield();
+	}
+	PaceDeadline += period;
+}
+
+
+// a frame has been drawn and swapped:
+
+void
+PaceFrameDone()
+{
+	double now = WallSeconds();
+	PaceStatsAdd(&PaceWindow, now);
+	PaceStatsAdd(&PaceTotal, now);
+	if (now - PaceWindow.wallStart >= PACEWINDOW)
+	{
+		PaceLast = PaceSummarize(&PaceWindow);
+		PaceStatsStart(&PaceWindow);
+		PaceWindow.lastFrame = now;		// (so the next interval is not lost)
+	}
+}
@@ -0,0 +1,292 @@
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//	Working out the next frame on another thread while this one is drawn
+//
+//	Everything about a frame that does not need opengl -- moving the bodies (UpdateBodyFrame( )), placing the eye,
+//	the projection, frustum culling, and picking levels of detail, all of it proportional to the number of bodies --
+//	goes into a frame packet.  With the pipeline on, Display( ) hands the inputs of its frame (the time, the view,
+//	the switches: struct FrameInputs) to a worker thread, and draws the packet the worker worked out for the frame
+//	before, so frame N+1 is being worked out while frame N is drawn.  With it off, Display( ) works it out itself.
+//	Either way the same function does the work (the one FramePipelineStart( ) is given), so the pictures match.
+//
+//	The packets go through a triple buffer: the worker always has one to write (FrameBack), the drawing thread one
+//	to read (FrameFront), and the newest finished one waits in the middle.  Handing one over is one atomic exchange,
+//	so neither side waits on the other for it, and a packet is never changed while it is being drawn.
+//	The worker sleeps on a condition variable until it is asked for a frame.
+//
+//	What is drawn lags the inputs by a frame.  A packet whose switches (the view, the depth mode, ...) are not the
+//	current ones is never drawn -- FrameGet( ) waits for the worker to catch up instead.
+//
+//	A packet has one view, or with the quad view on, all four points of view: the bodies are moved once for all of
+//	them, each view gets its own eye, projection, and levels of detail, and they are frustum culled together in one
+//	pass (FrustumCullViews( )).  The packet's bodies are relative to the last view's origin; InstallFrameView( )
+//	moves them to each view's before it is drawn.
+//
+//	The worker reads the scene's own arrays (the bodies' orbits, radii, flags), so the scene must not change while
+//	it is busy: call FramePipelineSync( ) before reading a new one.
+
+
+const int	FRAMEFRESH = 4;		// set in FrameMiddle when the worker has put a new packet there
+const int	FRAMEINDEX = 3;		// the packet's index in FrameMiddle
+const int	FRAMEMAXVIEWS = 4;	// views in a packet: the quad view has every point of view
+
+// what a frame is worked out from, copied from the globals by the drawing thread:
+
+struct FrameInputs
+{
+	int	scene;			// SceneSerial
+	double	years;
+	int	pov;			// WhichPOV
+	bool	quad;			// true to draw all four points of view at once (pov is not used then)
+	float	xrot, yrot, scale;
+	bool	cameraRelative;
+	int	depthMode;
+	bool	frustum;		// true to do frustum culling
+	bool	lod;			// true to pick levels of detail, false for the 64-slice sphere
+	bool	skipSky;		// true if the far plane does not have to take in the sky body (it is a cube map)
+	int	viewportSize;		// in pixels (the viewport is square)
+};
+
+// one point of view in a frame:
+
+struct FrameView
+{
+	int			pov;
+	float			view[16];		// the view and projection matrices, column-major
+	float			projection[16];
+	struct CullView		cull;			// the eye's origin, the view volume, and the bodies inside it
+	std::vector<int>	lods;			// each lit body's level of detail, -1 for the rest (see PickBodyLods( ))
+};
+
+// everything about a frame that can be worked out ahead of time:
+
+struct FramePacket
+{
+	struct FrameInputs	in;
+	long			serial;			// which request it is for: 0 if it is empty, -1 if not from the worker
+	struct BodyFrame	bodies;			// the bodies' places and world matrices, relative to the last view's eye
+	int			numViews;
+	struct FrameView	views[FRAMEMAXVIEWS];
+	double			moveMs;			// how long the bodies and the views took
+	double			cullMs;			// how long the culling and levels of detail took
+};
+
+// how long each stage took, added up over the frames drawn:
+
+struct FrameStageTimes
+{
+	long	frames;
+	long	packets;		// new packets drawn (a packet can be drawn twice)
+	double	moveMs;			// moving the bodies and placing the eye (on the worker, with the pipeline on)
+	double	cullMs;			// frustum culling and levels of detail (ditto)
+	double	waitMs;			// the drawing thread waiting for a packet
+	double	installMs;		// copying a packet's bodies into the scene
+	double	drawMs;			// the rest of Display( ), after the packet is installed: the opengl calls
+};
+
+typedef void	(*FrameComputeFunc)(const struct FrameInputs*, struct FramePacket*);
+
+struct FramePacket	FramePackets[3];
+std::atomic<int>	FrameMiddle;		// the packet between the worker and the drawing thread, | FRAMEFRESH if new
+int			FrameBack = 1;		// the worker's packet
+int			FrameFront = 2;		// the drawing thread's packet
+FrameComputeFunc	FrameCompute;		// works a packet out
+std::thread		FrameThread;
+bool			FrameThreadRunning;
+std::mutex		FrameMutex;		// guards the request and the worker's state below
+std::condition_variable	FrameWake;		// the worker waits on it for a request, the drawing thread for a packet
+struct FrameInputs	FrameRequested;		// the newest inputs asked for
+long			FrameRequestSerial;	// counts the requests
+long			FrameDoneSerial;	// the last request the worker finished (or skipped, for a newer one)
+bool			FrameWorkerBusy;
+bool			FrameWorkerQuit;
+bool			FrameLastPipelined;	// true if the last frame's packet came from the worker
+struct FrameStageTimes	FrameTotal;		// since the caller last zeroed it
+
+
+// true if a packet for inputs a can be drawn when the inputs are b -- the switches are the same,
+// and only the time and the mouse's rotation and scale may be a frame behind:
+
+bool
+FrameInputsMatch(const struct FrameInputs* a, const struct FrameInputs* b)
+{
+	return a->scene == b->scene && a->pov == b->pov && a->quad == b->quad && a->cameraRelative == b->cameraRelative &&
+		a->depthMode == b->depthMode && a->frustum == b->frustum && a->lod == b->lod &&
+		a->skipSky == b->skipSky && a->viewportSize == b->viewportSize;
+}
+
+// true if a packet for inputs a is exactly what inputs b would make:
+
+bool
+FrameInputsSame(const struct FrameInputs* a, const struct FrameInputs* b)
+{
+	return FrameInputsMatch(a, b) && a->years == b->years && a->xrot == b->xrot && a->yrot == b->yrot &&
+		a->scale == b->scale;
+}
+
+
+// the worker thread: work out the newest request into the back packet, and put it in the middle
+// (no opengl calls in here!)
+
+void
+FrameWorker()
+{
+	std::unique_lock<std::mutex> lock(FrameMutex);
+	for (;;)
+	{
+		FrameWake.wait(lock, [] { return FrameWorkerQuit || FrameDoneSerial != FrameRequestSerial; });
+		if (FrameWorkerQuit)
+			return;
+		struct FrameInputs in = FrameRequested;
+		long serial = FrameRequestSerial;
+		FrameWorkerBusy = true;
+		lock.unlock();
+
+		struct FramePacket* p = &FramePackets[FrameBack];
+		FrameCompute(&in, p);
+		p->in = in;
+		p->serial = serial;
+		FrameBack = FrameMiddle.exchange(FrameBack | FRAMEFRESH) & FRAMEINDEX;
+
+		lock.lock();
+		FrameDoneSerial = serial;
+		FrameWorkerBusy = false;
+		FrameWake.notify_all();
+	}
+}
+
+
+// say which function works out a packet, and start the worker:
+
+void
+FramePipelineStart(FrameComputeFunc compute)
+{
+	FrameCompute = compute;
+	if (FrameThreadRunning)
+		return;
+	FrameMiddle = 0;
+	FrameBack = 1;
+	FrameFront = 2;
+	FrameWorkerQuit = false;
+	FrameThread = std::thread(FrameWorker);
+	FrameThreadRunning = true;
+}
+
+
+// wait for the worker to finish what it is doing, and throw away every packet:
+// (for when the scene is about to change)
+
+void
+FramePipelineSync()
+{
+	std::unique_lock<std::mutex> lock(FrameMutex);
+	FrameWake.wait(lock, [] { return !FrameWorkerBusy && FrameDoneSerial == FrameRequestSerial; });
+	FrameMiddle = FrameMiddle & FRAMEINDEX;
+	for (int i = 0; i < 3; i++)
+		FramePackets[i].serial = 0;
+}
+
+
+// stop the worker (before the program exits):
+
+void
+FramePipelineStop()
+{
+	if (!FrameThreadRunning)
+		return;
+	{
+		std::lock_guard<std::mutex> lock(FrameMutex);
+		FrameWorkerQuit = true;
+	}
+	FrameWake.notify_all();
+	FrameThread.join();
+	FrameThreadRunning = false;
+}
+
+
+// the packet to draw a frame with these inputs from:
+//	pipelined true means ask the worker for this frame and draw the one it worked out for the last frame
+//	(or a newer one -- waiting, if it is not finished yet), false means work it out right here
+// (the packet stays the drawing thread's until the next call)
+
+struct FramePacket*
+FrameGet(const struct FrameInputs* in, bool pipelined)
+{
+	struct FramePacket* p;
+	if (!pipelined || !FrameThreadRunning)
+	{
+		if (FrameLastPipelined)
+			FramePipelineSync();		// (so nothing the worker finished before now is drawn later)
+		FrameLastPipelined = false;
+		p = &FramePackets[FrameFront];
+		FrameCompute(in, p);
+		p->in = *in;
+		p->serial = -1;
+	}
+	else
+	{
+		// the packet for the last request (worked out while the last frame was drawn) or a newer one,
+		// and not the one that is already on the screen:
+		long serial;
+		{
+			std::lock_guard<std::mutex> lock(FrameMutex);
+			FrameRequested = *in;
+			serial = ++FrameRequestSerial;
+		}
+		FrameWake.notify_all();
+
+		double t0 = WallSeconds();
+		long shown = FramePackets[FrameFront].serial;
+		for (;;)
+		{
+			if (FrameMiddle.load() & FRAMEFRESH)
+				FrameFront = FrameMiddle.exchange(FrameFront) & FRAMEINDEX;
+			p = &FramePackets[FrameFront];
+			if (p->serial > 0 && p->serial >= serial - 1 && p->serial != shown && FrameInputsMatch(&p->in, in))
+				break;
+
+			// nothing that can be drawn yet -- wait for the worker to finish another one:
+			std::unique_lock<std::mutex> lock(FrameMutex);
+			FrameWake.wait(lock, [] { return (FrameMiddle.load() & FRAMEFRESH) != 0; });
+		}
+		FrameTotal.waitMs += 1000. * (WallSeconds() - t0);
+		FrameLastPipelined = true;
+	}
+
+	FrameTotal.packets++;
+	FrameTotal.moveMs += p->moveMs;
+	FrameTotal.cullMs += p->cullMs;
+	return p;
+}
+
+
+// make a packet's bodies the scene's, for drawing:
+
+void
+InstallFramePacket(const struct FramePacket* p)
+{
+	double t0 = WallSeconds();
+	static_cast<struct BodyFrame&>(Bodies) = p->bodies;
+	PickedBodyLods = &p->views[0].lods;
+	FrameTotal.installMs += 1000. * (WallSeconds() - t0);
+}
+
+
+// get the scene's bodies ready to draw one of the packet's views:
+// (moves them to the view's origin, if they are not already there)
+
+void
+InstallFrameView(const struct FramePacket* p, int view)
+{
+	double t0 = WallSeconds();
+	const struct FrameView* v = &p->views[view];
+	RebaseScene(v->cull.origin[0], v->cull.origin[1], v->cull.origin[2]);
+	PickedBodyLods = &v->lods;
+	FrameTotal.installMs += 1000. * (WallSeconds() - t0);
+}
@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+//	One buffer for everything a frame writes for the gpu, with no driver allocations from frame to frame
+//
+//	The per-frame data the buffer-based drawing uses -- the FrameLighting uniform block (shading.cpp) and the
+//	instance data (instancing.cpp) -- is carved out of one buffer cut into RINGSECTIONS sections, a section a frame.
+//	Where there is glBufferStorage( ) (opengl 4.4 or ARB_buffer_storage), the buffer is mapped once, persistently
+//	and coherently, so RingAlloc( ) just hands out a pointer into it and nothing else has to be called to get the
+//	data to the gpu.  A fence is put down after each frame's draws, and the frame that comes back around to that
+//	section waits on it (RingFrameBegin( )), so a section is never written while the gpu may still be reading it.
+//	With three sections, that wait only happens when the gpu is more than two frames behind.
+//
+//	Without it, the buffer is orphaned with glBufferData( ) once a frame, and each piece is copied in with
+//	glBufferSubData( ) by RingCommit( ) (which does nothing when the buffer is mapped).  --ring orphan forces this.
+//
+//	A section is as big as the biggest frame asked for so far (RingFrameBegin( ) gets told how much the frame will
+//	need, and makes a new, bigger buffer if it has to); a frame that asks RingAlloc( ) for more than it said
+//	gets NULL, and its caller skips that drawing for the frame.
+//
+//	Needs glMapBufferRange( ) (opengl 3.0) even for the fallback, like the shaders that use it.
+
+
+const int		RINGSECTIONS = 3;
+const GLsizeiptr	RINGMINSECTION = 64 * 1024;		// smallest section, in bytes
+const GLuint64		RINGFENCETIMEOUT = 1000000000;		// longest wait on a fence, in nanoseconds
+
+struct RingCounters
+{
+	long	frames;
+	double	bytes;			// handed out by RingAlloc( )
+	long	fenceWaits;		// frames that had to wait for the gpu to finish with their section
+	double	waitMs;			// how long they waited
+	long	grows;			// new, bigger buffers
+};
+
+GLuint		RingBuffer;			// the buffer, 0 until RingFrameBegin( ) first makes it
+bool		RingPersistent;			// true if it is mapped persistently, false if it is orphaned each frame
+bool		RingPersistentOK;		// true if this opengl can do that (see InitFrameRing( ))
+unsigned char *	RingMapped;			// the whole buffer, when it is mapped
+std::vector<unsigned char>	RingStaging;	// this frame's section, when it is not
+GLsizeiptr	RingSectionSize;		// bytes in each section
+GLsizeiptr	RingUsed;			// bytes of this frame's section handed out so far
+GLsizeiptr	RingNeeded;			// the most a frame has needed (or been short by)
+GLint		RingAlignment = 16;		// offsets handed out are multiples of this
+int		RingSection;			// this frame's section
+GLsync		RingFences[RINGSECTIONS];	// put down after the last frame that wrote each section
+struct RingCounters	RingTotal;		// since the caller last zeroed it
+
+
+// find out what this opengl can do:
+//	persistent false means always orphan, even if it could map persistently
+
+void
+InitFrameRing(bool persistent)
+{
+	RingPersistentOK = (GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage) && (GLEW_VERSION_3_2 || GLEW_ARB_sync);
+	RingPersistent = persistent && RingPersistentOK;
+
+	// uniform blocks have to start on GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, and vec4's want 16:
+	GLint uboAlign = 0;
+	if (GLEW_VERSION_3_1)
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uboAlign);
+	RingAlignment = uboAlign > 16 ? uboAlign : 16;
+}
+
+
+// throw the buffer away (it gets made again, as it is needed, by the next RingFrameBegin( )):
+
+void
+RingRelease()
+{
+	for (int s = 0; s < RINGSECTIONS; s++)
+	{
+		if (RingFences[s] != 0)
+			glDeleteSync(RingFences[s]);
+		RingFences[s] = 0;
+	}
+	if (RingBuffer != 0)
+	{
+		if (RingMapped != NULL)
+		{
+			RsBindBuffer(GL_COPY_WRITE_BUFFER, RingBuffer);
+			glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+		}
+		RsBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		glDeleteBuffers(1, &RingBuffer);
+		RsInvalidate();		// (deleting it unbound it wherever else it was bound)
+	}
+	RingBuffer = 0;
+	RingMapped = NULL;
+	RingSectionSize = 0;
+}
+
+
+// the size a piece of the ring takes up, rounded up to the alignment:
+
+GLsizeiptr
+RingAligned(GLsizeiptr bytes)
+{
+	return (bytes + RingAlignment - 1) / RingAlignment * RingAlignment;
+}
+
+
+// start a frame that will need up to 'bytes' of the ring (counting the alignment of each piece -- see RingAligned( )):
+// (makes the buffer the first time, or a bigger one, and waits for the gpu to finish with this frame's section)
+
+void
+RingFrameBegin(GLsizeiptr bytes)
+{
+	if (bytes > RingNeeded)
+		RingNeeded = bytes;
+
+	if (RingBuffer == 0 || RingNeeded > RingSectionSize)
+	{
+		if (RingBuffer != 0)
+			RingTotal.grows++;
+		RingRelease();
+
+		GLsizeiptr size = RINGMINSECTION;
+		while (size < RingNeeded)
+			size *= 2;
+		RingSectionSize = size;
+
+		glGenBuffers(1, &RingBuffer);
+		RsBindBuffer(GL_COPY_WRITE_BUFFER, RingBuffer);
+		if (RingPersistent)
+		{
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(GL_COPY_WRITE_BUFFER, RINGSECTIONS * size, NULL, flags);
+			RingMapped = (unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, RINGSECTIONS * size, flags);
+			if (RingMapped == NULL)
+			{
+				fprintf(stderr, "Cannot map the frame ring persistently (0x%04x) -- orphaning it each frame instead\n",
+					glGetError());
+				RingPersistentOK = RingPersistent = false;
+				RingRelease();
+				RingFrameBegin(bytes);
+				return;
+			}
+		}
+		else
+			RingStaging.resize(size);
+		RingSection = RINGSECTIONS - 1;
+	}
+
+	if (RingPersistent)
+	{
+		// the next section, once the gpu is done with what was written there RINGSECTIONS frames ago:
+		RingSection = (RingSection + 1) % RINGSECTIONS;
+		GLsync fence = RingFences[RingSection];
+		if (fence != 0)
+		{
+			if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+			{
+				double t0 = WallSeconds();
+				glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, RINGFENCETIMEOUT);
+				RingTotal.fenceWaits++;
+				RingTotal.waitMs += 1000. * (WallSeconds() - t0);
+			}
+			glDeleteSync(fence);
+			RingFences[RingSection] = 0;
+		}
+	}
+	else
+	{
+		// one section, handed fresh memory by the driver each frame:
+		RingSection = 0;
+		RsBindBuffer(GL_COPY_WRITE_BUFFER, RingBuffer);
+		glBufferData(GL_COPY_WRITE_BUFFER, RingSectionSize, NULL, GL_STREAM_DRAW);
+	}
+
+	RingUsed = 0;
+	RingTotal.frames++;
+}
+
+
+// hand out 'bytes' of this frame's section to write into, and where they are in RingBuffer (*offset):
+// returns NULL if the frame has used up what it said it would need
+// (the memory is write-only -- never read it back -- and has to go through RingCommit( ) once it is filled in)
+
+void *
+RingAlloc(GLsizeiptr bytes, GLintptr* offset)
+{
+	GLsizeiptr size = RingAligned(bytes);
+	if (RingBuffer == 0 || RingUsed + size > RingSectionSize)
+	{
+		if (RingUsed + size > RingNeeded)
+			RingNeeded = RingUsed + size;		// (enough room next time)
+		return NULL;
+	}
+
+	GLsizeiptr start = RingUsed;
+	RingUsed += size;
+	RingTotal.bytes += (double)bytes;
+	if (RingPersistent)
+	{
+		*offset = (GLintptr)(RingSection * RingSectionSize + start);
+		return RingMapped + *offset;
+	}
+	*offset = (GLintptr)start;
+	return &RingStaging[start];
+}
+
+
+// get what was written into a piece RingAlloc( ) handed out to the gpu:
+// (nothing to do when the ring is mapped coherently)
+
+void
+RingCommit(GLintptr offset, GLsizeiptr bytes)
+{
+	if (RingPersistent)
+		return;
+	RsBindBuffer(GL_COPY_WRITE_BUFFER, RingBuffer);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, offset, bytes, &RingStaging[offset]);
+}
+
+
+// the frame's draws that read the ring have all been issued:
+
+void
+RingFrameEnd()
+{
+	if (RingPersistent && RingBuffer != 0)
+	{
+		if (RingFences[RingSection] != 0)
+			glDeleteSync(RingFences[RingSection]);
+		RingFences[RingSection] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+}
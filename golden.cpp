@@ -0,0 +1,592 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+//	Golden-image regression checks
+//
+//	Each case is a picture drawn headless through a software opengl (Mesa's llvmpipe) -- GoldenCheck( ) in final.cpp
+//	draws every point of view at a few fixed times, lit both ways -- and is compared with the png of the same name in
+//	the golden directory.  The comparison is perceptual, not exact: colors are compared in CIE L*a*b*, and a pixel is
+//	only wrong if it is more than GoldenTolerance (delta E, CIE76 -- about 2.3 is just noticeable) from the golden
+//	pixel and from all eight of its neighbors, so rounding and edges a fraction of a pixel over pass, while a changed
+//	color or a body in the wrong place does not.  A case fails if more than GOLDENMAXWRONG of its pixels are wrong.
+//
+//	A case that fails gets what was drawn, and a diff image, written to the failed/ directory inside the golden one:
+//	the golden picture dimmed to gray, with the wrong pixels in red (brighter the worse they are) and the pixels that
+//	differ but pass in blue.
+//
+//	The opengl thread draws the cases one after another; reading the golden pngs, comparing, and writing are on
+//	worker threads, which take each case as soon as it has been drawn.  With update true, the workers write what
+//	was drawn as the new golden images instead.
+//
+//	The golden pngs are read with the inflate here (any 8-bit rgb or rgba png that is not interlaced will do), and
+//	written with CaptureEncodePng( ) (capture.cpp).
+
+
+const double	GOLDENMAXWRONG = .001;		// of a case's pixels that can be wrong before it fails
+const int	GOLDENMAXWORKERS = 8;
+const int	GOLDENMAXPATH = 1024;
+
+// one picture to check:
+
+struct GoldenCase
+{
+	char				name[64];	// what it is called, and its file in <golden directory>/failed/
+	char				golden[64];	// the golden image is <golden directory>/<golden>.png
+	int				width, height;
+	std::vector<unsigned char>	rgba;		// what was drawn, as read back: bottom row first
+	bool				passed;
+	double				maxDeltaE;	// the worst pixel, after its neighbors have been looked at
+	long				wrong;		// pixels over the tolerance
+	char				message[GOLDENMAXPATH + 128];	// why it failed, if not because of its pixels (it can hold a path)
+};
+
+// reading a deflate stream:
+
+struct GoldenBits
+{
+	const unsigned char *	data;
+	size_t			size, pos;
+	unsigned int		bits;
+	int			count;
+	bool			overrun;	// true if it tried to read past the end
+};
+
+// a canonical huffman code, as a count of the codes of each length and the symbols in code order:
+
+struct GoldenHuffman
+{
+	short	counts[16];
+	short	symbols[288];
+};
+
+double		GoldenTolerance = 5.;			// delta E a pixel can be off by
+char		GoldenDir[GOLDENMAXPATH];
+bool		GoldenUpdate;				// true to write new golden images rather than check
+float		GoldenLinear[256];			// an srgb byte's linear value
+
+std::vector<std::thread>		GoldenWorkers;
+std::mutex				GoldenMutex;		// guards the three below
+std::condition_variable			GoldenWake;
+std::deque<struct GoldenCase*>		GoldenQueue;		// drawn, waiting for a worker
+bool					GoldenQuit;
+
+
+unsigned int
+GoldenGetBits(struct GoldenBits* b, int n)
+{
+	while (b->count < n)
+	{
+		if (b->pos >= b->size)
+		{
+			b->overrun = true;
+			return 0;
+		}
+		b->bits |= (unsigned int)b->data[b->pos++] << b->count;
+		b->count += 8;
+	}
+	unsigned int value = b->bits & ((1u << n) - 1);
+	b->bits >>= n;
+	b->count -= n;
+	return value;
+}
+
+
+// make the code from each symbol's code length (0 for a symbol with none):
+
+void
+GoldenMakeHuffman(struct GoldenHuffman* h, const short* lengths, int n)
+{
+	short offsets[16];
+	memset(h->counts, 0, sizeof(h->counts));
+	for (int s = 0; s < n; s++)
+		h->counts[lengths[s]]++;
+	h->counts[0] = 0;
+	offsets[1] = 0;
+	for (int len = 1; len < 15; len++)
+		offsets[len + 1] = offsets[len] + h->counts[len];
+	for (int s = 0; s < n; s++)
+		if (lengths[s] != 0)
+			h->symbols[offsets[lengths[s]]++] = (short)s;
+}
+
+
+// the next symbol, one bit at a time (codes are at most 15 bits), or -1 if there is no such code:
+
+int
+GoldenDecode(struct GoldenBits* b, const struct GoldenHuffman* h)
+{
+	int code = 0, first = 0, index = 0;
+	for (int len = 1; len < 16; len++)
+	{
+		code |= (int)GoldenGetBits(b, 1);
+		int count = h->counts[len];
+		if (code - first < count)
+			return h->symbols[index + code - first];
+		index += count;
+		first = (first + count) << 1;
+		code <<= 1;
+		if (b->overrun)
+			break;
+	}
+	return -1;
+}
+
+
+// undo a zlib (rfc 1950) stream, appending what it held to out:
+// returns false if it is not one, or is broken
+
+bool
+GoldenInflate(const unsigned char* data, size_t n, std::vector<unsigned char>* out)
+{
+	if (n < 2 || (data[0] & 0x0f) != 8 || ((data[0] << 8) | data[1]) % 31 != 0 || (data[1] & 0x20) != 0)
+		return false;
+	struct GoldenBits b = { data, n, 2, 0, 0, false };
+
+	static const short order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+	int last;
+	do
+	{
+		last = (int)GoldenGetBits(&b, 1);
+		int type = (int)GoldenGetBits(&b, 2);
+		if (type == 0)
+		{
+			// stored: from the next byte on, a length, its complement, and that many bytes
+			b.bits = 0;
+			b.count = 0;
+			if (b.pos + 4 > n)
+				return false;
+			unsigned int len = data[b.pos] | (data[b.pos + 1] << 8);
+			unsigned int check = data[b.pos + 2] | (data[b.pos + 3] << 8);
+			b.pos += 4;
+			if (len != (~check & 0xffff) || b.pos + len > n)
+				return false;
+			out->insert(out->end(), data + b.pos, data + b.pos + len);
+			b.pos += len;
+			continue;
+		}
+
+		struct GoldenHuffman lengthCode, distCode;
+		short lengths[288 + 32];
+		if (type == 1)
+		{
+			for (int s = 0; s < 288; s++)
+				lengths[s] = s < 144 ? 8 : s < 256 ? 9 : s < 280 ? 7 : 8;
+			GoldenMakeHuffman(&lengthCode, lengths, 288);
+			for (int s = 0; s < 30; s++)
+				lengths[s] = 5;
+			GoldenMakeHuffman(&distCode, lengths, 30);
+		}
+		else if (type == 2)
+		{
+			int numLengths = (int)GoldenGetBits(&b, 5) + 257;
+			int numDists = (int)GoldenGetBits(&b, 5) + 1;
+			int numCodeLengths = (int)GoldenGetBits(&b, 4) + 4;
+			short codeLengths[19];
+			memset(codeLengths, 0, sizeof(codeLengths));
+			for (int k = 0; k < numCodeLengths; k++)
+				codeLengths[order[k]] = (short)GoldenGetBits(&b, 3);
+			struct GoldenHuffman codeLengthCode;
+			GoldenMakeHuffman(&codeLengthCode, codeLengths, 19);
+
+			int k = 0;
+			while (k < numLengths + numDists)
+			{
+				int symbol = GoldenDecode(&b, &codeLengthCode);
+				if (symbol < 0)
+					return false;
+				if (symbol < 16)
+				{
+					lengths[k++] = (short)symbol;
+					continue;
+				}
+				short repeat = 0;
+				int times;
+				if (symbol == 16)
+				{
+					if (k == 0)
+						return false;
+					repeat = lengths[k - 1];
+					times = 3 + (int)GoldenGetBits(&b, 2);
+				}
+				else if (symbol == 17)
+					times = 3 + (int)GoldenGetBits(&b, 3);
+				else
+					times = 11 + (int)GoldenGetBits(&b, 7);
+				if (k + times > numLengths + numDists)
+					return false;
+				while (times-- > 0)
+					lengths[k++] = repeat;
+			}
+			GoldenMakeHuffman(&lengthCode, lengths, numLengths);
+			GoldenMakeHuffman(&distCode, lengths + numLengths, numDists);
+		}
+		else
+			return false;
+
+		// the literals and matches, to the end of the block:
+		for (;;)
+		{
+			int symbol = GoldenDecode(&b, &lengthCode);
+			if (symbol < 0 || b.overrun)
+				return false;
+			if (symbol < 256)
+				out->push_back((unsigned char)symbol);
+			else if (symbol == 256)
+				break;
+			else
+			{
+				symbol -= 257;
+				if (symbol >= 29)
+					return false;
+				int length = CAPTURELENGTHBASE[symbol] + (int)GoldenGetBits(&b, CAPTURELENGTHEXTRA[symbol]);
+				int d = GoldenDecode(&b, &distCode);
+				if (d < 0 || d >= 30)
+					return false;
+				size_t distance = (size_t)(CAPTUREDISTBASE[d] + (int)GoldenGetBits(&b, CAPTUREDISTEXTRA[d]));
+				if (distance > out->size())
+					return false;
+				size_t from = out->size() - distance;
+				for (int k = 0; k < length; k++)
+					out->push_back((*out)[from + k]);
+			}
+		}
+	} while (!last && !b.overrun);
+	return !b.overrun;
+}
+
+
+// read an 8-bit rgb or rgba png, not interlaced, into rgba with the bottom row first (the way opengl reads back):
+// returns false, saying why in message, if it cannot
+
+bool
+GoldenReadPng(const char* path, int* width, int* height, std::vector<unsigned char>* rgba, char* message, size_t size)
+{
+	FILE* fp = fopen(path, "rb");
+	if (fp == NULL)
+	{
+		snprintf(message, size, "no golden image %s (make them with --golden-update)", path);
+		return false;
+	}
+	std::vector<unsigned char> file;
+	unsigned char buffer[65536];
+	size_t got;
+	while ((got = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+		file.insert(file.end(), buffer, buffer + got);
+	fclose(fp);
+
+	static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	if (file.size() < 8 || memcmp(&file[0], signature, 8) != 0)
+	{
+		snprintf(message, size, "%s is not a png", path);
+		return false;
+	}
+
+	int w = 0, h = 0, channels = 0;
+	std::vector<unsigned char> compressed;
+	for (size_t pos = 8; pos + 12 <= file.size(); )
+	{
+		const unsigned char* p = &file[pos];
+		size_t length = ((size_t)p[0] << 24) | ((size_t)p[1] << 16) | ((size_t)p[2] << 8) | (size_t)p[3];
+		if (pos + 12 + length > file.size())
+			break;
+		const unsigned char* body = p + 8;
+		if (memcmp(p + 4, "IHDR", 4) == 0 && length >= 13)
+		{
+			w = (body[0] << 24) | (body[1] << 16) | (body[2] << 8) | body[3];
+			h = (body[4] << 24) | (body[5] << 16) | (body[6] << 8) | body[7];
+			channels = body[9] == 2 ? 3 : body[9] == 6 ? 4 : 0;
+			if (body[8] != 8 || channels == 0 || body[12] != 0)
+			{
+				snprintf(message, size, "%s is not an 8-bit rgb or rgba png that is not interlaced", path);
+				return false;
+			}
+		}
+		else if (memcmp(p + 4, "IDAT", 4) == 0)
+			compressed.insert(compressed.end(), body, body + length);
+		else if (memcmp(p + 4, "IEND", 4) == 0)
+			break;
+		pos += 12 + length;
+	}
+
+	size_t stride = (size_t)channels * w;
+	std::vector<unsigned char> filtered;
+	filtered.reserve((stride + 1) * h);
+	if (w <= 0 || h <= 0 || !GoldenInflate(compressed.empty() ? NULL : &compressed[0], compressed.size(), &filtered) ||
+		filtered.size() < (stride + 1) * h)
+	{
+		snprintf(message, size, "%s is broken", path);
+		return false;
+	}
+
+	// undo the filters, row by row, and put the rows bottom first:
+	*width = w;
+	*height = h;
+	rgba->resize(4 * (size_t)w * h);
+	std::vector<unsigned char> row(stride), above(stride, 0);
+	for (int y = 0; y < h; y++)
+	{
+		const unsigned char* src = &filtered[y * (stride + 1)];
+		int filter = src[0];
+		for (size_t k = 0; k < stride; k++)
+		{
+			int a = k >= (size_t)channels ? row[k - channels] : 0;
+			int c = k >= (size_t)channels ? above[k - channels] : 0;
+			row[k] = (unsigned char)(src[1 + k] + CapturePredict(filter, a, above[k], c));
+		}
+		unsigned char* dst = &(*rgba)[(size_t)(h - 1 - y) * 4 * w];
+		for (int x = 0; x < w; x++)
+		{
+			dst[4*x + 0] = row[channels*x + 0];
+			dst[4*x + 1] = row[channels*x + 1];
+			dst[4*x + 2] = row[channels*x + 2];
+			dst[4*x + 3] = 255;
+		}
+		above.swap(row);
+	}
+	return true;
+}
+
+
+// write rgba pixels, bottom row first, as a png:
+
+bool
+GoldenWritePng(const char* path, int width, int height, const std::vector<unsigned char>& rgba)
+{
+	struct CaptureImage image;
+	image.index = 0;
+	image.rgba = rgba;
+	CaptureEncodePng(&image, width, height, &image.encoded);
+
+	FILE* fp = fopen(path, "wb");
+	if (fp == NULL)
+	{
+		fprintf(stderr, "Cannot write '%s'\n", path);
+		return false;
+	}
+	size_t written = fwrite(&image.encoded[0], 1, image.encoded.size(), fp);
+	return fclose(fp) == 0 && written == image.encoded.size();
+}
+
+
+void
+GoldenMakeDir(const char* path)
+{
+#ifdef WIN32
+	_mkdir(path);
+#else
+	mkdir(path, 0755);
+#endif
+}
+
+
+// an image's colors in CIE L*a*b* (d65 white), three floats a pixel:
+
+void
+GoldenToLab(const std::vector<unsigned char>& rgba, size_t pixels, std::vector<float>* lab)
+{
+	lab->resize(3 * pixels);
+	for (size_t i = 0; i < pixels; i++)
+	{
+		float r = GoldenLinear[rgba[4*i]], g = GoldenLinear[rgba[4*i + 1]], b = GoldenLinear[rgba[4*i + 2]];
+		float xyz[3] =
+		{
+			(.4124f * r + .3576f * g + .1805f * b) / .95047f,
+			 .2126f * r + .7152f * g + .0722f * b,
+			(.0193f * r + .1192f * g + .9505f * b) / 1.08883f
+		};
+		float f[3];
+		for (int k = 0; k < 3; k++)
+			f[k] = xyz[k] > .008856f ? cbrtf(xyz[k]) : 7.787f * xyz[k] + 16.f / 116.f;
+		(*lab)[3*i + 0] = 116.f * f[1] - 16.f;
+		(*lab)[3*i + 1] = 500.f * (f[0] - f[1]);
+		(*lab)[3*i + 2] = 200.f * (f[1] - f[2]);
+	}
+}
+
+
+float
+GoldenDeltaE(const float* p, const float* q)
+{
+	float dl = p[0] - q[0], da = p[1] - q[1], db = p[2] - q[2];
+	return sqrtf(dl*dl + da*da + db*db);
+}
+
+
+// compare a case with its golden image (or make it the golden image), and write out what failed:
+// (no opengl calls in here!)
+
+void
+GoldenRun(struct GoldenCase* c)
+{
+	char path[GOLDENMAXPATH + 96];
+	snprintf(path, sizeof(path), "%s/%s.png", GoldenDir, c->golden);
+	c->passed = false;
+	c->maxDeltaE = 0.;
+	c->wrong = 0;
+	c->message[0] = '\0';
+	if (GoldenUpdate)
+	{
+		c->passed = GoldenWritePng(path, c->width, c->height, c->rgba);
+		if (!c->passed)
+			snprintf(c->message, sizeof(c->message), "cannot write %s", path);
+		return;
+	}
+
+	int w, h;
+	std::vector<unsigned char> golden;
+	if (GoldenReadPng(path, &w, &h, &golden, c->message, sizeof(c->message)))
+	{
+		if (w != c->width || h != c->height)
+			snprintf(c->message, sizeof(c->message), "the golden image is %dx%d, not %dx%d", w, h, c->width, c->height);
+		else
+		{
+			size_t pixels = (size_t)w * h;
+			std::vector<float> drawnLab, goldenLab;
+			GoldenToLab(c->rgba, pixels, &drawnLab);
+			GoldenToLab(golden, pixels, &goldenLab);
+
+			// the diff image starts as the golden one in dim gray:
+			std::vector<unsigned char> diff(4 * pixels);
+			for (size_t i = 0; i < pixels; i++)
+			{
+				unsigned char gray = (unsigned char)(.4f * 2.55f * goldenLab[3*i]);
+				diff[4*i] = diff[4*i + 1] = diff[4*i + 2] = gray;
+				diff[4*i + 3] = 255;
+			}
+
+			for (int y = 0; y < h; y++)
+			{
+				for (int x = 0; x < w; x++)
+				{
+					size_t i = (size_t)y * w + x;
+					float d = GoldenDeltaE(&drawnLab[3*i], &goldenLab[3*i]);
+					for (int dy = -1; dy <= 1 && d > GoldenTolerance; dy++)
+						for (int dx = -1; dx <= 1 && d > GoldenTolerance; dx++)
+							if (y + dy >= 0 && y + dy < h && x + dx >= 0 && x + dx < w)
+								d = std::min(d, GoldenDeltaE(&drawnLab[3*i], &goldenLab[3*((size_t)(y + dy) * w + x + dx)]));
+					if (d > c->maxDeltaE)
+						c->maxDeltaE = d;
+					if (d > GoldenTolerance)
+					{
+						c->wrong++;
+						diff[4*i] = (unsigned char)std::min(255.f, 128.f + 4.f * d);
+						diff[4*i + 1] = diff[4*i + 2] = 0;
+					}
+					else if (c->rgba[4*i] != golden[4*i] || c->rgba[4*i + 1] != golden[4*i + 1] || c->rgba[4*i + 2] != golden[4*i + 2])
+					{
+						diff[4*i] = diff[4*i + 1] = 0;
+						diff[4*i + 2] = 160;
+					}
+				}
+			}
+			c->passed = (double)c->wrong <= GOLDENMAXWRONG * (double)pixels;
+			if (!c->passed)
+			{
+				char failed[GOLDENMAXPATH + 8];		// (the directory, and "/failed")
+				snprintf(failed, sizeof(failed), "%s/failed", GoldenDir);
+				GoldenMakeDir(failed);
+				snprintf(path, sizeof(path), "%s/%s-diff.png", failed, c->name);
+				GoldenWritePng(path, w, h, diff);
+			}
+		}
+	}
+
+	if (!c->passed)
+	{
+		snprintf(path, sizeof(path), "%s/failed", GoldenDir);
+		GoldenMakeDir(path);
+		snprintf(path, sizeof(path), "%s/failed/%s.png", GoldenDir, c->name);
+		GoldenWritePng(path, c->width, c->height, c->rgba);
+	}
+}
+
+
+// a worker thread: check cases as they are drawn, until told to quit and there are none left
+
+void
+GoldenWorker()
+{
+	std::unique_lock<std::mutex> lock(GoldenMutex);
+	for (;;)
+	{
+		GoldenWake.wait(lock, [] { return GoldenQuit || !GoldenQueue.empty(); });
+		if (GoldenQueue.empty())
+			return;
+		struct GoldenCase* c = GoldenQueue.front();
+		GoldenQueue.pop_front();
+		lock.unlock();
+		GoldenRun(c);
+		lock.lock();
+	}
+}
+
+
+// start the workers, to check against (or, with update true, write) the golden images in dir:
+
+void
+GoldenStart(const char* dir, bool update)
+{
+	strncpy(GoldenDir, dir, GOLDENMAXPATH - 1);
+	GoldenDir[GOLDENMAXPATH - 1] = '\0';
+	GoldenUpdate = update;
+	if (update)
+		GoldenMakeDir(GoldenDir);
+	CaptureMakeCrcTable();
+	for (int i = 0; i < 256; i++)
+	{
+		float c = (float)i / 255.f;
+		GoldenLinear[i] = c <= .04045f ? c / 12.92f : powf((c + .055f) / 1.055f, 2.4f);
+	}
+
+	int numWorkers = (int)std::thread::hardware_concurrency();
+	if (numWorkers < 1)
+		numWorkers = 1;
+	if (numWorkers > GOLDENMAXWORKERS)
+		numWorkers = GOLDENMAXWORKERS;
+	GoldenQuit = false;
+	for (int i = 0; i < numWorkers; i++)
+		GoldenWorkers.push_back(std::thread(GoldenWorker));
+}
+
+
+// hand a case that has been drawn to the workers (it must stay put until GoldenFinish( )):
+
+void
+GoldenSubmit(struct GoldenCase* c)
+{
+	{
+		std::lock_guard<std::mutex> lock(GoldenMutex);
+		GoldenQueue.push_back(c);
+	}
+	GoldenWake.notify_one();
+}
+
+
+// wait for the workers to check every case, and stop them:
+
+void
+GoldenFinish()
+{
+	{
+		std::lock_guard<std::mutex> lock(GoldenMutex);
+		GoldenQuit = true;
+	}
+	GoldenWake.notify_all();
+	for (size_t i = 0; i < GoldenWorkers.size(); i++)
+		GoldenWorkers[i].join();
+	GoldenWorkers.clear();
+}
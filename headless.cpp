@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+
+#ifndef WIN32
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+//	Offscreen (windowless) rendering for the benchmark mode
+//
+//	Instead of a GLUT window, we ask EGL for a desktop OpenGL context with no surface
+//		(Mesa's "surfaceless" platform, so this works on machines with no X server,
+//		rendering with a software GL such as llvmpipe) and draw into a framebuffer object
+//
+//	Only available on Linux -- on Windows, use the regular GLUT window
+
+
+int		HeadlessWidth, HeadlessHeight;		// size of the offscreen framebuffer
+GLuint	HeadlessFramebuffer;				// the offscreen framebuffer object
+GLuint	HeadlessColorBuffer;				// its color renderbuffer
+GLuint	HeadlessDepthBuffer;				// its depth renderbuffer
+
+#ifndef WIN32
+EGLDisplay	HeadlessDisplay = EGL_NO_DISPLAY;
+EGLContext	HeadlessContext = EGL_NO_CONTEXT;
+#endif
+
+
+// create an opengl context with no window and bind an offscreen framebuffer of the given size:
+// returns false if this cannot be done
+
+bool
+HeadlessInit(int width, int height)
+{
+#ifdef WIN32
+	fprintf(stderr, "Headless rendering is not supported on Windows\n");
+	return false;
+#else
+	// prefer the surfaceless platform so that we do not need a display server:
+
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (getPlatformDisplay != NULL)
+		HeadlessDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	if (HeadlessDisplay == EGL_NO_DISPLAY)
+		HeadlessDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+	EGLint major, minor;
+	if (HeadlessDisplay == EGL_NO_DISPLAY || !eglInitialize(HeadlessDisplay, &major, &minor))
+	{
+		fprintf(stderr, "Cannot initialize EGL (0x%04x)\n", eglGetError());
+		return false;
+	}
+
+	// the fixed-function pipeline needs the desktop (compatibility profile) api:
+
+	if (!eglBindAPI(EGL_OPENGL_API))
+	{
+		fprintf(stderr, "EGL does not support desktop OpenGL\n");
+		return false;
+	}
+
+	const EGLint configAttribs[] =
+	{
+		EGL_SURFACE_TYPE,		EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE,	EGL_OPENGL_BIT,
+		EGL_NONE
+	};
+	EGLConfig config;
+	EGLint numConfigs = 0;
+	eglChooseConfig(HeadlessDisplay, configAttribs, &config, 1, &numConfigs);
+	if (numConfigs == 0)
+	{
+		fprintf(stderr, "Cannot find an EGL config for desktop OpenGL\n");
+		return false;
+	}
+
+	HeadlessContext = eglCreateContext(HeadlessDisplay, config, EGL_NO_CONTEXT, NULL);
+	if (HeadlessContext == EGL_NO_CONTEXT ||
+		!eglMakeCurrent(HeadlessDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, HeadlessContext))
+	{
+		fprintf(stderr, "Cannot create a surfaceless EGL context (0x%04x)\n", eglGetError());
+		return false;
+	}
+
+	GLenum err = glewInit();
+	if (err != GLEW_OK)
+		fprintf(stderr, "glewInit Error (%d) -- continuing\n", err);
+
+	fprintf(stderr, "Headless: EGL %d.%d, %s, OpenGL %s\n",
+		major, minor, glGetString(GL_RENDERER), glGetString(GL_VERSION));
+
+	// the offscreen framebuffer:
+
+	HeadlessWidth = width;
+	HeadlessHeight = height;
+
+	glGenRenderbuffers(1, &HeadlessColorBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, HeadlessColorBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+	// (a float depth buffer, if there is one, for reversed-Z -- see depth.cpp)
+	glGenRenderbuffers(1, &HeadlessDepthBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, HeadlessDepthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GLEW_VERSION_3_0 ? GL_DEPTH_COMPONENT32F : GL_DEPTH_COMPONENT24, width, height);
+
+	glGenFramebuffers(1, &HeadlessFramebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, HeadlessFramebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, HeadlessColorBuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, HeadlessDepthBuffer);
+
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+	{
+		fprintf(stderr, "Offscreen framebuffer is incomplete (0x%04x)\n", status);
+		return false;
+	}
+
+	glDrawBuffer(GL_COLOR_ATTACHMENT0);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	return true;
+#endif
+}
+
+
+// tear down the offscreen framebuffer and the context:
+
+void
+HeadlessFinish()
+{
+#ifndef WIN32
+	if (HeadlessContext == EGL_NO_CONTEXT)
+		return;
+
+	glDeleteFramebuffers(1, &HeadlessFramebuffer);
+	glDeleteRenderbuffers(1, &HeadlessColorBuffer);
+	glDeleteRenderbuffers(1, &HeadlessDepthBuffer);
+
+	eglMakeCurrent(HeadlessDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	eglDestroyContext(HeadlessDisplay, HeadlessContext);
+	eglTerminate(HeadlessDisplay);
+	HeadlessContext = EGL_NO_CONTEXT;
+	HeadlessDisplay = EGL_NO_DISPLAY;
+#endif
+}
+
+
+// a monotonic wall clock in seconds (does not need glut to be running):
+
+double
+WallSeconds()
+{
+	using namespace std::chrono;
+	return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+
+// return the p'th percentile (0. <= p <= 100.) of an already-sorted list:
+
+double
+Percentile(const std::vector<double>& sorted, double p)
+{
+	if (sorted.empty())
+		return 0.;
+	double rank = (p / 100.) * (double)(sorted.size() - 1);
+	size_t lo = (size_t)rank;
+	size_t hi = std::min(lo + 1, sorted.size() - 1);
+	double frac = rank - (double)lo;
+	return sorted[lo] + frac * (sorted[hi] - sorted[lo]);
+}
+
+
+// print the frame rate and the distribution of frame times (in milliseconds):
+
+void
+PrintFrameStats(FILE* fp, const std::vector<double>& frameMs, double totalSeconds)
+{
+	std::vector<double> sorted = frameMs;
+	std::sort(sorted.begin(), sorted.end());
+
+	int n = (int)sorted.size();
+	fprintf(fp, "frames:        %d\n", n);
+	fprintf(fp, "total time:    %.3f s\n", totalSeconds);
+	fprintf(fp, "frames/sec:    %.2f\n", totalSeconds > 0. ? (double)n / totalSeconds : 0.);
+	fprintf(fp, "ms/frame:      min %.3f  p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n",
+		Percentile(sorted, 0.), Percentile(sorted, 50.), Percentile(sorted, 90.),
+		Percentile(sorted, 99.), Percentile(sorted, 100.));
+}
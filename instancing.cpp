@@ -0,0 +1,382 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include "glm/gtc/type_ptr.hpp"
+
+//	Drawing all of the bodies with a handful of instanced draw calls
+//
+//	Instead of a push / multiply / bind / draw / pop for every lit body, the bodies' world matrices, radii,
+//	and texture layers go into the frame ring (framering.cpp) each frame, sorted by sphere level of detail,
+//	and each level of detail is drawn with a single glDrawElementsInstanced( ) of the shared sphere mesh.
+//	Every scene texture is copied into one layer of a 2D array texture, so no texture binds are needed either.
+//	The few unlit bodies (the sun, the sky) are still drawn one at a time: they are the ones that are huge
+//	on the screen, where the fixed-function pipeline's plain 2D textures are cheaper to fill with.
+//
+//	The vertex shader does what the fixed-function pipeline would have done for each vertex
+//	(the same opengl lights and material), so the picture looks the same as the one-body-at-a-time way.
+//	Like the fixed-function pipeline, it gets compiled separately for each number of lights that are on,
+//	since a loop with a fixed count is a lot cheaper per vertex on a software renderer.
+//	With per-pixel lighting on (shading.cpp), it is compiled with PERPIXEL instead, and takes the view and
+//	lights from the FrameLighting uniform block and lights each pixel the same way DrawBodiesShaded( ) does
+//	(and with logarithmic depth, writes its own depth the same way too).
+//
+//	Needs opengl 3.3 (instanced arrays, primitive restart, array textures) --
+//	InitInstancing( ) returns false if that is not there, and the bodies get drawn one at a time.
+
+
+const GLuint	INSTMODELATTRIB = 8;		// 8, 9, 10, 11: the columns of the model matrix
+const GLuint	INSTPARAMSATTRIB = 12;		// radius, texture layer
+const int	INSTMAXTEXSIZE = 2048;		// largest layer of the texture array
+
+struct BodyInstance
+{
+	float	model[16];		// world matrix (column-major)
+	float	radius;
+	float	layer;			// layer of InstTextureArray
+	float	pad[2];
+};
+
+GLuint	InstPrograms[3][MAXSCENELIGHTS+1];	// the instancing shader program, per-vertex, per-pixel, and per-pixel with
+						// logarithmic depth, for each number of lights
+bool	InstancingBroken;		// true if the shaders would not compile
+bool	InstancingReady;		// true if InitInstancing( ) worked
+GLuint	InstTextureArray;		// every scene texture, one per layer, plus a white layer at the end
+int		InstWhiteLayer;			// the layer for bodies without a texture
+
+
+// (NUMLIGHTS, and maybe PERPIXEL and the FrameLighting block, go ahead of this)
+const char *	INSTVERTEXSHADER =
+	"in vec4 instModel0, instModel1, instModel2, instModel3;\n"
+	"in vec4 instParams;			// radius, texture layer\n"
+	"out vec3 vTexCoord;\n"
+	"#ifdef PERPIXEL\n"
+	"out vec3 vEyePos;\n"
+	"out vec3 vNormal;\n"
+	"#else\n"
+	"out vec4 vColor;\n"
+	"#endif\n"
+	"#ifdef LOGDEPTH\n"
+	"out float vDepthW;\n"
+	"#endif\n"
+	"\n"
+	"void main()\n"
+	"{\n"
+	"	mat4 model = mat4(instModel0, instModel1, instModel2, instModel3);\n"
+	"	vTexCoord = vec3(gl_MultiTexCoord0.st, instParams.y);\n"
+	"#ifdef PERPIXEL\n"
+	"	vec4 eyePos = View * (model * vec4(instParams.x * gl_Vertex.xyz, 1.));\n"
+	"	gl_Position = Projection * eyePos;\n"
+	"	vEyePos = eyePos.xyz;\n"
+	"	vNormal = mat3(ViewNormal) * (mat3(model) * gl_Normal);\n"
+	"#ifdef LOGDEPTH\n"
+	"	vDepthW = gl_Position.w;\n"
+	"#endif\n"
+	"#else\n"
+	"	vec4 eyePos = gl_ModelViewMatrix * (model * vec4(instParams.x * gl_Vertex.xyz, 1.));\n"
+	"	gl_Position = gl_ProjectionMatrix * eyePos;\n"
+	"\n"
+	"	// the fixed-function lighting equation, for the front face, with an infinite viewer:\n"
+	"	vec3 n = normalize(gl_NormalMatrix * (mat3(model) * gl_Normal));\n"
+	"	vec4 c = gl_FrontMaterial.emission + gl_LightModel.ambient * gl_FrontMaterial.ambient;\n"
+	"	for (int i = 0; i < NUMLIGHTS; i++)\n"
+	"	{\n"
+	"		vec3 l = gl_LightSource[i].position.xyz - eyePos.xyz * gl_LightSource[i].position.w;\n"
+	"		float d = length(l);\n"
+	"		l /= d;\n"
+	"		float att = 1.;\n"
+	"		if (gl_LightSource[i].position.w != 0.)\n"
+	"			att = 1. / (gl_LightSource[i].constantAttenuation + d * (gl_LightSource[i].linearAttenuation + d * gl_LightSource[i].quadraticAttenuation));\n"
+	"		float ndotl = max(dot(n, l), 0.);\n"
+	"		vec4 lc = gl_LightSource[i].ambient * gl_FrontMaterial.ambient + ndotl * gl_LightSource[i].diffuse * gl_FrontMaterial.diffuse;\n"
+	"		if (ndotl > 0.)\n"
+	"			lc += pow(max(dot(n, normalize(l + vec3(0., 0., 1.))), 0.), gl_FrontMaterial.shininess) * gl_LightSource[i].specular * gl_FrontMaterial.specular;\n"
+	"		c += att * lc;\n"
+	"	}\n"
+	"	vColor = clamp(vec4(c.rgb, gl_FrontMaterial.diffuse.a), 0., 1.);\n"
+	"#endif\n"
+	"}\n";
+
+const char *	INSTFRAGMENTSHADER =
+	"#version 130\n"
+	"uniform sampler2DArray Textures;\n"
+	"in vec4 vColor;\n"
+	"in vec3 vTexCoord;\n"
+	"\n"
+	"void main()\n"
+	"{\n"
+	"	gl_FragColor = vColor * texture(Textures, vTexCoord);		// GL_MODULATE\n"
+	"}\n";
+
+// (after ShadingPreamble( ), SHADINGLIGHTGLSL, and LOGDEPTHGLSL)
+const char *	INSTSHADEDFRAGMENTSHADER =
+	"uniform sampler2DArray Textures;\n"
+	"in vec3 vTexCoord;\n"
+	"in vec3 vEyePos;\n"
+	"in vec3 vNormal;\n"
+	"\n"
+	"void main()\n"
+	"{\n"
+	"	gl_FragColor = ShadeLighting(vEyePos, normalize(vNormal)) * texture(Textures, vTexCoord);\n"
+	"#ifdef LOGDEPTH\n"
+	"	gl_FragDepth = LogDepth();\n"
+	"#endif\n"
+	"}\n";
+
+
+// the instancing shader program for a number of lights, lit per vertex or per pixel
+// (and if per pixel, with or without logarithmic depth), compiling it the first time:
+// returns 0 if it cannot be compiled
+
+GLuint
+InstancingProgram(int numLights, bool perPixel, bool logDepth)
+{
+	if (numLights < 0 || numLights > MAXSCENELIGHTS || InstancingBroken)
+		return 0;
+	GLuint* saved = &InstPrograms[perPixel ? (logDepth ? 2 : 1) : 0][numLights];
+	if (*saved != 0)
+		return *saved;
+
+	std::string vertexSource, fragmentSource;
+	if (perPixel)
+	{
+		std::string preamble = ShadingPreamble(numLights, logDepth);
+		vertexSource = preamble + "#define PERPIXEL\n" + INSTVERTEXSHADER;
+		fragmentSource = preamble + SHADINGLIGHTGLSL + LOGDEPTHGLSL + INSTSHADEDFRAGMENTSHADER;
+	}
+	else
+	{
+		vertexSource = "#version 130\n#define NUMLIGHTS " + std::to_string(numLights) + "\n" + INSTVERTEXSHADER;
+		fragmentSource = INSTFRAGMENTSHADER;
+	}
+	const char* attribNames[] = { "instModel0", "instModel1", "instModel2", "instModel3", "instParams", NULL };
+	const GLuint attribLocs[] = { INSTMODELATTRIB, INSTMODELATTRIB+1, INSTMODELATTRIB+2, INSTMODELATTRIB+3, INSTPARAMSATTRIB };
+	GLuint program = LinkShaderProgram(vertexSource.c_str(), fragmentSource.c_str(),
+		perPixel ? "per-pixel instancing" : "instancing", attribNames, attribLocs);
+	if (program == 0)
+	{
+		if (!perPixel)
+			InstancingBroken = true;
+		return 0;
+	}
+
+	if (perPixel)
+		UseShadingBlock(program);
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "Textures"), 0);
+	glUseProgram(0);
+	*saved = program;
+	return program;
+}
+
+
+// get ready to draw instanced:
+// returns false if this opengl cannot do instancing
+
+bool
+InitInstancing()
+{
+	if (!GLEW_VERSION_3_3)
+	{
+		fprintf(stderr, "Instancing needs OpenGL 3.3 -- drawing the bodies one at a time\n");
+		return false;
+	}
+	if (InstancingProgram(1, false, false) == 0)		// (the usual case, and a check that the shaders compile)
+		return false;
+
+	InstancingReady = true;
+	return true;
+}
+
+
+// copy each of the 2D textures into a layer of the array texture, stretching them all to the size of the biggest:
+// (call again whenever any of them change)
+
+void
+BuildInstanceTextureArray(const GLuint* textures, int numTextures)
+{
+	if (!InstancingReady)
+		return;
+
+	int width = 1, height = 1;
+	for (int i = 0; i < numTextures; i++)
+	{
+		GLint w = 0, h = 0;
+		RsBindTexture(GL_TEXTURE_2D, textures[i]);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &w);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &h);
+		width = std::max(width, std::min((int)w, INSTMAXTEXSIZE));
+		height = std::max(height, std::min((int)h, INSTMAXTEXSIZE));
+	}
+	RsBindTexture(GL_TEXTURE_2D, 0);
+
+	InstWhiteLayer = numTextures;
+	int numLayers = numTextures + 1;
+	int numLevels = 1;
+	while ((width >> numLevels) > 0 || (height >> numLevels) > 0)
+		numLevels++;
+
+	if (InstTextureArray == 0)
+		glGenTextures(1, &InstTextureArray);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, InstTextureArray);
+	for (int level = 0; level < numLevels; level++)
+	{
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, std::max(width >> level, 1), std::max(height >> level, 1),
+			numLayers, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	}
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	// draw each texture onto its layer with a full-screen quad
+	// (this works whatever the source textures are stored as, including compressed):
+
+	GLint oldFramebuffer;
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &oldFramebuffer);
+	RsUseProgram(0);		// (the quads are drawn fixed-function, and the attribute push does not save the program)
+	glPushAttrib(GL_ALL_ATTRIB_BITS);
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadIdentity();
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	glLoadIdentity();
+
+	GLuint fbo;
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glDrawBuffer(GL_COLOR_ATTACHMENT0);
+	glViewport(0, 0, width, height);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_LIGHTING);
+	glDisable(GL_BLEND);
+	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+	glColor3f(1., 1., 1.);
+
+	for (int layer = 0; layer < numLayers; layer++)
+	{
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, InstTextureArray, 0, layer);
+		if (layer < numTextures)
+		{
+			glEnable(GL_TEXTURE_2D);
+			glBindTexture(GL_TEXTURE_2D, textures[layer]);
+		}
+		else
+			glDisable(GL_TEXTURE_2D);		// the white layer
+
+		glBegin(GL_QUADS);
+			glTexCoord2f(0., 0.);	glVertex2f(-1., -1.);
+			glTexCoord2f(1., 0.);	glVertex2f( 1., -1.);
+			glTexCoord2f(1., 1.);	glVertex2f( 1.,  1.);
+			glTexCoord2f(0., 1.);	glVertex2f(-1.,  1.);
+		glEnd();
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, oldFramebuffer);
+	glDeleteFramebuffers(1, &fbo);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode(GL_MODELVIEW);
+	glPopMatrix();
+	glPopAttrib();
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, InstTextureArray);
+	glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	RsInvalidate();		// (the attribute push and pop, and the binds in between, went around the state cache)
+}
+
+
+// draw every lit body of the scene, with the current modelview and projection as the view:
+// (between RingFrameBegin( ) and RingFrameEnd( ))
+//	numLights is how many of the opengl lights (starting at GL_LIGHT0) are on and placed,
+//	lod false means always use the 64-slice sphere,
+//	perPixel true means light with the FrameLighting block UpdateShadingFrame( ) filled in instead
+//	(and then write logarithmic depth if that is the depth mode)
+
+void
+DrawBodiesInstanced(int numLights, bool lod, bool perPixel)
+{
+	int n = Bodies.count;
+	GLuint program = InstancingProgram(numLights, perPixel, perPixel && DepthMode == DEPTHLOG);
+	if (program == 0 || n == 0 || (perPixel && !ShadeFrameBound))
+		return;
+
+	int count[SPHNUMLODS];
+	int numInstances = ComputeBodyLods(lod, count);
+	if (numInstances == 0)
+		return;
+
+	// fill the instance data, grouped by level of detail, straight into this frame's part of the frame ring:
+	GLsizeiptr bytes = numInstances * sizeof(struct BodyInstance);
+	GLintptr offset;
+	struct BodyInstance* instances = (struct BodyInstance*)RingAlloc(bytes, &offset);
+	if (instances == NULL)
+		return;
+
+	int first[SPHNUMLODS];
+	int next[SPHNUMLODS];
+	for (int li = 0, sum = 0; li < SPHNUMLODS; li++)
+	{
+		first[li] = next[li] = sum;
+		sum += count[li];
+	}
+
+	for (int i = 0; i < n; i++)
+	{
+		if (BodyLod[i] < 0)
+			continue;
+		struct BodyInstance* bi = &instances[next[BodyLod[i]]++];
+		memcpy(bi->model, glm::value_ptr(Bodies.world[i]), sizeof(bi->model));
+		bi->radius = Bodies.radius[i];
+		int t = Bodies.texture[i];
+		bi->layer = (float)(t >= 0 && t < InstWhiteLayer ? t : InstWhiteLayer);
+		bi->pad[0] = bi->pad[1] = 0.f;
+	}
+
+	RingCommit(offset, bytes);
+
+	// one draw per level of detail:
+
+	RsUseProgram(program);
+	RsBindTexture(GL_TEXTURE_2D_ARRAY, InstTextureArray);
+
+	for (int a = 0; a < 5; a++)		// the 4 model matrix columns, then INSTPARAMSATTRIB
+	{
+		glEnableVertexAttribArray(INSTMODELATTRIB + a);
+		glVertexAttribDivisor(INSTMODELATTRIB + a, 1);
+	}
+
+	for (int li = 0; li < SPHNUMLODS; li++)
+	{
+		if (count[li] == 0)
+			continue;
+
+		// point the instance attributes at this group's part of the buffer:
+		RsBindBuffer(GL_ARRAY_BUFFER, RingBuffer);
+		size_t base = offset + first[li] * sizeof(struct BodyInstance);
+		for (int a = 0; a < 4; a++)
+		{
+			glVertexAttribPointer(INSTMODELATTRIB + a, 4, GL_FLOAT, GL_FALSE, sizeof(struct BodyInstance),
+				(void*)(base + offsetof(struct BodyInstance, model) + 4 * a * sizeof(float)));
+		}
+		glVertexAttribPointer(INSTPARAMSATTRIB, 4, GL_FLOAT, GL_FALSE, sizeof(struct BodyInstance),
+			(void*)(base + offsetof(struct BodyInstance, radius)));
+
+		DrawSphereMeshInstanced(GetSphereMesh(SPHLODSLICES[li], SPHLODSLICES[li]), count[li]);
+	}
+
+	for (int a = 0; a < 5; a++)
+	{
+		glVertexAttribDivisor(INSTMODELATTRIB + a, 0);
+		glDisableVertexAttribArray(INSTMODELATTRIB + a);
+	}
+	RsBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	RsUseProgram(0);
+}
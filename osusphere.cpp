@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stddef.h>
 #include <math.h>
 #include <GL/gl.h>
 
@@ -36,8 +37,40 @@ SphPtsPointer( int lat, int lng )
 	return &SphPts[ SphNumLngs*lat + lng ];
 }
 
+// a unit sphere that lives in buffer objects on the graphics card:
+// (built once per slices x stacks and shared by everything that draws a sphere)
+
+struct SphereMesh
+{
+	int	slices, stacks;			// tessellation this mesh was built with
+	GLuint	vertexBuffer;			// interleaved struct point's
+	GLuint	indexBuffer;			// GL_UNSIGNED_INT triangle strips, separated by SPHRESTART
+	int	numVertices;
+	int	numIndices;
+	int	numStrips, stripLength;		// for drawing without primitive restart
+};
+
+const GLuint	SPHRESTART = 0xffffffff;	// primitive restart index between the strips
+const int	MAXSPHMESHES = 16;
+
+struct SphereMesh	SphMeshes[ MAXSPHMESHES ];
+int			SphNumMeshes;
+int			SphVerticesDrawn;		// running count of vertices sent to the card
+
+// the level-of-detail chain, coarsest to finest (slices = stacks):
+
+const int	SPHLODSLICES[ ] = { 8, 16, 32, 64, 128 };
+const int	SPHNUMLODS = sizeof(SPHLODSLICES) / sizeof(SPHLODSLICES[0]);
+
+// largest allowed distance, in pixels, between the true silhouette and the tessellated one:
+
+const float	SPHLODMAXERROR = 0.5f;
+
+
+// fill the vertex and index buffers of a unit sphere:
+
 void
-OsuSphere( float radius, int slices, int stacks )
+BuildSphereMesh( struct SphereMesh *m, int slices, int stacks )
 {
 	// set the globals:
 
@@ -53,6 +86,8 @@ OsuSphere( float radius, int slices, int stacks )
 	SphPts = new struct point[ SphNumLngs * SphNumLats ];
 
 	// fill the SphPts structure:
+	// (the first and last latitudes are the poles -- they get one point per longitude
+	//  so that each has its own s texture coordinate)
 
 	for( int ilat = 0; ilat < SphNumLats; ilat++ )
 	{
@@ -60,6 +95,11 @@ OsuSphere( float radius, int slices, int stacks )
 											// ilat=SphNumLats-1, lat=+M_PI/2. is the north pole
 		float xz = cosf( lat );
 		float  y = sinf( lat );
+		if( ilat == 0  ||  ilat == SphNumLats-1 )
+		{
+			xz = 0.;
+			y = ( ilat == 0 ) ? -1. : 1.;
+		}
 		for( int ilng = 0; ilng < SphNumLngs; ilng++ )				// ilng=0, lng=-M_PI and
 											// ilng=SphNumLngs-1, lng=+M_PI are the same meridian
 		{
@@ -67,9 +107,9 @@ OsuSphere( float radius, int slices, int stacks )
 			float x =  xz * cosf( lng );
 			float z = -xz * sinf( lng );
 			struct point* p = SphPtsPointer( ilat, ilng );
-			p->x  = radius * x;
-			p->y  = radius * y;
-			p->z  = radius * z;
+			p->x  = x;
+			p->y  = y;
+			p->z  = z;
 			p->nx = x;
 			p->ny = y;
 			p->nz = z;
@@ -78,60 +118,233 @@ OsuSphere( float radius, int slices, int stacks )
 		}
 	}
 
-	struct point top, bot;		// top, bottom points
+	// one triangle strip per latitude band, from the south pole up to the north pole:
+
+	m->slices = slices;
+	m->stacks = stacks;
+	m->numVertices = SphNumLngs * SphNumLats;
+	m->numStrips = SphNumLats - 1;
+	m->stripLength = 2 * SphNumLngs;
+	m->numIndices = m->numStrips * m->stripLength  +  ( m->numStrips - 1 );
 
-	top.x =  0.;		top.y  = radius;	top.z = 0.;
-	top.nx = 0.;		top.ny = 1.;		top.nz = 0.;
-	top.s  = 0.;		top.t  = 1.;
+	GLuint *indices = new GLuint[ m->numIndices ];
+	GLuint *ip = indices;
+	for( int ilat = 1; ilat < SphNumLats; ilat++ )
+	{
+		if( ilat > 1 )
+			*ip++ = SPHRESTART;
+		for( int ilng = 0; ilng < SphNumLngs; ilng++ )
+		{
+			*ip++ = SphNumLngs*ilat     + ilng;
+			*ip++ = SphNumLngs*(ilat-1) + ilng;
+		}
+	}
 
-	bot.x =  0.;		bot.y  = -radius;	bot.z = 0.;
-	bot.nx = 0.;		bot.ny = -1.;		bot.nz = 0.;
-	bot.s  = 0.;		bot.t  =  0.;
+	// upload both to the graphics card:
 
-	// connect the north pole to the latitude SphNumLats-2:
+	glGenBuffers( 1, &m->vertexBuffer );
+	glBindBuffer( GL_ARRAY_BUFFER, m->vertexBuffer );
+	glBufferData( GL_ARRAY_BUFFER, m->numVertices * sizeof(struct point), SphPts, GL_STATIC_DRAW );
+	glBindBuffer( GL_ARRAY_BUFFER, 0 );
 
-	glBegin(GL_TRIANGLE_STRIP);
-	for (int ilng = 0; ilng < SphNumLngs; ilng++)
+	glGenBuffers( 1, &m->indexBuffer );
+	glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, m->indexBuffer );
+	glBufferData( GL_ELEMENT_ARRAY_BUFFER, m->numIndices * sizeof(GLuint), indices, GL_STATIC_DRAW );
+	glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, 0 );
+
+	// clean-up:
+
+	delete [ ] indices;
+	delete [ ] SphPts;
+	SphPts = NULL;
+}
+
+
+// find the unit sphere mesh with this tessellation, building it the first time it is asked for:
+
+struct SphereMesh *
+GetSphereMesh( int slices, int stacks )
+{
+	for( int i = 0; i < SphNumMeshes; i++ )
 	{
-		float lng = -M_PI + 2. * M_PI * (float)ilng / (float)(SphNumLngs - 1);
-		top.s = (lng + M_PI) / (2. * M_PI);
-		DrawPoint(&top);
-		struct point* p = SphPtsPointer(SphNumLats - 2, ilng);	// ilat=SphNumLats-1 is the north pole
-		DrawPoint(p);
+		if( SphMeshes[i].slices == slices  &&  SphMeshes[i].stacks == stacks )
+			return &SphMeshes[i];
 	}
-	glEnd();
 
-	// connect the south pole to the latitude 1:
-
-	glBegin( GL_TRIANGLE_STRIP );
-	for (int ilng = SphNumLngs - 1; ilng >= 0; ilng--)
+	if( SphNumMeshes >= MAXSPHMESHES )
 	{
-		float lng = -M_PI + 2. * M_PI * (float)ilng / (float)(SphNumLngs - 1);
-		bot.s = (lng + M_PI) / (2. * M_PI);
-		DrawPoint(&bot);
-		struct point* p = SphPtsPointer(1, ilng);					// ilat=0 is the south pole
-		DrawPoint(p);
+		fprintf( stderr, "Too many sphere meshes -- reusing %d x %d\n", SphMeshes[0].slices, SphMeshes[0].stacks );
+		return &SphMeshes[0];
 	}
-	glEnd();
 
-	// connect the horizontal strips:
+	struct SphereMesh *m = &SphMeshes[ SphNumMeshes++ ];
+	BuildSphereMesh( m, slices, stacks );
+	return m;
+}
+
+
+// make a unit sphere mesh the current vertex arrays, for drawing it one or more times:
+// (through the state cache, so binding the mesh that is already bound costs nothing)
+
+void
+BindSphereMesh( struct SphereMesh *m )
+{
+	RsBindBuffer( GL_ARRAY_BUFFER, m->vertexBuffer );
+	RsBindBuffer( GL_ELEMENT_ARRAY_BUFFER, m->indexBuffer );
+
+	RsEnableClientState( GL_VERTEX_ARRAY );
+	RsEnableClientState( GL_NORMAL_ARRAY );
+	RsEnableClientState( GL_TEXTURE_COORD_ARRAY );
+	glVertexPointer(   3, GL_FLOAT, sizeof(struct point), (void *)offsetof( struct point, x ) );
+	glNormalPointer(      GL_FLOAT, sizeof(struct point), (void *)offsetof( struct point, nx ) );
+	glTexCoordPointer( 2, GL_FLOAT, sizeof(struct point), (void *)offsetof( struct point, s ) );
+
+	if( GLEW_VERSION_3_1 )
+		RsEnable( GL_PRIMITIVE_RESTART );
+}
+
 
-	for( int ilat = 2; ilat < SphNumLats-1; ilat++ )
+// draw the mesh BindSphereMesh( ) was last called with:
+
+void
+DrawBoundSphereMesh( struct SphereMesh *m )
+{
+	if( GLEW_VERSION_3_1 )
 	{
-		struct point* p;
-		glBegin(GL_TRIANGLE_STRIP);
-		for( int ilng = 0; ilng < SphNumLngs; ilng++ )
+		glDrawElements( GL_TRIANGLE_STRIP, m->numIndices, GL_UNSIGNED_INT, (void *)0 );
+	}
+	else
+	{
+		// no primitive restart -- draw the strips one at a time, skipping the restart indices:
+
+		for( int i = 0; i < m->numStrips; i++ )
 		{
-			p = SphPtsPointer( ilat, ilng );
-			DrawPoint( p );
-			p = SphPtsPointer( ilat-1, ilng );
-			DrawPoint( p );
+			GLuint first = i * ( m->stripLength + 1 );
+			glDrawElements( GL_TRIANGLE_STRIP, m->stripLength, GL_UNSIGNED_INT, (void *)( first * sizeof(GLuint) ) );
 		}
-		glEnd();
 	}
 
-	// clean-up:
+	SphVerticesDrawn += m->numStrips * m->stripLength;
+}
 
-	delete [ ] SphPts;
-	SphPts = NULL;
-}
\ No newline at end of file
+
+// turn off the vertex arrays and buffers the sphere meshes use,
+// once all of the spheres have been drawn:
+
+void
+UnbindSphereMesh( )
+{
+	if( GLEW_VERSION_3_1 )
+		RsDisable( GL_PRIMITIVE_RESTART );
+
+	RsDisableClientState( GL_VERTEX_ARRAY );
+	RsDisableClientState( GL_NORMAL_ARRAY );
+	RsDisableClientState( GL_TEXTURE_COORD_ARRAY );
+
+	RsBindBuffer( GL_ARRAY_BUFFER, 0 );
+	RsBindBuffer( GL_ELEMENT_ARRAY_BUFFER, 0 );
+}
+
+
+// draw a unit sphere mesh:
+// (it stays bound -- call UnbindSphereMesh( ) when done with the spheres)
+
+void
+DrawSphereMesh( struct SphereMesh *m )
+{
+	BindSphereMesh( m );
+	DrawBoundSphereMesh( m );
+}
+
+
+// draw a unit sphere mesh numInstances times in one call:
+// (the caller sets up the per-instance attributes and the shader that uses them)
+
+void
+DrawSphereMeshInstanced( struct SphereMesh *m, int numInstances )
+{
+	BindSphereMesh( m );
+	glDrawElementsInstanced( GL_TRIANGLE_STRIP, m->numIndices, GL_UNSIGNED_INT, (void *)0, numInstances );
+	SphVerticesDrawn += numInstances * m->numStrips * m->stripLength;
+}
+
+
+// draw a sphere of the given radius centered at the origin:
+// (the shared unit mesh is scaled by the modelview matrix, so GL_NORMALIZE or
+//  GL_RESCALE_NORMAL must be on for the lighting to be right.
+//  do not call this inside a display list -- the vertex arrays would be copied into it,
+//  and call UnbindSphereMesh( ) after the last sphere)
+
+void
+OsuSphere( float radius, int slices, int stacks )
+{
+	struct SphereMesh *m = GetSphereMesh( slices, stacks );
+
+	glPushMatrix( );
+	glScalef( radius, radius, radius );
+	DrawSphereMesh( m );
+	glPopMatrix( );
+}
+
+
+// build every mesh in the level-of-detail chain ahead of time:
+
+void
+InitSphereLods( )
+{
+	for( int i = 0; i < SPHNUMLODS; i++ )
+		GetSphereMesh( SPHLODSLICES[i], SPHLODSLICES[i] );
+
+	// the restart index is part of the context, so it only needs setting once:
+	if( GLEW_VERSION_3_1 )
+		glPrimitiveRestartIndex( SPHRESTART );
+}
+
+
+// the index into SPHLODSLICES[ ] of the coarsest level of detail that keeps the silhouette error
+// under SPHLODMAXERROR pixels, for a sphere of eye-space radius r whose center is d away from the eye:
+// (pixelsPerTan is how many pixels one unit of tangent covers at the center of the screen)
+
+int
+SphereLodIndex( float pixelsPerTan, float d, float r )
+{
+	// projected radius in pixels -- if the eye is inside the sphere, there is no silhouette,
+	// so use the size of one radian of view instead:
+
+	float pixels;
+	if( d > r )
+		pixels = pixelsPerTan * r / sqrtf( d*d - r*r );
+	else
+		pixels = pixelsPerTan;
+
+	// a circle of radius R drawn with N segments is off by at most R * ( 1 - cos( PI/N ) ):
+
+	for( int i = 0; i < SPHNUMLODS; i++ )
+	{
+		int n = SPHLODSLICES[i];
+		if( pixels * ( 1.f - cosf( M_PI / (float)n ) ) <= SPHLODMAXERROR )
+			return i;
+	}
+	return SPHNUMLODS-1;
+}
+
+
+// pick the level of detail for a sphere of this radius drawn with the current modelview, projection, and viewport:
+
+int
+OsuSphereLodSlices( float radius )
+{
+	GLfloat mv[16], proj[16];
+	GLint viewport[4];
+	glGetFloatv( GL_MODELVIEW_MATRIX, mv );
+	glGetFloatv( GL_PROJECTION_MATRIX, proj );
+	glGetIntegerv( GL_VIEWPORT, viewport );
+
+	// the radius in eye coordinates includes any scaling in the modelview matrix:
+
+	float scale = sqrtf( mv[0]*mv[0] + mv[1]*mv[1] + mv[2]*mv[2] );
+	float r = radius * scale;
+	float d = sqrtf( mv[12]*mv[12] + mv[13]*mv[13] + mv[14]*mv[14] );	// eye to center
+
+	return SPHLODSLICES[ SphereLodIndex( 0.5f * (float)viewport[3] * proj[5], d, r ) ];
+}
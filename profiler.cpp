@@ -0,0 +1,387 @@
+#include <stdio.h>
+#include <string.h>
+#include <deque>
+
+//	Where a frame's time goes, on the cpu and on the gpu
+//
+//	Each stage of a frame is bracketed with ProfileBegin( "name", gpu ) and ProfileEnd( ), which may nest.  The cpu side
+//	of a stage is the WallSeconds( ) between the two.  For the stages that draw (gpu true), a GL_TIME_ELAPSED query is
+//	wrapped around them as well.  Those queries cannot nest, so a stage inside another timed one gets cpu time only.
+//	The query results are read back PROFLATENCY frames later, in ProfileFrameBegin( ), so the cpu never waits on
+//	the gpu for them; a result that is still not in by then is dropped (and counted).
+//
+//	Each stage's times are kept smoothed over the last frames for the hud (DrawProfileHud( ) in final.cpp), and
+//	added up for the headless report.  The time between frames, the cpu time inside them, and the gpu time of
+//	each frame are kept for the last PROFHISTORY frames, for the hud's graph.
+//
+//	While the profiler is on, every stage is also recorded as an event, for the last PROFMAXEVENTS of them, and
+//	ProfileWriteTrace( ) writes them out as a chrome trace (chrome://tracing, or ui.perfetto.dev): the cpu stages on
+//	one track and the gpu ones on another.  A GL_TIME_ELAPSED query only gives how long the gpu took, not when it
+//	started, so the gpu events are put where their stage started on the cpu.
+//
+//	Costs nothing but a test of ProfileOn when it is off.  Needs GL_TIME_ELAPSED (opengl 3.3 or ARB_timer_query)
+//	for the gpu times; without it, there are only cpu times.
+
+
+const int	PROFMAXZONES = 24;		// different stages
+const int	PROFMAXDEPTH = 8;		// how deep stages can nest
+const int	PROFMAXGPU = 32;		// gpu-timed stages in a frame (each view of the quad view has its own)
+const int	PROFLATENCY = 4;		// frames before a gpu time is read back
+const int	PROFHISTORY = 120;		// frames in the hud's graph
+const size_t	PROFMAXEVENTS = 200000;		// events kept for the trace
+const double	PROFSMOOTHING = 0.05;		// how much of a new frame's time goes into the hud's averages
+const char *	PROFILETRACEFILE = "profile.json";	// where the debug menu saves the trace
+
+// one stage of the frame:
+
+struct ProfileZone
+{
+	const char *	name;
+	double		cpuMs;			// in the frame being drawn, so far
+	double		cpuAvg, gpuAvg;		// smoothed over the last frames, in milliseconds
+	double		cpuTotal, gpuTotal;	// since the caller last zeroed them (ProfileResetTotals( ))
+	bool		between;		// true if it is timed between frames (like the animation), so averaged per call
+};
+
+// one stage that was timed, as the trace gets it:
+
+struct ProfileEvent
+{
+	const char *	name;
+	bool		gpu;
+	long		frame;
+	double		startUs, durUs;		// since ProfileEpoch
+};
+
+// the gpu-timed stages of one frame, waiting for their queries to come back:
+
+struct ProfileGpuFrame
+{
+	long		frame;
+	int		count;
+	int		zone[PROFMAXGPU];
+	double		cpuStart[PROFMAXGPU];	// when each stage started on the cpu
+	GLuint		query[PROFMAXGPU];
+};
+
+struct ProfileOpen
+{
+	int		zone;
+	double		start;
+	bool		gpu;
+};
+
+int			ProfileOn;			// != 0 means to time the frame's stages
+bool			ProfileGpuOK;			// true if this opengl has GL_TIME_ELAPSED queries
+bool			ProfileInitDone;
+struct ProfileZone	ProfileZones[PROFMAXZONES];
+int			ProfileNumZones;
+struct ProfileOpen	ProfileStack[PROFMAXDEPTH];
+int			ProfileDepth;
+bool			ProfileGpuActive;		// true while a GL_TIME_ELAPSED query is open
+struct ProfileGpuFrame	ProfileGpuFrames[PROFLATENCY];
+long			ProfileFrame;			// counts the profiled frames
+bool			ProfileInFrame;			// true between ProfileFrameBegin( ) and ProfileFrameEnd( )
+double			ProfileFrameStart;		// WallSeconds( ) at this frame's ProfileFrameBegin( )
+double			ProfileLastFrameStart;		// and at the last one's, 0 if it was not profiled
+double			ProfileEpoch;			// WallSeconds( ) the trace's times are from
+float			ProfileIntervalMs[PROFHISTORY];	// from one frame's start to the next's
+float			ProfileCpuMs[PROFHISTORY];	// inside the frame, on the cpu
+float			ProfileGpuMs[PROFHISTORY];	// the frame's gpu-timed stages, added up (once they are back)
+std::deque<struct ProfileEvent>	ProfileEvents;
+long			ProfileTotalFrames;		// since the totals were last zeroed
+long			ProfileGpuLate;			// gpu results that were not in after PROFLATENCY frames
+
+
+// find out if there are gpu timers, and make the queries for them:
+
+void
+InitProfiler()
+{
+	ProfileInitDone = true;
+	ProfileGpuOK = false;
+	if (GLEW_VERSION_3_3 || GLEW_ARB_timer_query)
+	{
+		GLint bits = 0;
+		glGetQueryiv(GL_TIME_ELAPSED, GL_QUERY_COUNTER_BITS, &bits);
+		ProfileGpuOK = bits > 0;
+	}
+	if (!ProfileGpuOK)
+	{
+		fprintf(stderr, "No GL_TIME_ELAPSED queries -- the profiler will only time the cpu\n");
+		return;
+	}
+	for (int f = 0; f < PROFLATENCY; f++)
+	{
+		glGenQueries(PROFMAXGPU, ProfileGpuFrames[f].query);
+		ProfileGpuFrames[f].count = 0;
+	}
+}
+
+
+// the zone for a stage's name, made the first time it is seen:
+// (the names are string constants, so the pointer is almost always enough)
+
+int
+ProfileZoneFor(const char* name)
+{
+	for (int z = 0; z < ProfileNumZones; z++)
+		if (ProfileZones[z].name == name || strcmp(ProfileZones[z].name, name) == 0)
+			return z;
+	if (ProfileNumZones >= PROFMAXZONES)
+		return -1;
+	struct ProfileZone* zone = &ProfileZones[ProfileNumZones];
+	memset(zone, 0, sizeof(*zone));
+	zone->name = name;
+	return ProfileNumZones++;
+}
+
+
+void
+ProfileRecord(const char* name, bool gpu, long frame, double startSeconds, double ms)
+{
+	struct ProfileEvent e;
+	e.name = name;
+	e.gpu = gpu;
+	e.frame = frame;
+	e.startUs = 1.e6 * (startSeconds - ProfileEpoch);
+	e.durUs = 1000. * ms;
+	ProfileEvents.push_back(e);
+	if (ProfileEvents.size() > PROFMAXEVENTS)
+		ProfileEvents.pop_front();
+}
+
+
+// pick up one frame's gpu times:
+//	wait true means wait for them, false means drop the ones that are not in yet
+
+void
+ProfileReadGpuFrame(struct ProfileGpuFrame* g, bool wait)
+{
+	double frameMs = 0.;
+	bool complete = true;
+	for (int k = 0; k < g->count; k++)
+	{
+		if (!wait)
+		{
+			GLuint available = 0;
+			glGetQueryObjectuiv(g->query[k], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+			{
+				ProfileGpuLate++;
+				complete = false;
+				continue;
+			}
+		}
+		GLuint64 ns = 0;
+		glGetQueryObjectui64v(g->query[k], GL_QUERY_RESULT, &ns);
+		double ms = (double)ns / 1.e6;
+		struct ProfileZone* zone = &ProfileZones[g->zone[k]];
+		zone->gpuAvg += PROFSMOOTHING * (ms - zone->gpuAvg);
+		zone->gpuTotal += ms;
+		frameMs += ms;
+		ProfileRecord(zone->name, true, g->frame, g->cpuStart[k], ms);
+	}
+	if (g->count > 0 && complete)
+		ProfileGpuMs[g->frame % PROFHISTORY] = (float)frameMs;
+	g->count = 0;
+}
+
+
+// start timing a frame:
+// (reads back the gpu times of the frame PROFLATENCY frames ago)
+
+void
+ProfileFrameBegin()
+{
+	if (!ProfileOn)
+	{
+		ProfileLastFrameStart = 0.;
+		return;
+	}
+	if (!ProfileInitDone)
+		InitProfiler();
+
+	double now = WallSeconds();
+	if (ProfileEpoch == 0.)
+		ProfileEpoch = now;
+	ProfileFrame++;
+	ProfileInFrame = true;
+	ProfileFrameStart = now;
+	ProfileDepth = 0;
+	for (int z = 0; z < ProfileNumZones; z++)
+		ProfileZones[z].cpuMs = 0.;
+
+	int h = ProfileFrame % PROFHISTORY;
+	ProfileIntervalMs[h] = ProfileLastFrameStart > 0. ? (float)(1000. * (now - ProfileLastFrameStart)) : 0.f;
+	ProfileCpuMs[h] = ProfileGpuMs[h] = 0.f;
+	ProfileLastFrameStart = now;
+
+	if (ProfileGpuOK)
+	{
+		struct ProfileGpuFrame* g = &ProfileGpuFrames[ProfileFrame % PROFLATENCY];
+		ProfileReadGpuFrame(g, false);
+		g->frame = ProfileFrame;
+	}
+}
+
+
+// start a stage (gpu true to time it on the gpu too -- only for stages that draw):
+
+void
+ProfileBegin(const char* name, bool gpu)
+{
+	if (!ProfileOn || ProfileDepth >= PROFMAXDEPTH)
+		return;
+	if (ProfileEpoch == 0.)
+		ProfileEpoch = WallSeconds();
+
+	struct ProfileOpen* o = &ProfileStack[ProfileDepth++];
+	o->zone = ProfileZoneFor(name);
+	o->gpu = false;
+	o->start = WallSeconds();
+
+	if (gpu && ProfileGpuOK && ProfileInFrame && !ProfileGpuActive && o->zone >= 0)
+	{
+		struct ProfileGpuFrame* g = &ProfileGpuFrames[ProfileFrame % PROFLATENCY];
+		if (g->count < PROFMAXGPU)
+		{
+			g->zone[g->count] = o->zone;
+			g->cpuStart[g->count] = o->start;
+			glBeginQuery(GL_TIME_ELAPSED, g->query[g->count]);
+			ProfileGpuActive = true;
+			o->gpu = true;
+		}
+	}
+}
+
+
+// end the stage begun last:
+
+void
+ProfileEnd()
+{
+	if (ProfileDepth <= 0)
+		return;
+	struct ProfileOpen* o = &ProfileStack[--ProfileDepth];
+	if (o->gpu)
+	{
+		glEndQuery(GL_TIME_ELAPSED);
+		ProfileGpuActive = false;
+		ProfileGpuFrames[ProfileFrame % PROFLATENCY].count++;
+	}
+	if (o->zone < 0)
+		return;
+
+	double ms = 1000. * (WallSeconds() - o->start);
+	struct ProfileZone* zone = &ProfileZones[o->zone];
+	zone->cpuMs += ms;
+	zone->cpuTotal += ms;
+	if (!ProfileInFrame)
+	{
+		zone->between = true;
+		zone->cpuAvg += PROFSMOOTHING * (ms - zone->cpuAvg);
+	}
+	ProfileRecord(zone->name, false, ProfileFrame, o->start, ms);
+}
+
+
+// the frame is done (after the buffers are swapped):
+
+void
+ProfileFrameEnd()
+{
+	if (!ProfileOn || !ProfileInFrame)
+		return;
+	while (ProfileDepth > 0)
+		ProfileEnd();
+
+	double ms = 1000. * (WallSeconds() - ProfileFrameStart);
+	ProfileCpuMs[ProfileFrame % PROFHISTORY] = (float)ms;
+	ProfileRecord("frame", false, ProfileFrame, ProfileFrameStart, ms);
+	for (int z = 0; z < ProfileNumZones; z++)
+	{
+		struct ProfileZone* zone = &ProfileZones[z];
+		if (!zone->between)
+			zone->cpuAvg += PROFSMOOTHING * (zone->cpuMs - zone->cpuAvg);
+	}
+	ProfileTotalFrames++;
+	ProfileInFrame = false;
+}
+
+
+// wait for every gpu time that is still out:
+
+void
+ProfileFlush()
+{
+	if (!ProfileGpuOK || !ProfileInitDone)
+		return;
+	for (int k = 1; k <= PROFLATENCY; k++)
+		ProfileReadGpuFrame(&ProfileGpuFrames[(ProfileFrame + k) % PROFLATENCY], true);
+}
+
+
+// start the totals over (the history and the trace keep going):
+
+void
+ProfileResetTotals()
+{
+	ProfileFlush();
+	for (int z = 0; z < ProfileNumZones; z++)
+		ProfileZones[z].cpuTotal = ProfileZones[z].gpuTotal = 0.;
+	ProfileTotalFrames = 0;
+	ProfileGpuLate = 0;
+}
+
+
+// a frame's times, 'back' frames before the newest one that is finished:
+//	which is 0 for the time from one frame to the next, 1 for the cpu time in it, 2 for its gpu time
+// (0 if there is no such frame)
+
+float
+ProfileHistoryMs(int back, int which)
+{
+	long frame = ProfileFrame - (ProfileInFrame ? 1 : 0) - back;
+	if (back < 0 || back >= PROFHISTORY || frame <= 0)
+		return 0.f;
+	int h = frame % PROFHISTORY;
+	return which == 0 ? ProfileIntervalMs[h] : which == 1 ? ProfileCpuMs[h] : ProfileGpuMs[h];
+}
+
+
+// write the events recorded so far as a chrome trace:
+// returns false if the file cannot be written
+
+bool
+ProfileWriteTrace(const char* filename)
+{
+	ProfileFlush();
+
+	FILE* fp = fopen(filename, "w");
+	if (fp == NULL)
+	{
+		fprintf(stderr, "Cannot write the trace to '%s'\n", filename);
+		return false;
+	}
+
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"Sun-Earth-Moon\"}},\n");
+	fprintf(fp, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"cpu\"}},\n");
+	fprintf(fp, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"gpu (GL_TIME_ELAPSED)\"}}");
+	for (size_t i = 0; i < ProfileEvents.size(); i++)
+	{
+		const struct ProfileEvent* e = &ProfileEvents[i];
+		fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"frame\":%ld}}",
+			e->name, e->gpu ? "gpu" : "cpu", e->startUs, e->durUs, e->gpu ? 2 : 1, e->frame);
+	}
+	fprintf(fp, "\n]}\n");
+
+	bool ok = ferror(fp) == 0;
+	fclose(fp);
+	if (!ok)
+		fprintf(stderr, "Error writing the trace to '%s'\n", filename);
+	else
+		fprintf(stderr, "Wrote %zu profiler events to '%s'\n", ProfileEvents.size(), filename);
+	return ok;
+}
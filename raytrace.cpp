@@ -0,0 +1,913 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__AVX2__) && defined(__FMA__)
+#define RT_AVX2
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define RT_NEON
+#include <arm_neon.h>
+#endif
+
+//	Drawing a view by ray tracing the bodies on the cpu, with no opengl at all
+//
+//	Every body is a sphere, so a ray can find it exactly -- no meshes, no levels of detail, and the silhouettes are
+//	round at any size.  RayTraceView( ) traces one view of a frame packet (worked out by ComputeFrame( ), which
+//	does no opengl either) into an rgba image, bottom row first the way glReadPixels( ) gives it, so the same
+//	pictures can go to the capture workers (capture.cpp), into the window with glDrawPixels( ), or be made on a
+//	machine with no gpu at all.
+//
+//	The image is cut into RTTILE x RTTILE tiles.  Each sphere's bounds on the screen (worked out exactly from the
+//	cone it fills as seen from the eye) put it into the lists of the tiles it can show up in, so a ray is only tried
+//	against the few spheres of its tile.  The rays go RTLANES at a time -- a packet is a row of a tile, all from the
+//	eye -- through a SIMD layer like the batch ephemeris's (ephemeris.cpp): AVX2+FMA, NEON, or a plain loop.
+//	What a ray hit is then shaded a pixel at a time, with the lighting equation the shaders use (shading.cpp,
+//	and its constants), so the pictures match opengl's.  A ray that hits nothing looks up the sky body's texture
+//	in its direction, the way the sky's cube map would (skybox.cpp).  The orbit lines and axes are not traced.
+//
+//	Shadows (ShadowsOn): a light is a sphere here, not a point.  What fraction of its disc each body in the way
+//	covers, as seen from the point being lit, is the area where two circles overlap, so there are umbras, penumbras,
+//	and annular eclipses when the moon is too far away to cover the whole sun.  Only the diffuse and specular
+//	light are dimmed.  The bodies that can be in the way are found once a tile, for all of its pixels: the ones near
+//	enough to the line from the sphere around the tile's hits to the light.
+//
+//	The tiles are shared out among persistent threads, one a core, the calling thread being one of them.  Each
+//	starts a frame with an even run of tiles, and takes them from the front of it; one that runs out steals the back
+//	half of the longest run left.  A run is two tile numbers packed into one 64-bit atomic, so taking a tile and
+//	stealing are each one compare-and-swap, with no locks.
+
+
+const int	RTLANES = 8;			// rays in a packet
+const int	RTTILE = 16;			// pixels on a side of a tile (RTTILE / RTLANES packets to a row)
+const int	RTMAXTHREADS = 64;
+const float	RTNEAR = .1f;			// where the rays start, like the projection's near plane (see ComputeFrame( ))
+const float	RTFAR = 1.e30f;			// "no hit"
+
+#if defined(RT_AVX2)
+const char *	RTSIMDNAME = "avx2";
+#elif defined(RT_NEON)
+const char *	RTSIMDNAME = "neon";
+#else
+const char *	RTSIMDNAME = "plain";
+#endif
+
+// a texture, as the tracer looks it up:
+
+struct RtImage
+{
+	int				width, height;
+	std::vector<unsigned char>	rgb;		// bottom row first, as BmpToTexture( ) gives it
+};
+
+// a body, as the rays see it:
+
+struct RtSphere
+{
+	float	center[3];		// relative to the eye
+	float	radius;
+	double	centerD[3];		// (the same, for shading)
+	float	toBody[9];		// world directions into the body's own (for its texture), row-major
+	int	body;
+};
+
+// one frame's view, set up by RtSetup( ) for the threads to trace:
+
+struct RtFrame
+{
+	int				width, height, stride;		// of the image, in pixels
+	unsigned char *			rgba;
+	int				tilesX, tilesY;
+	float				right[3], up[3], forward[3];	// a ray through ndc (x,y) goes along forward + x*right + y*up
+	float				viewer[3];			// toward the eye, for the specular (an infinite viewer)
+	std::vector<struct RtSphere>	spheres;
+	std::vector<int>		tileStart;			// each tile's spheres are tileSpheres[tileStart[t] .. tileStart[t+1]-1]
+	std::vector<int>		tileSpheres;
+	std::vector<float>		casterX, casterY, casterZ;	// the spheres' centers and radii again, RTLANES to a packet
+	std::vector<float>		casterR;			// (padded out with ones far away), for RtFindCasters( )
+	int				numLights;
+	int				lights[MAXSCENELIGHTS];		// indices into spheres[ ]
+	bool				shadows;
+	int				skyBody;			// -1 if none
+	float				toSky[9];			// world directions into the sky body's, row-major
+	unsigned char			background[3];
+};
+
+// one thread's run of tiles, and what it did with them (on a cache line of its own):
+
+struct alignas(64) RtRun
+{
+	std::atomic<unsigned long long>	run;		// the next tile to take, and (in the top 32 bits) the end of the run
+	long				tiles;
+	long				steals;
+	double				tests;		// ray-sphere tests, counting every lane of a packet
+};
+
+// one thread's working space for a tile:
+
+struct RtScratch
+{
+	float			t[RTTILE * RTTILE];		// each pixel's nearest hit, RTFAR for none
+	float			hit[RTTILE * RTTILE];		// and the index of the sphere, as a float (-1 for none)
+	std::vector<int>	casters[MAXSCENELIGHTS];	// the spheres that might be in front of each light
+};
+
+struct RtCounters
+{
+	long	frames;			// views traced
+	double	setupMs;		// placing and binning the spheres, on the calling thread
+	double	traceMs;		// tracing the tiles, with every thread
+	double	rays;
+	double	tests;
+	double	tiles;
+	double	binned;			// sphere-tile pairs
+	long	steals;
+};
+
+std::vector<struct RtImage>	RayTraceTextures;	// the scene's textures (SceneTextures[ ]), loaded by the caller
+struct RtFrame			RtCurrent;
+struct RtRun			RtRuns[RTMAXTHREADS];
+struct RtScratch		RtScratches[RTMAXTHREADS];
+int				RtNumThreads = 1;	// counting the calling thread
+bool				RtStarted;		// true between RayTraceStart( ) and RayTraceStop( )
+std::vector<std::thread>	RtThreads;
+std::mutex			RtMutex;		// guards the four below
+std::condition_variable		RtWake;			// the threads wait on it for a frame
+std::condition_variable		RtDone;			// the calling thread waits on it for them to finish one
+long				RtGeneration;		// counts the frames handed out
+int				RtBusy;			// threads still tracing this frame (not counting the calling one)
+bool				RtQuit;
+struct RtCounters		RayTraceTotal;
+
+
+//	The SIMD layer: RtFloats is RTLANES floats that get the same operation (see ephemeris.cpp's EphFloats)
+
+#if defined(RT_AVX2)
+
+struct RtFloats { __m256 v; };
+inline RtFloats RtSet(float a)							{ return { _mm256_set1_ps(a) }; }
+inline RtFloats RtLoad(const float* p)						{ return { _mm256_loadu_ps(p) }; }
+inline void RtStore(float* p, RtFloats a)					{ _mm256_storeu_ps(p, a.v); }
+inline RtFloats RtAdd(RtFloats a, RtFloats b)					{ return { _mm256_add_ps(a.v, b.v) }; }
+inline RtFloats RtSub(RtFloats a, RtFloats b)					{ return { _mm256_sub_ps(a.v, b.v) }; }
+inline RtFloats RtMul(RtFloats a, RtFloats b)					{ return { _mm256_mul_ps(a.v, b.v) }; }
+inline RtFloats RtMulAdd(RtFloats a, RtFloats b, RtFloats c)			{ return { _mm256_fmadd_ps(a.v, b.v, c.v) }; }
+inline RtFloats RtDiv(RtFloats a, RtFloats b)					{ return { _mm256_div_ps(a.v, b.v) }; }
+inline RtFloats RtSqrt(RtFloats a)						{ return { _mm256_sqrt_ps(a.v) }; }
+inline RtFloats RtMax(RtFloats a, RtFloats b)					{ return { _mm256_max_ps(a.v, b.v) }; }
+inline RtFloats RtMin(RtFloats a, RtFloats b)					{ return { _mm256_min_ps(a.v, b.v) }; }
+inline int RtLessBits(RtFloats a, RtFloats b)					{ return _mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)); }
+// a < b ? x : y, a lane at a time:
+inline RtFloats RtLessSelect(RtFloats a, RtFloats b, RtFloats x, RtFloats y)	{ return { _mm256_blendv_ps(y.v, x.v, _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)) }; }
+
+#elif defined(RT_NEON)
+
+struct RtFloats { float32x4_t lo, hi; };
+inline RtFloats RtSet(float a)							{ return { vdupq_n_f32(a), vdupq_n_f32(a) }; }
+inline RtFloats RtLoad(const float* p)						{ return { vld1q_f32(p), vld1q_f32(p + 4) }; }
+inline void RtStore(float* p, RtFloats a)					{ vst1q_f32(p, a.lo); vst1q_f32(p + 4, a.hi); }
+inline RtFloats RtAdd(RtFloats a, RtFloats b)					{ return { vaddq_f32(a.lo, b.lo), vaddq_f32(a.hi, b.hi) }; }
+inline RtFloats RtSub(RtFloats a, RtFloats b)					{ return { vsubq_f32(a.lo, b.lo), vsubq_f32(a.hi, b.hi) }; }
+inline RtFloats RtMul(RtFloats a, RtFloats b)					{ return { vmulq_f32(a.lo, b.lo), vmulq_f32(a.hi, b.hi) }; }
+inline RtFloats RtMulAdd(RtFloats a, RtFloats b, RtFloats c)			{ return { vfmaq_f32(c.lo, a.lo, b.lo), vfmaq_f32(c.hi, a.hi, b.hi) }; }
+inline RtFloats RtDiv(RtFloats a, RtFloats b)					{ return { vdivq_f32(a.lo, b.lo), vdivq_f32(a.hi, b.hi) }; }
+inline RtFloats RtSqrt(RtFloats a)						{ return { vsqrtq_f32(a.lo), vsqrtq_f32(a.hi) }; }
+inline RtFloats RtMax(RtFloats a, RtFloats b)					{ return { vmaxq_f32(a.lo, b.lo), vmaxq_f32(a.hi, b.hi) }; }
+inline RtFloats RtMin(RtFloats a, RtFloats b)					{ return { vminq_f32(a.lo, b.lo), vminq_f32(a.hi, b.hi) }; }
+inline int RtLessBits(RtFloats a, RtFloats b)
+{
+	static const uint32_t bits[4] = { 1, 2, 4, 8 };
+	uint32x4_t m = vld1q_u32(bits);
+	return (int)(vaddvq_u32(vandq_u32(vcltq_f32(a.lo, b.lo), m)) | (vaddvq_u32(vandq_u32(vcltq_f32(a.hi, b.hi), m)) << 4));
+}
+inline RtFloats RtLessSelect(RtFloats a, RtFloats b, RtFloats x, RtFloats y)
+	{ return { vbslq_f32(vcltq_f32(a.lo, b.lo), x.lo, y.lo), vbslq_f32(vcltq_f32(a.hi, b.hi), x.hi, y.hi) }; }
+
+#else
+
+struct RtFloats { float v[RTLANES]; };
+#define RT_EACH(expr)	RtFloats r; for (int i = 0; i < RTLANES; i++) r.v[i] = (expr); return r
+inline RtFloats RtSet(float a)							{ RT_EACH(a); }
+inline RtFloats RtLoad(const float* p)						{ RT_EACH(p[i]); }
+inline void RtStore(float* p, RtFloats a)					{ for (int i = 0; i < RTLANES; i++) p[i] = a.v[i]; }
+inline RtFloats RtAdd(RtFloats a, RtFloats b)					{ RT_EACH(a.v[i] + b.v[i]); }
+inline RtFloats RtSub(RtFloats a, RtFloats b)					{ RT_EACH(a.v[i] - b.v[i]); }
+inline RtFloats RtMul(RtFloats a, RtFloats b)					{ RT_EACH(a.v[i] * b.v[i]); }
+inline RtFloats RtMulAdd(RtFloats a, RtFloats b, RtFloats c)			{ RT_EACH(a.v[i] * b.v[i] + c.v[i]); }
+inline RtFloats RtDiv(RtFloats a, RtFloats b)					{ RT_EACH(a.v[i] / b.v[i]); }
+inline RtFloats RtSqrt(RtFloats a)						{ RT_EACH(sqrtf(a.v[i])); }
+inline RtFloats RtMax(RtFloats a, RtFloats b)					{ RT_EACH(a.v[i] > b.v[i] ? a.v[i] : b.v[i]); }
+inline RtFloats RtMin(RtFloats a, RtFloats b)					{ RT_EACH(a.v[i] < b.v[i] ? a.v[i] : b.v[i]); }
+inline int RtLessBits(RtFloats a, RtFloats b)
+{
+	int bits = 0;
+	for (int i = 0; i < RTLANES; i++)
+		bits |= a.v[i] < b.v[i] ? 1 << i : 0;
+	return bits;
+}
+inline RtFloats RtLessSelect(RtFloats a, RtFloats b, RtFloats x, RtFloats y)	{ RT_EACH(a.v[i] < b.v[i] ? x.v[i] : y.v[i]); }
+#undef RT_EACH
+
+#endif
+
+
+inline unsigned long long
+RtPackRun(unsigned int next, unsigned int end)
+{
+	return ((unsigned long long)end << 32) | next;
+}
+
+
+// the tiles *first to *last (of n, across an image size pixels wide) that ndc from lo to hi falls in:
+// returns false if it is all off the image
+
+bool
+RtTileRange(double lo, double hi, int size, int n, int* first, int* last)
+{
+	double plo = (lo + 1.) * .5 * (double)size;
+	double phi = (hi + 1.) * .5 * (double)size;
+	if (phi < 0. || plo >= (double)size)
+		return false;
+	*first = plo <= 0. ? 0 : (int)(plo / (double)RTTILE);
+	*last = phi >= (double)size ? n - 1 : (int)(phi / (double)RTTILE);
+	if (*last > n - 1)
+		*last = n - 1;
+	return true;
+}
+
+
+// where a sphere with camera-space center (x, -d) and radius r (in the x-z or y-z plane) shows up, as ndc from *lo
+// to *hi, with scale the projection's P00 or P11: (it must not be all behind the eye)
+//	the edges of the cone from the eye around it are the center's angle, plus and minus asin(r / distance)
+
+void
+RtSphereBounds(double x, double d, double r, double scale, double* lo, double* hi)
+{
+	double len = sqrt(x*x + d*d);
+	if (len <= r)
+	{
+		*lo = -RTFAR;
+		*hi = RTFAR;
+		return;
+	}
+	double center = atan2(x, d);
+	double half = asin(r / len);
+	*lo = center - half <= -M_PI / 2. ? -RTFAR : scale * tan(center - half);
+	*hi = center + half >= M_PI / 2. ? RTFAR : scale * tan(center + half);
+}
+
+
+// set up RtCurrent to trace view v of frame f into a width x height image:
+
+void
+RtSetup(const struct BodyFrame* f, const struct FrameView* v, int width, int height, int stride, bool lightsOn,
+	bool shadows, const float background[3], unsigned char* rgba)
+{
+	struct RtFrame* rf = &RtCurrent;
+	rf->width = width;
+	rf->height = height;
+	rf->stride = stride;
+	rf->rgba = rgba;
+	rf->tilesX = (width + RTTILE - 1) / RTTILE;
+	rf->tilesY = (height + RTTILE - 1) / RTTILE;
+	for (int k = 0; k < 3; k++)
+		rf->background[k] = (unsigned char)(background[k] * 255.f + .5f);
+
+	// the eye, and the rays' directions, in world coordinates (relative to the view's origin):
+	glm::dmat4 view = glm::dmat4(glm::make_mat4(v->view));
+	glm::dmat4 inv = glm::inverse(view);
+	double p00 = (double)v->projection[0];
+	double p11 = (double)v->projection[5];
+	double eye[3] = { inv[3][0], inv[3][1], inv[3][2] };
+	for (int k = 0; k < 3; k++)
+	{
+		rf->right[k] = (float)(inv[0][k] / p00);
+		rf->up[k] = (float)(inv[1][k] / p11);
+		rf->forward[k] = (float)(-inv[2][k]);
+	}
+	double back = sqrt(inv[2][0]*inv[2][0] + inv[2][1]*inv[2][1] + inv[2][2]*inv[2][2]);
+	for (int k = 0; k < 3; k++)
+		rf->viewer[k] = (float)(inv[2][k] / back);
+	double viewScale = sqrt(view[0][0]*view[0][0] + view[0][1]*view[0][1] + view[0][2]*view[0][2]);
+
+	// every body but the sky, relative to the eye, and the tiles each can be seen in:
+	int numBodies = (int)f->frameX.size();
+	rf->spheres.clear();
+	rf->numLights = 0;
+	rf->shadows = shadows;
+	rf->skyBody = -1;
+	std::vector<int> bounds;		// first and last tile across and up, for each sphere
+	for (int b = 0; b < numBodies; b++)
+	{
+		const glm::mat4& w = f->world[b];
+		if ((Bodies.flags[b] & BODYSKY) != 0)
+		{
+			if (rf->skyBody < 0)
+			{
+				rf->skyBody = b;
+				for (int c = 0; c < 3; c++)
+				{
+					float len = sqrtf(w[c][0]*w[c][0] + w[c][1]*w[c][1] + w[c][2]*w[c][2]);
+					for (int k = 0; k < 3; k++)
+						rf->toSky[3*c + k] = len > 0.f ? w[c][k] / len : 0.f;
+				}
+			}
+			continue;
+		}
+
+		struct RtSphere s;
+		s.centerD[0] = f->frameX[b] - v->cull.origin[0] - eye[0];
+		s.centerD[1] = -v->cull.origin[1] - eye[1];
+		s.centerD[2] = f->frameZ[b] - v->cull.origin[2] - eye[2];
+		for (int k = 0; k < 3; k++)
+			s.center[k] = (float)s.centerD[k];
+		s.radius = Bodies.radius[b];
+		for (int c = 0; c < 3; c++)
+			for (int k = 0; k < 3; k++)
+				s.toBody[3*c + k] = w[c][k];
+		s.body = b;
+
+		// in camera coordinates (looking down -z), and where that is on the screen:
+		// (one that cannot be seen is still kept if it is a light, or, with shadows, might be in a light's way)
+		glm::dvec4 e = view * glm::dvec4(s.centerD[0] + eye[0], s.centerD[1] + eye[1], s.centerD[2] + eye[2], 1.);
+		double r = (double)s.radius * viewScale;
+		double xlo, xhi, ylo, yhi;
+		RtSphereBounds(e.x, -e.z, r, p00, &xlo, &xhi);
+		RtSphereBounds(e.y, -e.z, r, p11, &ylo, &yhi);
+		int tx0, tx1, ty0, ty1;
+		if (-e.z + r <= (double)RTNEAR ||
+			!RtTileRange(xlo, xhi, width, rf->tilesX, &tx0, &tx1) || !RtTileRange(ylo, yhi, height, rf->tilesY, &ty0, &ty1))
+		{
+			if (!shadows && (Bodies.flags[b] & BODYLIGHT) == 0)
+				continue;
+			tx0 = ty0 = 0;
+			tx1 = ty1 = -1;
+		}
+
+		if (lightsOn && (Bodies.flags[b] & BODYLIGHT) != 0 && rf->numLights < MAXSCENELIGHTS)
+			rf->lights[rf->numLights++] = (int)rf->spheres.size();
+		rf->spheres.push_back(s);
+		bounds.push_back(tx0);
+		bounds.push_back(tx1);
+		bounds.push_back(ty0);
+		bounds.push_back(ty1);
+	}
+
+	// the tiles' lists of spheres, in order:
+	int numTiles = rf->tilesX * rf->tilesY;
+	rf->tileStart.assign(numTiles + 1, 0);
+	int numSpheres = (int)rf->spheres.size();
+	for (int i = 0; i < numSpheres; i++)
+		for (int ty = bounds[4*i + 2]; ty <= bounds[4*i + 3]; ty++)
+			for (int tx = bounds[4*i]; tx <= bounds[4*i + 1]; tx++)
+				rf->tileStart[ty * rf->tilesX + tx + 1]++;
+	for (int t = 0; t < numTiles; t++)
+		rf->tileStart[t + 1] += rf->tileStart[t];
+	rf->tileSpheres.resize(rf->tileStart[numTiles]);
+	std::vector<int> fill(rf->tileStart.begin(), rf->tileStart.end() - 1);
+	for (int i = 0; i < numSpheres; i++)
+		for (int ty = bounds[4*i + 2]; ty <= bounds[4*i + 3]; ty++)
+			for (int tx = bounds[4*i]; tx <= bounds[4*i + 1]; tx++)
+				rf->tileSpheres[fill[ty * rf->tilesX + tx]++] = i;
+
+	// the spheres for looking through a packet at a time, for shadows:
+	int padded = shadows ? (numSpheres + RTLANES - 1) / RTLANES * RTLANES : 0;
+	rf->casterX.assign(padded, RTFAR);
+	rf->casterY.assign(padded, RTFAR);
+	rf->casterZ.assign(padded, RTFAR);
+	rf->casterR.assign(padded, 0.f);
+	for (int i = 0; i < numSpheres && shadows; i++)
+	{
+		rf->casterX[i] = rf->spheres[i].center[0];
+		rf->casterY[i] = rf->spheres[i].center[1];
+		rf->casterZ[i] = rf->spheres[i].center[2];
+		rf->casterR[i] = rf->spheres[i].radius;
+	}
+}
+
+
+// the texture of body b, or white if it has none:
+
+const struct RtImage*
+RtTexture(int b)
+{
+	static struct RtImage white = { 1, 1, std::vector<unsigned char>(3, 255) };
+	int t = Bodies.texture[b];
+	if (t < 0 || t >= (int)RayTraceTextures.size() || RayTraceTextures[t].rgb.empty())
+		return &white;
+	return &RayTraceTextures[t];
+}
+
+
+// how much of a disc of angular radius a is covered by one of angular radius b, their centers d apart:
+// (the area of the two circles' overlap, over the first one's area)
+
+double
+RtDiscCovered(double a, double b, double d)
+{
+	if (d >= a + b)
+		return 0.;
+	if (d <= b - a)
+		return 1.;				// the whole disc is behind the other
+	if (d <= a - b)
+		return (b * b) / (a * a);		// the other is all in front of it (an annular eclipse)
+	double ca = (d*d + a*a - b*b) / (2. * d * a);
+	double cb = (d*d + b*b - a*a) / (2. * d * b);
+	ca = ca < -1. ? -1. : (ca > 1. ? 1. : ca);
+	cb = cb < -1. ? -1. : (cb > 1. ? 1. : cb);
+	double k = (-d + a + b) * (d + a - b) * (d - a + b) * (d + a + b);
+	double area = a*a * acos(ca) + b*b * acos(cb) - .5 * sqrt(k > 0. ? k : 0.);
+	double covered = area / (M_PI * a * a);
+	return covered < 0. ? 0. : (covered > 1. ? 1. : covered);
+}
+
+
+// how much of light li's disc can be seen from point p (relative to the eye) on sphere self:
+
+double
+RtLightVisible(const struct RtFrame* rf, const struct RtScratch* s, int li, const double p[3], int self)
+{
+	const struct RtSphere* light = &rf->spheres[rf->lights[li]];
+	double l[3] = { light->centerD[0] - p[0], light->centerD[1] - p[1], light->centerD[2] - p[2] };
+	double lightDist = sqrt(l[0]*l[0] + l[1]*l[1] + l[2]*l[2]);
+	if (lightDist <= (double)light->radius)
+		return 1.;
+	double sinA = (double)light->radius / lightDist;
+	double cos2A = 1. - sinA * sinA;
+	double a = asin(sinA);
+	for (int k = 0; k < 3; k++)
+		l[k] /= lightDist;
+
+	double visible = 1.;
+	const std::vector<int>& casters = s->casters[li];
+	for (size_t i = 0; i < casters.size() && visible > 0.; i++)
+	{
+		if (casters[i] == self)
+			continue;
+		const struct RtSphere* o = &rf->spheres[casters[i]];
+		double u[3] = { o->centerD[0] - p[0], o->centerD[1] - p[1], o->centerD[2] - p[2] };
+		double along = u[0]*l[0] + u[1]*l[1] + u[2]*l[2];
+		if (along <= 0.)
+			continue;		// behind the point
+		double dist2 = u[0]*u[0] + u[1]*u[1] + u[2]*u[2];
+		double out = along * sinA + (double)o->radius;
+		if ((dist2 - along * along) * cos2A > out * out)
+			continue;		// clear of the cone from the point to the light's disc
+		double dist = sqrt(dist2);
+		if (dist - (double)o->radius >= lightDist)
+			continue;		// past the light
+		if (dist <= (double)o->radius)
+			return 0.;
+		double b = asin((double)o->radius / dist);
+		double cross[3] = { u[1]*l[2] - u[2]*l[1], u[2]*l[0] - u[0]*l[2], u[0]*l[1] - u[1]*l[0] };
+		double d = atan2(sqrt(cross[0]*cross[0] + cross[1]*cross[1] + cross[2]*cross[2]), along);
+		visible *= 1. - RtDiscCovered(a, b, d);
+	}
+	return visible;
+}
+
+
+// find the spheres that might be between the tile's hits (within radius of center) and each light:
+// (the ones that reach both the capsule around the line between them, as wide as the wider end, and the cone
+// that fits around both ends -- for the cone, a sphere's distance from the line, times the cosine of the cone's
+// half-angle, against the cone's radius abreast of it; a packet of spheres at a time)
+
+void
+RtFindCasters(const struct RtFrame* rf, struct RtScratch* s, const double center[3], double radius)
+{
+	int numSpheres = (int)rf->spheres.size();
+	int padded = (int)rf->casterR.size();
+	RtFloats zero = RtSet(0.f);
+	RtFloats one = RtSet(1.f);
+	for (int li = 0; li < rf->numLights; li++)
+	{
+		std::vector<int>& casters = s->casters[li];
+		casters.clear();
+		int lightSphere = rf->lights[li];
+		const struct RtSphere* light = &rf->spheres[lightSphere];
+		double seg[3] = { light->centerD[0] - center[0], light->centerD[1] - center[1], light->centerD[2] - center[2] };
+		double segLen2 = seg[0]*seg[0] + seg[1]*seg[1] + seg[2]*seg[2];
+		double grow = (double)light->radius - radius;		// how much wider the cone gets, end to end
+		double margin = 1.e-6 * (sqrt(segLen2) + sqrt(center[0]*center[0] + center[1]*center[1] + center[2]*center[2]));
+		bool cone = grow * grow < segLen2;			// (else one end's sphere holds the other's)
+		double reach = (radius > (double)light->radius ? radius : (double)light->radius) + margin;
+
+		RtFloats qx = RtSet((float)center[0]), qy = RtSet((float)center[1]), qz = RtSet((float)center[2]);
+		RtFloats sx = RtSet((float)seg[0]), sy = RtSet((float)seg[1]), sz = RtSet((float)seg[2]);
+		RtFloats negSx = RtSet((float)-seg[0]), negSy = RtSet((float)-seg[1]), negSz = RtSet((float)-seg[2]);
+		RtFloats invLen2 = RtSet(segLen2 > 0. ? (float)(1. / segLen2) : 0.f);
+		RtFloats reachV = RtSet((float)reach);
+		RtFloats base = RtSet((float)(radius + margin));
+		RtFloats growV = RtSet((float)grow);
+		RtFloats coneV = RtSet(cone ? (float)(1. - grow * grow / segLen2) : 0.f);
+		RtFloats slack = RtSet(1.e-6f);
+		for (int i = 0; i < padded; i += RTLANES)
+		{
+			RtFloats r = RtLoad(&rf->casterR[i]);
+			RtFloats ux = RtSub(RtLoad(&rf->casterX[i]), qx);
+			RtFloats uy = RtSub(RtLoad(&rf->casterY[i]), qy);
+			RtFloats uz = RtSub(RtLoad(&rf->casterZ[i]), qz);
+			RtFloats dot = RtMulAdd(ux, sx, RtMulAdd(uy, sy, RtMul(uz, sz)));
+			RtFloats t0 = RtMul(dot, invLen2);
+			RtFloats t = RtMin(RtMax(t0, zero), one);
+			RtFloats dx = RtMulAdd(t, negSx, ux);
+			RtFloats dy = RtMulAdd(t, negSy, uy);
+			RtFloats dz = RtMulAdd(t, negSz, uz);
+			RtFloats capsule = RtAdd(r, reachV);
+			int out = RtLessBits(RtMul(capsule, capsule), RtMulAdd(dx, dx, RtMulAdd(dy, dy, RtMul(dz, dz))));
+			if (cone && out != (1 << RTLANES) - 1)
+			{
+				RtFloats u2 = RtMulAdd(ux, ux, RtMulAdd(uy, uy, RtMul(uz, uz)));
+				RtFloats perp2 = RtSub(u2, RtMul(dot, t0));
+				RtFloats abreast = RtMax(RtAdd(RtAdd(r, base), RtMul(t0, growV)), zero);
+				out |= RtLessBits(RtMulAdd(u2, slack, RtMul(abreast, abreast)), RtMul(perp2, coneV));
+			}
+			int in = ~out & ((1 << RTLANES) - 1);
+			for (int k = 0; in != 0; k++, in >>= 1)
+				if ((in & 1) != 0 && i + k < numSpheres && i + k != lightSphere)
+					casters.push_back(i + k);
+		}
+	}
+}
+
+
+// the color of a ray along dir (unit length, from the eye, starting tmin along it) that hit sphere i, into rgb[ ]:
+
+void
+RtShade(const struct RtFrame* rf, const struct RtScratch* s, const double dir[3], double tmin, int i, unsigned char rgb[3])
+{
+	const struct RtSphere* sp = &rf->spheres[i];
+	int b = sp->body;
+
+	// where it hit, again in double precision, and the normal there:
+	const double* c = sp->centerD;
+	double along = c[0]*dir[0] + c[1]*dir[1] + c[2]*dir[2];
+	double q[3] = { c[0] - along * dir[0], c[1] - along * dir[1], c[2] - along * dir[2] };
+	double r = (double)sp->radius;
+	double disc = r*r - (q[0]*q[0] + q[1]*q[1] + q[2]*q[2]);
+	double root = sqrt(disc > 0. ? disc : 0.);
+	double t = along - root;
+	if (t <= tmin)
+		t = along + root;		// (the eye is inside it)
+	double p[3] = { t * dir[0], t * dir[1], t * dir[2] };
+	double n[3] = { (p[0] - c[0]) / r, (p[1] - c[1]) / r, (p[2] - c[2]) / r };
+
+	// its texture, the way the sphere mesh maps it (see SampleLatLng( )):
+	const struct RtImage* tex = RtTexture(b);
+	float o[3];
+	for (int k = 0; k < 3; k++)
+		o[k] = sp->toBody[3*k + 0] * (float)n[0] + sp->toBody[3*k + 1] * (float)n[1] + sp->toBody[3*k + 2] * (float)n[2];
+	unsigned char texel[3];
+	SampleLatLng(&tex->rgb[0], tex->width, tex->height, o[0], o[1], o[2], texel);
+	if ((Bodies.flags[b] & BODYUNLIT) != 0)
+	{
+		memcpy(rgb, texel, 3);
+		return;
+	}
+
+	// the fixed-function lighting equation, as the shaders have it:
+	float color[3];
+	for (int k = 0; k < 3; k++)
+		color[k] = SHADINGGLOBALAMBIENT[k] * SHADINGMATERIAL[k];
+	for (int li = 0; li < rf->numLights; li++)
+	{
+		const struct RtSphere* light = &rf->spheres[rf->lights[li]];
+		double l[3] = { light->centerD[0] - p[0], light->centerD[1] - p[1], light->centerD[2] - p[2] };
+		double len = sqrt(l[0]*l[0] + l[1]*l[1] + l[2]*l[2]);
+		for (int k = 0; k < 3; k++)
+			l[k] = len > 0. ? l[k] / len : 0.;
+		float ndotl = (float)(n[0]*l[0] + n[1]*l[1] + n[2]*l[2]);
+		ndotl = ndotl > 0.f ? ndotl : 0.f;
+		float visible = 1.f;
+		if (rf->shadows && ndotl > 0.f)
+			visible = (float)RtLightVisible(rf, s, li, p, i);
+		for (int k = 0; k < 3; k++)
+			color[k] += SHADINGLIGHTAMBIENT[k] * SHADINGMATERIAL[k] + visible * ndotl * SHADINGLIGHTCOLOR[k] * SHADINGMATERIAL[k];
+		if (ndotl > 0.f && visible > 0.f)
+		{
+			double h[3] = { l[0] + rf->viewer[0], l[1] + rf->viewer[1], l[2] + rf->viewer[2] };
+			double hl = sqrt(h[0]*h[0] + h[1]*h[1] + h[2]*h[2]);
+			float ndoth = hl > 0. ? (float)((n[0]*h[0] + n[1]*h[1] + n[2]*h[2]) / hl) : 0.f;
+			float spec = visible * powf(ndoth > 0.f ? ndoth : 0.f, SHADINGSHININESS);
+			for (int k = 0; k < 3; k++)
+				color[k] += spec * SHADINGLIGHTCOLOR[k] * SHADINGSPECULAR;
+		}
+	}
+	for (int k = 0; k < 3; k++)
+		rgb[k] = (unsigned char)((color[k] < 1.f ? color[k] : 1.f) * (float)texel[k] + .5f);
+}
+
+
+// trace one tile of RtCurrent:
+
+void
+RtTraceTile(int tile, struct RtScratch* s, struct RtRun* stats)
+{
+	const struct RtFrame* rf = &RtCurrent;
+	int x0 = (tile % rf->tilesX) * RTTILE;
+	int y0 = (tile / rf->tilesX) * RTTILE;
+	const int* list = rf->tileSpheres.empty() ? NULL : &rf->tileSpheres[0] + rf->tileStart[tile];
+	int n = rf->tileStart[tile + 1] - rf->tileStart[tile];
+
+	// the nearest hit of every pixel, a packet at a time:
+	float step = 2.f / (float)rf->width;
+	float offsets[RTLANES];
+	for (int i = 0; i < RTLANES; i++)
+		offsets[i] = (float)i * step;
+	RtFloats laneX = RtLoad(offsets);
+	RtFloats fx = RtSet(rf->forward[0]), fy = RtSet(rf->forward[1]), fz = RtSet(rf->forward[2]);
+	RtFloats zero = RtSet(0.f), one = RtSet(1.f), miss = RtSet(RTFAR), none = RtSet(-1.f), start = RtSet(RTNEAR);
+	int rows = rf->height - y0 < RTTILE ? rf->height - y0 : RTTILE;
+	for (int row = 0; row < rows; row++)
+	{
+		float y = (float)(2 * (y0 + row) + 1) / (float)rf->height - 1.f;
+		RtFloats wy = RtSet(y);
+		for (int p = 0; p < RTTILE; p += RTLANES)
+		{
+			float x = (float)(2 * (x0 + p) + 1) / (float)rf->width - 1.f;
+			RtFloats wx = RtAdd(RtSet(x), laneX);
+
+			// forward + x*right + y*up, made unit length -- and the near plane is RTNEAR times as far along as that:
+			RtFloats dx = RtMulAdd(wy, RtSet(rf->up[0]), RtMulAdd(wx, RtSet(rf->right[0]), fx));
+			RtFloats dy = RtMulAdd(wy, RtSet(rf->up[1]), RtMulAdd(wx, RtSet(rf->right[1]), fy));
+			RtFloats dz = RtMulAdd(wy, RtSet(rf->up[2]), RtMulAdd(wx, RtSet(rf->right[2]), fz));
+			RtFloats len = RtSqrt(RtMulAdd(dz, dz, RtMulAdd(dy, dy, RtMul(dx, dx))));
+			RtFloats inv = RtDiv(one, len);
+			dx = RtMul(dx, inv);
+			dy = RtMul(dy, inv);
+			dz = RtMul(dz, inv);
+			RtFloats tmin = RtMul(start, len);
+
+			RtFloats best = miss, hit = none;
+			for (int k = 0; k < n; k++)
+			{
+				const struct RtSphere* sp = &rf->spheres[list[k]];
+				RtFloats cx = RtSet(sp->center[0]), cy = RtSet(sp->center[1]), cz = RtSet(sp->center[2]);
+
+				// along the ray to the point nearest the center, and how far the center is from the ray there:
+				// (r^2 - that^2, not b^2 - c.c + r^2, which loses everything to roundoff when the sphere is far away)
+				RtFloats b = RtMulAdd(cz, dz, RtMulAdd(cy, dy, RtMul(cx, dx)));
+				RtFloats qx = RtSub(cx, RtMul(b, dx));
+				RtFloats qy = RtSub(cy, RtMul(b, dy));
+				RtFloats qz = RtSub(cz, RtMul(b, dz));
+				RtFloats disc = RtSub(RtSet(sp->radius * sp->radius), RtMulAdd(qz, qz, RtMulAdd(qy, qy, RtMul(qx, qx))));
+				RtFloats root = RtSqrt(RtMax(disc, zero));
+				RtFloats t0 = RtSub(b, root);
+				RtFloats t = RtLessSelect(tmin, t0, t0, RtAdd(b, root));	// (the far side, from inside it)
+				t = RtLessSelect(disc, zero, miss, t);
+				t = RtLessSelect(tmin, t, t, miss);
+				hit = RtLessSelect(t, best, RtSet((float)list[k]), hit);
+				best = RtLessSelect(t, best, t, best);
+			}
+			RtStore(&s->t[row * RTTILE + p], best);
+			RtStore(&s->hit[row * RTTILE + p], hit);
+		}
+	}
+	stats->tests += (double)n * (double)(rows * RTTILE);
+
+	// the bodies that can shadow this tile, from a sphere around its lit hits:
+	if (rf->shadows && rf->numLights > 0)
+	{
+		double lo[3] = { 1.e300, 1.e300, 1.e300 }, hi[3] = { -1.e300, -1.e300, -1.e300 };
+		bool any = false;
+		for (int row = 0; row < rows; row++)
+		{
+			float y = (float)(2 * (y0 + row) + 1) / (float)rf->height - 1.f;
+			for (int col = 0; col < RTTILE && x0 + col < rf->width; col++)
+			{
+				int h = (int)s->hit[row * RTTILE + col];
+				if (h < 0 || (Bodies.flags[rf->spheres[h].body] & BODYUNLIT) != 0)
+					continue;
+				float x = (float)(2 * (x0 + col) + 1) / (float)rf->width - 1.f;
+				double w[3], wl = 0.;
+				for (int k = 0; k < 3; k++)
+				{
+					w[k] = (double)(rf->forward[k] + x * rf->right[k] + y * rf->up[k]);
+					wl += w[k] * w[k];
+				}
+				wl = sqrt(wl);
+				for (int k = 0; k < 3; k++)
+				{
+					double v = w[k] / wl * (double)s->t[row * RTTILE + col];
+					lo[k] = v < lo[k] ? v : lo[k];
+					hi[k] = v > hi[k] ? v : hi[k];
+				}
+				any = true;
+			}
+		}
+		if (any)
+		{
+			double center[3], radius = 0.;
+			for (int k = 0; k < 3; k++)
+			{
+				center[k] = .5 * (lo[k] + hi[k]);
+				radius += .25 * (hi[k] - lo[k]) * (hi[k] - lo[k]);
+			}
+			RtFindCasters(rf, s, center, sqrt(radius) * 1.001 + 1.e-6);
+		}
+	}
+
+	// and the color of every pixel:
+	for (int row = 0; row < rows; row++)
+	{
+		float y = (float)(2 * (y0 + row) + 1) / (float)rf->height - 1.f;
+		unsigned char* out = rf->rgba + 4 * ((size_t)(y0 + row) * rf->stride + x0);
+		for (int col = 0; col < RTTILE && x0 + col < rf->width; col++, out += 4)
+		{
+			float x = (float)(2 * (x0 + col) + 1) / (float)rf->width - 1.f;
+			double dir[3], len = 0.;
+			for (int k = 0; k < 3; k++)
+			{
+				dir[k] = (double)(rf->forward[k] + x * rf->right[k] + y * rf->up[k]);
+				len += dir[k] * dir[k];
+			}
+			len = sqrt(len);
+			for (int k = 0; k < 3; k++)
+				dir[k] /= len;
+
+			int h = (int)s->hit[row * RTTILE + col];
+			if (h >= 0)
+				RtShade(rf, s, dir, (double)RTNEAR * len, h, out);
+			else if (rf->skyBody >= 0)
+			{
+				// the sky, in the direction of the ray turned into the sky body's own:
+				const struct RtImage* tex = RtTexture(rf->skyBody);
+				const float* m = rf->toSky;
+				SampleLatLng(&tex->rgb[0], tex->width, tex->height,
+					m[0] * (float)dir[0] + m[1] * (float)dir[1] + m[2] * (float)dir[2],
+					m[3] * (float)dir[0] + m[4] * (float)dir[1] + m[5] * (float)dir[2],
+					m[6] * (float)dir[0] + m[7] * (float)dir[1] + m[8] * (float)dir[2], out);
+			}
+			else
+				memcpy(out, rf->background, 3);
+			out[3] = 255;
+		}
+	}
+}
+
+
+// trace tiles until there are none left -- this thread's own run first, then stolen ones:
+
+void
+RtTraceTiles(int id)
+{
+	struct RtRun* mine = &RtRuns[id];
+	for (;;)
+	{
+		unsigned long long r = mine->run.load();
+		unsigned int next = (unsigned int)r, end = (unsigned int)(r >> 32);
+		if (next < end)
+		{
+			if (mine->run.compare_exchange_weak(r, RtPackRun(next + 1, end)))
+			{
+				RtTraceTile((int)next, &RtScratches[id], mine);
+				mine->tiles++;
+			}
+			continue;
+		}
+
+		// out of tiles -- take the back half of the longest run left:
+		int victim = -1;
+		unsigned int most = 0;
+		unsigned long long seen = 0;
+		for (int k = 0; k < RtNumThreads; k++)
+		{
+			unsigned long long v = RtRuns[k].run.load();
+			unsigned int left = (unsigned int)(v >> 32) - (unsigned int)v;
+			if (k != id && (unsigned int)v < (unsigned int)(v >> 32) && left > most)
+			{
+				victim = k;
+				most = left;
+				seen = v;
+			}
+		}
+		if (victim < 0)
+			return;
+		unsigned int vnext = (unsigned int)seen, vend = (unsigned int)(seen >> 32);
+		unsigned int mid = vnext + (vend - vnext) / 2;
+		if (RtRuns[victim].run.compare_exchange_strong(seen, RtPackRun(vnext, mid)))
+		{
+			mine->run.store(RtPackRun(mid, vend));		// (empty until now, so nobody else was taking from it)
+			mine->steals++;
+		}
+	}
+}
+
+
+// a tracing thread: trace its share of each frame it is woken for
+
+void
+RtWorker(int id)
+{
+	long seen = 0;
+	std::unique_lock<std::mutex> lock(RtMutex);
+	for (;;)
+	{
+		RtWake.wait(lock, [&seen] { return RtQuit || RtGeneration != seen; });
+		if (RtQuit)
+			return;
+		seen = RtGeneration;
+		lock.unlock();
+
+		RtTraceTiles(id);
+
+		lock.lock();
+		if (--RtBusy == 0)
+			RtDone.notify_all();
+	}
+}
+
+
+// start the tracing threads: threads in all, counting the one that calls RayTraceView( ), or 0 for one a core
+
+void
+RayTraceStart(int threads)
+{
+	if (RtStarted)
+		return;
+	if (threads <= 0)
+		threads = (int)std::thread::hardware_concurrency();
+	if (threads < 1)
+		threads = 1;
+	if (threads > RTMAXTHREADS)
+		threads = RTMAXTHREADS;
+	RtNumThreads = threads;
+	RtQuit = false;
+	RtStarted = true;
+	for (int i = 1; i < threads; i++)
+		RtThreads.push_back(std::thread(RtWorker, i));
+}
+
+
+// stop them (before the program exits):
+
+void
+RayTraceStop()
+{
+	{
+		std::lock_guard<std::mutex> lock(RtMutex);
+		RtQuit = true;
+	}
+	RtWake.notify_all();
+	for (size_t i = 0; i < RtThreads.size(); i++)
+		RtThreads[i].join();
+	RtThreads.clear();
+	RtNumThreads = 1;
+	RtStarted = false;
+}
+
+
+// trace view v of frame f into a width x height image at rgba (stride pixels from one row to the next, bottom row
+// first), lit by the light bodies if lightsOn, with their shadows if shadows is true, and background where there is
+// no sky body:
+// (f's bodies can be relative to any origin -- they are put relative to the view's eye here)
+
+void
+RayTraceView(const struct BodyFrame* f, const struct FrameView* v, int width, int height, int stride, bool lightsOn,
+	bool shadows, const float background[3], unsigned char* rgba)
+{
+	if (width < 1 || height < 1)
+		return;
+	double t0 = WallSeconds();
+	RtSetup(f, v, width, height, stride, lightsOn, shadows, background, rgba);
+	double t1 = WallSeconds();
+
+	// an even run of tiles each, then everybody traces until they are all gone:
+	int numTiles = RtCurrent.tilesX * RtCurrent.tilesY;
+	for (int k = 0; k < RtNumThreads; k++)
+	{
+		RtRuns[k].run = RtPackRun((unsigned int)((long)numTiles * k / RtNumThreads),
+			(unsigned int)((long)numTiles * (k + 1) / RtNumThreads));
+		RtRuns[k].tiles = RtRuns[k].steals = 0;
+		RtRuns[k].tests = 0.;
+	}
+	{
+		std::lock_guard<std::mutex> lock(RtMutex);
+		RtGeneration++;
+		RtBusy = RtNumThreads - 1;
+	}
+	RtWake.notify_all();
+	RtTraceTiles(0);
+	{
+		std::unique_lock<std::mutex> lock(RtMutex);
+		RtDone.wait(lock, [] { return RtBusy == 0; });
+	}
+	double t2 = WallSeconds();
+
+	RayTraceTotal.frames++;
+	RayTraceTotal.setupMs += 1000. * (t1 - t0);
+	RayTraceTotal.traceMs += 1000. * (t2 - t1);
+	RayTraceTotal.rays += (double)width * (double)height;
+	RayTraceTotal.tiles += (double)numTiles;
+	RayTraceTotal.binned += (double)RtCurrent.tileSpheres.size();
+	for (int k = 0; k < RtNumThreads; k++)
+	{
+		RayTraceTotal.tests += RtRuns[k].tests;
+		RayTraceTotal.steals += RtRuns[k].steals;
+	}
+}
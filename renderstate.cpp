@@ -0,0 +1,357 @@
+#include <stdio.h>
+#include <string.h>
+
+//	A thin cache of the opengl state the drawing code changes, so that calls which would not change anything
+//	never get to the driver
+//
+//	All of the drawing sets its enables, binds, texture environment, material, lights, and window through the
+//	Rs...( ) functions below instead of calling opengl itself.  Each one remembers what it last set, drops the
+//	call if nothing would change, and counts the call as issued or skipped for the frame.
+//	Anything that changes this state behind the cache's back (glPushAttrib/glPopAttrib, deleting a bound
+//	object, a display list that sets state) has to call RsInvalidate( ) afterwards, so the next call of each
+//	kind goes through again.
+//
+//	Light positions and spot directions are never skipped, since opengl transforms them by the modelview
+//	matrix at the time of the call.
+
+
+const int	RSMAXCAPS = 32;			// different glEnable( ) capabilities and client arrays remembered
+const int	RSMAXBUFFERS = 8;		// different buffer binding targets remembered
+const int	RSMAXTEXTURES = 4;		// different texture targets remembered (on texture unit 0)
+const int	RSMAXLIGHTS = 8;
+const int	RSNUMLIGHTPARAMS = 8;		// GL_AMBIENT ... GL_QUADRATIC_ATTENUATION, but not GL_POSITION or GL_SPOT_DIRECTION
+const int	RSNUMMATERIALPARAMS = 5;	// GL_AMBIENT, GL_DIFFUSE, GL_SPECULAR, GL_EMISSION, GL_SHININESS
+
+struct RsCounters
+{
+	long	issued;			// calls that went to opengl
+	long	skipped;		// calls that were dropped because the state was already that way
+};
+
+struct RsCache
+{
+	GLenum	caps[RSMAXCAPS];		// glEnable( ) / glEnableClientState( ) capabilities seen so far
+	bool	capClient[RSMAXCAPS];		// true for client arrays
+	int	capOn[RSMAXCAPS];		// 1, 0, or -1 if not known
+	int	numCaps;
+
+	GLenum	bufferTargets[RSMAXBUFFERS];
+	GLuint	buffers[RSMAXBUFFERS];
+	bool	bufferKnown[RSMAXBUFFERS];
+	int	numBufferTargets;
+
+	GLenum	textureTargets[RSMAXTEXTURES];
+	GLuint	textures[RSMAXTEXTURES];
+	bool	textureKnown[RSMAXTEXTURES];
+	int	numTextureTargets;
+
+	GLuint	program;		bool programKnown;
+	GLenum	shadeModel;		bool shadeModelKnown;
+	GLenum	texEnvMode;		bool texEnvModeKnown;
+
+	float	material[2][RSNUMMATERIALPARAMS][4];	// [front, back][param]
+	bool	materialKnown[2][RSNUMMATERIALPARAMS];
+	float	light[RSMAXLIGHTS][RSNUMLIGHTPARAMS][4];
+	bool	lightKnown[RSMAXLIGHTS][RSNUMLIGHTPARAMS];
+};
+
+struct RsCache		Rs;
+struct RsCounters	RsFrame;		// counts for the frame being drawn
+struct RsCounters	RsLastFrame;		// counts for the last whole frame
+struct RsCounters	RsTotal;		// counts since the program started (or the caller zeroed them)
+
+
+inline
+void
+RsCount(bool issued)
+{
+	if (issued)
+	{
+		RsFrame.issued++;
+		RsTotal.issued++;
+	}
+	else
+	{
+		RsFrame.skipped++;
+		RsTotal.skipped++;
+	}
+}
+
+
+// forget everything the cache knows, so the next call of each kind goes through:
+
+void
+RsInvalidate()
+{
+	for (int i = 0; i < Rs.numCaps; i++)
+		Rs.capOn[i] = -1;
+	for (int i = 0; i < Rs.numBufferTargets; i++)
+		Rs.bufferKnown[i] = false;
+	for (int i = 0; i < Rs.numTextureTargets; i++)
+		Rs.textureKnown[i] = false;
+	Rs.programKnown = Rs.shadeModelKnown = Rs.texEnvModeKnown = false;
+	memset(Rs.materialKnown, 0, sizeof(Rs.materialKnown));
+	memset(Rs.lightKnown, 0, sizeof(Rs.lightKnown));
+}
+
+
+// start counting a new frame:
+
+void
+RsFrameBegin()
+{
+	RsLastFrame = RsFrame;
+	RsFrame.issued = RsFrame.skipped = 0;
+}
+
+
+// turn a capability (or, with client true, a client array) on or off, if it is not already:
+
+void
+RsSetCap(GLenum cap, bool client, bool on)
+{
+	int i;
+	for (i = 0; i < Rs.numCaps; i++)
+	{
+		if (Rs.caps[i] == cap && Rs.capClient[i] == client)
+			break;
+	}
+	if (i == Rs.numCaps && Rs.numCaps < RSMAXCAPS)
+	{
+		Rs.caps[i] = cap;
+		Rs.capClient[i] = client;
+		Rs.capOn[i] = -1;
+		Rs.numCaps++;
+	}
+
+	if (i < Rs.numCaps && Rs.capOn[i] == (on ? 1 : 0))
+	{
+		RsCount(false);
+		return;
+	}
+
+	if (client)
+	{
+		if (on)
+			glEnableClientState(cap);
+		else
+			glDisableClientState(cap);
+	}
+	else
+	{
+		if (on)
+			glEnable(cap);
+		else
+			glDisable(cap);
+	}
+	if (i < Rs.numCaps)
+		Rs.capOn[i] = on ? 1 : 0;
+	RsCount(true);
+}
+
+inline void	RsEnable(GLenum cap)			{ RsSetCap(cap, false, true); }
+inline void	RsDisable(GLenum cap)			{ RsSetCap(cap, false, false); }
+inline void	RsEnableClientState(GLenum array)	{ RsSetCap(array, true, true); }
+inline void	RsDisableClientState(GLenum array)	{ RsSetCap(array, true, false); }
+
+
+void
+RsBindBuffer(GLenum target, GLuint buffer)
+{
+	int i;
+	for (i = 0; i < Rs.numBufferTargets; i++)
+	{
+		if (Rs.bufferTargets[i] == target)
+			break;
+	}
+	if (i == Rs.numBufferTargets && Rs.numBufferTargets < RSMAXBUFFERS)
+	{
+		Rs.bufferTargets[i] = target;
+		Rs.bufferKnown[i] = false;
+		Rs.numBufferTargets++;
+	}
+
+	if (i < Rs.numBufferTargets && Rs.bufferKnown[i] && Rs.buffers[i] == buffer)
+	{
+		RsCount(false);
+		return;
+	}
+	glBindBuffer(target, buffer);
+	if (i < Rs.numBufferTargets)
+	{
+		Rs.buffers[i] = buffer;
+		Rs.bufferKnown[i] = true;
+	}
+	RsCount(true);
+}
+
+
+// bind a texture on texture unit 0:
+
+void
+RsBindTexture(GLenum target, GLuint texture)
+{
+	int i;
+	for (i = 0; i < Rs.numTextureTargets; i++)
+	{
+		if (Rs.textureTargets[i] == target)
+			break;
+	}
+	if (i == Rs.numTextureTargets && Rs.numTextureTargets < RSMAXTEXTURES)
+	{
+		Rs.textureTargets[i] = target;
+		Rs.textureKnown[i] = false;
+		Rs.numTextureTargets++;
+	}
+
+	if (i < Rs.numTextureTargets && Rs.textureKnown[i] && Rs.textures[i] == texture)
+	{
+		RsCount(false);
+		return;
+	}
+	glBindTexture(target, texture);
+	if (i < Rs.numTextureTargets)
+	{
+		Rs.textures[i] = texture;
+		Rs.textureKnown[i] = true;
+	}
+	RsCount(true);
+}
+
+
+void
+RsUseProgram(GLuint program)
+{
+	if (Rs.programKnown && Rs.program == program)
+	{
+		RsCount(false);
+		return;
+	}
+	glUseProgram(program);
+	Rs.program = program;
+	Rs.programKnown = true;
+	RsCount(true);
+}
+
+
+void
+RsShadeModel(GLenum mode)
+{
+	if (Rs.shadeModelKnown && Rs.shadeModel == mode)
+	{
+		RsCount(false);
+		return;
+	}
+	glShadeModel(mode);
+	Rs.shadeModel = mode;
+	Rs.shadeModelKnown = true;
+	RsCount(true);
+}
+
+
+void
+RsTexEnvMode(GLenum mode)
+{
+	if (Rs.texEnvModeKnown && Rs.texEnvMode == mode)
+	{
+		RsCount(false);
+		return;
+	}
+	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, (GLfloat)mode);
+	Rs.texEnvMode = mode;
+	Rs.texEnvModeKnown = true;
+	RsCount(true);
+}
+
+
+// make a glut window the current one:
+// (glut already knows which one is current, so this asks it rather than remembering;
+//  not for headless mode, where there is no glut)
+
+void
+RsSetWindow(int window)
+{
+	if (glutGetWindow() == window)
+	{
+		RsCount(false);
+		return;
+	}
+	glutSetWindow(window);
+	RsCount(true);
+}
+
+
+// glMaterialfv( ) for GL_FRONT or GL_BACK and one of GL_AMBIENT, GL_DIFFUSE, GL_SPECULAR, GL_EMISSION, GL_SHININESS:
+
+void
+RsMaterialfv(GLenum face, GLenum pname, const GLfloat* params)
+{
+	int f = face == GL_BACK ? 1 : 0;
+	int p;
+	switch (pname)
+	{
+		case GL_AMBIENT:	p = 0;	break;
+		case GL_DIFFUSE:	p = 1;	break;
+		case GL_SPECULAR:	p = 2;	break;
+		case GL_EMISSION:	p = 3;	break;
+		case GL_SHININESS:	p = 4;	break;
+		default:		p = -1;
+	}
+	if (face != GL_FRONT && face != GL_BACK)
+		p = -1;
+	int n = pname == GL_SHININESS ? 1 : 4;
+
+	if (p >= 0 && Rs.materialKnown[f][p] && memcmp(Rs.material[f][p], params, n * sizeof(GLfloat)) == 0)
+	{
+		RsCount(false);
+		return;
+	}
+	glMaterialfv(face, pname, params);
+	if (p >= 0)
+	{
+		memcpy(Rs.material[f][p], params, n * sizeof(GLfloat));
+		Rs.materialKnown[f][p] = true;
+	}
+	RsCount(true);
+}
+
+inline void	RsMaterialf(GLenum face, GLenum pname, GLfloat param)	{ RsMaterialfv(face, pname, &param); }
+
+
+// glLightfv( ) for GL_LIGHT0 ... GL_LIGHT7:
+
+void
+RsLightfv(GLenum light, GLenum pname, const GLfloat* params)
+{
+	int l = (int)(light - GL_LIGHT0);
+	int p, n = 1;
+	switch (pname)
+	{
+		case GL_AMBIENT:		p = 0;	n = 4;	break;
+		case GL_DIFFUSE:		p = 1;	n = 4;	break;
+		case GL_SPECULAR:		p = 2;	n = 4;	break;
+		case GL_SPOT_EXPONENT:		p = 3;		break;
+		case GL_SPOT_CUTOFF:		p = 4;		break;
+		case GL_CONSTANT_ATTENUATION:	p = 5;		break;
+		case GL_LINEAR_ATTENUATION:	p = 6;		break;
+		case GL_QUADRATIC_ATTENUATION:	p = 7;		break;
+		default:			p = -1;		// GL_POSITION and GL_SPOT_DIRECTION depend on the modelview
+	}
+	if (l < 0 || l >= RSMAXLIGHTS)
+		p = -1;
+
+	if (p >= 0 && Rs.lightKnown[l][p] && memcmp(Rs.light[l][p], params, n * sizeof(GLfloat)) == 0)
+	{
+		RsCount(false);
+		return;
+	}
+	glLightfv(light, pname, params);
+	if (p >= 0)
+	{
+		memcpy(Rs.light[l][p], params, n * sizeof(GLfloat));
+		Rs.lightKnown[l][p] = true;
+	}
+	RsCount(true);
+}
+
+inline void	RsLightf(GLenum light, GLenum pname, GLfloat param)	{ RsLightfv(light, pname, &param); }
@@ -0,0 +1,402 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include "glm/mat4x4.hpp"
+
+//	The bodies in the scene, read from a scene file
+//
+//	Each body hangs off of a parent body (or off of the origin), orbiting it in the XZ plane
+//	and spinning about its own Y axis. A body's children orbit around where it is,
+//	in its orbit's frame -- they do not get dragged around by its spin.
+//
+//	The bodies are kept in structure-of-arrays form, sorted so that every parent comes before its children,
+//	so the world matrices can all be brought up to date in one pass down the arrays (see UpdateSceneState( )).
+//	No opengl in here -- offline tools can include it too.
+//
+//	Scene file lines ('#' starts a comment, periods are in days, a negative period turns the other way,
+//	a period of 0 does not turn at all, and '-' means none):
+//
+//	body <name> <parent> <radius> <orbit radius> <orbit period> <spin period> <texture.bmp> <r g b> [flags]
+//		r g b is the color to show until the texture is loaded (0-255)
+//		flags:	unlit   -- drawn without lighting (the sun, the sky)
+//			light   -- a point light sits at its center
+//			noorbit -- do not draw its orbit line
+//			sky     -- the star background: drawn as a cube map behind everything else (see skybox.cpp)
+//
+//	belt <name> <parent> <count> <inner orbit radius> <outer orbit radius> <min radius> <max radius>
+//			<orbit period at the inner radius> <texture.bmp> <r g b>
+//		scatters 'count' small bodies (named <name>0, <name>1, ...) between the two orbit radii, at
+//		random starting angles, with orbit periods from Kepler's third law. The same line always makes the same belt.
+
+
+const char *	SCENEFILE = "solarsystem.txt";		// the default scene file
+const int	MAXSCENELIGHTS = 8;				// opengl's GL_LIGHT0 - GL_LIGHT7
+
+// body flags:
+const int	BODYUNLIT	= 1;
+const int	BODYLIGHT	= 2;
+const int	BODYNOORBIT	= 4;
+const int	BODYSKY		= 8;
+
+// used if the scene file cannot be read -- the sun, earth, and moon as they have always been:
+const char *	DEFAULTSCENE =
+	"body stars  -     1000      0     0      0    stars.bmp    0   0   0  unlit noorbit sky\n"
+	"body sun    -     15        0     0      0    sun.bmp    255 215 100  unlit light\n"
+	"body earth  sun   2         45    365.3  1    earth.bmp   50  80 150\n"
+	"body moon   earth 0.544676  4     27.3   27.3 moon.bmp   128 128 128\n";
+
+struct SceneTexture
+{
+	std::string	filename;
+	unsigned char	placeholder[3];		// color shown until the image arrives
+};
+
+// where the bodies are at one time -- brought up to date by UpdateBodyFrame( ), relative to a world point near
+// the eye that RebaseBodyFrame( ) picks.  The scene keeps the one being drawn; the frame pipeline's worker
+// fills in others for frames to come (see framepipeline.cpp):
+
+struct BodyFrame
+{
+	int			scene;			// the SceneSerial these are for
+	double			years;			// the time the rest of these are for
+	bool			valid;			// false until the first UpdateBodyFrame( )
+	std::vector<double>	frameCos, frameSin;	// the rotation of the body's orbit frame (what its children orbit in)
+	std::vector<double>	frameX, frameZ;		// where the body is, in world coordinates
+
+	double			originX, originY, originZ;	// the world point the rest of these are relative to
+	std::vector<float>	relX, relZ;		// where the body is
+	float			relY;			// (all of the bodies are in the world's y = 0 plane)
+	std::vector<glm::mat4>	world;			// the body's world matrix, including its spin
+};
+
+struct SceneBodies : BodyFrame
+{
+	int			count;
+
+	// from the scene file:
+	std::vector<std::string>	name;
+	std::vector<int>	parent;			// index of the parent body (always < this body's index), -1 for none
+	std::vector<float>	radius;
+	std::vector<float>	orbitRadius;
+	std::vector<float>	orbitTurns;		// orbits per year
+	std::vector<double>	orbitPhase;		// fraction of an orbit already done at time 0
+	std::vector<float>	spinTurns;		// spins per year
+	std::vector<int>	texture;		// index into SceneTextures, -1 for none
+	std::vector<int>	flags;			// BODYUNLIT, ...
+
+	// (and, from BodyFrame, where they are in the frame being drawn: see UpdateSceneState( ) and RebaseScene( ))
+} Bodies;
+
+int	SceneSerial;			// counts the scenes read, so a BodyFrame can tell when it is for an old one
+
+std::vector<struct SceneTexture>	SceneTextures;		// the textures the bodies use, each file once
+
+
+// one body, as read from the scene file:
+
+struct BodyDef
+{
+	std::string	name, parentName;
+	float		radius, orbitRadius, orbitPeriod, spinPeriod;
+	double		orbitPhase;
+	std::string	texture;
+	int		rgb[3];
+	int		flags;
+	int		parent, depth;
+};
+
+
+// make a frame the right size for the current scene, with nothing in it yet:
+
+void
+ResizeBodyFrame(struct BodyFrame* f, int n)
+{
+	f->scene = SceneSerial;
+	f->valid = false;
+	f->frameCos.resize(n);
+	f->frameSin.resize(n);
+	f->frameX.resize(n);
+	f->frameZ.resize(n);
+	f->relX.resize(n);
+	f->relZ.resize(n);
+	f->world.resize(n);
+}
+
+
+// the body with this name, or -1:
+
+int
+FindBody(const char* name)
+{
+	for (int i = 0; i < Bodies.count; i++)
+	{
+		if (Bodies.name[i] == name)
+			return i;
+	}
+	return -1;
+}
+
+
+// turns per year for a period in days (0. = does not turn):
+// (done in float so that the default scene comes out exactly as DAYS_PER_YEAR, MONTHS_PER_YEAR, ...)
+
+float
+TurnsPerYear(float periodDays)
+{
+	if (periodDays == 0.f)
+		return 0.f;
+	return DAYS_PER_YEAR / periodDays;
+}
+
+
+int
+SceneTextureIndex(const std::string& filename, const int rgb[3])
+{
+	if (filename == "-")
+		return -1;
+	for (size_t i = 0; i < SceneTextures.size(); i++)
+	{
+		if (SceneTextures[i].filename == filename)
+			return (int)i;
+	}
+	struct SceneTexture st;
+	st.filename = filename;
+	for (int k = 0; k < 3; k++)
+		st.placeholder[k] = (unsigned char)std::min(std::max(rgb[k], 0), 255);
+	SceneTextures.push_back(st);
+	return (int)SceneTextures.size() - 1;
+}
+
+
+// a repeatable random number in [0.,1.) for building belts:
+
+double
+BeltRandom(unsigned long long* state)
+{
+	*state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+	return (double)(*state >> 11) / 9007199254740992.;
+}
+
+
+// read the body and belt lines of a scene:
+// returns false if it did not find any bodies
+
+bool
+ParseScene(const char* text, const char* source)
+{
+	std::vector<struct BodyDef> defs;
+	std::map<std::string, int> byName;
+
+	int lineNum = 0;
+	const char* p = text;
+	while (*p != '\0')
+	{
+		const char* eol = strchr(p, '\n');
+		size_t len = eol != NULL ? (size_t)(eol - p) : strlen(p);
+		std::string line(p, len);
+		p += len + (eol != NULL ? 1 : 0);
+		lineNum++;
+
+		size_t hash = line.find('#');
+		if (hash != std::string::npos)
+			line.erase(hash);
+
+		char kind[32], name[128], parent[128], texture[256], flagWords[4][32];
+		float a[7];
+		int rgb[3], count;
+		if (sscanf(line.c_str(), "%31s", kind) != 1)
+			continue;		// blank line
+
+		if (strcmp(kind, "body") == 0)
+		{
+			int n = sscanf(line.c_str(), "%*s %127s %127s %f %f %f %f %255s %d %d %d %31s %31s %31s %31s",
+				name, parent, &a[0], &a[1], &a[2], &a[3], texture, &rgb[0], &rgb[1], &rgb[2],
+				flagWords[0], flagWords[1], flagWords[2], flagWords[3]);
+			if (n < 10)
+			{
+				fprintf(stderr, "%s:%d: a body needs a name, parent, radius, orbit radius, orbit period, spin period, texture, and r g b\n",
+					source, lineNum);
+				continue;
+			}
+
+			struct BodyDef d;
+			d.name = name;
+			d.parentName = parent;
+			d.radius = a[0];
+			d.orbitRadius = a[1];
+			d.orbitPeriod = a[2];
+			d.spinPeriod = a[3];
+			d.orbitPhase = 0.;
+			d.texture = texture;
+			memcpy(d.rgb, rgb, sizeof(rgb));
+			d.flags = 0;
+			for (int i = 0; i < n - 10; i++)
+			{
+				if (strcmp(flagWords[i], "unlit") == 0)			d.flags |= BODYUNLIT;
+				else if (strcmp(flagWords[i], "light") == 0)		d.flags |= BODYLIGHT;
+				else if (strcmp(flagWords[i], "noorbit") == 0)		d.flags |= BODYNOORBIT;
+				else if (strcmp(flagWords[i], "sky") == 0)			d.flags |= BODYSKY;
+				else
+					fprintf(stderr, "%s:%d: don't know what flag '%s' is\n", source, lineNum, flagWords[i]);
+			}
+			defs.push_back(d);
+		}
+		else if (strcmp(kind, "belt") == 0)
+		{
+			int n = sscanf(line.c_str(), "%*s %127s %127s %d %f %f %f %f %f %255s %d %d %d",
+				name, parent, &count, &a[0], &a[1], &a[2], &a[3], &a[4], texture, &rgb[0], &rgb[1], &rgb[2]);
+			if (n < 12 || count < 0 || a[0] <= 0.f)
+			{
+				fprintf(stderr, "%s:%d: a belt needs a name, parent, count, inner and outer orbit radius, min and max radius, inner orbit period, texture, and r g b\n",
+					source, lineNum);
+				continue;
+			}
+
+			// seed from the line number and name, so a belt does not change when others are added:
+			unsigned long long state = (unsigned long long)lineNum;
+			for (const char* c = name; *c != '\0'; c++)
+				state = state * 131 + (unsigned char)*c;
+			for (int i = 0; i < count; i++)
+			{
+				struct BodyDef d;
+				char bodyName[160];
+				snprintf(bodyName, sizeof(bodyName), "%s%d", name, i);
+				d.name = bodyName;
+				d.parentName = parent;
+				d.orbitRadius = a[0] + (a[1] - a[0]) * (float)BeltRandom(&state);
+				d.radius = a[2] + (a[3] - a[2]) * (float)BeltRandom(&state);
+				d.orbitPeriod = a[4] * powf(d.orbitRadius / a[0], 1.5f);		// Kepler: T^2 is proportional to R^3
+				d.spinPeriod = 0.25f + 2.f * (float)BeltRandom(&state);
+				d.orbitPhase = BeltRandom(&state);
+				d.texture = texture;
+				memcpy(d.rgb, rgb, sizeof(rgb));
+				d.flags = BODYNOORBIT;
+				defs.push_back(d);
+			}
+		}
+		else
+			fprintf(stderr, "%s:%d: don't know what '%s' is\n", source, lineNum, kind);
+	}
+
+	// hook up the parents:
+
+	for (size_t i = 0; i < defs.size(); i++)
+	{
+		if (!byName.insert(std::make_pair(defs[i].name, (int)i)).second)
+			fprintf(stderr, "%s: there is more than one body named '%s' -- using the first\n", source, defs[i].name.c_str());
+	}
+	for (size_t i = 0; i < defs.size(); i++)
+	{
+		defs[i].parent = -1;
+		defs[i].depth = -1;
+		if (defs[i].parentName == "-")
+			continue;
+		std::map<std::string, int>::iterator it = byName.find(defs[i].parentName);
+		if (it == byName.end())
+			fprintf(stderr, "%s: cannot find '%s', the parent of '%s' -- it will orbit the origin\n",
+				source, defs[i].parentName.c_str(), defs[i].name.c_str());
+		else
+			defs[i].parent = it->second;
+	}
+
+	// put every parent ahead of its children by sorting on how deep each body is:
+
+	for (size_t i = 0; i < defs.size(); i++)
+	{
+		int depth = 0;
+		for (int j = defs[i].parent; j >= 0; j = defs[j].parent)
+		{
+			if (defs[j].depth >= 0)
+			{
+				depth += defs[j].depth + 1;
+				break;
+			}
+			if (++depth > (int)defs.size())
+			{
+				fprintf(stderr, "%s: '%s' is its own ancestor -- it will orbit the origin\n", source, defs[i].name.c_str());
+				defs[i].parent = -1;
+				depth = 0;
+				break;
+			}
+		}
+		defs[i].depth = depth;
+	}
+
+	std::vector<int> order(defs.size());
+	for (size_t i = 0; i < defs.size(); i++)
+		order[i] = (int)i;
+	std::stable_sort(order.begin(), order.end(),
+		[&defs](int a, int b) { return defs[a].depth < defs[b].depth; });
+
+	std::vector<int> newIndex(defs.size());
+	for (size_t i = 0; i < order.size(); i++)
+		newIndex[order[i]] = (int)i;
+
+	// fill in the arrays:
+
+	int n = (int)defs.size();
+	Bodies = SceneBodies();
+	Bodies.count = n;
+	Bodies.name.resize(n);
+	Bodies.parent.resize(n);
+	Bodies.radius.resize(n);
+	Bodies.orbitRadius.resize(n);
+	Bodies.orbitTurns.resize(n);
+	Bodies.orbitPhase.resize(n);
+	Bodies.spinTurns.resize(n);
+	Bodies.texture.resize(n);
+	Bodies.flags.resize(n);
+	SceneSerial++;
+	ResizeBodyFrame(&Bodies, n);
+	SceneTextures.clear();
+
+	for (int i = 0; i < n; i++)
+	{
+		const struct BodyDef& d = defs[order[i]];
+		Bodies.name[i] = d.name;
+		Bodies.parent[i] = d.parent >= 0 ? newIndex[d.parent] : -1;
+		Bodies.radius[i] = d.radius;
+		Bodies.orbitRadius[i] = d.orbitRadius;
+		Bodies.orbitTurns[i] = TurnsPerYear(d.orbitPeriod);
+		Bodies.orbitPhase[i] = d.orbitPhase;
+		Bodies.spinTurns[i] = TurnsPerYear(d.spinPeriod);
+		Bodies.texture[i] = SceneTextureIndex(d.texture, d.rgb);
+		Bodies.flags[i] = d.flags;
+	}
+
+	return n > 0;
+}
+
+
+// read a scene file, or use the default scene if it cannot be read:
+
+void
+LoadScene(const char* filename)
+{
+	FILE* fp = fopen(filename, "rb");
+	if (fp != NULL)
+	{
+		std::string text;
+		char buf[4096];
+		size_t n;
+		while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+			text.append(buf, n);
+		fclose(fp);
+
+		if (ParseScene(text.c_str(), filename))
+		{
+			fprintf(stderr, "Scene: %d bodies and %d textures from '%s'\n",
+				Bodies.count, (int)SceneTextures.size(), filename);
+			return;
+		}
+		fprintf(stderr, "Scene file '%s' has no bodies in it -- using the default scene\n", filename);
+	}
+	else
+		fprintf(stderr, "Cannot open scene file '%s' -- using the default scene\n", filename);
+
+	ParseScene(DEFAULTSCENE, "default scene");
+}
@@ -0,0 +1,587 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include "glm/mat3x3.hpp"
+#include "glm/mat4x4.hpp"
+#include "glm/gtc/matrix_inverse.hpp"
+#include "glm/gtc/type_ptr.hpp"
+
+//	Per-pixel lighting with GLSL, in place of the fixed-function lights
+//
+//	Everything the lighting needs for a frame -- the view and projection, the lights in eye coordinates,
+//	and the material -- goes into one uniform block (FrameLighting), written into the frame ring (framering.cpp)
+//	once per frame by UpdateShadingFrame( ).  Each body then only sets its modelview and normal matrices and, if it differs
+//	from the last body's, its texture: no glLight*( ), no glMaterial*( ), and no GL_NORMALIZE, since the
+//	normal matrix is passed in explicitly and the normal is normalized per pixel anyway.
+//	The lighting equation is the fixed-function one (ambient + diffuse + Blinn specular, infinite viewer),
+//	just evaluated at every pixel instead of at every vertex.
+//
+//	The shaders are compiled separately for each number of lights (NUMLIGHTS), as in instancing.cpp,
+//	and the instanced path uses the same uniform block and lighting function when this is on.
+//	With logarithmic depth (depth.cpp's DEPTHLOG) they are compiled with LOGDEPTH as well, and write their own
+//	depth; the unlit program here draws everything else that writes depth (the sun, the orbit lines) that way too.
+//
+//	Needs GLSL 1.30 and uniform buffer objects (opengl 3.1) -- InitShading( ) returns false if they are
+//	not there, and the fixed-function lighting is used.
+
+
+const GLuint	SHADINGBLOCKBINDING = 0;	// uniform buffer binding point of the FrameLighting block
+
+// the light and material the fixed-function pipeline gets from SetPointLight( ) and SetMaterial(1., 1., 1., 50.):
+// (the sun is white; opengl's default global ambient is .2)
+
+const float	SHADINGGLOBALAMBIENT[3] = { .2f, .2f, .2f };
+const float	SHADINGLIGHTAMBIENT[3]  = { .1f, .1f, .2f };
+const float	SHADINGLIGHTCOLOR[3]    = { 1.f, 1.f, 1.f };
+const float	SHADINGMATERIAL[3]      = { 1.f, 1.f, 1.f };		// ambient and diffuse
+const float	SHADINGSPECULAR         = .8f;
+const float	SHADINGSHININESS        = 50.f;
+
+// the FrameLighting uniform block, in std140 layout:
+
+struct ShadingFrame
+{
+	float	view[16];
+	float	viewNormal[16];		// inverse transpose of the view's upper 3x3 (a mat3 is padded to this in std140 anyway)
+	float	projection[16];
+	float	sceneAmbient[4];	// global ambient times the material ambient
+	float	materialDiffuse[4];	// .a is the alpha
+	float	materialSpecular[4];	// .w is the shininess
+	float	lightPosition[MAXSCENELIGHTS][4];	// eye coordinates
+	float	lightAmbient[MAXSCENELIGHTS][4];	// already multiplied by the material
+	float	lightDiffuse[MAXSCENELIGHTS][4];
+	float	lightSpecular[MAXSCENELIGHTS][4];
+};
+
+struct ShadingFrame	ShadeFrame;
+bool	ShadeFrameBound;		// true if this frame's ShadeFrame made it into the frame ring (see framering.cpp)
+GLuint	ShadeWhiteTexture;		// for bodies without a texture (a missing texture would be black in a shader)
+GLuint	ShadePrograms[2][MAXSCENELIGHTS+1];	// the per-pixel program for each number of lights, without and with
+						// logarithmic depth, 0 until needed
+GLuint	UnlitProgram;			// color times texture, with logarithmic depth
+GLint	UnlitTexturedLoc;		// its Textured uniform
+bool	ShadingBroken;			// true if the shaders would not compile
+int		ShadeNumLights;			// how many lights UpdateShadingFrame( ) placed this frame
+glm::mat4	ShadeView;			// the view this frame, as a glm matrix
+glm::mat3	ShadeViewNormal;
+std::vector<int>	BodyLod;	// level of detail of each body this frame, -1 for the unlit ones
+const std::vector<int>*	PickedBodyLods;	// BodyLod for this frame picked ahead of time (by the frame pipeline), or NULL
+
+
+// the uniform block and the lighting function, for any shader that wants them:
+// (ShadingPreamble( ) #define's MAXLIGHTS and NUMLIGHTS ahead of them)
+
+const char *	SHADINGBLOCKGLSL =
+	"layout(std140) uniform FrameLighting\n"
+	"{\n"
+	"	mat4 View;\n"
+	"	mat4 ViewNormal;\n"
+	"	mat4 Projection;\n"
+	"	vec4 SceneAmbient;\n"
+	"	vec4 MaterialDiffuse;\n"
+	"	vec4 MaterialSpecular;\n"
+	"	vec4 LightPosition[MAXLIGHTS];\n"
+	"	vec4 LightAmbient[MAXLIGHTS];\n"
+	"	vec4 LightDiffuse[MAXLIGHTS];\n"
+	"	vec4 LightSpecular[MAXLIGHTS];\n"
+	"};\n"
+	"\n";
+
+const char *	SHADINGLIGHTGLSL =
+	"// the fixed-function lighting equation, for the front face, with an infinite viewer:\n"
+	"vec4 ShadeLighting(vec3 eyePos, vec3 n)\n"
+	"{\n"
+	"	vec3 c = SceneAmbient.rgb;\n"
+	"	for (int i = 0; i < NUMLIGHTS; i++)\n"
+	"	{\n"
+	"		vec3 l = normalize(LightPosition[i].xyz - eyePos * LightPosition[i].w);\n"
+	"		float ndotl = max(dot(n, l), 0.);\n"
+	"		c += LightAmbient[i].rgb + ndotl * LightDiffuse[i].rgb;\n"
+	"		if (ndotl > 0.)\n"
+	"			c += pow(max(dot(n, normalize(l + vec3(0., 0., 1.))), 0.), MaterialSpecular.w) * LightSpecular[i].rgb;\n"
+	"	}\n"
+	"	return vec4(min(c, 1.), MaterialDiffuse.a);\n"
+	"}\n"
+	"\n";
+
+// (these go after SHADINGBLOCKGLSL, and the fragment shader after SHADINGLIGHTGLSL too)
+// logarithmic depth, for the fragment shaders of programs compiled with LOGDEPTH
+// (their vertex shaders pass on the clip w as vDepthW):
+const char *	LOGDEPTHGLSL =
+	"#ifdef LOGDEPTH\n"
+	"in float vDepthW;\n"
+	"\n"
+	"float LogDepth()\n"
+	"{\n"
+	"	return log2(max(vDepthW, 1.e-6) + 1.) * LOGDEPTHCOEF;\n"
+	"}\n"
+	"#endif\n"
+	"\n";
+
+const char *	SHADEVERTEXSHADER =
+	"uniform mat4 ModelView;		// the body's world matrix and radius, then the view\n"
+	"uniform mat3 NormalMatrix;\n"
+	"out vec3 vEyePos;\n"
+	"out vec3 vNormal;\n"
+	"out vec2 vTexCoord;\n"
+	"#ifdef LOGDEPTH\n"
+	"out float vDepthW;\n"
+	"#endif\n"
+	"\n"
+	"void main()\n"
+	"{\n"
+	"	vec4 eyePos = ModelView * gl_Vertex;\n"
+	"	gl_Position = Projection * eyePos;\n"
+	"	vEyePos = eyePos.xyz;\n"
+	"	vNormal = NormalMatrix * gl_Normal;\n"
+	"	vTexCoord = gl_MultiTexCoord0.st;\n"
+	"#ifdef LOGDEPTH\n"
+	"	vDepthW = gl_Position.w;\n"
+	"#endif\n"
+	"}\n";
+
+// (after LOGDEPTHGLSL)
+const char *	SHADEFRAGMENTSHADER =
+	"uniform sampler2D Texture;\n"
+	"in vec3 vEyePos;\n"
+	"in vec3 vNormal;\n"
+	"in vec2 vTexCoord;\n"
+	"\n"
+	"void main()\n"
+	"{\n"
+	"	gl_FragColor = ShadeLighting(vEyePos, normalize(vNormal)) * texture(Texture, vTexCoord);		// GL_MODULATE\n"
+	"#ifdef LOGDEPTH\n"
+	"	gl_FragDepth = LogDepth();\n"
+	"#endif\n"
+	"}\n";
+
+// what the fixed-function pipeline does for the unlit bodies and the lines, but with logarithmic depth:
+// (after the LOGDEPTH #define's)
+const char *	UNLITVERTEXSHADER =
+	"out vec4 vColor;\n"
+	"out vec2 vTexCoord;\n"
+	"out float vDepthW;\n"
+	"\n"
+	"void main()\n"
+	"{\n"
+	"	gl_Position = ftransform();\n"
+	"	vColor = gl_Color;\n"
+	"	vTexCoord = gl_MultiTexCoord0.st;\n"
+	"	vDepthW = gl_Position.w;\n"
+	"}\n";
+
+// (after LOGDEPTHGLSL)
+const char *	UNLITFRAGMENTSHADER =
+	"uniform sampler2D Texture;\n"
+	"uniform bool Textured;\n"
+	"in vec4 vColor;\n"
+	"in vec2 vTexCoord;\n"
+	"\n"
+	"void main()\n"
+	"{\n"
+	"	gl_FragColor = Textured ? vColor * texture(Texture, vTexCoord) : vColor;\n"
+	"	gl_FragDepth = LogDepth();\n"
+	"}\n";
+
+
+// compile one shader, printing the log if it does not work:
+// returns 0 on failure
+
+GLuint
+CompileShader(GLenum type, const char* source, const char* what)
+{
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, 1, &source, NULL);
+	glCompileShader(shader);
+
+	GLint ok = GL_FALSE;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+	if (ok != GL_TRUE)
+	{
+		char log[4096];
+		glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+		fprintf(stderr, "Cannot compile the %s:\n%s\n", what, log);
+		glDeleteShader(shader);
+		return 0;
+	}
+	return shader;
+}
+
+
+// compile and link a vertex and fragment shader, with the given attribute locations:
+// (attribNames[ ] ends with a NULL; returns 0 on failure)
+
+GLuint
+LinkShaderProgram(const char* vertexSource, const char* fragmentSource, const char* what,
+	const char* attribNames[], const GLuint attribLocs[])
+{
+	char name[256];
+	snprintf(name, sizeof(name), "%s vertex shader", what);
+	GLuint vs = CompileShader(GL_VERTEX_SHADER, vertexSource, name);
+	snprintf(name, sizeof(name), "%s fragment shader", what);
+	GLuint fs = CompileShader(GL_FRAGMENT_SHADER, fragmentSource, name);
+	if (vs == 0 || fs == 0)
+	{
+		glDeleteShader(vs);
+		glDeleteShader(fs);
+		return 0;
+	}
+
+	GLuint program = glCreateProgram();
+	glAttachShader(program, vs);
+	glAttachShader(program, fs);
+	for (int i = 0; attribNames != NULL && attribNames[i] != NULL; i++)
+		glBindAttribLocation(program, attribLocs[i], attribNames[i]);
+	glLinkProgram(program);
+	glDeleteShader(vs);		// (they stay around until the program goes away)
+	glDeleteShader(fs);
+
+	GLint ok = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &ok);
+	if (ok != GL_TRUE)
+	{
+		char log[4096];
+		glGetProgramInfoLog(program, sizeof(log), NULL, log);
+		fprintf(stderr, "Cannot link the %s shaders:\n%s\n", what, log);
+		glDeleteProgram(program);
+		return 0;
+	}
+	return program;
+}
+
+
+// the #define's a shader with logarithmic depth needs:
+
+std::string
+LogDepthDefines()
+{
+	char coef[64];
+	snprintf(coef, sizeof(coef), "%.9g", 1. / log2(DEPTHLOGFAR + 1.));
+	return std::string("#define LOGDEPTH\n#define LOGDEPTHCOEF ") + coef + "\n";
+}
+
+
+// the start of every shader that uses the FrameLighting block:
+//	logDepth true means to compile it with logarithmic depth
+
+std::string
+ShadingPreamble(int numLights, bool logDepth)
+{
+	return "#version 130\n"
+		"#extension GL_ARB_uniform_buffer_object : require\n"
+		"#define MAXLIGHTS " + std::to_string(MAXSCENELIGHTS) + "\n"
+		"#define NUMLIGHTS " + std::to_string(numLights) + "\n" +
+		(logDepth ? LogDepthDefines() : std::string()) +
+		SHADINGBLOCKGLSL;
+}
+
+
+// attach a linked program's FrameLighting block to the uniform buffer:
+
+void
+UseShadingBlock(GLuint program)
+{
+	GLuint block = glGetUniformBlockIndex(program, "FrameLighting");
+	if (block != GL_INVALID_INDEX)
+		glUniformBlockBinding(program, block, SHADINGBLOCKBINDING);
+}
+
+
+// the per-pixel program for a number of lights, with or without logarithmic depth, compiling it the first time:
+// returns 0 if it cannot be compiled
+
+GLuint
+ShadingProgram(int numLights, bool logDepth)
+{
+	if (numLights < 0 || numLights > MAXSCENELIGHTS || ShadingBroken)
+		return 0;
+	GLuint* saved = &ShadePrograms[logDepth ? 1 : 0][numLights];
+	if (*saved != 0)
+		return *saved;
+
+	std::string preamble = ShadingPreamble(numLights, logDepth);
+	std::string vertexSource = preamble + SHADEVERTEXSHADER;
+	std::string fragmentSource = preamble + SHADINGLIGHTGLSL + LOGDEPTHGLSL + SHADEFRAGMENTSHADER;
+	GLuint program = LinkShaderProgram(vertexSource.c_str(), fragmentSource.c_str(), "per-pixel lighting", NULL, NULL);
+	if (program == 0)
+	{
+		ShadingBroken = true;
+		return 0;
+	}
+
+	UseShadingBlock(program);
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "Texture"), 0);
+	glUseProgram(0);
+	*saved = program;
+	return program;
+}
+
+
+// compile the unlit program:
+// returns false if it cannot be compiled (and then there is no logarithmic depth)
+
+bool
+InitUnlitShading()
+{
+	if (UnlitProgram != 0)
+		return true;
+
+	std::string preamble = "#version 130\n" + LogDepthDefines();
+	std::string vertexSource = preamble + UNLITVERTEXSHADER;
+	std::string fragmentSource = preamble + LOGDEPTHGLSL + UNLITFRAGMENTSHADER;
+	GLuint program = LinkShaderProgram(vertexSource.c_str(), fragmentSource.c_str(), "unlit", NULL, NULL);
+	if (program == 0)
+		return false;
+
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "Texture"), 0);
+	glUseProgram(0);
+	UnlitTexturedLoc = glGetUniformLocation(program, "Textured");
+	UnlitProgram = program;
+	return true;
+}
+
+
+// get ready to draw something unlit (textured or not) -- with the unlit program when the depth is logarithmic,
+// otherwise with the fixed-function pipeline:
+
+void
+UseUnlitShading(bool textured)
+{
+	if (DepthMode != DEPTHLOG || UnlitProgram == 0)
+	{
+		RsUseProgram(0);
+		return;
+	}
+	RsUseProgram(UnlitProgram);
+	glUniform1i(UnlitTexturedLoc, textured ? 1 : 0);
+}
+
+
+// get ready to light with shaders:
+// returns false if this opengl cannot do it
+
+bool
+InitShading()
+{
+	if (!GLEW_VERSION_3_1)
+	{
+		fprintf(stderr, "Per-pixel lighting needs OpenGL 3.1 -- using the fixed-function lighting\n");
+		return false;
+	}
+	if (ShadingProgram(1, false) == 0)		// (the usual case, and a check that the shaders compile)
+		return false;
+	InitUnlitShading();
+
+	if (ShadeWhiteTexture == 0)
+	{
+		const unsigned char white[4] = { 255, 255, 255, 255 };
+		glGenTextures(1, &ShadeWhiteTexture);
+		glBindTexture(GL_TEXTURE_2D, ShadeWhiteTexture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+	return true;
+}
+
+
+// fill the FrameLighting block for this frame, with the current modelview and projection as the view,
+// and put a light at each body that is one (if lightsOn):
+// (between RingFrameBegin( ) and RingFrameEnd( ))
+// returns how many lights were placed
+
+int
+UpdateShadingFrame(bool lightsOn)
+{
+	struct ShadingFrame* f = &ShadeFrame;
+
+	glGetFloatv(GL_MODELVIEW_MATRIX, f->view);
+	glGetFloatv(GL_PROJECTION_MATRIX, f->projection);
+	ShadeView = glm::make_mat4(f->view);
+	ShadeViewNormal = glm::inverseTranspose(glm::mat3(ShadeView));
+	glm::mat4 viewNormal = glm::mat4(ShadeViewNormal);
+	memcpy(f->viewNormal, glm::value_ptr(viewNormal), sizeof(f->viewNormal));
+
+	for (int k = 0; k < 3; k++)
+	{
+		f->sceneAmbient[k] = SHADINGGLOBALAMBIENT[k] * SHADINGMATERIAL[k];
+		f->materialDiffuse[k] = SHADINGMATERIAL[k];
+		f->materialSpecular[k] = SHADINGSPECULAR;
+	}
+	f->sceneAmbient[3] = 1.f;
+	f->materialDiffuse[3] = 1.f;
+	f->materialSpecular[3] = SHADINGSHININESS;
+
+	int numLights = 0;
+	for (int i = 0; lightsOn && i < Bodies.count && numLights < MAXSCENELIGHTS; i++)
+	{
+		if ((Bodies.flags[i] & BODYLIGHT) == 0)
+			continue;
+		glm::vec4 p = ShadeView * Bodies.world[i][3];
+		memcpy(f->lightPosition[numLights], glm::value_ptr(p), sizeof(f->lightPosition[0]));
+		for (int k = 0; k < 3; k++)
+		{
+			f->lightAmbient[numLights][k] = SHADINGLIGHTAMBIENT[k] * SHADINGMATERIAL[k];
+			f->lightDiffuse[numLights][k] = SHADINGLIGHTCOLOR[k] * SHADINGMATERIAL[k];
+			f->lightSpecular[numLights][k] = SHADINGLIGHTCOLOR[k] * SHADINGSPECULAR;
+		}
+		f->lightAmbient[numLights][3] = f->lightDiffuse[numLights][3] = f->lightSpecular[numLights][3] = 1.f;
+		numLights++;
+	}
+
+	// into this frame's part of the frame ring, and make that the block:
+	GLintptr offset;
+	void* dst = RingAlloc(sizeof(struct ShadingFrame), &offset);
+	ShadeFrameBound = dst != NULL;
+	if (ShadeFrameBound)
+	{
+		memcpy(dst, f, sizeof(struct ShadingFrame));
+		RingCommit(offset, sizeof(struct ShadingFrame));
+		glBindBufferRange(GL_UNIFORM_BUFFER, SHADINGBLOCKBINDING, RingBuffer, offset, sizeof(struct ShadingFrame));
+	}
+
+	ShadeNumLights = numLights;
+	return numLights;
+}
+
+
+// pick the level of detail of every lit body of a frame from where its center is in eye coordinates,
+// with mv as the view, into lods[ ] (-1 for the unlit ones, and the ones inView[ ] says are outside the view,
+// if it is not NULL):
+//	lod false means always use the 64-slice sphere
+// (no opengl calls, so the frame pipeline's worker can use it)
+
+void
+PickBodyLods(const struct BodyFrame* f, const float mv[16], const float proj[16], int viewportHeight, bool lod,
+	const unsigned char* inView, std::vector<int>* lods)
+{
+	float pixelsPerTan = 0.5f * (float)viewportHeight * proj[5];
+	float scale = sqrtf(mv[0]*mv[0] + mv[1]*mv[1] + mv[2]*mv[2]);
+
+	int fixedLod = 0;
+	while (fixedLod < SPHNUMLODS-1 && SPHLODSLICES[fixedLod] < 64)
+		fixedLod++;
+
+	int n = Bodies.count;
+	lods->resize(n);
+	for (int i = 0; i < n; i++)
+	{
+		int li = -1;
+		if ((Bodies.flags[i] & BODYUNLIT) == 0 && (inView == NULL || inView[i]))
+		{
+			li = fixedLod;
+			if (lod)
+			{
+				float x = f->relX[i], y = f->relY, z = f->relZ[i];
+				float ex = mv[0]*x + mv[4]*y + mv[8]*z + mv[12];
+				float ey = mv[1]*x + mv[5]*y + mv[9]*z + mv[13];
+				float ez = mv[2]*x + mv[6]*y + mv[10]*z + mv[14];
+				li = SphereLodIndex(pixelsPerTan, sqrtf(ex*ex + ey*ey + ez*ez), Bodies.radius[i] * scale);
+			}
+		}
+		(*lods)[i] = li;
+	}
+}
+
+
+// the level of detail of every lit body this frame, into BodyLod[ ] (-1 for the unlit ones
+// and the ones CullBodies( ) said not to draw) -- PickedBodyLods, if the frame pipeline picked them ahead of time,
+// otherwise picked here with the current modelview, projection, and viewport --
+// counting how many use each level:
+//	lod false means always use the 64-slice sphere
+// returns how many bodies are lit
+
+int
+ComputeBodyLods(bool lod, int count[SPHNUMLODS])
+{
+	if (PickedBodyLods != NULL && (int)PickedBodyLods->size() == Bodies.count)
+		BodyLod = *PickedBodyLods;
+	else
+	{
+		GLfloat mv[16], proj[16];
+		GLint viewport[4];
+		glGetFloatv(GL_MODELVIEW_MATRIX, mv);
+		glGetFloatv(GL_PROJECTION_MATRIX, proj);
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		PickBodyLods(&Bodies, mv, proj, viewport[3], lod, NULL, &BodyLod);
+	}
+
+	for (int li = 0; li < SPHNUMLODS; li++)
+		count[li] = 0;
+
+	int numLit = 0;
+	for (int i = 0; i < Bodies.count; i++)
+	{
+		if (BodyLod[i] < 0)
+			continue;
+		if (i < (int)BodyVisible.size() && !BodyVisible[i])
+		{
+			BodyLod[i] = -1;
+			continue;
+		}
+		count[BodyLod[i]]++;
+		numLit++;
+	}
+	return numLit;
+}
+
+
+// draw every lit body of the scene one at a time with the per-pixel program,
+// using the view and lights UpdateShadingFrame( ) put in the uniform block this frame:
+// (the bodies go level of detail by level of detail, so each mesh is bound once,
+//  and the state cache only binds a texture when it is different from the last body's)
+
+void
+DrawBodiesShaded(const GLuint* textures, int numTextures, bool lod)
+{
+	GLuint program = ShadingProgram(ShadeNumLights, DepthMode == DEPTHLOG);
+	if (program == 0 || !ShadeFrameBound)
+		return;
+
+	int count[SPHNUMLODS];
+	if (ComputeBodyLods(lod, count) == 0)
+		return;
+
+	RsUseProgram(program);
+	GLint modelViewLoc = glGetUniformLocation(program, "ModelView");
+	GLint normalMatrixLoc = glGetUniformLocation(program, "NormalMatrix");
+
+	for (int li = 0; li < SPHNUMLODS; li++)
+	{
+		if (count[li] == 0)
+			continue;
+
+		struct SphereMesh* m = GetSphereMesh(SPHLODSLICES[li], SPHLODSLICES[li]);
+		BindSphereMesh(m);
+		for (int i = 0; i < Bodies.count; i++)
+		{
+			if (BodyLod[i] != li)
+				continue;
+
+			// the world matrix is a rotation plus a translation, so only the view's part of the normal matrix
+			// needs inverting (once per frame); the radius only scales the positions:
+			float r = Bodies.radius[i];
+			glm::mat4 modelView = ShadeView * Bodies.world[i];
+			glm::mat3 normalMatrix = ShadeViewNormal * glm::mat3(Bodies.world[i]);
+			modelView[0] *= r;
+			modelView[1] *= r;
+			modelView[2] *= r;
+			glUniformMatrix4fv(modelViewLoc, 1, GL_FALSE, glm::value_ptr(modelView));
+			glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+
+			int t = Bodies.texture[i];
+			GLuint tex = t >= 0 && t < numTextures && textures[t] != 0 ? textures[t] : ShadeWhiteTexture;
+			RsBindTexture(GL_TEXTURE_2D, tex);
+			CullBeginQuery(i);
+			DrawBoundSphereMesh(m);
+			CullEndQuery(i);
+		}
+	}
+
+	RsUseProgram(0);
+}
@@ -0,0 +1,122 @@
+#include <math.h>
+
+//	The simulation clock
+//
+//	Simulation time only moves in whole fixed steps (SIMSTEPYEARS long), counted with an integer,
+//	so the same real time always produces the same sequence of steps no matter what the frame rate is.
+//	Real time that has not yet added up to a whole step waits in an accumulator, and the
+//	time that gets rendered is interpolated that far between the current step and the next one.
+//
+//	Times are in years (earth orbits), held in double precision, and never wrap around --
+//	whatever turns (orbits and spins) takes the fractional part of its own number of turns,
+//	so the angles stay precise and continuous forever.
+//
+//	The warp factor scales how fast simulation time runs compared to real time
+//	(1. = one year per SIMREALSECONDSPERYEAR seconds, < 0. runs backwards).
+
+
+const double	SIMREALSECONDSPERYEAR = 700.;				// one earth orbit takes this many real seconds at warp 1
+const double	SIMSTEPYEARS = 1. / ( 120. * SIMREALSECONDSPERYEAR );	// 120 steps per real second at warp 1
+const double	SIMMAXWARP = 100000.;
+
+struct SimClock
+{
+	long long	step;		// current step -- the simulation epoch is step * SIMSTEPYEARS
+	double		accumulator;	// years not yet simulated, toward the next step (-SIMSTEPYEARS, SIMSTEPYEARS)
+	double		warp;		// simulation years per SIMREALSECONDSPERYEAR real seconds
+	bool		paused;
+	double		lastSeconds;	// real time of the last SimClockTick( ), < 0. if there has not been one
+} Sim = { 0, 0., 1., false, -1. };
+
+
+// jump to a given time and stop interpolating:
+
+void
+SimClockSet( double years )
+{
+	Sim.step = (long long)floor( years / SIMSTEPYEARS );
+	Sim.accumulator = years - (double)Sim.step * SIMSTEPYEARS;
+}
+
+
+// run the simulation for some amount of real time, in whole steps:
+
+void
+SimClockAdvance( double realSeconds )
+{
+	if( Sim.paused )
+		return;
+
+	Sim.accumulator += realSeconds * Sim.warp / SIMREALSECONDSPERYEAR;
+
+	// the fixed-step loop -- the state is a pure function of the step number,
+	// so taking n steps is just adding n:
+
+	long long n = (long long)( Sim.accumulator / SIMSTEPYEARS );		// rounds toward 0., so works both ways
+	Sim.step += n;
+	Sim.accumulator -= (double)n * SIMSTEPYEARS;
+}
+
+
+// advance by however much real time has gone by since the last call:
+
+void
+SimClockTick( double nowSeconds )
+{
+	if( Sim.lastSeconds >= 0. )
+		SimClockAdvance( nowSeconds - Sim.lastSeconds );
+	Sim.lastSeconds = nowSeconds;
+}
+
+
+// pausing drops the interpolation so that the picture sits exactly on a step:
+
+void
+SimClockPause( bool paused )
+{
+	Sim.paused = paused;
+	Sim.accumulator = 0.;
+	Sim.lastSeconds = -1.;		// do not count the time spent paused
+}
+
+
+// move a whole number of steps forward (> 0) or backward (< 0), e.g., while paused:
+
+void
+SimClockStep( int steps )
+{
+	Sim.step += steps;
+	Sim.accumulator = 0.;
+}
+
+
+void
+SimClockSetWarp( double warp )
+{
+	if( warp > SIMMAXWARP )
+		warp = SIMMAXWARP;
+	if( warp < -SIMMAXWARP )
+		warp = -SIMMAXWARP;
+	Sim.warp = warp;
+}
+
+
+// the time to render, interpolated between the current step and the next one:
+//	(the state is a pure function of time, so interpolating the time interpolates the state)
+
+double
+SimClockYears( )
+{
+	double alpha = Sim.accumulator / SIMSTEPYEARS;		// in (-1.,1.), < 0. when running backwards
+	return ( (double)Sim.step + alpha ) * SIMSTEPYEARS;
+}
+
+
+// the angle of something that makes 'turnsPerYear' full turns per year, at this time:
+
+float
+TurnAngle( double years, double turnsPerYear )
+{
+	double turns = years * turnsPerYear;
+	return (float)( 2. * M_PI * ( turns - floor( turns ) ) );
+}
@@ -0,0 +1,340 @@
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+
+//	The star background as a cube map, drawn last
+//
+//	The sky used to be a 1000-mile textured sphere drawn first, so every pixel of the window was textured and
+//	written once for the sky and then again for whatever was in front of it, and the far plane had to reach
+//	out past it.  Now the sky body's texture is turned into a cube map once, when it is loaded, and after the
+//	bodies are drawn a unit cube around the eye (rotated like the view, but not moved) is drawn with that cube map,
+//	squashed onto the far plane with glDepthRange( ) (at DepthFarValue( ), see depth.cpp) and with depth writes
+//	off -- so the depth test throws away its fragments wherever anything else has already been drawn, and the sky
+//	is only textured where it shows.
+//	The far plane then only has to reach the far side of the scene (SceneFarDistance( )).
+//
+//	A body marked "sky" in the scene file is the one drawn this way; the cube map is made by looking up its
+//	latitude-longitude texture the way the sphere mesh would have shown it (see BuildSphereMesh( )).
+//	The cube is at infinity, where the sphere was 1000 miles away, so the stars no longer shift as the eye moves.
+//
+//	Needs cube map textures (opengl 1.3) -- InitSkybox( ) returns false if they are not there, and the sky is
+//	drawn as a sphere as it always was.
+
+
+struct SkyCubeFace
+{
+	GLenum	target;
+	float	major[3];		// direction through the middle of the face
+	float	s[3];			// direction a texel steps in as s grows
+	float	t[3];			// direction a texel steps in as t grows
+};
+
+// the faces as opengl lays them out:
+const struct SkyCubeFace	SKYFACES[6] =
+{
+	{ GL_TEXTURE_CUBE_MAP_POSITIVE_X, {  1.f,  0.f,  0.f }, {  0.f,  0.f, -1.f }, {  0.f, -1.f,  0.f } },
+	{ GL_TEXTURE_CUBE_MAP_NEGATIVE_X, { -1.f,  0.f,  0.f }, {  0.f,  0.f,  1.f }, {  0.f, -1.f,  0.f } },
+	{ GL_TEXTURE_CUBE_MAP_POSITIVE_Y, {  0.f,  1.f,  0.f }, {  1.f,  0.f,  0.f }, {  0.f,  0.f,  1.f } },
+	{ GL_TEXTURE_CUBE_MAP_NEGATIVE_Y, {  0.f, -1.f,  0.f }, {  1.f,  0.f,  0.f }, {  0.f,  0.f, -1.f } },
+	{ GL_TEXTURE_CUBE_MAP_POSITIVE_Z, {  0.f,  0.f,  1.f }, {  1.f,  0.f,  0.f }, {  0.f, -1.f,  0.f } },
+	{ GL_TEXTURE_CUBE_MAP_NEGATIVE_Z, {  0.f,  0.f, -1.f }, { -1.f,  0.f,  0.f }, {  0.f, -1.f,  0.f } },
+};
+
+const float	SKYFARMARGIN = 1.01f;		// how far past the farthest body the far plane goes
+
+GLuint	SkyCubeMap;				// the sky's cube map texture
+GLuint	SkyboxList;				// the unit cube, with each corner's direction as its texture coordinate
+int		SkyFaceSize;			// pixels on a side of each face, 0 until the cube map has been made
+GLuint	SkySourceTexture;		// the 2d texture the cube map was made from
+GLuint	SkyQuery;				// counts the sky's fragments, when SkyCountFragments is on
+bool	SkyQueryPending;		// true if SkyQuery has a count that SkyReadFragments( ) has not read yet
+bool	SkyCountFragments;		// true means to count the fragments the sky draws (the headless benchmark)
+double	SkyFragments;			// fragments counted since the caller last zeroed this
+
+
+// make the cube and the cube map texture:
+// returns false if there are no cube maps
+
+bool
+InitSkybox()
+{
+	if (!GLEW_VERSION_1_3)
+	{
+		fprintf(stderr, "Cube map textures need OpenGL 1.3 -- the sky will be drawn as a sphere\n");
+		return false;
+	}
+
+	glGenTextures(1, &SkyCubeMap);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, SkyCubeMap);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+	if (GLEW_VERSION_3_2)
+		glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);		// filter across the edges between faces
+
+	if (GLEW_VERSION_1_5)
+		glGenQueries(1, &SkyQuery);
+
+	// each face, from the inside:
+	SkyboxList = glGenLists(1);
+	glNewList(SkyboxList, GL_COMPILE);
+	glBegin(GL_QUADS);
+	for (int f = 0; f < 6; f++)
+	{
+		const struct SkyCubeFace* face = &SKYFACES[f];
+		const float corners[4][2] = { { -1.f, -1.f }, { 1.f, -1.f }, { 1.f, 1.f }, { -1.f, 1.f } };
+		for (int c = 0; c < 4; c++)
+		{
+			float v[3];
+			for (int k = 0; k < 3; k++)
+				v[k] = face->major[k] + corners[c][0] * face->s[k] + corners[c][1] * face->t[k];
+			glTexCoord3fv(v);
+			glVertex3fv(v);
+		}
+	}
+	glEnd();
+	glEndList();
+
+	return true;
+}
+
+
+// the first body marked as the sky, or -1 if there is none:
+
+int
+FindSkyBody()
+{
+	for (int i = 0; i < Bodies.count; i++)
+	{
+		if ((Bodies.flags[i] & BODYSKY) != 0)
+			return i;
+	}
+	return -1;
+}
+
+
+// look up a latitude-longitude image in a direction, with bilinear filtering:
+// (the image wraps around in longitude and stops at the poles)
+
+void
+SampleLatLng(const unsigned char* image, int width, int height, float x, float y, float z, unsigned char rgb[3])
+{
+	float len = sqrtf(x*x + y*y + z*z);
+	float lat = asinf(y / len);
+	float lng = atan2f(-z, x);
+
+	// the same s and t the sphere mesh gives this direction:
+	float u = (lng + (float)M_PI) / (2.f * (float)M_PI) * (float)width - .5f;
+	float v = (lat + (float)M_PI / 2.f) / (float)M_PI * (float)height - .5f;
+
+	int u0 = (int)floorf(u);
+	int v0 = (int)floorf(v);
+	float fu = u - (float)u0;
+	float fv = v - (float)v0;
+	int u1 = u0 + 1;
+	int v1 = v0 + 1;
+	u0 = ((u0 % width) + width) % width;
+	u1 = ((u1 % width) + width) % width;
+	v0 = v0 < 0 ? 0 : (v0 >= height ? height - 1 : v0);
+	v1 = v1 < 0 ? 0 : (v1 >= height ? height - 1 : v1);
+
+	for (int c = 0; c < 3; c++)
+	{
+		float a = (float)image[3 * (v0*width + u0) + c];
+		float b = (float)image[3 * (v0*width + u1) + c];
+		float d = (float)image[3 * (v1*width + u0) + c];
+		float e = (float)image[3 * (v1*width + u1) + c];
+		float top = a + fu * (b - a);
+		float bottom = d + fu * (e - d);
+		rgb[c] = (unsigned char)(top + fv * (bottom - top) + .5f);
+	}
+}
+
+
+// make the sky's cube map from a latitude-longitude 2d texture:
+// (reads the texture back from the card, so this is for load time, not every frame)
+
+void
+BuildSkyCubeMap(GLuint texture)
+{
+	SkySourceTexture = texture;
+	SkyFaceSize = 0;
+	if (texture == 0)
+		return;
+
+	int width = 0, height = 0;
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+	if (width <= 0 || height <= 0)
+	{
+		glBindTexture(GL_TEXTURE_2D, 0);
+		return;
+	}
+
+	std::vector<unsigned char> image(3 * width * height);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_UNSIGNED_BYTE, &image[0]);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	// a quarter of the way around the equator on each face keeps about the same texels per degree:
+	int n = width / 4;
+	if (n < 1)
+		n = 1;
+
+	std::vector<unsigned char> face(3 * n * n);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, SkyCubeMap);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (int f = 0; f < 6; f++)
+	{
+		const struct SkyCubeFace* sf = &SKYFACES[f];
+		for (int j = 0; j < n; j++)
+		{
+			float tc = 2.f * ((float)j + .5f) / (float)n - 1.f;
+			for (int i = 0; i < n; i++)
+			{
+				float sc = 2.f * ((float)i + .5f) / (float)n - 1.f;
+				float d[3];
+				for (int k = 0; k < 3; k++)
+					d[k] = sf->major[k] + sc * sf->s[k] + tc * sf->t[k];
+				SampleLatLng(&image[0], width, height, d[0], d[1], d[2], &face[3 * (j*n + i)]);
+			}
+		}
+		glTexImage2D(sf->target, 0, GL_RGB, n, n, 0, GL_RGB, GL_UNSIGNED_BYTE, &face[0]);
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+	SkyFaceSize = n;
+}
+
+
+// how far the far plane has to be, with mv as the view, to take in every body and orbit circle of a frame
+// (leaving out the sky body, when it is drawn as a cube map):
+// (no opengl calls, so the frame pipeline's worker can use it)
+
+float
+SceneFarDistance(const struct BodyFrame* f, const float mv[16], bool skipSky)
+{
+	float scale = sqrtf(mv[0]*mv[0] + mv[1]*mv[1] + mv[2]*mv[2]);	// the view's uniform scale
+
+	float farthest = 0.f;
+	for (int i = 0; i < Bodies.count; i++)
+	{
+		if (skipSky && (Bodies.flags[i] & BODYSKY) != 0)
+			continue;
+
+		// the body, and the circle it goes around on:
+		float c[2][3], r[2];
+		BodyCenter(f, i, c[0]);					r[0] = Bodies.radius[i];
+		BodyCenter(f, Bodies.parent[i], c[1]);	r[1] = Bodies.orbitRadius[i] + Bodies.radius[i];
+		for (int k = 0; k < 2; k++)
+		{
+			float ex = mv[0]*c[k][0] + mv[4]*c[k][1] + mv[8]*c[k][2] + mv[12];
+			float ey = mv[1]*c[k][0] + mv[5]*c[k][1] + mv[9]*c[k][2] + mv[13];
+			float ez = mv[2]*c[k][0] + mv[6]*c[k][1] + mv[10]*c[k][2] + mv[14];
+			float d = sqrtf(ex*ex + ey*ey + ez*ez) + scale * r[k];
+			if (d > farthest)
+				farthest = d;
+		}
+	}
+	return SKYFARMARGIN * farthest;
+}
+
+
+// count the fragments drawn between these two, if SkyCountFragments is on:
+
+void
+SkyBeginCount()
+{
+	if (SkyCountFragments && SkyQuery != 0 && !SkyQueryPending)
+		glBeginQuery(GL_SAMPLES_PASSED, SkyQuery);
+}
+
+void
+SkyEndCount()
+{
+	if (SkyCountFragments && SkyQuery != 0 && !SkyQueryPending)
+	{
+		glEndQuery(GL_SAMPLES_PASSED);
+		SkyQueryPending = true;
+	}
+}
+
+
+// add the last count to SkyFragments:
+// (waits for it -- call after glFinish( ))
+
+void
+SkyReadFragments()
+{
+	if (!SkyQueryPending)
+		return;
+	GLuint samples = 0;
+	glGetQueryObjectuiv(SkyQuery, GL_QUERY_RESULT, &samples);
+	SkyFragments += (double)samples;
+	SkyQueryPending = false;
+}
+
+
+// draw the sky body's cube behind everything already drawn, in whatever color and texture are set up:
+// (the modelview must be the view)
+
+void
+DrawSkyboxShape(int body)
+{
+	// the view times the sky body's turn, with the translation and scale taken out:
+	GLfloat view[16];
+	glGetFloatv(GL_MODELVIEW_MATRIX, view);
+	glm::mat4 m = glm::make_mat4(view) * Bodies.world[body];
+	for (int c = 0; c < 3; c++)
+	{
+		float len = sqrtf(m[c][0]*m[c][0] + m[c][1]*m[c][1] + m[c][2]*m[c][2]);
+		if (len > 0.f)
+		{
+			m[c][0] /= len;
+			m[c][1] /= len;
+			m[c][2] /= len;
+		}
+	}
+	m[3][0] = m[3][1] = m[3][2] = 0.f;
+
+	// on the far plane, behind anything already drawn, and never written into the depth buffer:
+	double far = DepthFarValue();
+	glDepthRange(far, far);
+	glDepthFunc(DepthFarFunc());
+	glDepthMask(GL_FALSE);
+
+	glPushMatrix();
+	glLoadMatrixf(glm::value_ptr(m));
+	SkyBeginCount();
+	glCallList(SkyboxList);
+	SkyEndCount();
+	glPopMatrix();
+
+	glDepthMask(GL_TRUE);
+	glDepthFunc(DepthTestFunc());
+	glDepthRange(0., 1.);
+}
+
+
+// draw the sky body's cube map behind everything already drawn:
+// (the modelview must be the view, and lighting must be off)
+
+void
+DrawSkybox(int body)
+{
+	if (SkyFaceSize == 0)
+		return;
+
+	RsUseProgram(0);
+	RsDisable(GL_TEXTURE_2D);
+	RsEnable(GL_TEXTURE_CUBE_MAP);
+	RsBindTexture(GL_TEXTURE_CUBE_MAP, SkyCubeMap);
+	RsTexEnvMode(GL_REPLACE);
+	DrawSkyboxShape(body);
+	RsDisable(GL_TEXTURE_CUBE_MAP);
+}
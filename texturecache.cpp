@@ -0,0 +1,311 @@
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#ifdef WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+//	On-disk cache of block-compressed, mipmapped textures
+//
+//	The first time a bmp file is seen, the driver compresses it (S3TC / DXT1) and builds the mipmaps,
+//	and we read the result back and save it as TEXCACHEDIR/<name>-<hash of the bmp file>.tex
+//	After that, startup just hands the saved blocks to glCompressedTexImage2D( ).
+//	Editing the bmp file changes its hash, so a stale cache file is simply never found again.
+//
+//	The .tex file is a TexCacheHeader followed, for each mipmap level, by
+//	a TexCacheLevel and then that level's compressed bytes
+
+
+const char *	TEXCACHEDIR = "texcache";
+const char	TEXCACHEMAGIC[4] = { 'S', 'E', 'M', 'T' };
+const int	TEXCACHEVERSION = 1;
+
+std::atomic<int>	TexCacheWritesPending;	// # cache files still being written
+
+struct TexCacheHeader
+{
+	char		magic[4];		// TEXCACHEMAGIC
+	int		version;		// TEXCACHEVERSION
+	unsigned long long	sourceHash;	// HashBytes( ) of the whole bmp file
+	int		internalFormat;		// e.g., GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+	int		numLevels;		// # of mipmap levels that follow
+};
+
+struct TexCacheLevel
+{
+	int		width, height;
+	int		size;			// # of compressed bytes that follow
+};
+
+
+// 64-bit FNV-1a hash, continued from 'hash' (start with TEXCACHEHASHSTART):
+
+const unsigned long long TEXCACHEHASHSTART = 0xcbf29ce484222325ULL;
+
+unsigned long long
+HashBytes( const unsigned char *p, size_t n, unsigned long long hash )
+{
+	for( size_t i = 0; i < n; i++ )
+	{
+		hash ^= p[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+
+// hash a whole file by reading it (for when it is not already memory-mapped):
+// returns false if the file cannot be read
+
+bool
+HashFile( const char *filename, unsigned long long *hash )
+{
+	FILE *fp = fopen( filename, "rb" );
+	if( fp == NULL )
+		return false;
+
+	unsigned char buf[ 64*1024 ];
+	size_t n;
+	*hash = TEXCACHEHASHSTART;
+	while( ( n = fread( buf, 1, sizeof(buf), fp ) ) > 0 )
+		*hash = HashBytes( buf, n, *hash );
+	fclose( fp );
+	return true;
+}
+
+
+// where the cache file for this bmp file and hash lives:
+
+void
+TexCachePath( char *path, size_t size, const char *filename, unsigned long long hash )
+{
+	char base[256];
+	strncpy( base, filename, sizeof(base)-1 );
+	base[ sizeof(base)-1 ] = '\0';
+	char *dot = strrchr( base, '.' );
+	if( dot != NULL )
+		*dot = '\0';
+	snprintf( path, size, "%s/%s-%016llx.tex", TEXCACHEDIR, base, hash );
+}
+
+
+// read and check a cache file:
+// returns the whole file in a new[ ]'ed buffer, or NULL if there is no usable cache file
+// (this does not touch opengl, so it can run on any thread)
+
+unsigned char *
+ReadTexCache( const char *path, unsigned long long hash, size_t *length )
+{
+	FILE *fp = fopen( path, "rb" );
+	if( fp == NULL )
+		return NULL;
+
+	fseek( fp, 0, SEEK_END );
+	long size = ftell( fp );
+	rewind( fp );
+	if( size < (long)sizeof(struct TexCacheHeader) )
+	{
+		fclose( fp );
+		return NULL;
+	}
+
+	unsigned char *data = new unsigned char[ size ];
+	bool ok = fread( data, 1, size, fp ) == (size_t)size;
+	fclose( fp );
+
+	// check the header and that the levels add up to the file size:
+
+	struct TexCacheHeader h;
+	memcpy( &h, data, sizeof(h) );
+	ok = ok  &&  memcmp( h.magic, TEXCACHEMAGIC, 4 ) == 0  &&  h.version == TEXCACHEVERSION  &&
+		h.sourceHash == hash  &&  h.numLevels > 0;
+
+	size_t offset = sizeof(h);
+	for( int i = 0; ok && i < h.numLevels; i++ )
+	{
+		struct TexCacheLevel lv;
+		ok = offset + sizeof(lv) <= (size_t)size;
+		if( ok )
+		{
+			memcpy( &lv, &data[offset], sizeof(lv) );
+			offset += sizeof(lv);
+			ok = lv.width > 0  &&  lv.height > 0  &&  lv.size > 0  &&  offset + lv.size <= (size_t)size;
+			offset += lv.size;
+		}
+	}
+
+	if( !ok  ||  offset != (size_t)size )
+	{
+		fprintf( stderr, "Ignoring bad texture cache file '%s'\n", path );
+		delete [ ] data;
+		return NULL;
+	}
+
+	*length = (size_t)size;
+	return data;
+}
+
+
+// glCompressedTexImage2D( ) every level of a cache file (as returned by ReadTexCache( )) into the bound texture:
+
+void
+UploadTexCache( const unsigned char *data )
+{
+	struct TexCacheHeader h;
+	memcpy( &h, data, sizeof(h) );
+
+	size_t offset = sizeof(h);
+	for( int i = 0; i < h.numLevels; i++ )
+	{
+		struct TexCacheLevel lv;
+		memcpy( &lv, &data[offset], sizeof(lv) );
+		offset += sizeof(lv);
+		glCompressedTexImage2D( GL_TEXTURE_2D, i, h.internalFormat, lv.width, lv.height, 0, lv.size, &data[offset] );
+		offset += lv.size;
+	}
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, h.numLevels-1 );
+}
+
+
+// write a buffer to a file, then delete[ ] it:
+
+void
+WriteTexCacheFile( char *path, unsigned char *data, size_t length )
+{
+#ifdef WIN32
+	_mkdir( TEXCACHEDIR );
+#else
+	mkdir( TEXCACHEDIR, 0755 );
+#endif
+
+	// write to a temporary name first so a reader never sees half a file:
+
+	char tmp[512];
+	snprintf( tmp, sizeof(tmp), "%s.tmp", path );
+	FILE *fp = fopen( tmp, "wb" );
+	bool ok = fp != NULL  &&  fwrite( data, 1, length, fp ) == length;
+	if( fp != NULL )
+		ok = fclose( fp ) == 0  &&  ok;
+	remove( path );
+	if( !ok  ||  rename( tmp, path ) != 0 )
+	{
+		fprintf( stderr, "Cannot write texture cache file '%s'\n", path );
+		remove( tmp );
+	}
+
+	delete [ ] data;
+	delete [ ] path;
+	TexCacheWritesPending--;
+}
+
+
+// wait for any cache files still being written (call before exiting):
+
+void
+FinishTexCacheWrites( )
+{
+	while( TexCacheWritesPending > 0 )
+		std::this_thread::sleep_for( std::chrono::milliseconds(1) );
+}
+
+
+// read back every level of the bound (compressed) texture and save it as a cache file:
+// (the readback is on this thread, the file writing is on another)
+
+void
+WriteTexCache( const char *path, unsigned long long hash )
+{
+	GLint compressed = 0, internalFormat = 0, maxLevel = 1000;
+	glGetTexLevelParameteriv( GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &compressed );
+	glGetTexLevelParameteriv( GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat );
+	glGetTexParameteriv( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, &maxLevel );
+	if( !compressed )
+		return;
+
+	// add up the size first:
+
+	int numLevels = 0;
+	size_t length = sizeof(struct TexCacheHeader);
+	for( int i = 0; i <= maxLevel; i++ )
+	{
+		GLint w = 0, size = 0;
+		glGetTexLevelParameteriv( GL_TEXTURE_2D, i, GL_TEXTURE_WIDTH, &w );
+		if( w == 0 )
+			break;
+		glGetTexLevelParameteriv( GL_TEXTURE_2D, i, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size );
+		length += sizeof(struct TexCacheLevel) + size;
+		numLevels++;
+	}
+
+	unsigned char *data = new unsigned char[ length ];
+	struct TexCacheHeader h;
+	memcpy( h.magic, TEXCACHEMAGIC, 4 );
+	h.version = TEXCACHEVERSION;
+	h.sourceHash = hash;
+	h.internalFormat = internalFormat;
+	h.numLevels = numLevels;
+	memcpy( data, &h, sizeof(h) );
+
+	glPushClientAttrib( GL_CLIENT_PIXEL_STORE_BIT );
+	glPixelStorei( GL_PACK_ALIGNMENT, 1 );
+	size_t offset = sizeof(h);
+	for( int i = 0; i < numLevels; i++ )
+	{
+		struct TexCacheLevel lv;
+		glGetTexLevelParameteriv( GL_TEXTURE_2D, i, GL_TEXTURE_WIDTH, &lv.width );
+		glGetTexLevelParameteriv( GL_TEXTURE_2D, i, GL_TEXTURE_HEIGHT, &lv.height );
+		glGetTexLevelParameteriv( GL_TEXTURE_2D, i, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &lv.size );
+		memcpy( &data[offset], &lv, sizeof(lv) );
+		offset += sizeof(lv);
+		glGetCompressedTexImage( GL_TEXTURE_2D, i, &data[offset] );
+		offset += lv.size;
+	}
+	glPopClientAttrib( );
+
+	char *pathCopy = new char[ strlen(path)+1 ];
+	strcpy( pathCopy, path );
+	TexCacheWritesPending++;
+	std::thread( WriteTexCacheFile, pathCopy, data, length ).detach( );
+}
+
+
+// how many bytes the bound texture takes on the card, adding up all of its mipmap levels:
+// (uncompressed texels are counted at 4 bytes, since that is how cards store GL_RGB8)
+
+size_t
+TextureMemory( )
+{
+	GLint maxLevel = 1000;
+	glGetTexParameteriv( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, &maxLevel );
+
+	// a texture without mipmaps only has level 0 in use:
+
+	GLint minFilter;
+	glGetTexParameteriv( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, &minFilter );
+	if( minFilter == GL_LINEAR  ||  minFilter == GL_NEAREST )
+		maxLevel = 0;
+
+	size_t bytes = 0;
+	for( int i = 0; i <= maxLevel; i++ )
+	{
+		GLint w = 0, h = 0, compressed = 0, size = 0;
+		glGetTexLevelParameteriv( GL_TEXTURE_2D, i, GL_TEXTURE_WIDTH, &w );
+		glGetTexLevelParameteriv( GL_TEXTURE_2D, i, GL_TEXTURE_HEIGHT, &h );
+		if( w == 0 )
+			break;
+		glGetTexLevelParameteriv( GL_TEXTURE_2D, i, GL_TEXTURE_COMPRESSED, &compressed );
+		if( compressed )
+		{
+			glGetTexLevelParameteriv( GL_TEXTURE_2D, i, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size );
+			bytes += size;
+		}
+		else
+			bytes += 4 * (size_t)w * (size_t)h;
+	}
+	return bytes;
+}
@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+
+#include "glm/vec3.hpp"
+#include "glm/vec4.hpp"
+#include "glm/mat4x4.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+
+#include "simclock.cpp"
+#include "ephemeris.cpp"
+#include "scenegraph.cpp"
+#include "transforms.cpp"
+
+//	Microbenchmark and check for the closed-form world matrices in transforms.cpp (no opengl needed)
+//
+//	Build and run:
+//		g++ -O2 transformbench.cpp -o transformbench
+//		./transformbench [--samples N] [--scene FILE]
+//
+//	Compares UpdateSceneState( ) for the default scene against the old way of building the earth and moon
+//	matrices (five glm matrices multiplied together, in double) over many times, and prints how long each takes
+//	(the old way in float, as it was) and the largest difference, which must be within TRANSFORMTOLERANCE.
+//	With --scene, also times updating every body of that scene.
+
+
+const double TRANSFORMTOLERANCE = 1.e-6;		// relative to the size of the number (or 1., whichever is bigger)
+
+volatile float	Sink;		// where the timed results go, so the compiler cannot throw the work away
+
+
+// the old way, as MakeEarthMatrix( ) and MakeMoonMatrix( ) used to do it -- in float (M = glm::mat4, V = glm::vec3,
+// T = float) for timing, and in double (glm::dmat4, glm::dvec3, double) to check against, since the closed form
+// is worked out in double (a float angle near a full turn is only good to about 2.4e-7, times the orbit radius):
+
+double
+ExactTurnAngle(double years, double turnsPerYear)
+{
+	double turns = years * turnsPerYear;
+	return 2. * M_PI * (turns - floor(turns));
+}
+
+template <class M, class V, class T>
+M
+GlmEarthMatrix(double years)
+{
+	T earthSpinAngle = (T)ExactTurnAngle(years, DAYS_PER_YEAR);
+	T earthOrbitAngle = (T)ExactTurnAngle(years, 1.);
+	M identity = M(1.);
+	V yaxis = V(0., 1., 0.);
+	M erorbity = glm::rotate(identity, earthOrbitAngle, yaxis);
+	M etransx = glm::translate(identity, V(EARTH_ORBITAL_RADIUS_MILES, 0., 0.));
+	M erspiny = glm::rotate(identity, earthSpinAngle, yaxis);
+	return erorbity * etransx * erspiny;
+}
+
+template <class M, class V, class T>
+M
+GlmMoonMatrix(double years)
+{
+	T moonSpinAngle = (T)ExactTurnAngle(years, MONTHS_PER_YEAR);
+	T moonOrbitAngle = (T)ExactTurnAngle(years, MONTHS_PER_YEAR);
+	T earthOrbitAngle = (T)ExactTurnAngle(years, 1.);
+	M identity = M(1.);
+	V yaxis = V(0., 1., 0.);
+	M erorbity = glm::rotate(identity, earthOrbitAngle, yaxis);
+	M etransx = glm::translate(identity, V(EARTH_ORBITAL_RADIUS_MILES, 0., 0.));
+	M mrorbity = glm::rotate(identity, moonOrbitAngle, yaxis);
+	M mtransx = glm::translate(identity, V(MOON_ORBITAL_RADIUS_MILES, 0., 0.));
+	M mrspiny = glm::rotate(identity, moonSpinAngle, yaxis);
+	return erorbity * etransx * mrorbity * mtransx * mrspiny;
+}
+
+
+double
+BenchSeconds()
+{
+	using namespace std::chrono;
+	return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+
+// largest relative difference between two matrices:
+
+double
+MatrixDiff(const glm::mat4& a, const glm::dmat4& b)
+{
+	double worst = 0.;
+	for (int i = 0; i < 4; i++)
+	{
+		for (int j = 0; j < 4; j++)
+		{
+			double size = fabs((double)b[i][j]);
+			double d = fabs((double)a[i][j] - (double)b[i][j]) / (size > 1. ? size : 1.);
+			if (d > worst)
+				worst = d;
+		}
+	}
+	return worst;
+}
+
+
+int
+main(int argc, char* argv[])
+{
+	int n = 1000000;
+	const char* sceneFile = NULL;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc)
+			n = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--scene") == 0 && i + 1 < argc)
+			sceneFile = argv[++i];
+		else
+		{
+			fprintf(stderr, "Usage: %s [--samples N] [--scene FILE]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	ParseScene(DEFAULTSCENE, "default scene");
+	int earth = FindBody("earth");
+	int moon = FindBody("moon");
+
+	// frame times a 60th of a second apart, starting at a few different epochs:
+	const double dt = 1. / (SIMREALSECONDSPERYEAR * 60.);
+
+	// check:
+	double worst = 0.;
+	double worstYears = 0.;
+	for (int i = 0; i < n; i++)
+	{
+		double years = (double)(i % 4) * 250. + (double)i * dt;
+		UpdateSceneState(years);
+		double d = MatrixDiff(Bodies.world[earth], GlmEarthMatrix<glm::dmat4, glm::dvec3, double>(years));
+		double dm = MatrixDiff(Bodies.world[moon], GlmMoonMatrix<glm::dmat4, glm::dvec3, double>(years));
+		if (dm > d)
+			d = dm;
+		if (d > worst)
+		{
+			worst = d;
+			worstYears = years;
+		}
+	}
+
+	// time:
+	float sum = 0.;
+	double t0 = BenchSeconds();
+	for (int i = 0; i < n; i++)
+	{
+		double years = (double)i * dt;
+		glm::mat4 e = GlmEarthMatrix<glm::mat4, glm::vec3, float>(years);
+		glm::mat4 m = GlmMoonMatrix<glm::mat4, glm::vec3, float>(years);
+		sum += e[3][0] + m[3][2];
+	}
+	double glmSeconds = BenchSeconds() - t0;
+
+	t0 = BenchSeconds();
+	for (int i = 0; i < n; i++)
+	{
+		double years = (double)i * dt;
+		UpdateSceneState(years);
+		sum += Bodies.world[earth][3][0] + Bodies.world[moon][3][2];
+	}
+	double closedSeconds = BenchSeconds() - t0;
+	Sink = sum;
+
+	fprintf(stdout, "samples:       %d\n", n);
+	fprintf(stdout, "glm multiply:  %.1f ns per earth+moon\n", 1.e9 * glmSeconds / (double)n);
+	fprintf(stdout, "closed form:   %.1f ns per update of all %d bodies (%.1fx)\n", 1.e9 * closedSeconds / (double)n,
+		Bodies.count, closedSeconds > 0. ? glmSeconds / closedSeconds : 0.);
+	fprintf(stdout, "max diff:      %.2e at %.6f years (tolerance %.0e)\n", worst, worstYears, TRANSFORMTOLERANCE);
+
+	// a bigger scene:
+	if (sceneFile != NULL)
+	{
+		LoadScene(sceneFile);
+		int reps = 1 + n / (Bodies.count > 0 ? Bodies.count : 1);
+		t0 = BenchSeconds();
+		for (int i = 0; i < reps; i++)
+			UpdateSceneState((double)i * dt);
+		double seconds = BenchSeconds() - t0;
+		fprintf(stdout, "%s: %.3f ms per update of all %d bodies (%.1f ns per body)\n", sceneFile,
+			1.e3 * seconds / (double)reps, Bodies.count, 1.e9 * seconds / ((double)reps * (double)Bodies.count));
+	}
+
+	if (worst > TRANSFORMTOLERANCE)
+	{
+		fprintf(stdout, "FAILED\n");
+		return 1;
+	}
+	fprintf(stdout, "passed\n");
+	return 0;
+}
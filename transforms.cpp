@@ -0,0 +1,158 @@
+#include <math.h>
+#include "glm/mat4x4.hpp"
+
+//	World matrices for the bodies, written down directly instead of multiplied together
+//
+//	Every body's chain of transformations is rotations about Y and translations along X, e.g.:
+//		moon = RotateY(earthOrbit) * Translate(earth's orbit radius) *
+//		       RotateY(moonOrbit) * Translate(moon's orbit radius) * RotateY(moonSpin)
+//	which always comes out as a single rotation about Y (by the sum of the angles) plus a translation in the XZ plane.
+//	So each body only needs the cos and sin of its own angles: the sums come from the angle-addition formulas
+//	applied to its parent's frame, and the 16 numbers of its matrix are filled in directly.
+//
+//	The places and frame rotations are worked out in double, in world coordinates, so they hold up at real
+//	solar-system distances (at 93 million miles, a float is only good to about 8 miles).  The float matrices
+//	opengl gets are relative to an origin near the eye instead (see RebaseScene( )): the numbers in them stay
+//	small around the eye, where precision shows, and only get big for bodies so far away that it does not.
+//
+//	Needs TurnAngle( ) from simclock.cpp and the bodies from scenegraph.cpp
+
+
+// the matrix of RotateY(angle) followed by a translation of (tx, ty, tz),
+// given the cos and sin of the angle:
+// (glm is column-major: m[column][row])
+
+void
+YRotateTranslate(float c, float s, float tx, float ty, float tz, glm::mat4* m)
+{
+	(*m)[0] = glm::vec4(c, 0., -s, 0.);
+	(*m)[1] = glm::vec4(0., 1., 0., 0.);
+	(*m)[2] = glm::vec4(s, 0., c, 0.);
+	(*m)[3] = glm::vec4(tx, ty, tz, 1.);
+}
+
+
+// where a body is in a frame, relative to the frame's origin (the world's origin for body < 0):
+
+void
+BodyCenter(const struct BodyFrame* f, int body, float c[3])
+{
+	c[0] = body >= 0 ? f->relX[body] : (float)-f->originX;
+	c[1] = f->relY;
+	c[2] = body >= 0 ? f->relZ[body] : (float)-f->originZ;
+}
+
+
+// the matrix of the frame a body's children orbit in, relative to the scene's origin:
+
+glm::mat4
+BodyFrameMatrix(int body)
+{
+	glm::mat4 m;
+	float c[3];
+	BodyCenter(&Bodies, body, c);
+	if (body < 0)
+		YRotateTranslate(1.f, 0.f, c[0], c[1], c[2], &m);
+	else
+		YRotateTranslate((float)Bodies.frameCos[body], (float)Bodies.frameSin[body], c[0], c[1], c[2], &m);
+	return m;
+}
+
+
+// move a frame's origin to a world point (x, y, z), and bring the bodies' places relative to it up to date:
+// (with the eye there, everything near the eye is small numbers in the float matrices)
+
+void
+RebaseBodyFrame(struct BodyFrame* f, double x, double y, double z)
+{
+	if (f->originX == x && f->originY == y && f->originZ == z)
+		return;
+
+	f->originX = x;
+	f->originY = y;
+	f->originZ = z;
+	f->relY = (float)-y;
+	for (int i = 0; i < Bodies.count; i++)
+	{
+		f->relX[i] = (float)(f->frameX[i] - x);
+		f->relZ[i] = (float)(f->frameZ[i] - z);
+		f->world[i][3] = glm::vec4(f->relX[i], f->relY, f->relZ[i], 1.f);
+	}
+}
+
+
+// bring every body's world matrix in a frame up to date for a time (in years), if it is not already:
+// (one pass down the arrays -- parents always come before their children;
+//  only reads the scene's own arrays, so the frame pipeline's worker can call it on its frames)
+
+void
+UpdateBodyFrame(struct BodyFrame* f, double years)
+{
+	if (f->scene != SceneSerial || (int)f->world.size() != Bodies.count)
+		ResizeBodyFrame(f, Bodies.count);
+	if (f->valid && f->years == years)
+		return;
+
+	f->relY = (float)-f->originY;
+	for (int i = 0; i < Bodies.count; i++)
+	{
+		// the orbit, on top of the parent's frame:
+		double co = 1., so = 0.;
+		if (Bodies.orbitTurns[i] != 0.f || Bodies.orbitPhase[i] != 0.)
+		{
+			double turns = years * (double)Bodies.orbitTurns[i] + Bodies.orbitPhase[i];
+			double orbitAngle = 2. * M_PI * (turns - floor(turns));
+			co = cos(orbitAngle);
+			so = sin(orbitAngle);
+		}
+
+		double fc = co, fs = so, fx = 0., fz = 0.;
+		int p = Bodies.parent[i];
+		if (p >= 0)
+		{
+			double pc = f->frameCos[p], ps = f->frameSin[p];
+			fc = pc*co - ps*so;
+			fs = ps*co + pc*so;
+			fx = f->frameX[p];
+			fz = f->frameZ[p];
+		}
+		fx += Bodies.orbitRadius[i] * fc;
+		fz -= Bodies.orbitRadius[i] * fs;
+
+		f->frameCos[i] = fc;
+		f->frameSin[i] = fs;
+		f->frameX[i] = fx;
+		f->frameZ[i] = fz;
+		f->relX[i] = (float)(fx - f->originX);
+		f->relZ[i] = (float)(fz - f->originZ);
+
+		// the spin, on top of that:
+		double wc = fc, ws = fs;
+		if (Bodies.spinTurns[i] != 0.f)
+		{
+			double spinAngle = TurnAngle(years, Bodies.spinTurns[i]);
+			double cs = cos(spinAngle), ss = sin(spinAngle);
+			wc = fc*cs - fs*ss;
+			ws = fs*cs + fc*ss;
+		}
+		YRotateTranslate((float)wc, (float)ws, f->relX[i], f->relY, f->relZ[i], &f->world[i]);
+	}
+
+	f->years = years;
+	f->valid = true;
+}
+
+
+// the same, for the scene's own frame (the one being drawn):
+
+void
+UpdateSceneState(double years)
+{
+	UpdateBodyFrame(&Bodies, years);
+}
+
+void
+RebaseScene(double x, double y, double z)
+{
+	RebaseBodyFrame(&Bodies, x, y, z);
+}